@@ -0,0 +1,320 @@
+#include "bench.hpp"
+#include "synthetic.hpp"
+
+#include "clip.hpp"
+#include "layer_encoder.hpp"
+#include "map_to_features.hpp"
+#include "map_to_zoom.hpp"
+#include "output_mbtiles.hpp"
+#include "tile_cover.hpp"
+
+#include <mapbox/geometry.hpp>
+#include <mapbox/geojson.hpp>
+#include <mapbox/vector_tile/encode_layer.hpp>
+
+#include <unistd.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace mapbox;
+using namespace mapbox::mrmvt;
+using namespace mapbox::mrmvt::bench;
+
+namespace {
+
+std::size_t tiles_of(geometry::geometry<std::int64_t> const& g) {
+    return tile_cover::get_tiles(g, 4096).size();
+}
+
+geometry::feature_collection<double> read_fixture(std::string const& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::ostringstream err;
+        err << "Bench Error: Failed to open " << path;
+        throw std::runtime_error(err.str());
+    }
+    std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return geojson_to_fc(geojson::parse<double>(json));
+}
+
+struct projected_case {
+    std::string name;
+    geometry::geometry<double> geom;
+    std::size_t zoom;
+};
+
+void bench_geom_to_zoom(bench_runner & runner, std::vector<projected_case> const& cases) {
+    for (auto const& c : cases) {
+        std::size_t vertices = count_vertices(c.geom);
+        runner.run("geom_to_zoom/" + c.name, vertices, 0, [&] {
+            return count_vertices(geom_to_zoom(c.geom, c.zoom, 4096, 4.0));
+        });
+    }
+}
+
+void bench_douglas_peucker(bench_runner & runner,
+                           std::string const& name,
+                           geometry::line_string<std::int64_t> const& line) {
+    runner.run("douglas_peucker/" + name, line.size(), 0, [&] {
+        geometry::line_string<std::int64_t> simplified;
+        douglas_peucker<std::int64_t>(line, std::back_inserter(simplified), 4.0);
+        return simplified.size();
+    });
+    std::vector<geometry::point<std::int64_t>> points;
+    std::vector<char> keep;
+    runner.run("douglas_peucker_in_place/" + name, line.size(), 0, [&] {
+        points.assign(line.begin(), line.end());
+        douglas_peucker_in_place<std::int64_t>(points, keep, 4.0);
+        return points.size();
+    });
+}
+
+void bench_tile_cover(bench_runner & runner, std::vector<projected_case> const& cases) {
+    for (auto const& c : cases) {
+        auto g = geom_to_zoom(c.geom, c.zoom, 4096, 4.0);
+        runner.run("get_tiles/" + c.name, count_vertices(g), tiles_of(g), [&] {
+            return tiles_of(g);
+        });
+    }
+}
+
+void bench_clip(bench_runner & runner, std::vector<projected_case> const& cases) {
+    for (auto const& c : cases) {
+        auto g = geom_to_zoom(c.geom, c.zoom, 4096, 4.0);
+        auto tiles = tile_cover::get_tiles(g, 4096);
+        std::size_t clipped = 0;
+        for (auto const& t : tiles) {
+            clipped += t.fill ? 0 : 1;
+        }
+        runner.run("clip/" + c.name, count_vertices(g), clipped, [&] {
+            std::size_t n = 0;
+            for (auto const& t : tiles) {
+                if (t.fill) {
+                    continue;
+                }
+                auto og = clip(g, static_cast<std::uint32_t>(t.x), static_cast<std::uint32_t>(t.y), 8);
+                n += og ? count_vertices(*og) : 0;
+            }
+            return n;
+        });
+    }
+}
+
+using tile_features = std::map<std::pair<std::int64_t, std::int64_t>, geometry::feature_collection<std::int64_t>>;
+
+// The clipped features of every tile at zoom z, as r2mvt would see them.
+tile_features clip_to_tiles(geometry::feature_collection<double> const& fc, std::size_t z) {
+    tile_features tiles;
+    geometry::polygon<std::int64_t> fill_geometry = tile_fill_polygon(8);
+    for (auto const& f : fc) {
+        auto g = geom_to_zoom(f.geometry, z, 4096, 4.0);
+        for (auto const& t : tile_cover::get_tiles(g, 4096)) {
+            auto og = t.fill ? optional_geometry(geometry::geometry<std::int64_t>(fill_geometry))
+                             : clip(g, static_cast<std::uint32_t>(t.x), static_cast<std::uint32_t>(t.y), 8);
+            if (og) {
+                tiles[std::make_pair(t.x, t.y)].push_back(geometry::feature<std::int64_t> { std::move(*og), f.properties, f.id });
+            }
+        }
+    }
+    return tiles;
+}
+
+void bench_encode_layer(bench_runner & runner,
+                        std::string const& name,
+                        tile_features const& tiles) {
+    std::size_t vertices = 0;
+    for (auto const& t : tiles) {
+        for (auto const& f : t.second) {
+            vertices += count_vertices(f.geometry);
+        }
+    }
+    runner.run("encode_layer/" + name, vertices, tiles.size(), [&] {
+        std::size_t bytes = 0;
+        std::string buffer;
+        for (auto const& t : tiles) {
+            buffer.clear();
+            vector_tile::encode_layer(buffer, "bench", t.second);
+            bytes += buffer.size();
+        }
+        return bytes;
+    });
+}
+
+void bench_streaming_encoder(bench_runner & runner,
+                             std::string const& name,
+                             tile_features const& tiles) {
+    std::size_t vertices = 0;
+    for (auto const& t : tiles) {
+        for (auto const& f : t.second) {
+            vertices += count_vertices(f.geometry);
+        }
+    }
+    streaming_layer_encoder encoder;
+    runner.run("streaming_layer_encoder/" + name, vertices, tiles.size(), [&] {
+        std::size_t bytes = 0;
+        std::string buffer;
+        for (auto const& t : tiles) {
+            buffer.clear();
+            encoder.encode(buffer, "bench", t.second);
+            bytes += buffer.size();
+        }
+        return bytes;
+    });
+}
+
+void bench_mbtiles(bench_runner & runner, tile_features const& tiles) {
+    std::vector<std::string> encoded;
+    for (auto const& t : tiles) {
+        encoded.emplace_back();
+        vector_tile::encode_layer(encoded.back(), "bench", t.second);
+    }
+    if (encoded.empty()) {
+        return;
+    }
+    char path[] = "/tmp/mvt-bench-XXXXXX";
+    int fd = ::mkstemp(path);
+    if (fd < 0) {
+        throw std::runtime_error("Bench Error: Failed to create a temporary file");
+    }
+    ::close(fd);
+    ::unlink(path);
+    {
+        sqlite_db db = mbtiles_open(path);
+        // every op writes 1000 tiles at fresh coordinates, a few distinct
+        // blobs repeat as they would for ocean or land tiles
+        const std::size_t batch = 1000;
+        std::size_t next = 0;
+        runner.run("mbtiles_write_tile/1000", 0, batch, [&] {
+            std::size_t bytes = 0;
+            for (std::size_t i = 0; i < batch; ++i, ++next) {
+                std::string const& tile = encoded[next % encoded.size()];
+                int x = static_cast<int>(next % (1 << 20));
+                int y = static_cast<int>(next / (1 << 20));
+                mbtiles_write_tile(db, 20, x, y, tile.data(), static_cast<int>(tile.size()));
+                bytes += tile.size();
+            }
+            mbtiles_commit(db);
+            return bytes;
+        });
+        mbtiles_close(db);
+    }
+    ::unlink(path);
+}
+
+void usage() {
+    std::cerr << "usage: mvt-bench [--filter NAME] [--min-time SECONDS] [--fixture PATH] [--json PATH]" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string filter;
+    std::string fixture = "test/fixtures/countries.geojson";
+    std::string json_path;
+    double min_time = 0.5;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (std::strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            min_time = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--fixture") == 0 && i + 1 < argc) {
+            fixture = argv[++i];
+        } else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    try {
+        auto countries_fc = read_fixture(fixture);
+        geometry::geometry_collection<double> countries_gc;
+        geometry::multi_polygon<double> countries_mp;
+        for (auto const& f : countries_fc) {
+            countries_gc.push_back(f.geometry);
+            if (f.geometry.is<geometry::polygon<double>>()) {
+                countries_mp.push_back(f.geometry.get<geometry::polygon<double>>());
+            } else if (f.geometry.is<geometry::multi_polygon<double>>()) {
+                for (auto const& p : f.geometry.get<geometry::multi_polygon<double>>()) {
+                    countries_mp.push_back(p);
+                }
+            }
+        }
+        geometry::geometry<double> countries(countries_gc);
+        // synthetic worst cases, fixed seeds keep runs comparable
+        std::mt19937 walk_gen(42);
+        std::mt19937 points_gen(42);
+        geometry::geometry<double> big_circle(circle(100000, 10.0, 20.0, 30.0));
+        geometry::geometry<double> walk(random_walk(walk_gen, 100000, 0.01));
+        geometry::geometry<double> points(random_points(points_gen, 100000));
+        geometry::geometry<double> squares(small_squares(10000));
+        geometry::geometry<double> multipolygon(countries_mp);
+
+        bench_runner runner(filter, min_time);
+        runner.print_header();
+
+        bench_geom_to_zoom(runner, {
+            { "countries/z0", countries, 0 },
+            { "countries/z8", countries, 8 },
+            { "countries/z14", countries, 14 },
+            { "circle-100k/z12", big_circle, 12 },
+            { "random-walk-100k/z14", walk, 14 },
+            { "points-100k/z14", points, 14 }
+        });
+
+        {
+            // projected without simplification, so douglas_peucker sees every vertex
+            auto walk_z14 = geom_to_zoom(walk, 14, 4096, 0.0).get<geometry::line_string<std::int64_t>>();
+            bench_douglas_peucker(runner, "random-walk-100k/z14", walk_z14);
+            auto ring_z12 = geom_to_zoom(big_circle, 12, 4096, 0.0).get<geometry::polygon<std::int64_t>>().front();
+            bench_douglas_peucker(runner, "circle-100k/z12", geometry::line_string<std::int64_t>(ring_z12.begin(), ring_z12.end()));
+        }
+
+        bench_tile_cover(runner, {
+            { "line/random-walk-100k/z14", walk, 14 },
+            { "ring/circle-100k/z10", big_circle, 10 },
+            { "polygon/countries/z8", countries, 8 },
+            { "polygon/small-squares-10k/z12", squares, 12 },
+            { "point/points-100k/z14", points, 14 }
+        });
+
+        bench_clip(runner, {
+            { "point/points-100k/z4", points, 4 },
+            { "line/random-walk-100k/z10", walk, 10 },
+            { "polygon/circle-100k/z6", big_circle, 6 },
+            { "multipolygon/countries/z5", multipolygon, 5 },
+            { "multipolygon/small-squares-10k/z8", squares, 8 }
+        });
+
+        auto countries_z3 = clip_to_tiles(countries_fc, 3);
+        bench_encode_layer(runner, "countries/z3", countries_z3);
+        bench_streaming_encoder(runner, "countries/z3", countries_z3);
+        bench_mbtiles(runner, countries_z3);
+
+        if (!json_path.empty()) {
+            std::ofstream out(json_path);
+            runner.print_json(out);
+        }
+        // keeps the results of every benchmark observable
+        if (runner.sink() == 1) {
+            std::cerr << std::endl;
+        }
+    } catch (std::exception const& ex) {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
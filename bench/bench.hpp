@@ -0,0 +1,97 @@
+#pragma once
+
+#include "stats.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace mapbox { namespace mrmvt { namespace bench {
+
+struct bench_result {
+    std::string name;
+    std::size_t iterations;
+    double ns_per_op;
+    std::size_t vertices; // per op, 0 when not meaningful
+    std::size_t tiles;    // per op, 0 when not meaningful
+};
+
+/*
+ * Runs each benchmark for at least min_seconds after one warm up call and
+ * reports the mean time per call. A benchmark returns a value derived from
+ * its work, which is folded into `sink` so the optimizer can't drop it.
+ */
+class bench_runner {
+public:
+    bench_runner(std::string const& filter, double min_seconds) :
+        filter_(filter),
+        min_seconds_(min_seconds),
+        results_(),
+        sink_(0) {}
+
+    template <typename F>
+    void run(std::string const& name, std::size_t vertices, std::size_t tiles, F && f) {
+        if (!filter_.empty() && name.find(filter_) == std::string::npos) {
+            return;
+        }
+        using clock = std::chrono::steady_clock;
+        sink_ += f();
+        std::size_t iterations = 0;
+        auto start = clock::now();
+        double elapsed = 0.0;
+        while (elapsed < min_seconds_) {
+            sink_ += f();
+            ++iterations;
+            elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        }
+        bench_result r { name, iterations, elapsed * 1e9 / static_cast<double>(iterations), vertices, tiles };
+        print(r);
+        results_.push_back(r);
+    }
+
+    void print_header() const {
+        std::printf("%-40s %10s %14s %12s %14s\n", "benchmark", "iters", "ns/op", "ns/vertex", "tiles/s");
+    }
+
+    void print_json(std::ostream & out) const {
+        out << "[";
+        for (std::size_t i = 0; i < results_.size(); ++i) {
+            auto const& r = results_[i];
+            out << (i == 0 ? "\n" : ",\n")
+                << "  {\"name\":\"" << r.name << "\",\"iterations\":" << r.iterations
+                << ",\"ns_per_op\":" << r.ns_per_op
+                << ",\"ns_per_vertex\":" << (r.vertices ? r.ns_per_op / static_cast<double>(r.vertices) : 0.0)
+                << ",\"tiles_per_second\":" << (r.tiles ? static_cast<double>(r.tiles) * 1e9 / r.ns_per_op : 0.0)
+                << "}";
+        }
+        out << "\n]\n";
+    }
+
+    std::uint64_t sink() const {
+        return sink_;
+    }
+
+private:
+    void print(bench_result const& r) const {
+        char vertex[32] = "-";
+        char tiles[32] = "-";
+        if (r.vertices) {
+            std::snprintf(vertex, sizeof(vertex), "%.2f", r.ns_per_op / static_cast<double>(r.vertices));
+        }
+        if (r.tiles) {
+            std::snprintf(tiles, sizeof(tiles), "%.0f", static_cast<double>(r.tiles) * 1e9 / r.ns_per_op);
+        }
+        std::printf("%-40s %10zu %14.0f %12s %14s\n", r.name.c_str(), r.iterations, r.ns_per_op, vertex, tiles);
+        std::fflush(stdout);
+    }
+
+    std::string filter_;
+    double min_seconds_;
+    std::vector<bench_result> results_;
+    std::uint64_t sink_;
+};
+
+}}}
@@ -0,0 +1,310 @@
+#include "synthetic.hpp"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunknown-pragmas" // clang+gcc
+#pragma GCC diagnostic ignored "-Wpragmas"         // gcc
+#pragma GCC diagnostic ignored "-Wexpansion-to-defined"
+#include <rapidjson/document.h>
+#pragma GCC diagnostic pop
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace mapbox::mrmvt::bench;
+
+namespace {
+
+struct stage_result {
+    std::string name;
+    double seconds = 0.0;
+    std::uint64_t peak_rss_bytes = 0;
+    std::uint64_t input_bytes = 0;
+    std::uint64_t output_bytes = 0;
+    std::uint64_t output_records = 0;
+};
+
+struct pipeline_options {
+    std::string dataset = "points";
+    std::size_t count = 100000;
+    std::size_t vertices = 1000;
+    std::uint32_t seed = 42;
+    int min_zoom = 0;
+    int max_zoom = 10;
+    std::string bin_dir = ".";
+    std::string work_dir = "/tmp/mvt-pipeline-bench";
+    std::string json_path;
+    std::string baseline_path;
+    double threshold = 0.10;
+    bool side_properties = false; // run m2f and r2mvt with --properties
+};
+
+std::uint64_t file_size(std::string const& path) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        return 0;
+    }
+    return static_cast<std::uint64_t>(st.st_size);
+}
+
+std::uint64_t count_lines(std::string const& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::uint64_t lines = 0;
+    char buffer[1 << 16];
+    while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0) {
+        for (std::streamsize i = 0; i < in.gcount(); ++i) {
+            lines += buffer[i] == '\n' ? 1 : 0;
+        }
+    }
+    return lines;
+}
+
+/*
+ * Runs one stage as its own process reading `input` and writing `output`,
+ * so wall time and peak RSS belong to that stage alone. Stages go through
+ * files rather than a pipe for the same reason.
+ */
+stage_result run_stage(std::string const& name,
+                       std::vector<std::string> const& args,
+                       std::string const& input,
+                       std::string const& output,
+                       bool count_records) {
+    std::vector<char*> argv;
+    for (auto const& a : args) {
+        argv.push_back(const_cast<char*>(a.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = ::fork();
+    if (pid < 0) {
+        throw std::runtime_error("Pipeline Error: fork failed");
+    }
+    if (pid == 0) {
+        int in = ::open(input.c_str(), O_RDONLY);
+        int out = ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (in < 0 || out < 0 || ::dup2(in, 0) < 0 || ::dup2(out, 1) < 0) {
+            std::perror(name.c_str());
+            ::_exit(127);
+        }
+        // byte order sort, as r2mvt only needs the records of a tile together
+        ::setenv("LC_ALL", "C", 1);
+        ::execvp(argv[0], argv.data());
+        std::perror(argv[0]);
+        ::_exit(127);
+    }
+    int status = 0;
+    struct rusage usage;
+    if (::wait4(pid, &status, 0, &usage) < 0) {
+        throw std::runtime_error("Pipeline Error: wait failed");
+    }
+    stage_result r;
+    r.name = name;
+    r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::ostringstream err;
+        err << "Pipeline Error: stage " << name << " failed";
+        throw std::runtime_error(err.str());
+    }
+#ifdef __APPLE__
+    r.peak_rss_bytes = static_cast<std::uint64_t>(usage.ru_maxrss);
+#else
+    r.peak_rss_bytes = static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+    r.input_bytes = file_size(input);
+    r.output_bytes = file_size(output);
+    r.output_records = count_records ? count_lines(output) : 0;
+    return r;
+}
+
+void print_json(std::ostream & out, pipeline_options const& options, std::vector<stage_result> const& stages) {
+    double total = 0.0;
+    out << "{\n"
+        << "  \"dataset\": \"" << options.dataset << "\",\n"
+        << "  \"count\": " << options.count << ",\n"
+        << "  \"vertices\": " << options.vertices << ",\n"
+        << "  \"seed\": " << options.seed << ",\n"
+        << "  \"min_zoom\": " << options.min_zoom << ",\n"
+        << "  \"max_zoom\": " << options.max_zoom << ",\n"
+        << "  \"side_properties\": " << (options.side_properties ? "true" : "false") << ",\n"
+        << "  \"stages\": [";
+    for (std::size_t i = 0; i < stages.size(); ++i) {
+        auto const& s = stages[i];
+        total += s.seconds;
+        out << (i == 0 ? "\n" : ",\n")
+            << "    {\"name\": \"" << s.name << "\""
+            << ", \"seconds\": " << s.seconds
+            << ", \"peak_rss_bytes\": " << s.peak_rss_bytes
+            << ", \"input_bytes\": " << s.input_bytes
+            << ", \"output_bytes\": " << s.output_bytes
+            << ", \"output_records\": " << s.output_records
+            << ", \"input_mb_per_second\": " << (s.seconds > 0.0 ? static_cast<double>(s.input_bytes) / 1e6 / s.seconds : 0.0)
+            << ", \"records_per_second\": " << (s.seconds > 0.0 ? static_cast<double>(s.output_records) / s.seconds : 0.0)
+            << "}";
+    }
+    out << "\n  ],\n"
+        << "  \"total_seconds\": " << total << "\n"
+        << "}\n";
+}
+
+/*
+ * Compares wall time and peak RSS of every stage with a stored run. A stage
+ * regressed when it is more than `threshold` worse; differences under 50ms
+ * or 1MB are treated as noise. Returns true if anything regressed.
+ */
+bool compare_baseline(pipeline_options const& options, std::vector<stage_result> const& stages) {
+    std::ifstream in(options.baseline_path, std::ios::binary);
+    if (!in) {
+        std::ostringstream err;
+        err << "Pipeline Error: Failed to open baseline " << options.baseline_path;
+        throw std::runtime_error(err.str());
+    }
+    std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    rapidjson::Document doc;
+    doc.Parse(json.c_str());
+    if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("stages") || !doc["stages"].IsArray()) {
+        throw std::runtime_error("Pipeline Error: invalid baseline json");
+    }
+    if (!doc.HasMember("dataset") || !doc["dataset"].IsString() || options.dataset != doc["dataset"].GetString() ||
+        !doc.HasMember("count") || !doc["count"].IsUint64() || options.count != doc["count"].GetUint64()) {
+        std::cerr << "Warning: baseline was recorded with a different dataset" << std::endl;
+    }
+    bool regressed = false;
+    std::fprintf(stderr, "%-8s %12s %12s %8s %12s %12s %8s\n", "stage", "base s", "run s", "change", "base MB", "run MB", "change");
+    for (auto const& s : stages) {
+        for (auto const& b : doc["stages"].GetArray()) {
+            if (!b.IsObject() || !b.HasMember("name") || !b["name"].IsString() || s.name != b["name"].GetString() ||
+                !b.HasMember("seconds") || !b["seconds"].IsNumber() ||
+                !b.HasMember("peak_rss_bytes") || !b["peak_rss_bytes"].IsNumber()) {
+                continue;
+            }
+            double base_seconds = b["seconds"].GetDouble();
+            double base_rss = b["peak_rss_bytes"].GetDouble() / 1e6;
+            double rss = static_cast<double>(s.peak_rss_bytes) / 1e6;
+            double time_change = base_seconds > 0.0 ? s.seconds / base_seconds - 1.0 : 0.0;
+            double rss_change = base_rss > 0.0 ? rss / base_rss - 1.0 : 0.0;
+            bool slower = time_change > options.threshold && s.seconds - base_seconds > 0.05;
+            bool larger = rss_change > options.threshold && rss - base_rss > 1.0;
+            std::fprintf(stderr, "%-8s %12.3f %12.3f %+7.1f%% %12.1f %12.1f %+7.1f%%%s\n",
+                         s.name.c_str(), base_seconds, s.seconds, time_change * 100.0,
+                         base_rss, rss, rss_change * 100.0,
+                         slower || larger ? "  REGRESSION" : "");
+            regressed = regressed || slower || larger;
+        }
+    }
+    return regressed;
+}
+
+void usage() {
+    std::cerr << "usage: mvt-pipeline-bench [--dataset points|lines|multipolygons|polygons] [--count N]\n"
+              << "                          [--vertices N] [--seed N] [--min Z] [--max Z] [--bin DIR]\n"
+              << "                          [--workdir DIR] [--json PATH] [--baseline PATH] [--threshold FRACTION]\n"
+              << "                          [--side-properties]" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    pipeline_options options;
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--dataset") == 0 && has_value) {
+            options.dataset = argv[++i];
+        } else if (std::strcmp(argv[i], "--count") == 0 && has_value) {
+            options.count = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--vertices") == 0 && has_value) {
+            options.vertices = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--seed") == 0 && has_value) {
+            options.seed = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (std::strcmp(argv[i], "--min") == 0 && has_value) {
+            options.min_zoom = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--max") == 0 && has_value) {
+            options.max_zoom = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--bin") == 0 && has_value) {
+            options.bin_dir = argv[++i];
+        } else if (std::strcmp(argv[i], "--workdir") == 0 && has_value) {
+            options.work_dir = argv[++i];
+        } else if (std::strcmp(argv[i], "--json") == 0 && has_value) {
+            options.json_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--baseline") == 0 && has_value) {
+            options.baseline_path = argv[++i];
+        } else if (std::strcmp(argv[i], "--threshold") == 0 && has_value) {
+            options.threshold = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--side-properties") == 0) {
+            options.side_properties = true;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    try {
+        dataset_kind kind = parse_dataset_kind(options.dataset);
+        if (::mkdir(options.work_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+            std::ostringstream err;
+            err << "Pipeline Error: Failed to create " << options.work_dir;
+            throw std::runtime_error(err.str());
+        }
+        std::string dir = options.work_dir + "/";
+        std::string bin = options.bin_dir + "/";
+        std::string mbtiles = dir + "out.mbtiles";
+        ::unlink(mbtiles.c_str());
+
+        std::cerr << "Generating " << options.count << " " << options.dataset << std::endl;
+        {
+            std::ofstream out(dir + "input.geojson", std::ios::binary | std::ios::trunc);
+            write_dataset(out, kind, options.count, options.vertices, options.seed);
+            if (!out) {
+                throw std::runtime_error("Pipeline Error: failed writing the dataset");
+            }
+        }
+
+        std::string min_zoom = std::to_string(options.min_zoom);
+        std::string max_zoom = std::to_string(options.max_zoom);
+        std::vector<std::string> m2f { bin + "m2f", "bench" };
+        std::vector<std::string> r2mvt { bin + "r2mvt", mbtiles };
+        if (options.side_properties) {
+            for (auto * args : { &m2f, &r2mvt }) {
+                args->push_back("--properties");
+                args->push_back(dir + "properties");
+            }
+        }
+        std::vector<stage_result> stages;
+        stages.push_back(run_stage("m2f", m2f, dir + "input.geojson", dir + "features", true));
+        stages.push_back(run_stage("m2z", { bin + "m2z", "--min", min_zoom, "--max", max_zoom }, dir + "features", dir + "zooms", true));
+        stages.push_back(run_stage("m2t", { bin + "m2t" }, dir + "zooms", dir + "tiles", true));
+        stages.push_back(run_stage("sort", { "sort" }, dir + "tiles", dir + "sorted", false));
+        stages.push_back(run_stage("r2mvt", r2mvt, dir + "sorted", "/dev/null", false));
+        stages.back().output_bytes = file_size(mbtiles);
+
+        print_json(std::cout, options, stages);
+        if (!options.json_path.empty()) {
+            std::ofstream out(options.json_path);
+            print_json(out, options, stages);
+        }
+        if (!options.baseline_path.empty() && compare_baseline(options, stages)) {
+            return 2;
+        }
+    } catch (std::exception const& ex) {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <mapbox/geometry.hpp>
+#include <mapbox/geojson.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace mapbox { namespace mrmvt { namespace bench {
+
+/*
+ * Synthetic geometries for the benchmarks. Everything is drawn from a seeded
+ * generator, so the same arguments always give the same data.
+ */
+
+// A ring of n vertices around lon, lat.
+inline geometry::polygon<double> circle(std::size_t n, double lon, double lat, double radius) {
+    geometry::linear_ring<double> ring;
+    ring.reserve(n + 1);
+    for (std::size_t i = 0; i < n; ++i) {
+        double a = 2.0 * M_PI * static_cast<double>(i) / static_cast<double>(n);
+        ring.emplace_back(lon + radius * std::cos(a), lat + radius * std::sin(a));
+    }
+    ring.push_back(ring.front());
+    geometry::polygon<double> poly;
+    poly.push_back(std::move(ring));
+    return poly;
+}
+
+// A random walk of n steps from x, y, the noise defeats most of the simplification.
+inline geometry::line_string<double> random_walk(std::mt19937 & gen, std::size_t n, double step, double x = 0.0, double y = 0.0) {
+    std::normal_distribution<double> d(0.0, step);
+    geometry::line_string<double> line;
+    line.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        x = std::max(-179.0, std::min(179.0, x + d(gen)));
+        y = std::max(-80.0, std::min(80.0, y + d(gen)));
+        line.emplace_back(x, y);
+    }
+    return line;
+}
+
+inline geometry::point<double> random_point(std::mt19937 & gen) {
+    std::uniform_real_distribution<double> lon(-180.0, 180.0);
+    std::uniform_real_distribution<double> lat(-80.0, 80.0);
+    double x = lon(gen);
+    return geometry::point<double>(x, lat(gen));
+}
+
+inline geometry::multi_point<double> random_points(std::mt19937 & gen, std::size_t n) {
+    geometry::multi_point<double> points;
+    points.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        points.push_back(random_point(gen));
+    }
+    return points;
+}
+
+// A grid of n small squares, the "many small polygons" case.
+inline geometry::multi_polygon<double> small_squares(std::size_t n) {
+    geometry::multi_polygon<double> mp;
+    std::size_t side = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(n))));
+    for (std::size_t i = 0; i < n; ++i) {
+        double x = -10.0 + 20.0 * static_cast<double>(i % side) / static_cast<double>(side);
+        double y = -10.0 + 20.0 * static_cast<double>(i / side) / static_cast<double>(side);
+        double s = 10.0 / static_cast<double>(side);
+        geometry::linear_ring<double> ring { { x, y }, { x + s, y }, { x + s, y + s }, { x, y + s }, { x, y } };
+        mp.push_back(geometry::polygon<double> { std::move(ring) });
+    }
+    return mp;
+}
+
+enum dataset_kind : std::uint8_t {
+    dataset_points = 0,
+    dataset_lines,
+    dataset_multipolygons,
+    dataset_polygons
+};
+
+inline dataset_kind parse_dataset_kind(std::string const& name) {
+    if (name == "points") {
+        return dataset_points;
+    } else if (name == "lines") {
+        return dataset_lines;
+    } else if (name == "multipolygons") {
+        return dataset_multipolygons;
+    } else if (name == "polygons") {
+        return dataset_polygons;
+    }
+    std::ostringstream err;
+    err << "Unknown dataset: " << name << " (expected points, lines, multipolygons or polygons)";
+    throw std::runtime_error(err.str());
+}
+
+/*
+ * One feature geometry of a dataset. `vertices` sets the size of a line, the
+ * vertices of each of the 100 parts of a multipolygon, and is ignored for
+ * points and the 16 vertex polygons.
+ */
+inline geometry::geometry<double> dataset_geometry(dataset_kind kind, std::mt19937 & gen, std::size_t vertices) {
+    switch (kind) {
+        case dataset_points:
+            return random_point(gen);
+        case dataset_lines: {
+            auto start = random_point(gen);
+            return random_walk(gen, vertices, 0.01, start.x, start.y);
+        }
+        case dataset_multipolygons: {
+            std::uniform_real_distribution<double> offset(-20.0, 20.0);
+            auto center = random_point(gen);
+            geometry::multi_polygon<double> mp;
+            for (std::size_t i = 0; i < 100; ++i) {
+                double lon = std::max(-170.0, std::min(170.0, center.x + offset(gen)));
+                double lat = std::max(-70.0, std::min(70.0, center.y + offset(gen) / 2.0));
+                mp.push_back(circle(vertices, lon, lat, 1.0));
+            }
+            return mp;
+        }
+        case dataset_polygons:
+        default: {
+            auto center = random_point(gen);
+            return circle(16, center.x, center.y, 0.01);
+        }
+    }
+}
+
+// Writes a FeatureCollection of `count` features, one per line.
+inline void write_dataset(std::ostream & out,
+                          dataset_kind kind,
+                          std::size_t count,
+                          std::size_t vertices,
+                          std::uint32_t seed) {
+    std::mt19937 gen(seed);
+    out << "{\"type\":\"FeatureCollection\",\"features\":[\n";
+    for (std::size_t i = 0; i < count; ++i) {
+        out << (i == 0 ? "" : ",\n")
+            << "{\"type\":\"Feature\",\"properties\":{\"id\":" << i << "},\"geometry\":"
+            << geojson::stringify<double>(dataset_geometry(kind, gen, vertices)) << "}";
+    }
+    out << "\n]}\n";
+}
+
+}}}
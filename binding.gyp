@@ -4,7 +4,7 @@
     {
       'target_name': '<(module_name)',
       'product_dir': '<(module_path)',
-      'sources': [ './src/node_map_to_zoom.cpp', './src/node.cpp' ],
+      'sources': [ './src/node_map_to_zoom.cpp', './src/node_tile_builder.cpp', './src/node_worker_pool.cpp', './src/node.cpp' ],
       'include_dirs': [
         '<!(node -e \'require("nan")\')',
         'include',
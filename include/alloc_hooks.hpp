@@ -0,0 +1,96 @@
+#pragma once
+
+// Replaces the global operator new and delete to feed alloc_stats.hpp.
+// Include from exactly one translation unit of a binary, the src/*.cpp
+// mains; without MRMVT_ALLOC_STATS this header is empty. malloc is not
+// replaced, so rapidjson's allocations go uncounted, see alloc_stats.hpp.
+
+#ifdef MRMVT_ALLOC_STATS
+
+#include "alloc_stats.hpp"
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace mapbox { namespace mrmvt {
+
+// Keeps the size and stage in front of every block, padded so the memory
+// handed out keeps malloc's alignment.
+struct alignas(alignof(std::max_align_t)) alloc_header {
+    std::size_t size;
+    std::uint8_t stage;
+};
+
+inline void * alloc_counted(std::size_t size) noexcept {
+    void * p = std::malloc(size + sizeof(alloc_header));
+    if (!p) {
+        return nullptr;
+    }
+    alloc_header * h = static_cast<alloc_header *>(p);
+    h->size = size;
+    h->stage = alloc_current_stage();
+    alloc_record(size, h->stage);
+    return h + 1;
+}
+
+inline void free_counted(void * p) noexcept {
+    if (!p) {
+        return;
+    }
+    alloc_header * h = static_cast<alloc_header *>(p) - 1;
+    alloc_release(h->size, h->stage);
+    std::free(h);
+}
+
+}}
+
+void * operator new(std::size_t size) {
+    void * p = mapbox::mrmvt::alloc_counted(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void * operator new[](std::size_t size) {
+    void * p = mapbox::mrmvt::alloc_counted(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void * operator new(std::size_t size, std::nothrow_t const&) noexcept {
+    return mapbox::mrmvt::alloc_counted(size);
+}
+
+void * operator new[](std::size_t size, std::nothrow_t const&) noexcept {
+    return mapbox::mrmvt::alloc_counted(size);
+}
+
+void operator delete(void * p) noexcept {
+    mapbox::mrmvt::free_counted(p);
+}
+
+void operator delete[](void * p) noexcept {
+    mapbox::mrmvt::free_counted(p);
+}
+
+void operator delete(void * p, std::size_t) noexcept {
+    mapbox::mrmvt::free_counted(p);
+}
+
+void operator delete[](void * p, std::size_t) noexcept {
+    mapbox::mrmvt::free_counted(p);
+}
+
+void operator delete(void * p, std::nothrow_t const&) noexcept {
+    mapbox::mrmvt::free_counted(p);
+}
+
+void operator delete[](void * p, std::nothrow_t const&) noexcept {
+    mapbox::mrmvt::free_counted(p);
+}
+
+#endif
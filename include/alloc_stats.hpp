@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace mapbox { namespace mrmvt {
+
+/*
+ * Heap counters of the allocation instrumentation build (ALLOC_STATS=1 make,
+ * which defines MRMVT_ALLOC_STATS). The operator new and delete replacements
+ * in alloc_hooks.hpp attribute every allocation to the stage the allocating
+ * thread is in, so the same memory is counted against the stage that created
+ * it when it is freed. In a normal build nothing updates these.
+ *
+ * Only operator new is counted. Memory taken with malloc directly is not,
+ * and that includes rapidjson's CrtAllocator, which holds the DOM of every
+ * geojson parse. The "parse" stage therefore counts the features built from
+ * the DOM but not the DOM itself. rapidjson 1.1.0 has no hook to route its
+ * allocations elsewhere, and geojson-cpp fixes the document's allocator type.
+ */
+static constexpr std::uint8_t alloc_max_stages = 8;
+
+struct alloc_stage_counters {
+    std::atomic<std::uint64_t> allocations;
+    std::atomic<std::uint64_t> bytes;
+    std::atomic<std::int64_t> live_bytes;
+};
+
+// zero initialized, so usable by operator new before any constructor runs
+inline alloc_stage_counters * alloc_stages() {
+    static alloc_stage_counters stages[alloc_max_stages];
+    return stages;
+}
+
+inline std::atomic<std::int64_t> & alloc_live_bytes() {
+    static std::atomic<std::int64_t> live;
+    return live;
+}
+
+inline std::atomic<std::int64_t> & alloc_peak_live_bytes() {
+    static std::atomic<std::int64_t> peak;
+    return peak;
+}
+
+// The stage of the calling thread, alloc_max_stages - 1 outside of any stage.
+inline std::uint8_t & alloc_current_stage() {
+    static thread_local std::uint8_t stage = alloc_max_stages - 1;
+    return stage;
+}
+
+inline void alloc_record(std::size_t size, std::uint8_t stage) {
+    alloc_stage_counters & c = alloc_stages()[stage];
+    c.allocations.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(size, std::memory_order_relaxed);
+    c.live_bytes.fetch_add(static_cast<std::int64_t>(size), std::memory_order_relaxed);
+    std::int64_t live = alloc_live_bytes().fetch_add(static_cast<std::int64_t>(size), std::memory_order_relaxed) +
+                        static_cast<std::int64_t>(size);
+    std::int64_t peak = alloc_peak_live_bytes().load(std::memory_order_relaxed);
+    while (live > peak && !alloc_peak_live_bytes().compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+inline void alloc_release(std::size_t size, std::uint8_t stage) {
+    alloc_stages()[stage].live_bytes.fetch_sub(static_cast<std::int64_t>(size), std::memory_order_relaxed);
+    alloc_live_bytes().fetch_sub(static_cast<std::int64_t>(size), std::memory_order_relaxed);
+}
+
+}}
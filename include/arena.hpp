@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace mapbox { namespace mrmvt {
+
+/*
+ * Bump allocator for the temporaries of one feature. Memory is only given
+ * back by rewinding to an earlier position, which keeps the blocks for the
+ * next feature, so a steady state run does no malloc or free for these
+ * temporaries at all. An arena belongs to one thread and takes no locks.
+ */
+class monotonic_arena {
+public:
+    struct mark {
+        std::size_t block;
+        std::size_t offset;
+    };
+
+    explicit monotonic_arena(std::size_t block_size = 64 * 1024) :
+        block_size_(block_size),
+        blocks_(),
+        block_(0),
+        offset_(0) {}
+
+    monotonic_arena(monotonic_arena const&) = delete;
+    monotonic_arena& operator=(monotonic_arena const&) = delete;
+
+    void * allocate(std::size_t bytes, std::size_t align) {
+        while (true) {
+            if (block_ < blocks_.size()) {
+                block & b = blocks_[block_];
+                std::size_t start = (offset_ + align - 1) & ~(align - 1);
+                if (start + bytes <= b.size) {
+                    offset_ = start + bytes;
+                    return b.data.get() + start;
+                }
+                if (offset_ == 0) {
+                    // an unused block that is too small, replace it
+                    b = new_block(bytes + align);
+                    continue;
+                }
+                ++block_;
+                offset_ = 0;
+                continue;
+            }
+            blocks_.push_back(new_block(bytes + align));
+        }
+    }
+
+    mark position() const {
+        return mark { block_, offset_ };
+    }
+
+    // Frees everything allocated since m was taken.
+    void rewind(mark m) {
+        block_ = m.block;
+        offset_ = m.offset;
+    }
+
+    void reset() {
+        rewind(mark { 0, 0 });
+    }
+
+    std::size_t capacity() const {
+        std::size_t n = 0;
+        for (auto const& b : blocks_) {
+            n += b.size;
+        }
+        return n;
+    }
+
+private:
+    struct block {
+        std::unique_ptr<char[]> data;
+        std::size_t size;
+    };
+
+    block new_block(std::size_t min_size) const {
+        std::size_t size = min_size > block_size_ ? min_size : block_size_;
+        return block { std::unique_ptr<char[]>(new char[size]), size };
+    }
+
+    std::size_t block_size_;
+    std::vector<block> blocks_;
+    std::size_t block_;
+    std::size_t offset_;
+};
+
+// Rewinds the arena to where it was when the scope was entered.
+class arena_scope {
+public:
+    explicit arena_scope(monotonic_arena & arena) :
+        arena_(arena),
+        mark_(arena.position()) {}
+
+    ~arena_scope() {
+        arena_.rewind(mark_);
+    }
+
+    arena_scope(arena_scope const&) = delete;
+    arena_scope& operator=(arena_scope const&) = delete;
+
+private:
+    monotonic_arena & arena_;
+    monotonic_arena::mark mark_;
+};
+
+template <typename T>
+class arena_allocator {
+public:
+    using value_type = T;
+
+    explicit arena_allocator(monotonic_arena & arena) noexcept :
+        arena_(&arena) {}
+
+    template <typename U>
+    arena_allocator(arena_allocator<U> const& other) noexcept :
+        arena_(other.arena()) {}
+
+    T * allocate(std::size_t n) {
+        return static_cast<T *>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, std::size_t) noexcept {}
+
+    monotonic_arena * arena() const noexcept {
+        return arena_;
+    }
+
+private:
+    monotonic_arena * arena_;
+};
+
+template <typename T, typename U>
+bool operator==(arena_allocator<T> const& a, arena_allocator<U> const& b) noexcept {
+    return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(arena_allocator<T> const& a, arena_allocator<U> const& b) noexcept {
+    return a.arena() != b.arena();
+}
+
+template <typename T>
+using arena_vector = std::vector<T, arena_allocator<T>>;
+
+// The calling thread's arena, for temporaries of code that has no arena
+// passed in. Users must scope their allocations with arena_scope.
+inline monotonic_arena & thread_arena() {
+    static thread_local monotonic_arena arena;
+    return arena;
+}
+
+}}
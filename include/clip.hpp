@@ -200,6 +200,19 @@ struct clip_visitor {
     }
 };
 
+// Polygon covering a whole tile and its buffer, used for tiles a polygon fills.
+inline geometry::polygon<std::int64_t> tile_fill_polygon(std::int64_t buffer) {
+    geometry::linear_ring<std::int64_t> fill_ring;
+    fill_ring.push_back({-buffer, 4095+buffer});
+    fill_ring.push_back({-buffer, -buffer});
+    fill_ring.push_back({4095+buffer, -buffer});
+    fill_ring.push_back({4095+buffer, 4095+buffer});
+    fill_ring.push_back({-buffer, 4095+buffer});
+    geometry::polygon<std::int64_t> fill_geometry;
+    fill_geometry.push_back(std::move(fill_ring));
+    return fill_geometry;
+}
+
 inline optional_geometry clip(geometry::geometry<std::int64_t> const& g, std::uint32_t x, std::uint32_t y, std::int64_t buffer) {
     auto bbox = create_bbox(x, y, buffer);
     std::int64_t offset_x = bbox.min.x + buffer;
@@ -0,0 +1,236 @@
+#pragma once
+
+#include "kd_index.hpp"
+#include "projection.hpp"
+
+#include <mapbox/geometry.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mapbox { namespace mrmvt {
+
+struct cluster_options {
+    bool enabled = false;
+    double radius = 320.0;   // in tile extent units at every zoom
+    std::size_t extent = 4096;
+    int max_zoom = -1;       // last zoom that is clustered, -1 for max_z - 1
+};
+
+struct cluster_point {
+    double x;                // world coordinates
+    double y;
+    std::uint32_t count;     // 1 for an input point
+    std::size_t index;       // input index, or into point_clusters::properties for clusters
+    std::uint64_t id;        // cluster_id, 0 for an input point
+
+    bool is_cluster() const {
+        return count > 1;
+    }
+};
+
+struct value_sum_visitor {
+    bool numeric = true;
+    bool is_double = false;
+    bool is_signed = false;
+    double d = 0.0;
+    std::int64_t i = 0;
+    std::uint64_t u = 0;
+
+    void operator() (std::uint64_t v) { d += static_cast<double>(v); i += static_cast<std::int64_t>(v); u += v; }
+    void operator() (std::int64_t v) { d += static_cast<double>(v); i += v; is_signed = true; }
+    void operator() (double v) { d += v; is_double = true; }
+
+    template <typename T>
+    void operator() (T const&) { numeric = false; }
+
+    geometry::value result() const {
+        if (is_double) {
+            return geometry::value(d);
+        } else if (is_signed) {
+            return geometry::value(i);
+        }
+        return geometry::value(u);
+    }
+};
+
+inline bool is_numeric_value(geometry::value const& v) {
+    value_sum_visitor s;
+    geometry::value::visit(v, s);
+    return s.numeric;
+}
+
+/*
+ * Folds the properties of another cluster member into `into`. Numeric values
+ * are summed, anything else is only kept while all members agree on it.
+ */
+inline void merge_cluster_properties(geometry::property_map & into, geometry::property_map const& other) {
+    for (auto itr = into.begin(); itr != into.end();) {
+        auto o = other.find(itr->first);
+        if (is_numeric_value(itr->second)) {
+            if (o != other.end() && is_numeric_value(o->second)) {
+                value_sum_visitor s;
+                geometry::value::visit(itr->second, s);
+                geometry::value::visit(o->second, s);
+                itr->second = s.result();
+            }
+            ++itr;
+        } else if (o != other.end() && o->second == itr->second) {
+            ++itr;
+        } else {
+            itr = into.erase(itr);
+        }
+    }
+    for (auto const& p : other) {
+        if (into.find(p.first) == into.end() && is_numeric_value(p.second)) {
+            into.emplace(p.first, p.second);
+        }
+    }
+}
+
+inline std::string abbreviate_count(std::uint32_t count) {
+    std::ostringstream buf;
+    if (count >= 10000) {
+        buf << std::lround(count / 1000.0) << "k";
+    } else if (count >= 1000) {
+        buf << std::lround(count / 100.0) / 10.0 << "k";
+    } else {
+        buf << count;
+    }
+    return buf.str();
+}
+
+/*
+ * Hierarchical greedy clustering of points, as done by supercluster. Every
+ * zoom from max_zoom down to min_zoom indexes the points of the zoom above in
+ * a kd_index, then each point not yet taken absorbs all untaken neighbours
+ * within radius / (extent * 2^z) into a cluster placed at their weighted
+ * centroid. Each zoom only looks at the output of the one above it, so the
+ * whole pyramid costs about n log n.
+ */
+class point_clusters {
+public:
+    // point_properties may be null when the points carry no properties.
+    point_clusters(std::vector<geometry::point<double>> const& points,
+                   std::vector<geometry::property_map> const* point_properties,
+                   cluster_options const& options,
+                   std::size_t min_zoom,
+                   std::size_t max_zoom) :
+        min_zoom_(min_zoom),
+        levels_(),
+        properties_(),
+        point_properties_(point_properties) {
+        if (max_zoom < min_zoom) {
+            return;
+        }
+        levels_.resize(max_zoom - min_zoom + 1);
+        std::vector<cluster_point> prev;
+        prev.reserve(points.size());
+        for (std::size_t i = 0; i < points.size(); ++i) {
+            prev.push_back(cluster_point { lon_to_world_x(points[i].x), lat_to_world_y(points[i].y), 1, i, 0 });
+        }
+        for (std::size_t z = max_zoom + 1; z-- > min_zoom;) {
+            double r = options.radius / (static_cast<double>(options.extent) * std::pow(2.0, static_cast<double>(z)));
+            levels_[z - min_zoom] = cluster_level(prev, r, z);
+            prev = levels_[z - min_zoom];
+        }
+    }
+
+    // Points and clusters of zoom z, which must be within [min_zoom, max_zoom].
+    std::vector<cluster_point> const& zoom(std::size_t z) const {
+        return levels_[z - min_zoom_];
+    }
+
+    geometry::property_map const& properties(cluster_point const& p) const {
+        if (p.is_cluster()) {
+            return properties_[p.index];
+        }
+        if (!point_properties_) {
+            static const geometry::property_map empty;
+            return empty;
+        }
+        return (*point_properties_)[p.index];
+    }
+
+    // Aggregated properties plus the point_count, point_count_abbreviated,
+    // cluster and cluster_id fields supercluster puts on every cluster.
+    geometry::property_map cluster_properties(cluster_point const& p) const {
+        geometry::property_map props = properties_[p.index];
+        props["cluster"] = true;
+        props["cluster_id"] = p.id;
+        props["point_count"] = static_cast<std::uint64_t>(p.count);
+        if (p.count >= 1000) {
+            props["point_count_abbreviated"] = abbreviate_count(p.count);
+        } else {
+            props["point_count_abbreviated"] = static_cast<std::uint64_t>(p.count);
+        }
+        return props;
+    }
+
+private:
+    std::vector<cluster_point> cluster_level(std::vector<cluster_point> const& points, double r, std::size_t z) {
+        std::vector<double> xs;
+        std::vector<double> ys;
+        xs.reserve(points.size());
+        ys.reserve(points.size());
+        for (auto const& p : points) {
+            xs.push_back(p.x);
+            ys.push_back(p.y);
+        }
+        kd_index tree(xs, ys);
+        std::vector<bool> taken(points.size(), false);
+        std::vector<std::uint32_t> neighbours;
+        std::vector<cluster_point> out;
+        for (std::size_t i = 0; i < points.size(); ++i) {
+            if (taken[i]) {
+                continue;
+            }
+            taken[i] = true;
+            cluster_point const& p = points[i];
+            neighbours.clear();
+            tree.within(p.x, p.y, r, [&](std::uint32_t id) {
+                if (!taken[id]) {
+                    taken[id] = true;
+                    neighbours.push_back(id);
+                }
+            });
+            if (neighbours.empty()) {
+                out.push_back(p);
+                continue;
+            }
+            double wx = p.x * p.count;
+            double wy = p.y * p.count;
+            std::uint32_t count = p.count;
+            geometry::property_map props = properties(p);
+            for (auto id : neighbours) {
+                cluster_point const& n = points[id];
+                wx += n.x * n.count;
+                wy += n.y * n.count;
+                count += n.count;
+                merge_cluster_properties(props, properties(n));
+            }
+            std::uint64_t id = (static_cast<std::uint64_t>(i) << 5) + (z + 1);
+            out.push_back(cluster_point { wx / count, wy / count, count, properties_.size(), id });
+            properties_.push_back(std::move(props));
+        }
+        return out;
+    }
+
+    std::size_t min_zoom_;
+    std::vector<std::vector<cluster_point>> levels_;
+    std::vector<geometry::property_map> properties_;
+    std::vector<geometry::property_map> const* point_properties_;
+};
+
+// Cluster center in integer tile coordinates at a world size of extent * 2^z.
+inline geometry::point<std::int64_t> cluster_to_tile_coord(cluster_point const& p, double size) {
+    return geometry::point<std::int64_t>(static_cast<std::int64_t>(std::round(p.x * size)),
+                                         static_cast<std::int64_t>(std::round(p.y * size)));
+}
+
+}}
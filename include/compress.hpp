@@ -0,0 +1,338 @@
+#pragma once
+
+#include "stats.hpp"
+#include "trace.hpp"
+
+#include <zlib.h>
+#ifdef MRMVT_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mapbox { namespace mrmvt {
+
+enum compression_type : std::uint8_t {
+    compression_none = 0,
+    compression_gzip,
+    compression_zstd
+};
+
+inline compression_type parse_compression(std::string const& name) {
+    if (name == "gzip") {
+        return compression_gzip;
+    } else if (name == "none") {
+        return compression_none;
+    } else if (name == "zstd") {
+#ifdef MRMVT_WITH_ZSTD
+        return compression_zstd;
+#else
+        throw std::runtime_error("zstd compression requested but not built with MRMVT_WITH_ZSTD");
+#endif
+    }
+    std::ostringstream err;
+    err << "Unknown compression type: " << name;
+    throw std::runtime_error(err.str());
+}
+
+inline const char * compression_name(compression_type type) {
+    switch (type) {
+        case compression_gzip:
+            return "gzip";
+        case compression_zstd:
+            return "zstd";
+        case compression_none:
+        default:
+            return "none";
+    }
+}
+
+inline void gzip_compress(std::string const& input, std::string & output, int level = Z_DEFAULT_COMPRESSION) {
+    z_stream stream{};
+    // 15 window bits plus 16 selects a gzip header instead of a zlib one
+    if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("gzip: deflateInit2 failed");
+    }
+    output.resize(deflateBound(&stream, static_cast<uLong>(input.size())));
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    stream.avail_in = static_cast<uInt>(input.size());
+    stream.next_out = reinterpret_cast<Bytef*>(&output[0]);
+    stream.avail_out = static_cast<uInt>(output.size());
+    int ret = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    if (ret != Z_STREAM_END) {
+        throw std::runtime_error("gzip: deflate failed");
+    }
+    output.resize(stream.total_out);
+}
+
+#ifdef MRMVT_WITH_ZSTD
+inline void zstd_compress(std::string const& input, std::string & output, int level = 3) {
+    output.resize(ZSTD_compressBound(input.size()));
+    std::size_t size = ZSTD_compress(&output[0], output.size(), input.data(), input.size(), level);
+    if (ZSTD_isError(size)) {
+        std::ostringstream err;
+        err << "zstd: " << ZSTD_getErrorName(size);
+        throw std::runtime_error(err.str());
+    }
+    output.resize(size);
+}
+#endif
+
+inline void gzip_decompress(const char * data, std::size_t size, std::string & output) {
+    z_stream stream{};
+    // 15 window bits plus 32 accepts both gzip and zlib headers
+    if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+        throw std::runtime_error("gzip: inflateInit2 failed");
+    }
+    output.resize(size * 4 + 64);
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = static_cast<uInt>(size);
+    int ret = Z_OK;
+    while (ret != Z_STREAM_END) {
+        if (stream.total_out >= output.size()) {
+            output.resize(output.size() * 2);
+        }
+        stream.next_out = reinterpret_cast<Bytef*>(&output[stream.total_out]);
+        stream.avail_out = static_cast<uInt>(output.size() - stream.total_out);
+        ret = inflate(&stream, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            inflateEnd(&stream);
+            throw std::runtime_error("gzip: inflate failed");
+        }
+    }
+    output.resize(stream.total_out);
+    inflateEnd(&stream);
+}
+
+#ifdef MRMVT_WITH_ZSTD
+inline void zstd_decompress(const char * data, std::size_t size, std::string & output) {
+    unsigned long long content_size = ZSTD_getFrameContentSize(data, size);
+    if (content_size == ZSTD_CONTENTSIZE_ERROR || content_size == ZSTD_CONTENTSIZE_UNKNOWN) {
+        throw std::runtime_error("zstd: frame has no content size");
+    }
+    output.resize(static_cast<std::size_t>(content_size));
+    std::size_t out_size = ZSTD_decompress(&output[0], output.size(), data, size);
+    if (ZSTD_isError(out_size)) {
+        std::ostringstream err;
+        err << "zstd: " << ZSTD_getErrorName(out_size);
+        throw std::runtime_error(err.str());
+    }
+    output.resize(out_size);
+}
+#endif
+
+// Compression of a stored tile, detected from its magic bytes.
+inline compression_type detect_compression(const char * data, std::size_t size) {
+    if (size >= 2 && static_cast<unsigned char>(data[0]) == 0x1f && static_cast<unsigned char>(data[1]) == 0x8b) {
+        return compression_gzip;
+    }
+    if (size >= 4 && static_cast<unsigned char>(data[0]) == 0x28 && static_cast<unsigned char>(data[1]) == 0xb5 &&
+        static_cast<unsigned char>(data[2]) == 0x2f && static_cast<unsigned char>(data[3]) == 0xfd) {
+        return compression_zstd;
+    }
+    return compression_none;
+}
+
+inline void decompress_tile(const char * data, std::size_t size, std::string & output) {
+    switch (detect_compression(data, size)) {
+        case compression_gzip:
+            gzip_decompress(data, size, output);
+            break;
+        case compression_zstd:
+#ifdef MRMVT_WITH_ZSTD
+            zstd_decompress(data, size, output);
+            break;
+#else
+            throw std::runtime_error("zstd compressed tile but not built with MRMVT_WITH_ZSTD");
+#endif
+        case compression_none:
+        default:
+            output.assign(data, size);
+            break;
+    }
+}
+
+inline void compress_tile(std::string const& input, std::string & output, compression_type type) {
+    switch (type) {
+        case compression_gzip:
+            gzip_compress(input, output);
+            break;
+#ifdef MRMVT_WITH_ZSTD
+        case compression_zstd:
+            zstd_compress(input, output);
+            break;
+#endif
+        case compression_none:
+            output = input;
+            break;
+        default:
+            throw std::runtime_error("Unsupported compression type");
+    }
+}
+
+/*
+ * Sits between tile encoding and the tile writer. Encoded tiles are queued
+ * and compressed by a pool of worker threads; compressed tiles are handed to
+ * `write` one at a time, so the writer itself never needs to be thread safe.
+ * With zero threads, or no compression, tiles are written inline by `push`.
+ */
+class compression_stage {
+public:
+    using write_fn = std::function<void(int z, int x, int y, std::string const& data)>;
+
+    compression_stage(compression_type type, std::size_t threads, write_fn write) :
+        type_(type),
+        write_(std::move(write)),
+        max_queue_(threads * 4),
+        done_(false),
+        error_() {
+        if (type_ == compression_none) {
+            threads = 0;
+        }
+        for (std::size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back([this]() { run(); });
+        }
+    }
+
+    ~compression_stage() {
+        try {
+            finish();
+        } catch (...) {
+            // errors are only reported through an explicit finish()
+        }
+    }
+
+    compression_stage(compression_stage const&) = delete;
+    compression_stage& operator=(compression_stage const&) = delete;
+
+    compression_type type() const {
+        return type_;
+    }
+
+    void push(int z, int x, int y, std::string && data) {
+        enqueue(z, x, y, std::move(data), false);
+    }
+
+    // Queues a tile that is already in the output compression. It shares the
+    // queue and the writer with pushed tiles but is not compressed again.
+    void push_raw(int z, int x, int y, std::string && data) {
+        enqueue(z, x, y, std::move(data), true);
+    }
+
+    // Drains the queue, joins the workers and rethrows the first worker error.
+    void finish() {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            done_ = true;
+        }
+        not_empty_.notify_all();
+        for (auto & w : workers_) {
+            w.join();
+        }
+        workers_.clear();
+        if (error_) {
+            std::exception_ptr err = error_;
+            error_ = nullptr;
+            std::rethrow_exception(err);
+        }
+    }
+
+private:
+    struct task {
+        int z;
+        int x;
+        int y;
+        std::string data;
+        bool raw;
+    };
+
+    void enqueue(int z, int x, int y, std::string && data, bool raw) {
+        if (workers_.empty()) {
+            if (raw || type_ == compression_none) {
+                write_(z, x, y, data);
+            } else {
+                std::string compressed;
+                {
+                    stats_scope timer(local_stats(), stats_timer_compress);
+                    trace_span span(trace_recorder::active(), "compress", "tile");
+                    compress_tile(data, compressed, type_);
+                }
+                write_(z, x, y, compressed);
+            }
+            return;
+        }
+        std::unique_lock<std::mutex> lock(queue_mutex_);
+        not_full_.wait(lock, [this]() { return queue_.size() < max_queue_ || error_; });
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+        queue_.push_back(task { z, x, y, std::move(data), raw });
+        not_empty_.notify_one();
+    }
+
+    void run() {
+        std::string compressed;
+        stats_counters * stats = local_stats();
+        while (true) {
+            task t;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex_);
+                not_empty_.wait(lock, [this]() { return !queue_.empty() || done_; });
+                if (queue_.empty()) {
+                    return;
+                }
+                t = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            not_full_.notify_one();
+            try {
+                if (t.raw) {
+                    std::lock_guard<std::mutex> lock(write_mutex_);
+                    write_(t.z, t.x, t.y, t.data);
+                    continue;
+                }
+                {
+                    stats_scope timer(stats, stats_timer_compress);
+                    trace_span span(trace_recorder::active(), "compress", "tile");
+                    compress_tile(t.data, compressed, type_);
+                }
+                if (stats) {
+                    stats_collector::instance().tick(*stats);
+                }
+                std::lock_guard<std::mutex> lock(write_mutex_);
+                write_(t.z, t.x, t.y, compressed);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(queue_mutex_);
+                if (!error_) {
+                    error_ = std::current_exception();
+                }
+                not_full_.notify_all();
+            }
+        }
+    }
+
+    compression_type type_;
+    write_fn write_;
+    std::size_t max_queue_;
+    bool done_;
+    std::exception_ptr error_;
+    std::deque<task> queue_;
+    std::mutex queue_mutex_;
+    std::mutex write_mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::vector<std::thread> workers_;
+};
+
+}}
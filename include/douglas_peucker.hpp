@@ -37,6 +37,7 @@
 // DEALINGS IN THE SOFTWARE.
 
 #include <mapbox/geometry/point.hpp>
+#include <cstddef>
 #include <vector>
 
 namespace mapbox { namespace mrmvt { namespace detail {
@@ -138,6 +139,66 @@ inline void consider(typename std::vector<douglas_peucker_point<value_type> >::i
     }
 }
 
+// Same as consider, over the index range [first, last] of points, marking
+// the points to keep in the parallel keep flags.
+template <typename value_type, typename calc_type>
+inline void consider_in_place(mapbox::geometry::point<value_type> const* points,
+                              char * keep,
+                              std::size_t first,
+                              std::size_t last,
+                              calc_type const& max_dist)
+{
+    if (last - first <= 1)
+    {
+        return;
+    }
+
+    mapbox::geometry::point<value_type> const& a = points[first];
+    mapbox::geometry::point<value_type> const& b = points[last];
+    calc_type md(-1.0);
+    std::size_t candidate = first;
+    calc_type const v_x = b.x - a.x;
+    calc_type const v_y = b.y - a.y;
+    calc_type const c2 = v_x * v_x + v_y * v_y;
+    for (std::size_t i = first + 1; i != last; ++i)
+    {
+        mapbox::geometry::point<value_type> const& p = points[i];
+        calc_type const w_x = p.x - a.x;
+        calc_type const w_y = p.y - a.y;
+        calc_type const c1 = w_x * v_x + w_y * v_y;
+        calc_type dist;
+        if (c1 <= 0)
+        {
+            dist = w_x * w_x + w_y * w_y;
+        }
+        else if (c2 <= c1)
+        {
+            calc_type const dx = p.x - b.x;
+            calc_type const dy = p.y - b.y;
+            dist = dx * dx + dy * dy;
+        }
+        else
+        {
+            calc_type const f = c1 / c2;
+            calc_type const dx = p.x - (a.x + f * v_x);
+            calc_type const dy = p.y - (a.y + f * v_y);
+            dist = dx * dx + dy * dy;
+        }
+        if (md < dist)
+        {
+            md = dist;
+            candidate = i;
+        }
+    }
+
+    if (max_dist < md)
+    {
+        keep[candidate] = 1;
+        consider_in_place<value_type>(points, keep, first, candidate, max_dist);
+        consider_in_place<value_type>(points, keep, candidate, last, max_dist);
+    }
+}
+
 } // end ns detail
 
 template <typename value_type, typename calc_type, typename Range, typename OutputIterator>
@@ -178,6 +239,37 @@ inline void douglas_peucker(Range const& range,
     }
 }
 
+// Simplifies points in place, moving the kept points to the front and
+// shrinking the container to them. keep is scratch space for the flags, both
+// keep their capacity so repeated calls do not allocate once warmed up.
+template <typename value_type, typename calc_type, typename Points>
+inline void douglas_peucker_in_place(Points & points,
+                                     std::vector<char> & keep,
+                                     calc_type max_distance)
+{
+    std::size_t size = points.size();
+    if (size <= 2)
+    {
+        return;
+    }
+    keep.assign(size, 0);
+    keep.front() = 1;
+    keep.back() = 1;
+
+    calc_type const max_sqrd = max_distance * max_distance;
+    detail::consider_in_place<value_type, calc_type>(points.data(), keep.data(), 0, size - 1, max_sqrd);
+
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        if (keep[i])
+        {
+            points[kept++] = points[i];
+        }
+    }
+    points.resize(kept);
+}
+
 } // end ns mrmvt
 } // end ns mapbox
 
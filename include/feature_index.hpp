@@ -0,0 +1,567 @@
+#pragma once
+
+#include "hilbert.hpp"
+#include "map_to_zoom.hpp"
+#include "tile_budget.hpp"
+#include "tile_hash.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mapbox { namespace mrmvt {
+
+/*
+ * Persisted spatial index over source features
+ *
+ *   [index_header][feature lines][node boxes][node indices][items][keys][options]
+ *
+ * The feature lines are the `layer geojson` records produced by m2f, stored
+ * verbatim. Every feature gets an item holding the location of its line, in
+ * input order, and a leaf box holding its bounding box in world coordinates
+ * (web mercator scaled to [0, 1], y pointing down). Leaves are sorted by the
+ * hilbert value of their box center and packed bottom up into a static R-tree
+ * with INDEX_NODE_SIZE children per node. All levels of the tree share one
+ * array of boxes: the first item_count boxes are the leaves, the last box is
+ * the root, and level_bounds[l] is the end of level l within that array. The
+ * node index of a leaf is its item number.
+ *
+ * Features with an id also get a key, a hash of their layer and id, in a
+ * table sorted by hash, so an update finds the old version of a changed
+ * feature without reading any other line. The options the tileset was built
+ * with close the file as `name value` lines.
+ */
+
+static const char INDEX_MAGIC[8] = { 'M', 'R', 'M', 'V', 'T', 'I', 'X', '\0' };
+static const std::uint32_t INDEX_VERSION = 2;
+static const std::uint32_t INDEX_NODE_SIZE = 16;
+static const std::size_t INDEX_MAX_LEVELS = 32;
+
+struct index_header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t node_size;
+    std::uint64_t item_count;
+    std::uint64_t node_count;
+    std::uint64_t level_count;
+    std::uint64_t level_bounds[INDEX_MAX_LEVELS];
+    std::uint64_t data_offset;
+    std::uint64_t data_length;
+    std::uint64_t boxes_offset;
+    std::uint64_t indices_offset;
+    std::uint64_t items_offset;
+    std::uint64_t keys_offset;
+    std::uint64_t key_count;
+    std::uint64_t options_offset;
+    std::uint64_t options_length;
+};
+
+using index_box = std::array<double, 4>; // min x, min y, max x, max y
+
+struct index_item {
+    std::uint64_t offset; // relative to data_offset
+    std::uint64_t length;
+};
+
+struct index_key {
+    std::uint64_t hash;
+    std::uint64_t item;
+};
+
+static_assert(sizeof(index_box) == 32, "index_box must be packed");
+static_assert(sizeof(index_item) == 16, "index_item must be packed");
+static_assert(sizeof(index_key) == 16, "index_key must be packed");
+
+/*
+ * How the tiles of an index are built: the m2z, m2t and r2mvt settings of the
+ * pipeline that made the tileset, so on demand tiles and updates come out the
+ * same as a full rebuild.
+ */
+struct index_options {
+    double simplify_distance = 4.0;
+    std::int64_t buffer = 8;
+    int max_zoom = 16;                   // m2z --max, resolves cluster.max_zoom -1
+    cluster_options cluster;
+    tile_budget budget;                  // compression is set by whoever stores the tiles
+    std::set<std::string> point_layers;  // layers holding Point features, tracked when clustering
+
+    // Last clustered zoom, or -1 without clustering.
+    int cluster_max_zoom() const {
+        if (!cluster.enabled) {
+            return -1;
+        }
+        return cluster.max_zoom < 0 ? max_zoom - 1 : std::min(cluster.max_zoom, max_zoom);
+    }
+};
+
+inline std::string index_options_string(index_options const& options) {
+    std::ostringstream out;
+    out.precision(17);
+    out << "simplify_distance " << options.simplify_distance << '\n'
+        << "buffer " << options.buffer << '\n'
+        << "max_zoom " << options.max_zoom << '\n'
+        << "cluster " << (options.cluster.enabled ? 1 : 0) << '\n'
+        << "cluster_radius " << options.cluster.radius << '\n'
+        << "cluster_extent " << options.cluster.extent << '\n'
+        << "cluster_max_zoom " << options.cluster.max_zoom << '\n'
+        << "max_tile_bytes " << options.budget.max_tile_bytes << '\n'
+        << "max_layer_features " << options.budget.max_layer_features << '\n'
+        << "priority " << priority_spec(options.budget) << '\n';
+    for (auto const& layer : options.point_layers) {
+        out << "point_layer " << layer << '\n';
+    }
+    return out.str();
+}
+
+inline index_options parse_index_options(std::string const& text) {
+    index_options options;
+    std::istringstream in(text);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::size_t sep = line.find(' ');
+        if (sep == std::string::npos) {
+            continue;
+        }
+        std::string name = line.substr(0, sep);
+        std::string value = line.substr(sep + 1);
+        if (name == "simplify_distance") {
+            options.simplify_distance = std::atof(value.c_str());
+        } else if (name == "buffer") {
+            options.buffer = std::atoll(value.c_str());
+        } else if (name == "max_zoom") {
+            options.max_zoom = std::atoi(value.c_str());
+        } else if (name == "cluster") {
+            options.cluster.enabled = value == "1";
+        } else if (name == "cluster_radius") {
+            options.cluster.radius = std::atof(value.c_str());
+        } else if (name == "cluster_extent") {
+            options.cluster.extent = static_cast<std::size_t>(std::atoll(value.c_str()));
+        } else if (name == "cluster_max_zoom") {
+            options.cluster.max_zoom = std::atoi(value.c_str());
+        } else if (name == "max_tile_bytes") {
+            options.budget.max_tile_bytes = static_cast<std::size_t>(std::atoll(value.c_str()));
+        } else if (name == "max_layer_features") {
+            options.budget.max_layer_features = static_cast<std::size_t>(std::atoll(value.c_str()));
+        } else if (name == "priority") {
+            parse_priority(value, options.budget);
+        } else if (name == "point_layer") {
+            options.point_layers.insert(value);
+        }
+    }
+    options.budget.simplify_distance = options.simplify_distance;
+    return options;
+}
+
+// Diff key of a feature, empty for features without an id.
+inline std::string feature_key(std::string const& layer, geometry::feature<double> const& f) {
+    if (!f.id) {
+        return std::string();
+    }
+    return layer + " " + feature_id_string(f);
+}
+
+// Diff key for the raw json id of a delete line: numbers as written, strings unquoted.
+inline std::string feature_key(std::string const& layer, std::string const& json_id) {
+    std::string id = json_id;
+    if (id.size() >= 2 && id.front() == '"' && id.back() == '"') {
+        id = id.substr(1, id.size() - 2);
+    }
+    return layer + " " + id;
+}
+
+inline std::uint64_t feature_key_hash(std::string const& key) {
+    std::uint64_t h1;
+    std::uint64_t h2;
+    detail::murmur_hash3_x64_128(key.data(), key.size(), h1, h2);
+    return h1;
+}
+
+struct lon_lat_bbox_visitor {
+    double min_x = std::numeric_limits<double>::max();
+    double min_y = std::numeric_limits<double>::max();
+    double max_x = std::numeric_limits<double>::lowest();
+    double max_y = std::numeric_limits<double>::lowest();
+
+    void operator() (geometry::point<double> const& pt) {
+        min_x = std::min(min_x, pt.x);
+        min_y = std::min(min_y, pt.y);
+        max_x = std::max(max_x, pt.x);
+        max_y = std::max(max_y, pt.y);
+    }
+
+    void operator() (geometry::geometry_collection<double> const& gc) {
+        for (auto const& g : gc) {
+            geometry::geometry<double>::visit(g, *this);
+        }
+    }
+
+    template <typename Container>
+    void operator() (Container const& c) {
+        for (auto const& g : c) {
+            (*this)(g);
+        }
+    }
+};
+
+// Bounding box of a geometry in world coordinates.
+inline index_box world_bbox(geometry::geometry<double> const& g) {
+    lon_lat_bbox_visitor v;
+    geometry::geometry<double>::visit(g, v);
+    // mercator y is decreasing in latitude, so max latitude gives min y
+    return index_box {{ lon_to_world_x(v.min_x), lat_to_world_y(v.max_y),
+                        lon_to_world_x(v.max_x), lat_to_world_y(v.min_y) }};
+}
+
+inline bool boxes_intersect(index_box const& a, index_box const& b) {
+    return a[0] <= b[2] && a[1] <= b[3] && a[2] >= b[0] && a[3] >= b[1];
+}
+
+/*
+ * Writes an index. Feature lines are streamed straight into the output, only
+ * the boxes, items and keys are kept in memory until finish() builds the
+ * tree. Lines whose box is already known, like the unchanged features of an
+ * update, go in without being parsed again.
+ */
+class feature_index_writer {
+public:
+    explicit feature_index_writer(std::string const& path) :
+        path_(path),
+        out_(path, std::ios::binary | std::ios::trunc),
+        boxes_(),
+        items_(),
+        keys_(),
+        data_length_(0) {
+        if (!out_) {
+            std::ostringstream err;
+            err << "Index Error: Failed to open " << path;
+            throw std::runtime_error(err.str());
+        }
+        index_header header;
+        std::memset(&header, 0, sizeof(header));
+        out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    // Appends one `layer geojson` line, without its newline, and returns its item number.
+    std::uint64_t add(const char * data, std::size_t size, index_box const& box) {
+        out_.write(data, static_cast<std::streamsize>(size));
+        out_.put('\n');
+        boxes_.push_back(box);
+        items_.push_back(index_item { data_length_, size });
+        data_length_ += size + 1;
+        return items_.size() - 1;
+    }
+
+    void add_key(std::uint64_t hash, std::uint64_t item) {
+        keys_.push_back(index_key { hash, item });
+    }
+
+    std::uint64_t finish(index_options const& options) {
+        index_header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+        header.version = INDEX_VERSION;
+        header.node_size = INDEX_NODE_SIZE;
+        header.data_offset = sizeof(index_header);
+        header.data_length = data_length_;
+        header.item_count = items_.size();
+
+        // sort leaves along the hilbert curve so spatially close items share nodes
+        const double hilbert_max = static_cast<double>((1 << 16) - 1);
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> order;
+        order.reserve(boxes_.size());
+        for (std::size_t i = 0; i < boxes_.size(); ++i) {
+            index_box const& b = boxes_[i];
+            double cx = std::min(std::max((b[0] + b[2]) / 2.0, 0.0), 1.0);
+            double cy = std::min(std::max((b[1] + b[3]) / 2.0, 0.0), 1.0);
+            order.emplace_back(hilbert_xy_to_d(16, static_cast<std::uint64_t>(cx * hilbert_max), static_cast<std::uint64_t>(cy * hilbert_max)), i);
+        }
+        std::sort(order.begin(), order.end());
+
+        std::vector<index_box> boxes;
+        std::vector<std::uint64_t> indices;
+        boxes.reserve(order.size() + order.size() / (INDEX_NODE_SIZE - 1) + 1);
+        indices.reserve(boxes.capacity());
+        for (auto const& o : order) {
+            boxes.push_back(boxes_[o.second]);
+            indices.push_back(o.second);
+        }
+        order.clear();
+        order.shrink_to_fit();
+        boxes_.clear();
+        boxes_.shrink_to_fit();
+
+        std::size_t level = 0;
+        header.level_bounds[level++] = boxes.size();
+        std::size_t level_start = 0;
+        std::size_t level_end = boxes.size();
+        while (level_end - level_start > 1) {
+            if (level >= INDEX_MAX_LEVELS) {
+                throw std::runtime_error("Index Error: too many levels");
+            }
+            for (std::size_t i = level_start; i < level_end; i += INDEX_NODE_SIZE) {
+                index_box node = boxes[i];
+                std::size_t end = std::min(i + INDEX_NODE_SIZE, level_end);
+                for (std::size_t j = i + 1; j < end; ++j) {
+                    node[0] = std::min(node[0], boxes[j][0]);
+                    node[1] = std::min(node[1], boxes[j][1]);
+                    node[2] = std::max(node[2], boxes[j][2]);
+                    node[3] = std::max(node[3], boxes[j][3]);
+                }
+                boxes.push_back(node);
+                indices.push_back(i);
+            }
+            level_start = level_end;
+            level_end = boxes.size();
+            header.level_bounds[level++] = level_end;
+        }
+        header.level_count = level;
+        header.node_count = boxes.size();
+
+        std::sort(keys_.begin(), keys_.end(), [](index_key const& a, index_key const& b) {
+            return a.hash < b.hash || (a.hash == b.hash && a.item < b.item);
+        });
+        std::string options_text = index_options_string(options);
+
+        // the tables that follow the feature lines are read in place, so they start 8 byte aligned
+        std::uint64_t padding = (8 - (header.data_offset + data_length_) % 8) % 8;
+        out_.write("\0\0\0\0\0\0\0", static_cast<std::streamsize>(padding));
+        header.boxes_offset = header.data_offset + data_length_ + padding;
+        out_.write(reinterpret_cast<const char*>(boxes.data()), static_cast<std::streamsize>(boxes.size() * sizeof(index_box)));
+        header.indices_offset = header.boxes_offset + boxes.size() * sizeof(index_box);
+        out_.write(reinterpret_cast<const char*>(indices.data()), static_cast<std::streamsize>(indices.size() * sizeof(std::uint64_t)));
+        header.items_offset = header.indices_offset + indices.size() * sizeof(std::uint64_t);
+        out_.write(reinterpret_cast<const char*>(items_.data()), static_cast<std::streamsize>(items_.size() * sizeof(index_item)));
+        header.keys_offset = header.items_offset + items_.size() * sizeof(index_item);
+        header.key_count = keys_.size();
+        out_.write(reinterpret_cast<const char*>(keys_.data()), static_cast<std::streamsize>(keys_.size() * sizeof(index_key)));
+        header.options_offset = header.keys_offset + keys_.size() * sizeof(index_key);
+        header.options_length = options_text.size();
+        out_.write(options_text.data(), static_cast<std::streamsize>(options_text.size()));
+
+        out_.seekp(0);
+        out_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out_.close();
+        if (!out_) {
+            std::ostringstream err;
+            err << "Index Error: failed writing " << path_;
+            throw std::runtime_error(err.str());
+        }
+        return header.item_count;
+    }
+
+private:
+    std::string path_;
+    std::ofstream out_;
+    std::vector<index_box> boxes_;
+    std::vector<index_item> items_;
+    std::vector<index_key> keys_;
+    std::uint64_t data_length_;
+};
+
+/*
+ * Reads `layer geojson` lines from `in` and writes an index to `path` that
+ * records `options`. With clustering, the layers holding Point features are
+ * added to the recorded options.
+ */
+inline std::uint64_t build_feature_index(std::istream & in, std::string const& path, index_options options = index_options()) {
+    feature_index_writer writer(path);
+    in >> std::noskipws;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::size_t sep = line.find(' ');
+        if (sep == std::string::npos) {
+            continue;
+        }
+        std::string layer = line.substr(0, sep);
+        auto feature = geojson::parse_feature<double>(line.substr(sep + 1));
+        reject_property_handle(feature, "mvt-index cannot read records written with m2f --properties, run m2f without --properties");
+        std::uint64_t item = writer.add(line.data(), line.size(), world_bbox(feature.geometry));
+        std::string key = feature_key(layer, feature);
+        if (!key.empty()) {
+            writer.add_key(feature_key_hash(key), item);
+        }
+        if (options.cluster.enabled && feature.geometry.is<geometry::point<double>>()) {
+            options.point_layers.insert(layer);
+        }
+    }
+    return writer.finish(options);
+}
+
+/*
+ * Memory mapped, read only view of an index written by feature_index_writer.
+ * Searches are const and can run from many threads at once.
+ */
+class feature_index {
+public:
+    explicit feature_index(std::string const& path) :
+        fd_(-1),
+        map_(nullptr),
+        size_(0),
+        header_(nullptr) {
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) {
+            std::ostringstream err;
+            err << "Index Error: Failed to open " << path;
+            throw std::runtime_error(err.str());
+        }
+        struct stat st;
+        if (::fstat(fd_, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(index_header)) {
+            ::close(fd_);
+            std::ostringstream err;
+            err << "Index Error: " << path << " is not a feature index";
+            throw std::runtime_error(err.str());
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        void * addr = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (addr == MAP_FAILED) {
+            ::close(fd_);
+            std::ostringstream err;
+            err << "Index Error: Failed to map " << path;
+            throw std::runtime_error(err.str());
+        }
+        map_ = static_cast<const char*>(addr);
+        header_ = reinterpret_cast<const index_header*>(map_);
+        if (std::memcmp(header_->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+            header_->version != INDEX_VERSION ||
+            header_->level_count > INDEX_MAX_LEVELS ||
+            header_->items_offset + header_->item_count * sizeof(index_item) > header_->keys_offset ||
+            header_->keys_offset + header_->key_count * sizeof(index_key) > header_->options_offset ||
+            header_->options_offset + header_->options_length > size_) {
+            release();
+            std::ostringstream err;
+            err << "Index Error: " << path << " is not a valid feature index";
+            throw std::runtime_error(err.str());
+        }
+        boxes_ = reinterpret_cast<const index_box*>(map_ + header_->boxes_offset);
+        indices_ = reinterpret_cast<const std::uint64_t*>(map_ + header_->indices_offset);
+        items_ = reinterpret_cast<const index_item*>(map_ + header_->items_offset);
+        keys_ = reinterpret_cast<const index_key*>(map_ + header_->keys_offset);
+        options_ = parse_index_options(std::string(map_ + header_->options_offset, header_->options_length));
+    }
+
+    ~feature_index() {
+        release();
+    }
+
+    feature_index(feature_index const&) = delete;
+    feature_index& operator=(feature_index const&) = delete;
+
+    std::uint64_t size() const {
+        return header_->item_count;
+    }
+
+    index_options const& options() const {
+        return options_;
+    }
+
+    // Calls visit(data, length) with the `layer geojson` line of every
+    // feature whose box intersects `query`.
+    template <typename Visitor>
+    void search(index_box const& query, Visitor && visit) const {
+        if (header_->node_count == 0) {
+            return;
+        }
+        std::uint64_t item_count = header_->item_count;
+        std::uint64_t node_size = header_->node_size;
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> stack;
+        stack.emplace_back(header_->node_count - 1, header_->level_count - 1);
+        while (!stack.empty()) {
+            std::uint64_t node = stack.back().first;
+            std::uint64_t level = stack.back().second;
+            stack.pop_back();
+            std::uint64_t end = std::min(node + node_size, header_->level_bounds[level]);
+            for (std::uint64_t pos = node; pos < end; ++pos) {
+                if (!boxes_intersect(query, boxes_[pos])) {
+                    continue;
+                }
+                if (pos < item_count) {
+                    index_item const& item = items_[indices_[pos]];
+                    visit(map_ + header_->data_offset + item.offset, static_cast<std::size_t>(item.length));
+                } else {
+                    stack.emplace_back(indices_[pos], level - 1);
+                }
+            }
+        }
+    }
+
+    // Calls visit(item, data, length) with the `layer geojson` line of every
+    // feature, in input order.
+    template <typename Visitor>
+    void for_each(Visitor && visit) const {
+        for (std::uint64_t i = 0; i < header_->item_count; ++i) {
+            index_item const& item = items_[i];
+            visit(i, map_ + header_->data_offset + item.offset, static_cast<std::size_t>(item.length));
+        }
+    }
+
+    // Calls visit(item, box) with the box of every feature, in tree order.
+    template <typename Visitor>
+    void for_each_box(Visitor && visit) const {
+        for (std::uint64_t pos = 0; pos < header_->item_count; ++pos) {
+            visit(indices_[pos], boxes_[pos]);
+        }
+    }
+
+    // Calls visit(key) for every key, in hash order.
+    template <typename Visitor>
+    void for_each_key(Visitor && visit) const {
+        for (std::uint64_t i = 0; i < header_->key_count; ++i) {
+            visit(keys_[i]);
+        }
+    }
+
+    // Calls visit(item, data, length) for every feature whose key hashes to
+    // `hash`. Hashes can collide, so callers compare the actual key.
+    template <typename Visitor>
+    void find(std::uint64_t hash, Visitor && visit) const {
+        const index_key * end = keys_ + header_->key_count;
+        const index_key * k = std::lower_bound(keys_, end, hash, [](index_key const& a, std::uint64_t h) {
+            return a.hash < h;
+        });
+        for (; k != end && k->hash == hash; ++k) {
+            index_item const& item = items_[k->item];
+            visit(k->item, map_ + header_->data_offset + item.offset, static_cast<std::size_t>(item.length));
+        }
+    }
+
+private:
+    void release() {
+        if (map_) {
+            ::munmap(const_cast<char*>(map_), size_);
+            map_ = nullptr;
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    int fd_;
+    const char * map_;
+    std::size_t size_;
+    const index_header * header_;
+    const index_box * boxes_ = nullptr;
+    const std::uint64_t * indices_ = nullptr;
+    const index_item * items_ = nullptr;
+    const index_key * keys_ = nullptr;
+    index_options options_;
+};
+
+}}
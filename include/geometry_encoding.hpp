@@ -0,0 +1,144 @@
+#pragma once
+
+#include <mapbox/geometry.hpp>
+
+#include <cstdint>
+#include <string>
+
+namespace mapbox { namespace mrmvt {
+
+/*
+ * Compact binary encoding of tile coordinate geometries
+ *
+ * A geometry is a type byte followed by its parts:
+ *
+ *   1 point              x y
+ *   2 line_string        n, n points
+ *   3 polygon            rings, then per ring n and n points
+ *   4 multi_point        n, n points
+ *   5 multi_line_string  lines, then per line n and n points
+ *   6 multi_polygon      polygons, then per polygon an encoded polygon body
+ *   7 geometry_collection  n, then n encoded geometries
+ *
+ * Counts are unsigned LEB128 varints. Coordinates are zigzag varints of the
+ * difference to the previous point of the whole geometry, starting at 0,0,
+ * so neighbouring vertices usually take one or two bytes each. lib/geometry.js
+ * decodes it back to GeoJSON.
+ */
+
+enum geometry_encoding_type : std::uint8_t {
+    geometry_encoding_point = 1,
+    geometry_encoding_line_string,
+    geometry_encoding_polygon,
+    geometry_encoding_multi_point,
+    geometry_encoding_multi_line_string,
+    geometry_encoding_multi_polygon,
+    geometry_encoding_geometry_collection
+};
+
+class geometry_encoder {
+public:
+    explicit geometry_encoder(std::string & out) :
+        out_(out),
+        x_(0),
+        y_(0) {}
+
+    void encode(geometry::geometry<std::int64_t> const& g) {
+        geometry::geometry<std::int64_t>::visit(g, *this);
+    }
+
+    void operator() (geometry::point<std::int64_t> const& pt) {
+        type(geometry_encoding_point);
+        point(pt);
+    }
+
+    void operator() (geometry::line_string<std::int64_t> const& ls) {
+        type(geometry_encoding_line_string);
+        points(ls);
+    }
+
+    void operator() (geometry::polygon<std::int64_t> const& poly) {
+        type(geometry_encoding_polygon);
+        polygon(poly);
+    }
+
+    void operator() (geometry::multi_point<std::int64_t> const& mp) {
+        type(geometry_encoding_multi_point);
+        points(mp);
+    }
+
+    void operator() (geometry::multi_line_string<std::int64_t> const& mls) {
+        type(geometry_encoding_multi_line_string);
+        varint(mls.size());
+        for (auto const& ls : mls) {
+            points(ls);
+        }
+    }
+
+    void operator() (geometry::multi_polygon<std::int64_t> const& mp) {
+        type(geometry_encoding_multi_polygon);
+        varint(mp.size());
+        for (auto const& poly : mp) {
+            polygon(poly);
+        }
+    }
+
+    void operator() (geometry::geometry_collection<std::int64_t> const& gc) {
+        type(geometry_encoding_geometry_collection);
+        varint(gc.size());
+        for (auto const& g : gc) {
+            encode(g);
+        }
+    }
+
+private:
+    void type(geometry_encoding_type t) {
+        out_.push_back(static_cast<char>(t));
+    }
+
+    void varint(std::uint64_t v) {
+        while (v >= 0x80) {
+            out_.push_back(static_cast<char>((v & 0x7f) | 0x80));
+            v >>= 7;
+        }
+        out_.push_back(static_cast<char>(v));
+    }
+
+    void zigzag(std::int64_t v) {
+        varint((static_cast<std::uint64_t>(v) << 1) ^ static_cast<std::uint64_t>(v >> 63));
+    }
+
+    void point(geometry::point<std::int64_t> const& pt) {
+        zigzag(pt.x - x_);
+        zigzag(pt.y - y_);
+        x_ = pt.x;
+        y_ = pt.y;
+    }
+
+    template <typename Points>
+    void points(Points const& pts) {
+        varint(pts.size());
+        for (auto const& pt : pts) {
+            point(pt);
+        }
+    }
+
+    void polygon(geometry::polygon<std::int64_t> const& poly) {
+        varint(poly.size());
+        for (auto const& ring : poly) {
+            points(ring);
+        }
+    }
+
+    std::string & out_;
+    std::int64_t x_;
+    std::int64_t y_;
+};
+
+// Appends the encoding of `g` to `out`.
+inline void encode_geometry(geometry::geometry<std::int64_t> const& g, std::string & out) {
+    geometry_encoder encoder(out);
+    encoder.encode(g);
+}
+
+}}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+
+namespace mapbox { namespace mrmvt {
+
+// Position of (x, y) along the hilbert curve filling a 2^z by 2^z grid.
+inline std::uint64_t hilbert_xy_to_d(std::uint32_t z, std::uint64_t x, std::uint64_t y) {
+    std::uint64_t n = static_cast<std::uint64_t>(1) << z;
+    std::uint64_t d = 0;
+    for (std::uint64_t s = n / 2; s > 0; s /= 2) {
+        std::uint64_t rx = (x & s) > 0 ? 1 : 0;
+        std::uint64_t ry = (y & s) > 0 ? 1 : 0;
+        d += s * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+inline void hilbert_d_to_xy(std::uint32_t z, std::uint64_t d, std::uint64_t & x, std::uint64_t & y) {
+    std::uint64_t n = static_cast<std::uint64_t>(1) << z;
+    x = 0;
+    y = 0;
+    for (std::uint64_t s = 1; s < n; s *= 2) {
+        std::uint64_t rx = 1 & (d / 2);
+        std::uint64_t ry = 1 & (d ^ rx);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+}
+
+}}
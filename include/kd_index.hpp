@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace mapbox { namespace mrmvt {
+
+/*
+ * Static KD-tree over 2d points, in the style of kdbush. The points are
+ * sorted once into an implicit tree: the median of every range is split on
+ * alternating axes until a range holds at most node_size points, which are
+ * then scanned linearly. Nothing is allocated per node, the whole index is
+ * three flat arrays.
+ */
+class kd_index {
+public:
+    kd_index(std::vector<double> const& xs, std::vector<double> const& ys, std::size_t node_size = 64) :
+        node_size_(std::max<std::size_t>(node_size, 1)),
+        ids_(),
+        coords_() {
+        std::size_t n = std::min(xs.size(), ys.size());
+        ids_.resize(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            ids_[i] = static_cast<std::uint32_t>(i);
+        }
+        if (n > 0) {
+            sort(xs, ys, 0, n - 1, 0);
+        }
+        coords_.reserve(n * 2);
+        for (auto id : ids_) {
+            coords_.push_back(xs[id]);
+            coords_.push_back(ys[id]);
+        }
+    }
+
+    std::size_t size() const {
+        return ids_.size();
+    }
+
+    // Calls visit(id) for every point within distance r of (qx, qy).
+    template <typename Visitor>
+    void within(double qx, double qy, double r, Visitor && visit) const {
+        if (ids_.empty()) {
+            return;
+        }
+        double r2 = r * r;
+        struct range {
+            std::size_t left;
+            std::size_t right;
+            int axis;
+        };
+        std::vector<range> stack;
+        stack.push_back(range { 0, ids_.size() - 1, 0 });
+        while (!stack.empty()) {
+            range cur = stack.back();
+            stack.pop_back();
+            if (cur.right - cur.left <= node_size_) {
+                for (std::size_t i = cur.left; i <= cur.right; ++i) {
+                    if (sq_dist(coords_[2 * i], coords_[2 * i + 1], qx, qy) <= r2) {
+                        visit(ids_[i]);
+                    }
+                }
+                continue;
+            }
+            std::size_t m = (cur.left + cur.right) >> 1;
+            double x = coords_[2 * m];
+            double y = coords_[2 * m + 1];
+            if (sq_dist(x, y, qx, qy) <= r2) {
+                visit(ids_[m]);
+            }
+            double q = cur.axis == 0 ? qx : qy;
+            double v = cur.axis == 0 ? x : y;
+            if (q - r <= v && m > cur.left) {
+                stack.push_back(range { cur.left, m - 1, 1 - cur.axis });
+            }
+            if (q + r >= v) {
+                stack.push_back(range { m + 1, cur.right, 1 - cur.axis });
+            }
+        }
+    }
+
+private:
+    static double sq_dist(double ax, double ay, double bx, double by) {
+        double dx = ax - bx;
+        double dy = ay - by;
+        return dx * dx + dy * dy;
+    }
+
+    void sort(std::vector<double> const& xs, std::vector<double> const& ys,
+              std::size_t left, std::size_t right, int axis) {
+        if (right - left <= node_size_) {
+            return;
+        }
+        std::size_t m = (left + right) >> 1;
+        std::vector<double> const& c = axis == 0 ? xs : ys;
+        std::nth_element(ids_.begin() + static_cast<std::ptrdiff_t>(left),
+                         ids_.begin() + static_cast<std::ptrdiff_t>(m),
+                         ids_.begin() + static_cast<std::ptrdiff_t>(right) + 1,
+                         [&c](std::uint32_t a, std::uint32_t b) {
+                             return c[a] < c[b];
+                         });
+        sort(xs, ys, left, m - 1, 1 - axis);
+        sort(xs, ys, m + 1, right, 1 - axis);
+    }
+
+    std::size_t node_size_;
+    std::vector<std::uint32_t> ids_;
+    std::vector<double> coords_;
+};
+
+}}
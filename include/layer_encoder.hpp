@@ -0,0 +1,359 @@
+#pragma once
+
+#include <mapbox/geometry.hpp>
+
+#include <protozero/pbf_writer.hpp>
+#include <protozero/varint.hpp>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mapbox { namespace mrmvt {
+
+/*
+ * Encodes one vector tile layer a feature at a time. Each feature is written
+ * to the layer message as soon as it is added, so the memory held for a layer
+ * is its encoded bytes plus the key and value dictionaries, never the parsed
+ * features. Keys and values are written after the features when the layer is
+ * finished; field order does not matter in a protobuf message.
+ *
+ * Properties holding lists or maps, and geometry collections, have no vector
+ * tile representation and are left out.
+ */
+class streaming_layer_encoder {
+public:
+    explicit streaming_layer_encoder(std::uint32_t extent = 4096) :
+        extent_(extent),
+        layer_(),
+        features_(0),
+        keys_(),
+        key_order_(),
+        values_(),
+        value_order_(),
+        value_(),
+        tags_(),
+        commands_(),
+        cursor_x_(0),
+        cursor_y_(0) {}
+
+    streaming_layer_encoder(streaming_layer_encoder const&) = delete;
+    streaming_layer_encoder& operator=(streaming_layer_encoder const&) = delete;
+
+    // Starts a new layer, dropping anything not finished.
+    void begin(std::string const& name) {
+        layer_.clear();
+        features_ = 0;
+        keys_.clear();
+        key_order_.clear();
+        values_.clear();
+        value_order_.clear();
+        protozero::pbf_writer layer(layer_);
+        layer.add_string(layer_name, name);
+    }
+
+    // Returns false when the feature has no geometry a vector tile can hold.
+    bool add(geometry::feature<std::int64_t> const& f) {
+        commands_.clear();
+        cursor_x_ = 0;
+        cursor_y_ = 0;
+        std::uint32_t type = geometry::geometry<std::int64_t>::visit(f.geometry, geometry_writer { *this });
+        if (commands_.empty()) {
+            return false;
+        }
+        tags_.clear();
+        for (auto const& p : f.properties) {
+            value_.clear();
+            protozero::pbf_writer value(value_);
+            if (geometry::value::visit(p.second, value_writer { value })) {
+                tags_.push_back(key_index(p.first));
+                tags_.push_back(value_index());
+            }
+        }
+        protozero::pbf_writer layer(layer_);
+        protozero::pbf_writer feature(layer, layer_features);
+        if (f.id) {
+            std::uint64_t id = 0;
+            if (geometry::identifier::visit(*f.id, id_visitor { id })) {
+                feature.add_uint64(feature_id, id);
+            }
+        }
+        feature.add_packed_uint32(feature_tags, tags_.begin(), tags_.end());
+        feature.add_uint32(feature_type, type);
+        feature.add_packed_uint32(feature_geometry, commands_.begin(), commands_.end());
+        ++features_;
+        return true;
+    }
+
+    std::size_t features() const {
+        return features_;
+    }
+
+    // Appends a whole layer to the tile in buffer.
+    void encode(std::string & buffer, std::string const& name, geometry::feature_collection<std::int64_t> const& features) {
+        begin(name);
+        for (auto const& f : features) {
+            add(f);
+        }
+        finish(buffer);
+    }
+
+    // Appends the layer to the tile in buffer; a layer without features is
+    // left out like the batch encoder does.
+    void finish(std::string & buffer) {
+        if (features_ == 0) {
+            return;
+        }
+        {
+            protozero::pbf_writer layer(layer_);
+            for (auto key : key_order_) {
+                layer.add_string(layer_keys, *key);
+            }
+            for (auto value : value_order_) {
+                layer.add_message(layer_values, *value);
+            }
+            layer.add_uint32(layer_extent, extent_);
+            layer.add_uint32(layer_version, 2);
+        }
+        protozero::pbf_writer tile(buffer);
+        tile.add_message(tile_layers, layer_);
+        features_ = 0;
+    }
+
+private:
+    enum : protozero::pbf_tag_type {
+        tile_layers = 3,
+        layer_name = 1,
+        layer_features = 2,
+        layer_keys = 3,
+        layer_values = 4,
+        layer_extent = 5,
+        layer_version = 15,
+        feature_id = 1,
+        feature_tags = 2,
+        feature_type = 3,
+        feature_geometry = 4
+    };
+
+    enum : std::uint32_t {
+        command_move_to = 1,
+        command_line_to = 2,
+        command_close_path = 7
+    };
+
+    enum : std::uint32_t {
+        geom_unknown = 0,
+        geom_point = 1,
+        geom_line_string = 2,
+        geom_polygon = 3
+    };
+
+    struct value_writer {
+        protozero::pbf_writer & out;
+
+        bool operator() (std::string const& v) {
+            out.add_string(1, v);
+            return true;
+        }
+
+        bool operator() (double v) {
+            out.add_double(3, v);
+            return true;
+        }
+
+        bool operator() (std::int64_t v) {
+            out.add_sint64(6, v);
+            return true;
+        }
+
+        bool operator() (std::uint64_t v) {
+            out.add_uint64(5, v);
+            return true;
+        }
+
+        bool operator() (bool v) {
+            out.add_bool(7, v);
+            return true;
+        }
+
+        // null, lists and maps
+        template <typename T>
+        bool operator() (T const&) {
+            return false;
+        }
+    };
+
+    struct id_visitor {
+        std::uint64_t & id;
+
+        bool operator() (std::uint64_t v) {
+            id = v;
+            return true;
+        }
+
+        bool operator() (std::int64_t v) {
+            if (v < 0) {
+                return false;
+            }
+            id = static_cast<std::uint64_t>(v);
+            return true;
+        }
+
+        template <typename T>
+        bool operator() (T const&) {
+            return false;
+        }
+    };
+
+    struct geometry_writer {
+        streaming_layer_encoder & e;
+
+        std::uint32_t operator() (geometry::point<std::int64_t> const& pt) {
+            e.command(command_move_to, 1);
+            e.point(pt);
+            return geom_point;
+        }
+
+        std::uint32_t operator() (geometry::multi_point<std::int64_t> const& mp) {
+            if (mp.empty()) {
+                return geom_unknown;
+            }
+            e.command(command_move_to, mp.size());
+            for (auto const& pt : mp) {
+                e.point(pt);
+            }
+            return geom_point;
+        }
+
+        std::uint32_t operator() (geometry::line_string<std::int64_t> const& ls) {
+            e.line(ls);
+            return geom_line_string;
+        }
+
+        std::uint32_t operator() (geometry::multi_line_string<std::int64_t> const& mls) {
+            for (auto const& ls : mls) {
+                e.line(ls);
+            }
+            return geom_line_string;
+        }
+
+        std::uint32_t operator() (geometry::polygon<std::int64_t> const& poly) {
+            e.polygon(poly);
+            return geom_polygon;
+        }
+
+        std::uint32_t operator() (geometry::multi_polygon<std::int64_t> const& mp) {
+            for (auto const& poly : mp) {
+                e.polygon(poly);
+            }
+            return geom_polygon;
+        }
+
+        std::uint32_t operator() (geometry::geometry_collection<std::int64_t> const&) {
+            return geom_unknown;
+        }
+    };
+
+    void command(std::uint32_t id, std::size_t count) {
+        commands_.push_back((id & 0x7) | (static_cast<std::uint32_t>(count) << 3));
+    }
+
+    void point(geometry::point<std::int64_t> const& pt) {
+        commands_.push_back(protozero::encode_zigzag32(static_cast<std::int32_t>(pt.x - cursor_x_)));
+        commands_.push_back(protozero::encode_zigzag32(static_cast<std::int32_t>(pt.y - cursor_y_)));
+        cursor_x_ = pt.x;
+        cursor_y_ = pt.y;
+    }
+
+    template <typename Line>
+    void line(Line const& ls) {
+        if (ls.size() < 2) {
+            return;
+        }
+        command(command_move_to, 1);
+        point(ls.front());
+        command(command_line_to, ls.size() - 1);
+        for (std::size_t i = 1; i < ls.size(); ++i) {
+            point(ls[i]);
+        }
+    }
+
+    // Points of a ring without the closing one, which ClosePath implies.
+    template <typename Ring>
+    static std::size_t ring_size(Ring const& r) {
+        std::size_t size = r.size();
+        if (size > 1 && r.front() == r.back()) {
+            --size;
+        }
+        return size;
+    }
+
+    // Holes without an exterior would turn into exteriors of their own, so a
+    // polygon whose exterior has collapsed is left out whole.
+    template <typename Polygon>
+    void polygon(Polygon const& poly) {
+        if (poly.empty() || ring_size(poly.front()) < 3) {
+            return;
+        }
+        for (auto const& r : poly) {
+            ring(r);
+        }
+    }
+
+    template <typename Ring>
+    void ring(Ring const& r) {
+        std::size_t size = ring_size(r);
+        if (size < 3) {
+            return;
+        }
+        command(command_move_to, 1);
+        point(r.front());
+        command(command_line_to, size - 1);
+        for (std::size_t i = 1; i < size; ++i) {
+            point(r[i]);
+        }
+        command(command_close_path, 1);
+    }
+
+    std::uint32_t key_index(std::string const& key) {
+        auto k = keys_.find(key);
+        if (k != keys_.end()) {
+            return k->second;
+        }
+        std::uint32_t index = static_cast<std::uint32_t>(key_order_.size());
+        k = keys_.emplace(key, index).first;
+        key_order_.push_back(&k->first);
+        return index;
+    }
+
+    // Values are keyed by their encoded Value message, which is unique per
+    // type and value.
+    std::uint32_t value_index() {
+        auto v = values_.find(value_);
+        if (v != values_.end()) {
+            return v->second;
+        }
+        std::uint32_t index = static_cast<std::uint32_t>(value_order_.size());
+        v = values_.emplace(value_, index).first;
+        value_order_.push_back(&v->first);
+        return index;
+    }
+
+    std::uint32_t extent_;
+    std::string layer_;
+    std::size_t features_;
+    // node based maps, so the key pointers in *_order_ stay valid
+    std::unordered_map<std::string, std::uint32_t> keys_;
+    std::vector<std::string const*> key_order_;
+    std::unordered_map<std::string, std::uint32_t> values_;
+    std::vector<std::string const*> value_order_;
+    // scratch reused across features
+    std::string value_;
+    std::vector<std::uint32_t> tags_;
+    std::vector<std::uint32_t> commands_;
+    std::int64_t cursor_x_;
+    std::int64_t cursor_y_;
+};
+
+}}
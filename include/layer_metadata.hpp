@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <sstream>
+#include <string>
+
+namespace mapbox { namespace mrmvt {
+
+inline void quote(std::ostringstream & buf, std::string const& input) {
+    for (auto & ch : input) {
+        if (ch == '\\' || ch == '\"') {
+            buf << '\\';
+            buf << ch;
+        } else if (ch < ' ') {
+            char tmp[7];
+            sprintf(tmp, "\\u%04x", ch);
+			buf << tmp;
+        } else {
+			buf << ch;
+        }
+    }
+}
+
+enum json_field_type : std::uint8_t {
+    json_field_type_number = 0,
+    json_field_type_boolean,
+    json_field_type_string
+};
+
+struct layer_meta_data {
+    int min_zoom;
+    int max_zoom;
+    std::map<std::string, json_field_type> fields;
+};
+
+using layer_map_type = std::map<std::string, layer_meta_data>;
+
+inline std::string vector_layers_json(layer_map_type const& layermap) {
+	std::ostringstream buf;
+	buf << "{\"vector_layers\": [ ";  
+    
+	bool first = true;
+	for (auto const& ai : layermap) {
+		if (first) {
+			first = false;
+			buf << "{ \"id\": \"";
+		} else {
+			buf << ", { \"id\": \"";
+		}
+		quote(buf, ai.first);
+		buf << "\", \"description\": \"\", \"minzoom\": ";
+		buf << ai.second.min_zoom;
+		buf << ", \"maxzoom\": ";
+		buf << ai.second.max_zoom;
+        buf << ", \"fields\": {";
+		bool first_field = true;
+		for (auto const& j : ai.second.fields) {
+			if (first_field) {
+				first_field = false;
+				buf << "\"";
+			} else {
+				buf << ", \"";
+			}
+			quote(buf, j.first);
+            if (j.second == json_field_type_number) {
+                buf << "\": \"Number\"";
+            } else if (j.second == json_field_type_boolean) {
+                buf << "\": \"Boolean\"";
+            } else {
+                buf << "\": \"String\"";
+            }
+		}
+		buf << "} }";
+    }
+	buf << " ] }";
+	return buf.str();
+}
+
+}} // end ns
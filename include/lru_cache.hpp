@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace mapbox { namespace mrmvt {
+
+/*
+ * LRU cache split into independently locked shards. A key always maps to the
+ * same shard, so threads only contend when they touch the same slice of the
+ * key space, and each shard holds at most capacity / shards bytes. Values are
+ * handed out as shared pointers so an entry evicted by another thread stays
+ * valid for as long as a reader holds on to it.
+ */
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class sharded_lru_cache {
+public:
+    using value_ptr = std::shared_ptr<const Value>;
+
+    sharded_lru_cache(std::size_t capacity_bytes, std::size_t shard_count = 16) :
+        shards_(shard_count == 0 ? 1 : shard_count),
+        hits_(0),
+        misses_(0) {
+        std::size_t per_shard = capacity_bytes / shards_.size();
+        for (auto & s : shards_) {
+            s.capacity = per_shard;
+        }
+    }
+
+    value_ptr get(Key const& key) {
+        shard & s = shard_for(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto itr = s.index.find(key);
+        if (itr == s.index.end()) {
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            return value_ptr();
+        }
+        // move to the front of the recency list
+        s.entries.splice(s.entries.begin(), s.entries, itr->second);
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return itr->second->value;
+    }
+
+    void put(Key const& key, value_ptr value, std::size_t cost) {
+        shard & s = shard_for(key);
+        if (cost > s.capacity) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto itr = s.index.find(key);
+        if (itr != s.index.end()) {
+            s.size -= itr->second->cost;
+            s.entries.erase(itr->second);
+            s.index.erase(itr);
+        }
+        while (s.size + cost > s.capacity && !s.entries.empty()) {
+            auto & last = s.entries.back();
+            s.size -= last.cost;
+            s.index.erase(last.key);
+            s.entries.pop_back();
+        }
+        s.entries.push_front(entry { key, std::move(value), cost });
+        s.index.emplace(key, s.entries.begin());
+        s.size += cost;
+    }
+
+    // Bytes currently held, summed over the shards.
+    std::size_t size() {
+        std::size_t total = 0;
+        for (auto & s : shards_) {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            total += s.size;
+        }
+        return total;
+    }
+
+    std::uint64_t hits() const {
+        return hits_.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t misses() const {
+        return misses_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct entry {
+        Key key;
+        value_ptr value;
+        std::size_t cost;
+    };
+
+    struct shard {
+        std::mutex mutex;
+        std::list<entry> entries;
+        std::unordered_map<Key, typename std::list<entry>::iterator, Hash> index;
+        std::size_t size = 0;
+        std::size_t capacity = 0;
+    };
+
+    shard & shard_for(Key const& key) {
+        // mix the hash so sequential keys spread over all shards
+        std::uint64_t h = static_cast<std::uint64_t>(Hash()(key));
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return shards_[h % shards_.size()];
+    }
+
+    std::vector<shard> shards_;
+    std::atomic<std::uint64_t> hits_;
+    std::atomic<std::uint64_t> misses_;
+};
+
+}}
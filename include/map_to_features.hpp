@@ -9,6 +9,9 @@
 #include <rapidjson/writer.h>
 #pragma GCC diagnostic pop
 
+#include "property_table.hpp"
+#include "stats.hpp"
+
 #include <mapbox/geojson.hpp>
 
 #include <iostream>
@@ -59,10 +62,29 @@ void to_std_out(mapbox::geometry::feature<T> const& f, std::string const& layer_
     std::cout << layer_name << " " << mapbox::geojson::stringify<T>(f) << std::endl;
 }
 
+// With a property table, each feature's properties are moved into it first
+// and only their handle is written.
 template <typename T>
-void to_std_out(mapbox::geometry::feature_collection<T> const& fc, std::string const& layer_name) {
-    for (auto const& f : fc) {
+void to_std_out(mapbox::geometry::feature_collection<T> & fc,
+                std::string const& layer_name,
+                property_table_writer * properties = nullptr) {
+    stats_counters * stats = local_stats();
+    for (auto & f : fc) {
+        if (properties) {
+            properties->detach(f);
+        }
         to_std_out<T>(f, layer_name);
+        if (stats) {
+            std::uint64_t vertices = count_vertices(f.geometry);
+            layer_zoom_stats & s = stats->at(-1, layer_name);
+            ++s.features_in;
+            ++s.features_out;
+            s.vertices_in += vertices;
+            s.vertices_out += vertices;
+            ++stats->records_in;
+            ++stats->records_out;
+            stats_collector::instance().tick(*stats);
+        }
     }
 }
 
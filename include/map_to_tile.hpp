@@ -1,7 +1,11 @@
 #pragma once
 
+#include "arena.hpp"
 #include "tile_cover.hpp"
 #include "clip.hpp"
+#include "partition.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunknown-pragmas" // clang+gcc
@@ -16,52 +20,123 @@
 
 #include <iostream>
 #include <istream>
+#include <string>
+#include <utility>
 
 namespace mapbox { namespace mrmvt {
 
-inline void map_to_tile() {
+/*
+ * The tile list and tile cover work lists of a feature live in an arena that
+ * is rewound after each feature. Properties and id move into one output
+ * feature per input feature instead of being copied for every tile, and fill
+ * tiles borrow them through O(1) swaps into a feature that permanently holds
+ * the fill polygon.
+ */
+inline void map_to_tile(partition_options const& partitions = partition_options()) {
     std::int64_t buffer = 8;
-    geometry::polygon<std::int64_t> fill_geometry;
-    geometry::linear_ring<std::int64_t> fill_ring;
-    fill_ring.push_back({-buffer, 4095+buffer});
-    fill_ring.push_back({-buffer, -buffer});
-    fill_ring.push_back({4095+buffer, -buffer});
-    fill_ring.push_back({4095+buffer, 4095+buffer});
-    fill_ring.push_back({-buffer, 4095+buffer});
-    fill_geometry.push_back(fill_ring);
+    geometry::feature<std::int64_t> fill_feature { tile_fill_polygon(buffer) };
+    std::size_t fill_vertices = fill_feature.geometry.get<geometry::polygon<std::int64_t>>().front().size();
+    partition_writer writer(partitions);
+    monotonic_arena arena;
     
     // don't skip the whitespace while reading
     std::cin >> std::noskipws;
     std::string feature_str;
     std::string layer_name;
     std::string zoom_level;
+    stats_counters * stats = local_stats();
+    trace_recorder * tracer = trace_recorder::active();
+    std::string record;
+    auto write_record = [&](std::ostream & out, tile_cover::tile_coordinate const& t, geometry::feature<std::int64_t> const& f) {
+        record.clear();
+        record += zoom_level;
+        record += ',';
+        record += std::to_string(t.x);
+        record += ',';
+        record += std::to_string(t.y);
+        record += ' ';
+        record += layer_name;
+        record += ' ';
+        record += mapbox::geojson::stringify<std::int64_t>(f);
+        record += '\n';
+        out.write(record.data(), static_cast<std::streamsize>(record.size()));
+        if (stats) {
+            ++stats->records_out;
+            stats->bytes_written += record.size();
+        }
+    };
     while (std::getline(std::cin, zoom_level, ' ') && 
            std::getline(std::cin, layer_name, ' ') && 
            std::getline(std::cin, feature_str)) {
-        auto feature = geojson::parse_feature<std::int64_t>(feature_str);
-        auto tiles = tile_cover::get_tiles(feature.geometry, 4096);
+        arena_scope feature_scope(arena);
+        feature_trace feature_timer(tracer);
+        geometry::feature<std::int64_t> feature;
+        {
+            stats_scope timer(stats, stats_timer_parse);
+            trace_span span(tracer, "parse", "feature");
+            feature = geojson::parse_feature<std::int64_t>(feature_str);
+        }
+        tile_cover::arena_tile_coordinates tiles { arena_allocator<tile_cover::tile_coordinate>(arena) };
+        {
+            trace_span span(tracer, "cover", "feature");
+            tiles = tile_cover::get_tiles(feature.geometry, 4096, arena);
+        }
+        std::uint32_t z = static_cast<std::uint32_t>(std::stoul(zoom_level));
+        std::size_t vertices = stats || tracer ? count_vertices(feature.geometry) : 0;
+        layer_zoom_stats * s = nullptr;
+        if (stats) {
+            s = &stats->at(static_cast<int>(z), layer_name);
+            ++stats->records_in;
+            ++s->features_in;
+            s->vertices_in += vertices;
+            stats_collector::instance().tick(*stats);
+        }
+        geometry::feature<std::int64_t> f {
+            geometry::geometry<std::int64_t>(),
+            std::move(feature.properties),
+            std::move(feature.id)
+        };
         for (auto const& t : tiles) {
+            std::ostream & out = writer.stream(z, t.x, t.y);
             if (t.fill) {
-                geometry::feature<std::int64_t> f { 
-                    fill_geometry, 
-                    feature.properties, 
-                    feature.id
-                };
-                std::cout << zoom_level << "," << t.x << "," << t.y << " " << layer_name << " " << mapbox::geojson::stringify<std::int64_t>(f) << std::endl;
+                std::swap(fill_feature.properties, f.properties);
+                std::swap(fill_feature.id, f.id);
+                write_record(out, t, fill_feature);
+                std::swap(fill_feature.properties, f.properties);
+                std::swap(fill_feature.id, f.id);
+                if (s) {
+                    ++s->fill_tiles;
+                    ++s->features_out;
+                    s->vertices_out += fill_vertices;
+                }
             } else {
-                auto og = clip(feature.geometry, t.x, t.y, buffer);
+                optional_geometry og;
+                {
+                    stats_scope timer(stats, stats_timer_clip);
+                    trace_span span(tracer, "clip", "tile");
+                    span.args([&](std::ostringstream & buf) {
+                        buf << "\"z\":" << z << ",\"x\":" << t.x << ",\"y\":" << t.y;
+                    });
+                    og = clip(feature.geometry, t.x, t.y, buffer);
+                }
                 if (!og) {
+                    if (s) {
+                        ++s->empty_clips;
+                    }
                     continue;
                 }
-                geometry::feature<std::int64_t> f { 
-                    std::move(*og), 
-                    feature.properties, 
-                    feature.id
-                };
-                std::cout << zoom_level << "," << t.x << "," << t.y << " " << layer_name << " " << mapbox::geojson::stringify<std::int64_t>(f) << std::endl;
+                f.geometry = std::move(*og);
+                write_record(out, t, f);
+                if (s) {
+                    ++s->clipped_tiles;
+                    ++s->features_out;
+                    s->vertices_out += count_vertices(f.geometry);
+                }
             }
         }
+        feature_timer.finish(f, layer_name, static_cast<int>(z), vertices, tiles.size());
     }
+    writer.close();
 }
 
 
@@ -1,6 +1,11 @@
 #pragma once
 
+#include "cluster.hpp"
 #include "douglas_peucker.hpp"
+#include "projection.hpp"
+#include "property_table.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunknown-pragmas" // clang+gcc
@@ -14,18 +19,27 @@
 #include <mapbox/geojson.hpp>
 
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <istream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 namespace mapbox {
 namespace mrmvt {
 
-static const double R2D = 180.0 / M_PI;
-static const double MAX_LATITUDE = R2D * (2 * std::atan(std::exp(M_PI)) - (M_PI / 2.0));
+// Highest zoom the bindings accept. Tile coordinates at zoom z use z + 12
+// bits, and every zoom multiplies the tiles a polygon covers by four.
+static const std::uint32_t MAX_ZOOM = 24;
 
 struct to_tile_coord_visitor {
     double size;
     double simplify_distance;
+    // scratch buffers reused across lines and rings
+    std::vector<geometry::point<std::int64_t>> points;
+    std::vector<char> keep;
 
     geometry::point<std::int64_t> convert(geometry::point<double> const& pt) {
         std::int64_t x = 0;
@@ -47,18 +61,22 @@ struct to_tile_coord_visitor {
         return geometry::point<std::int64_t>(x, y);
     }
     
-    geometry::linear_ring<std::int64_t> convert(geometry::linear_ring<double> const& geom) {
-        geometry::linear_ring<std::int64_t> new_geom;
-        new_geom.reserve(geom.size());
+    // Projects into the points scratch buffer and simplifies there, so the
+    // result is allocated once at its final size.
+    template <typename Geometry, typename Input>
+    Geometry project_and_simplify(Input const& geom) {
+        points.clear();
         for (auto const& g : geom) {
-            new_geom.push_back(convert(g));
+            points.push_back(convert(g));
         }
-        if (new_geom.size() <= 4) {
-            return new_geom;
+        if (points.size() > 4) {
+            douglas_peucker_in_place<std::int64_t>(points, keep, simplify_distance);
         }
-        geometry::linear_ring<std::int64_t> simplified;
-        douglas_peucker<std::int64_t>(new_geom, std::back_inserter(simplified), simplify_distance);
-        return simplified;
+        return Geometry(points.begin(), points.end());
+    }
+
+    geometry::linear_ring<std::int64_t> convert(geometry::linear_ring<double> const& geom) {
+        return project_and_simplify<geometry::linear_ring<std::int64_t>>(geom);
     }
 
     geometry::polygon<std::int64_t> convert(geometry::polygon<double> const& geom) {
@@ -80,17 +98,7 @@ struct to_tile_coord_visitor {
     }
 
     geometry::line_string<std::int64_t> convert(geometry::line_string<double> const& geom) {
-        geometry::line_string<std::int64_t> new_geom;
-        new_geom.reserve(geom.size());
-        for (auto const& g : geom) {
-            new_geom.push_back(convert(g));
-        }
-        if (new_geom.size() <= 4) {
-            return new_geom;
-        }
-        geometry::line_string<std::int64_t> simplified;
-        douglas_peucker<std::int64_t>(new_geom, std::back_inserter(simplified), simplify_distance);
-        return simplified;
+        return project_and_simplify<geometry::line_string<std::int64_t>>(geom);
     }
 
     geometry::multi_line_string<std::int64_t> convert(geometry::multi_line_string<double> const& geom) {
@@ -126,12 +134,15 @@ struct to_tile_coord_visitor {
     }
 };
 
-inline geometry::geometry<std::int64_t> geom_to_zoom(geometry::geometry<double> g, 
+inline geometry::geometry<std::int64_t> geom_to_zoom(geometry::geometry<double> const& g,
                                                      std::size_t z,
                                                      std::size_t extent,
                                                      double simplify_distance) {
-    double size = extent * std::pow(2, z);
-    return geometry::geometry<double>::visit(g, to_tile_coord_visitor { size, simplify_distance });
+    // one visitor per thread, so its scratch buffers outlive the call
+    static thread_local to_tile_coord_visitor visitor { 0.0, 0.0, {}, {} };
+    visitor.size = extent * std::pow(2, z);
+    visitor.simplify_distance = simplify_distance;
+    return geometry::geometry<double>::visit(g, visitor);
 }
 
 inline void map_feature_to_zoom(std::string const& layer_name,
@@ -139,26 +150,165 @@ inline void map_feature_to_zoom(std::string const& layer_name,
                                 std::size_t min_z,
                                 std::size_t max_z,
                                 std::size_t extent = 4096,
+                                double simplify_distance = 4.0);
+
+inline void map_feature_to_zoom(std::string const& layer_name,
+                                geometry::feature<double> const& feature,
+                                std::size_t min_z,
+                                std::size_t max_z,
+                                std::size_t extent = 4096,
                                 double simplify_distance = 4.0) {
-    auto feature = geojson::parse_feature<double>(feature_str);
+    stats_counters * stats = local_stats();
+    trace_recorder * tracer = trace_recorder::active();
+    std::size_t vertices = stats || tracer ? count_vertices(feature.geometry) : 0;
+    // properties are copied once per feature, not once per zoom
+    geometry::feature<std::int64_t> f { 
+        geometry::geometry<std::int64_t>(),
+        feature.properties, 
+        feature.id
+    };
     for (auto z = min_z; z <= max_z; ++z) {
-        geometry::feature<std::int64_t> f { 
-            geom_to_zoom(feature.geometry, z, extent, simplify_distance), 
-            feature.properties, 
-            feature.id
-        };
+        feature_trace feature_timer(tracer);
+        {
+            // projection and simplification happen in one pass over the vertices
+            stats_scope timer(stats, stats_timer_project);
+            trace_span span(tracer, "project", "feature");
+            f.geometry = geom_to_zoom(feature.geometry, z, extent, simplify_distance);
+        }
         std::cout << z << " " << layer_name << " " << mapbox::geojson::stringify<std::int64_t>(f) << std::endl;
+        feature_timer.finish(feature, layer_name, static_cast<int>(z), vertices, 0);
+        if (stats) {
+            layer_zoom_stats & s = stats->at(static_cast<int>(z), layer_name);
+            ++s.features_in;
+            ++s.features_out;
+            s.vertices_in += vertices;
+            s.vertices_out += count_vertices(f.geometry);
+            ++stats->records_out;
+        }
+    }
+}
+
+inline void map_feature_to_zoom(std::string const& layer_name,
+                                std::string const& feature_str,
+                                std::size_t min_z,
+                                std::size_t max_z,
+                                std::size_t extent,
+                                double simplify_distance) {
+    stats_counters * stats = local_stats();
+    geometry::feature<double> feature;
+    {
+        stats_scope timer(stats, stats_timer_parse);
+        trace_span span(trace_recorder::active(), "parse", "feature");
+        feature = geojson::parse_feature<double>(feature_str);
+    }
+    map_feature_to_zoom(layer_name, feature, min_z, max_z, extent, simplify_distance);
+}
+
+// Point features of one layer, held back until the input is exhausted so
+// they can be clustered together.
+struct point_layer {
+    std::vector<geometry::point<double>> points;
+    std::vector<geometry::property_map> properties;
+    std::vector<decltype(geometry::feature<double>::id)> ids;
+};
+
+// One clustered or unclustered output point standing for `points` inputs.
+inline void count_point_output(stats_counters * stats, std::size_t z, std::string const& layer_name, std::size_t points) {
+    if (stats) {
+        layer_zoom_stats & s = stats->at(static_cast<int>(z), layer_name);
+        s.features_in += points;
+        s.vertices_in += points;
+        ++s.features_out;
+        ++s.vertices_out;
+        ++stats->records_out;
     }
 }
 
-inline void map_to_zoom(std::size_t min_z, std::size_t max_z) {
+inline void map_point_layer_to_zoom(std::string const& layer_name,
+                                    point_layer const& layer,
+                                    std::size_t min_z,
+                                    std::size_t max_z,
+                                    cluster_options const& options) {
+    stats_counters * stats = local_stats();
+    int cluster_max_z = options.max_zoom < 0 ? static_cast<int>(max_z) - 1 : std::min(options.max_zoom, static_cast<int>(max_z));
+    std::size_t unclustered_z = min_z;
+    if (cluster_max_z >= static_cast<int>(min_z)) {
+        point_clusters clusters(layer.points, &layer.properties, options, min_z, static_cast<std::size_t>(cluster_max_z));
+        for (auto z = min_z; z <= static_cast<std::size_t>(cluster_max_z); ++z) {
+            double size = options.extent * std::pow(2, z);
+            for (auto const& p : clusters.zoom(z)) {
+                if (p.is_cluster()) {
+                    geometry::feature<std::int64_t> f {
+                        cluster_to_tile_coord(p, size),
+                        clusters.cluster_properties(p)
+                    };
+                    f.id = geometry::identifier(p.id);
+                    std::cout << z << " " << layer_name << " " << mapbox::geojson::stringify<std::int64_t>(f) << std::endl;
+                    count_point_output(stats, z, layer_name, p.count);
+                } else {
+                    geometry::feature<std::int64_t> f {
+                        geom_to_zoom(layer.points[p.index], z, options.extent, 0.0),
+                        layer.properties[p.index],
+                        layer.ids[p.index]
+                    };
+                    std::cout << z << " " << layer_name << " " << mapbox::geojson::stringify<std::int64_t>(f) << std::endl;
+                    count_point_output(stats, z, layer_name, 1);
+                }
+            }
+        }
+        unclustered_z = static_cast<std::size_t>(cluster_max_z) + 1;
+    }
+    for (auto z = unclustered_z; z <= max_z; ++z) {
+        for (std::size_t i = 0; i < layer.points.size(); ++i) {
+            geometry::feature<std::int64_t> f {
+                geom_to_zoom(layer.points[i], z, options.extent, 0.0),
+                layer.properties[i],
+                layer.ids[i]
+            };
+            std::cout << z << " " << layer_name << " " << mapbox::geojson::stringify<std::int64_t>(f) << std::endl;
+            count_point_output(stats, z, layer_name, 1);
+        }
+    }
+}
+
+/*
+ * With clustering enabled, Point features are collected per layer and only
+ * written once the input ends, as clusters up to the cluster max zoom and as
+ * the original points above it. All other geometries stream through as usual.
+ * Points whose properties were moved to a table by m2f --properties are
+ * refused: a cluster can only keep one handle, so it would lose every
+ * property of its members, numeric sums included.
+ */
+inline void map_to_zoom(std::size_t min_z, std::size_t max_z, cluster_options const& cluster = cluster_options()) {
     // don't skip the whitespace while reading
     std::cin >> std::noskipws;
     
     std::string feature_str;
     std::string layer_name;
+    std::map<std::string, point_layer> point_layers;
+    stats_counters * stats = local_stats();
     while (std::getline(std::cin, layer_name, ' ') && std::getline(std::cin, feature_str)) {
-        map_feature_to_zoom(layer_name, feature_str, min_z, max_z);
+        if (stats) {
+            ++stats->records_in;
+            stats_collector::instance().tick(*stats);
+        }
+        if (!cluster.enabled) {
+            map_feature_to_zoom(layer_name, feature_str, min_z, max_z);
+            continue;
+        }
+        auto feature = geojson::parse_feature<double>(feature_str);
+        if (!feature.geometry.is<geometry::point<double>>()) {
+            map_feature_to_zoom(layer_name, feature, min_z, max_z, cluster.extent);
+            continue;
+        }
+        reject_property_handle(feature, "--cluster cannot aggregate properties written with m2f --properties, run m2f without --properties");
+        point_layer & layer = point_layers[layer_name];
+        layer.points.push_back(feature.geometry.get<geometry::point<double>>());
+        layer.properties.push_back(std::move(feature.properties));
+        layer.ids.push_back(std::move(feature.id));
+    }
+    for (auto const& layer : point_layers) {
+        map_point_layer_to_zoom(layer.first, layer.second, min_z, max_z, cluster);
     }
 }
 
@@ -0,0 +1,579 @@
+#pragma once
+
+#include "compress.hpp"
+#include "layer_metadata.hpp"
+#include "output_archive.hpp"
+#include "output_mbtiles.hpp"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunknown-pragmas" // clang+gcc
+#pragma GCC diagnostic ignored "-Wpragmas"         // gcc
+#pragma GCC diagnostic ignored "-Wexpansion-to-defined"
+#include <rapidjson/document.h>
+#pragma GCC diagnostic pop
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mapbox { namespace mrmvt {
+
+/*
+ * Merges MBTiles written by several reducers into one tileset. Inputs are
+ * read in (zoom, column, row) order through their unique tile index and
+ * k-way merged, so memory stays flat no matter how large the inputs are.
+ * A tile found in only one input is copied as stored when it already has
+ * the output compression. A tile found in several inputs is decompressed
+ * and its layers are concatenated; since a vector tile is just a sequence
+ * of layer fields this needs no decoding beyond reading layer names. Layers
+ * of the same name are merged into one: their features are copied as they
+ * are, except that the key and value indices of their tags are remapped to
+ * the merged layer's dictionaries.
+ */
+
+struct merge_summary {
+    std::size_t inputs = 0;
+    std::size_t tiles = 0;
+    std::size_t combined = 0;
+    std::size_t transcoded = 0;
+    std::size_t merged_layers = 0;
+};
+
+namespace detail {
+
+inline bool read_varint(const char *& data, const char * end, std::uint64_t & value) {
+    value = 0;
+    for (int shift = 0; data < end && shift < 64; shift += 7) {
+        std::uint8_t byte = static_cast<std::uint8_t>(*data++);
+        value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Skips a field of the given wire type. Returns false on malformed input.
+inline bool skip_field(const char *& data, const char * end, std::uint32_t wire_type) {
+    std::uint64_t value;
+    switch (wire_type) {
+        case 0:
+            return read_varint(data, end, value);
+        case 1:
+            data += 8;
+            return data <= end;
+        case 2:
+            if (!read_varint(data, end, value) || value > static_cast<std::uint64_t>(end - data)) {
+                return false;
+            }
+            data += value;
+            return true;
+        case 5:
+            data += 4;
+            return data <= end;
+        default:
+            return false;
+    }
+}
+
+// Name of a Tile.Layer message (field 1).
+inline std::string layer_name(const char * data, const char * end) {
+    while (data < end) {
+        std::uint64_t key;
+        if (!read_varint(data, end, key)) {
+            break;
+        }
+        if (key == ((1 << 3) | 2)) {
+            std::uint64_t length;
+            if (!read_varint(data, end, length) || length > static_cast<std::uint64_t>(end - data)) {
+                break;
+            }
+            return std::string(data, static_cast<std::size_t>(length));
+        }
+        if (!skip_field(data, end, static_cast<std::uint32_t>(key & 0x7))) {
+            break;
+        }
+    }
+    throw std::runtime_error("Merge Error: layer without a name");
+}
+
+inline void write_varint(std::string & out, std::uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+inline void write_bytes_field(std::string & out, std::uint32_t field, const char * data, std::size_t size) {
+    write_varint(out, (static_cast<std::uint64_t>(field) << 3) | 2);
+    write_varint(out, size);
+    out.append(data, size);
+}
+
+struct layer_slice {
+    const char * data;
+    const char * end;
+};
+
+// Reads a length delimited value at data, leaving data after it.
+inline layer_slice read_bytes(const char *& data, const char * end) {
+    std::uint64_t length;
+    if (!read_varint(data, end, length) || length > static_cast<std::uint64_t>(end - data)) {
+        throw std::runtime_error("Merge Error: malformed tile");
+    }
+    layer_slice slice { data, data + length };
+    data += length;
+    return slice;
+}
+
+/*
+ * Merges Tile.Layer messages of the same name. Keys and values are
+ * deduplicated by their encoded bytes; features keep all their fields and
+ * only get their tags rewritten.
+ */
+class layer_merger {
+public:
+    explicit layer_merger(std::string const& name) :
+        name_(name),
+        extent_(0),
+        version_(0),
+        features_(),
+        keys_(),
+        key_order_(),
+        values_(),
+        value_order_(),
+        key_map_(),
+        value_map_(),
+        tags_() {}
+
+    layer_merger(layer_merger const&) = delete;
+    layer_merger& operator=(layer_merger const&) = delete;
+
+    void add(layer_slice layer) {
+        std::uint64_t extent = 4096;
+        std::uint64_t version = 1;
+        std::vector<layer_slice> features;
+        key_map_.clear();
+        value_map_.clear();
+        const char * data = layer.data;
+        while (data < layer.end) {
+            std::uint64_t key;
+            if (!read_varint(data, layer.end, key)) {
+                throw std::runtime_error("Merge Error: malformed layer");
+            }
+            std::uint32_t field = static_cast<std::uint32_t>(key >> 3);
+            std::uint32_t wire_type = static_cast<std::uint32_t>(key & 0x7);
+            bool ok = true;
+            if (wire_type == 2 && field == 2) {
+                features.push_back(read_bytes(data, layer.end));
+            } else if (wire_type == 2 && field == 3) {
+                layer_slice k = read_bytes(data, layer.end);
+                key_map_.push_back(index_of(keys_, key_order_, std::string(k.data, k.end)));
+            } else if (wire_type == 2 && field == 4) {
+                layer_slice v = read_bytes(data, layer.end);
+                value_map_.push_back(index_of(values_, value_order_, std::string(v.data, v.end)));
+            } else if (wire_type == 0 && field == 5) {
+                ok = read_varint(data, layer.end, extent);
+            } else if (wire_type == 0 && field == 15) {
+                ok = read_varint(data, layer.end, version);
+            } else {
+                ok = skip_field(data, layer.end, wire_type);
+            }
+            if (!ok) {
+                throw std::runtime_error("Merge Error: malformed layer");
+            }
+        }
+        if (extent_ == 0) {
+            extent_ = extent;
+            version_ = version;
+        } else if (extent != extent_) {
+            std::ostringstream err;
+            err << "Merge Error: layer " << name_ << " has extents " << extent_ << " and " << extent;
+            throw std::runtime_error(err.str());
+        }
+        for (auto const& f : features) {
+            add_feature(f);
+        }
+    }
+
+    // Appends the merged layer as a Tile field 3.
+    void finish(std::string & out) const {
+        std::string layer;
+        write_bytes_field(layer, 1, name_.data(), name_.size());
+        layer += features_;
+        for (auto k : key_order_) {
+            write_bytes_field(layer, 3, k->data(), k->size());
+        }
+        for (auto v : value_order_) {
+            write_bytes_field(layer, 4, v->data(), v->size());
+        }
+        write_varint(layer, (5 << 3) | 0);
+        write_varint(layer, extent_);
+        write_varint(layer, (15 << 3) | 0);
+        write_varint(layer, version_);
+        write_bytes_field(out, 3, layer.data(), layer.size());
+    }
+
+private:
+    using dictionary = std::unordered_map<std::string, std::uint32_t>;
+
+    static std::uint32_t index_of(dictionary & dict, std::vector<std::string const*> & order, std::string && item) {
+        auto itr = dict.find(item);
+        if (itr == dict.end()) {
+            itr = dict.emplace(std::move(item), static_cast<std::uint32_t>(order.size())).first;
+            order.push_back(&itr->first);
+        }
+        return itr->second;
+    }
+
+    std::uint32_t remap(std::uint64_t index, std::vector<std::uint32_t> const& map) const {
+        if (index >= map.size()) {
+            std::ostringstream err;
+            err << "Merge Error: tag index out of range in layer " << name_;
+            throw std::runtime_error(err.str());
+        }
+        return map[static_cast<std::size_t>(index)];
+    }
+
+    void add_feature(layer_slice feature) {
+        std::string out;
+        tags_.clear();
+        const char * data = feature.data;
+        while (data < feature.end) {
+            const char * field_start = data;
+            std::uint64_t key;
+            if (!read_varint(data, feature.end, key)) {
+                throw std::runtime_error("Merge Error: malformed feature");
+            }
+            std::uint32_t field = static_cast<std::uint32_t>(key >> 3);
+            std::uint32_t wire_type = static_cast<std::uint32_t>(key & 0x7);
+            std::uint64_t tag;
+            if (field == 2 && wire_type == 2) {
+                layer_slice packed = read_bytes(data, feature.end);
+                while (packed.data < packed.end) {
+                    if (!read_varint(packed.data, packed.end, tag)) {
+                        throw std::runtime_error("Merge Error: malformed feature");
+                    }
+                    tags_.push_back(tag);
+                }
+            } else if (field == 2 && wire_type == 0) {
+                if (!read_varint(data, feature.end, tag)) {
+                    throw std::runtime_error("Merge Error: malformed feature");
+                }
+                tags_.push_back(tag);
+            } else {
+                if (!skip_field(data, feature.end, wire_type)) {
+                    throw std::runtime_error("Merge Error: malformed feature");
+                }
+                out.append(field_start, static_cast<std::size_t>(data - field_start));
+            }
+        }
+        if (tags_.size() % 2 != 0) {
+            std::ostringstream err;
+            err << "Merge Error: odd number of tags in layer " << name_;
+            throw std::runtime_error(err.str());
+        }
+        if (!tags_.empty()) {
+            std::string packed;
+            for (std::size_t i = 0; i < tags_.size(); i += 2) {
+                write_varint(packed, remap(tags_[i], key_map_));
+                write_varint(packed, remap(tags_[i + 1], value_map_));
+            }
+            write_bytes_field(out, 2, packed.data(), packed.size());
+        }
+        write_bytes_field(features_, 2, out.data(), out.size());
+    }
+
+    std::string name_;
+    std::uint64_t extent_;
+    std::uint64_t version_;
+    std::string features_; // encoded Layer.features fields
+    // node based maps, so the pointers in *_order_ stay valid
+    dictionary keys_;
+    std::vector<std::string const*> key_order_;
+    dictionary values_;
+    std::vector<std::string const*> value_order_;
+    // indices of the layer being added into the merged dictionaries
+    std::vector<std::uint32_t> key_map_;
+    std::vector<std::uint32_t> value_map_;
+    std::vector<std::uint64_t> tags_;
+};
+
+} // namespace detail
+
+/*
+ * Concatenates the layers (Tile field 3) of uncompressed tiles into `out`,
+ * keeping the order in which layer names first appear. A tile must not hold
+ * two layers with the same name, so same named layers are merged into one.
+ */
+inline void merge_tile_layers(std::vector<std::string> const& tiles,
+                              std::string & out,
+                              merge_summary & summary) {
+    std::vector<std::pair<std::string, std::vector<detail::layer_slice>>> layers;
+    std::map<std::string, std::size_t> index;
+    for (auto const& tile : tiles) {
+        const char * data = tile.data();
+        const char * end = data + tile.size();
+        while (data < end) {
+            std::uint64_t key;
+            if (!detail::read_varint(data, end, key)) {
+                throw std::runtime_error("Merge Error: malformed tile");
+            }
+            if (key != ((3 << 3) | 2)) {
+                if (!detail::skip_field(data, end, static_cast<std::uint32_t>(key & 0x7))) {
+                    throw std::runtime_error("Merge Error: malformed tile");
+                }
+                continue;
+            }
+            detail::layer_slice layer = detail::read_bytes(data, end);
+            std::string name = detail::layer_name(layer.data, layer.end);
+            auto itr = index.find(name);
+            if (itr == index.end()) {
+                index.emplace(name, layers.size());
+                layers.emplace_back(std::move(name), std::vector<detail::layer_slice> { layer });
+            } else {
+                layers[itr->second].second.push_back(layer);
+            }
+        }
+    }
+    for (auto const& layer : layers) {
+        if (layer.second.size() == 1) {
+            detail::layer_slice only = layer.second.front();
+            detail::write_bytes_field(out, 3, only.data, static_cast<std::size_t>(only.end - only.data));
+            continue;
+        }
+        ++summary.merged_layers;
+        detail::layer_merger merger(layer.first);
+        for (auto const& slice : layer.second) {
+            merger.add(slice);
+        }
+        merger.finish(out);
+    }
+}
+
+// Folds a `vector_layers` json document from MBTiles metadata into layer_map.
+inline void merge_vector_layers(layer_map_type & layer_map, std::string const& json) {
+    rapidjson::Document doc;
+    doc.Parse(json.c_str());
+    if (doc.HasParseError() || !doc.IsObject()) {
+        throw std::runtime_error("Merge Error: invalid json metadata");
+    }
+    auto layers = doc.FindMember("vector_layers");
+    if (layers == doc.MemberEnd() || !layers->value.IsArray()) {
+        return;
+    }
+    for (auto const& layer : layers->value.GetArray()) {
+        if (!layer.IsObject() || !layer.HasMember("id") || !layer["id"].IsString()) {
+            continue;
+        }
+        std::string id(layer["id"].GetString(), layer["id"].GetStringLength());
+        int min_zoom = layer.HasMember("minzoom") && layer["minzoom"].IsInt() ? layer["minzoom"].GetInt() : 0;
+        int max_zoom = layer.HasMember("maxzoom") && layer["maxzoom"].IsInt() ? layer["maxzoom"].GetInt() : min_zoom;
+        auto lm = layer_map.find(id);
+        if (lm == layer_map.end()) {
+            lm = layer_map.emplace(id, layer_meta_data { min_zoom, max_zoom, std::map<std::string, json_field_type>() }).first;
+        } else {
+            lm->second.min_zoom = std::min(lm->second.min_zoom, min_zoom);
+            lm->second.max_zoom = std::max(lm->second.max_zoom, max_zoom);
+        }
+        if (!layer.HasMember("fields") || !layer["fields"].IsObject()) {
+            continue;
+        }
+        for (auto const& field : layer["fields"].GetObject()) {
+            std::string name(field.name.GetString(), field.name.GetStringLength());
+            if (lm->second.fields.find(name) != lm->second.fields.end() || !field.value.IsString()) {
+                continue;
+            }
+            std::string type(field.value.GetString(), field.value.GetStringLength());
+            json_field_type t = json_field_type_string;
+            if (type == "Number") {
+                t = json_field_type_number;
+            } else if (type == "Boolean") {
+                t = json_field_type_boolean;
+            }
+            lm->second.fields.emplace(name, t);
+        }
+    }
+}
+
+// One input tileset, read in tile key order.
+class merge_input {
+public:
+    explicit merge_input(std::string const& path) :
+        path_(path),
+        db_(),
+        stmt_(),
+        z_(0),
+        x_(0),
+        row_(0),
+        done_(false) {
+        sqlite3 * db;
+        if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK) {
+            std::ostringstream err;
+            err << "SQLite Error: Failed to open " << path << " - " << sqlite3_errmsg(db) << std::endl;
+            sqlite3_close(db);
+            throw std::runtime_error(err.str());
+        }
+        db_.reset(db);
+        sqlite3_stmt * stmt;
+        const char * query = "select zoom_level, tile_column, tile_row, tile_data from tiles order by zoom_level, tile_column, tile_row";
+        if (sqlite3_prepare_v2(db_.get(), query, -1, &stmt, NULL) != SQLITE_OK) {
+            std::ostringstream err;
+            err << "SQLite Error: Tile select statement failed to create for " << path << ": " << sqlite3_errmsg(db_.get()) << std::endl;
+            throw std::runtime_error(err.str());
+        }
+        stmt_.reset(stmt);
+        next();
+    }
+
+    bool done() const {
+        return done_;
+    }
+
+    int z() const { return z_; }
+    int x() const { return x_; }
+    int row() const { return row_; }
+
+    const char * data() const {
+        return static_cast<const char*>(sqlite3_column_blob(stmt_.get(), 3));
+    }
+
+    std::size_t size() const {
+        return static_cast<std::size_t>(sqlite3_column_bytes(stmt_.get(), 3));
+    }
+
+    void next() {
+        if (sqlite3_step(stmt_.get()) != SQLITE_ROW) {
+            done_ = true;
+            return;
+        }
+        z_ = sqlite3_column_int(stmt_.get(), 0);
+        x_ = sqlite3_column_int(stmt_.get(), 1);
+        row_ = sqlite3_column_int(stmt_.get(), 2);
+    }
+
+    std::string metadata(std::string const& name) const {
+        sqlite3_stmt * stmt;
+        if (sqlite3_prepare_v2(db_.get(), "select value from metadata where name = ?", -1, &stmt, NULL) != SQLITE_OK) {
+            return std::string();
+        }
+        sqlite_stmt_ptr guard(stmt);
+        sqlite3_bind_text(stmt, 1, name.c_str(), static_cast<int>(name.size()), NULL);
+        if (sqlite3_step(stmt) != SQLITE_ROW) {
+            return std::string();
+        }
+        const char * text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        return text ? std::string(text) : std::string();
+    }
+
+    std::string const& path() const {
+        return path_;
+    }
+
+private:
+    std::string path_;
+    sqlite_ptr db_;
+    sqlite_stmt_ptr stmt_;
+    int z_;
+    int x_;
+    int row_;
+    bool done_;
+};
+
+/*
+ * Streams every tile of `inputs` into `stage` in key order and unions their
+ * layer metadata into `layer_map`.
+ */
+inline merge_summary merge_tiles(std::vector<std::string> const& inputs,
+                                 compression_stage & stage,
+                                 layer_map_type & layer_map) {
+    merge_summary summary;
+    summary.inputs = inputs.size();
+    std::vector<std::unique_ptr<merge_input>> sources;
+    for (auto const& path : inputs) {
+        sources.emplace_back(new merge_input(path));
+        std::string json = sources.back()->metadata("json");
+        if (!json.empty()) {
+            merge_vector_layers(layer_map, json);
+        }
+    }
+
+    using heap_entry = std::pair<std::array<int, 3>, std::size_t>;
+    std::priority_queue<heap_entry, std::vector<heap_entry>, std::greater<heap_entry>> heap;
+    for (std::size_t i = 0; i < sources.size(); ++i) {
+        if (!sources[i]->done()) {
+            heap.emplace(std::array<int, 3> {{ sources[i]->z(), sources[i]->x(), sources[i]->row() }}, i);
+        }
+    }
+
+    std::vector<std::size_t> same;
+    std::string tile;
+    std::string merged;
+    std::vector<std::string> tiles;
+    while (!heap.empty()) {
+        std::array<int, 3> key = heap.top().first;
+        same.clear();
+        while (!heap.empty() && heap.top().first == key) {
+            same.push_back(heap.top().second);
+            heap.pop();
+        }
+        int z = key[0];
+        int x = key[1];
+        int y = (1 << z) - 1 - key[2];
+        ++summary.tiles;
+        if (same.size() == 1) {
+            merge_input & in = *sources[same.front()];
+            compression_type stored = detect_compression(in.data(), in.size());
+            if (stored == stage.type()) {
+                stage.push_raw(z, x, y, std::string(in.data(), in.size()));
+            } else {
+                ++summary.transcoded;
+                decompress_tile(in.data(), in.size(), tile);
+                stage.push(z, x, y, std::move(tile));
+                tile.clear();
+            }
+        } else {
+            ++summary.combined;
+            // inputs in a stable order, so the layer order is stable too
+            std::sort(same.begin(), same.end());
+            merged.clear();
+            tiles.resize(same.size());
+            for (std::size_t j = 0; j < same.size(); ++j) {
+                decompress_tile(sources[same[j]]->data(), sources[same[j]]->size(), tiles[j]);
+            }
+            merge_tile_layers(tiles, merged, summary);
+            stage.push(z, x, y, std::move(merged));
+            merged.clear();
+        }
+        for (auto i : same) {
+            sources[i]->next();
+            if (!sources[i]->done()) {
+                heap.emplace(std::array<int, 3> {{ sources[i]->z(), sources[i]->x(), sources[i]->row() }}, i);
+            }
+        }
+    }
+    stage.finish();
+    return summary;
+}
+
+inline void print_merge_summary(std::ostream & out, merge_summary const& summary) {
+    out << "Merge: " << summary.tiles << " tiles from " << summary.inputs << " inputs, "
+        << summary.combined << " combined, "
+        << summary.transcoded << " recompressed, "
+        << summary.merged_layers << " same named layers merged" << std::endl;
+}
+
+}}
@@ -2,6 +2,8 @@
 
 #include <mapbox/geometry.hpp>
 
+#include <memory>
+
 #pragma GCC diagnostic push
 // #pragma GCC diagnostic ignored "-Wunused-parameter"
 // #pragma GCC diagnostic ignored "-Wshadow"
@@ -13,9 +15,12 @@
  * This is in a header file so we can access it across other .cpp files
  * if necessary
  */
+struct MapToZoomSource;
+
 class MapToZoom: public Nan::ObjectWrap {
     public:
-        MapToZoom(const char* json, std::size_t size);
+        explicit MapToZoom(std::shared_ptr<MapToZoomSource> source_);
+        ~MapToZoom();
         
         // initializer
         static void Initialize(v8::Handle<v8::Object> target);
@@ -24,14 +29,25 @@ class MapToZoom: public Nan::ObjectWrap {
         // methods required for the constructor
         static NAN_METHOD(New);
 
+        // parses the buffer in the threadpool
+        static NAN_METHOD(create);
+        static void AsyncCreate(uv_work_t* req);
+        static void AfterCreate(uv_work_t* req);
+
         // shout, custom async method
         static NAN_METHOD(execute);
         static void AsyncExecute(uv_work_t* req);
         static void AfterExecute(uv_work_t* req);
 
+        // all zooms of a range in one task, geometries as Buffers
+        static NAN_METHOD(executeRange);
+        static void AsyncExecuteRange(uv_work_t* req);
+        static void AfterExecuteRange(uv_work_t* req);
+
     private:
         // member variable
-        // specific to each instance of the class
-        mapbox::geometry::geometry<double> geom; 
+        // specific to each instance of the class, and shared with its running
+        // tasks so they keep the geometry alive if the object is collected
+        std::shared_ptr<MapToZoomSource> source;
 
 };
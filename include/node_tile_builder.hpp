@@ -0,0 +1,36 @@
+#pragma once
+
+#include "tile_builder.hpp"
+
+#pragma GCC diagnostic push
+// #pragma GCC diagnostic ignored "-Wunused-parameter"
+// #pragma GCC diagnostic ignored "-Wshadow"
+#include <nan.h>
+#pragma GCC diagnostic pop
+
+#include <string>
+
+/**
+ * TileBuilder class
+ * Runs the whole map, clip and encode pipeline in the threadpool
+ */
+class TileBuilder: public Nan::ObjectWrap {
+    public:
+        explicit TileBuilder(mapbox::mrmvt::tile_builder_options const& options_, std::string const& layer_);
+
+        // initializer
+        static void Initialize(v8::Handle<v8::Object> target);
+        static Nan::Persistent<v8::FunctionTemplate> constructor;
+
+        // methods required for the constructor
+        static NAN_METHOD(New);
+
+        // encodes the tiles of a zoom range
+        static NAN_METHOD(build);
+        static void AsyncBuild(uv_work_t* req);
+        static void AfterBuild(uv_work_t* req);
+
+    private:
+        mapbox::mrmvt::tile_builder_options options;
+        std::string layer;
+};
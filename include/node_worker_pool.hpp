@@ -0,0 +1,28 @@
+#pragma once
+
+#pragma GCC diagnostic push
+// #pragma GCC diagnostic ignored "-Wunused-parameter"
+// #pragma GCC diagnostic ignored "-Wshadow"
+#include <nan.h>
+#pragma GCC diagnostic pop
+
+/**
+ * WorkerPool
+ * The binding's own threads, so tiling neither competes with fs and dns for
+ * the four libuv threads nor is limited to them. Work is queued like with
+ * `uv_queue_work`: `work` runs on a pool thread and `after` on the main
+ * thread once it is done.
+ */
+class WorkerPool {
+    public:
+        using work_cb = void (*)(uv_work_t* req);
+        using after_work_cb = void (*)(uv_work_t* req);
+
+        // initializer, adds setWorkerPoolSize and workerPoolStats to the module
+        static void Initialize(v8::Handle<v8::Object> target);
+
+        static void QueueWork(uv_work_t* req, work_cb work, after_work_cb after);
+
+        static NAN_METHOD(setSize);
+        static NAN_METHOD(stats);
+};
@@ -0,0 +1,391 @@
+#pragma once
+
+#include "compress.hpp"
+#include "hilbert.hpp"
+#include "layer_metadata.hpp"
+#include "tile_hash.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mapbox { namespace mrmvt {
+
+/*
+ * Packed tile archive
+ *
+ * A write-once, single file alternative to MBTiles:
+ *
+ *   [archive_header][tile data][metadata json][padding][directory]
+ *
+ * Tile blobs are laid out in tile id order, where the tile id is the number
+ * of tiles on all lower zooms plus the position of the tile along the hilbert
+ * curve at its own zoom. The directory is an array of archive_entry sorted by
+ * tile id, so a lookup is a binary search and neighbouring tiles sit next to
+ * each other on disk. Identical blobs are stored once and shared by several
+ * entries. All integers are written in host byte order (little endian on
+ * every platform we build for).
+ */
+
+static const char ARCHIVE_MAGIC[8] = { 'M', 'R', 'M', 'V', 'T', 'P', 'K', '\0' };
+static const std::uint32_t ARCHIVE_VERSION = 1;
+
+struct archive_header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint8_t compression;
+    std::uint8_t reserved[3];
+    std::uint64_t tile_count;
+    std::uint64_t data_offset;
+    std::uint64_t data_length;
+    std::uint64_t metadata_offset;
+    std::uint64_t metadata_length;
+    std::uint64_t directory_offset;
+    std::uint64_t directory_length;
+};
+
+struct archive_entry {
+    std::uint64_t tile_id;
+    std::uint64_t offset; // relative to data_offset
+    std::uint32_t length;
+    std::uint32_t reserved;
+};
+
+static_assert(sizeof(archive_header) == 72, "archive_header must be packed");
+static_assert(sizeof(archive_entry) == 24, "archive_entry must be packed");
+
+inline bool operator< (archive_entry const& a, archive_entry const& b) {
+    return a.tile_id < b.tile_id;
+}
+
+// Number of tiles on all zoom levels below z: (4^z - 1) / 3
+inline std::uint64_t zoom_tile_id_base(std::uint32_t z) {
+    return ((static_cast<std::uint64_t>(1) << (2 * z)) - 1) / 3;
+}
+
+inline std::uint64_t zxy_to_tile_id(std::uint32_t z, std::uint32_t x, std::uint32_t y) {
+    return zoom_tile_id_base(z) + hilbert_xy_to_d(z, x, y);
+}
+
+inline void tile_id_to_zxy(std::uint64_t tile_id, std::uint32_t & z, std::uint32_t & x, std::uint32_t & y) {
+    z = 0;
+    while (z < 31 && zoom_tile_id_base(z + 1) <= tile_id) {
+        ++z;
+    }
+    std::uint64_t hx;
+    std::uint64_t hy;
+    hilbert_d_to_xy(z, tile_id - zoom_tile_id_base(z), hx, hy);
+    x = static_cast<std::uint32_t>(hx);
+    y = static_cast<std::uint32_t>(hy);
+}
+
+inline std::string archive_metadata_json(std::string const& name,
+                                         int minzoom,
+                                         int maxzoom,
+                                         layer_map_type const& layermap,
+                                         std::string const& compression) {
+    std::ostringstream buf;
+    buf << "{\"name\": \"";
+    quote(buf, name);
+    buf << "\", \"format\": \"pbf\", \"minzoom\": " << minzoom;
+    buf << ", \"maxzoom\": " << maxzoom;
+    buf << ", \"compression\": \"";
+    quote(buf, compression);
+    buf << "\", \"json\": \"";
+    quote(buf, vector_layers_json(layermap));
+    buf << "\"}";
+    return buf.str();
+}
+
+/*
+ * Tiles may arrive in any order, so blobs are first spooled to a temporary
+ * file next to the output. close() sorts the directory by tile id and copies
+ * the blobs into their final hilbert ordered position.
+ */
+class archive_writer {
+public:
+    archive_writer(std::string const& path, compression_type compression) :
+        path_(path),
+        spool_path_(path + ".spool"),
+        compression_(compression),
+        spool_(spool_path_, std::ios::binary | std::ios::trunc),
+        spool_size_(0),
+        entries_(),
+        blobs_(),
+        metadata_() {
+        if (!spool_) {
+            std::ostringstream err;
+            err << "Archive Error: Failed to open " << spool_path_;
+            throw std::runtime_error(err.str());
+        }
+    }
+
+    // The spool is only a temporary, also when writing failed half way.
+    ~archive_writer() {
+        if (spool_.is_open()) {
+            spool_.close();
+        }
+        std::remove(spool_path_.c_str());
+    }
+
+    archive_writer(archive_writer const&) = delete;
+    archive_writer& operator=(archive_writer const&) = delete;
+
+    void write_tile(int z, int x, int y, const char * data, std::size_t size) {
+        std::string hash = tile_hash(data, size);
+        auto itr = blobs_.find(hash);
+        std::uint64_t offset;
+        if (itr == blobs_.end()) {
+            offset = spool_size_;
+            spool_.write(data, static_cast<std::streamsize>(size));
+            if (!spool_) {
+                throw std::runtime_error("Archive Error: failed writing tile to spool");
+            }
+            spool_size_ += size;
+            blobs_.emplace(std::move(hash), offset);
+        } else {
+            offset = itr->second;
+        }
+        entries_.push_back(archive_entry {
+            zxy_to_tile_id(static_cast<std::uint32_t>(z), static_cast<std::uint32_t>(x), static_cast<std::uint32_t>(y)),
+            offset,
+            static_cast<std::uint32_t>(size),
+            0 });
+    }
+
+    void write_metadata(std::string const& json) {
+        metadata_ = json;
+    }
+
+    void close() {
+        spool_.close();
+        std::sort(entries_.begin(), entries_.end());
+
+        std::ifstream spool(spool_path_, std::ios::binary);
+        std::ofstream out(path_, std::ios::binary | std::ios::trunc);
+        if (!spool || !out) {
+            std::ostringstream err;
+            err << "Archive Error: Failed to open " << path_;
+            throw std::runtime_error(err.str());
+        }
+
+        archive_header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+        header.version = ARCHIVE_VERSION;
+        header.compression = compression_;
+        header.tile_count = entries_.size();
+        header.data_offset = sizeof(archive_header);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        // Copy blobs in directory order, remapping spool offsets to their final
+        // position. A shared blob is only copied the first time it is reached.
+        std::unordered_map<std::uint64_t, std::uint64_t> moved;
+        std::uint64_t data_length = 0;
+        std::string blob;
+        for (auto & e : entries_) {
+            auto itr = moved.find(e.offset);
+            if (itr != moved.end()) {
+                e.offset = itr->second;
+                continue;
+            }
+            blob.resize(e.length);
+            spool.seekg(static_cast<std::streamoff>(e.offset));
+            spool.read(&blob[0], static_cast<std::streamsize>(e.length));
+            if (!spool || spool.gcount() != static_cast<std::streamsize>(e.length)) {
+                std::ostringstream err;
+                err << "Archive Error: failed reading tile from " << spool_path_;
+                throw std::runtime_error(err.str());
+            }
+            out.write(blob.data(), static_cast<std::streamsize>(blob.size()));
+            moved.emplace(e.offset, data_length);
+            e.offset = data_length;
+            data_length += e.length;
+        }
+        header.data_length = data_length;
+
+        header.metadata_offset = header.data_offset + data_length;
+        header.metadata_length = metadata_.size();
+        out.write(metadata_.data(), static_cast<std::streamsize>(metadata_.size()));
+
+        // the reader maps the directory as an array of archive_entry
+        std::uint64_t end = header.metadata_offset + header.metadata_length;
+        std::uint64_t align = alignof(archive_entry);
+        header.directory_offset = (end + align - 1) / align * align;
+        static const char padding[alignof(archive_entry)] = {};
+        out.write(padding, static_cast<std::streamsize>(header.directory_offset - end));
+        header.directory_length = entries_.size() * sizeof(archive_entry);
+        out.write(reinterpret_cast<const char*>(entries_.data()), static_cast<std::streamsize>(header.directory_length));
+
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!out) {
+            std::ostringstream err;
+            err << "Archive Error: failed writing " << path_;
+            throw std::runtime_error(err.str());
+        }
+        out.close();
+        if (!out) {
+            std::ostringstream err;
+            err << "Archive Error: failed writing " << path_;
+            throw std::runtime_error(err.str());
+        }
+        spool.close();
+        std::remove(spool_path_.c_str());
+    }
+
+private:
+    std::string path_;
+    std::string spool_path_;
+    compression_type compression_;
+    std::ofstream spool_;
+    std::uint64_t spool_size_;
+    std::vector<archive_entry> entries_;
+    std::unordered_map<std::string, std::uint64_t> blobs_;
+    std::string metadata_;
+};
+
+struct tile_view {
+    const char * data;
+    std::size_t size;
+
+    explicit operator bool() const {
+        return data != nullptr;
+    }
+};
+
+/*
+ * Read only view of a packed archive. The file is mapped once and lookups
+ * return pointers into the mapping, so no tile data is ever copied. Lookups
+ * are const and safe to call from many threads at once.
+ */
+class archive_reader {
+public:
+    explicit archive_reader(std::string const& path) :
+        fd_(-1),
+        map_(nullptr),
+        size_(0),
+        header_(nullptr),
+        entries_(nullptr),
+        entry_count_(0) {
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) {
+            std::ostringstream err;
+            err << "Archive Error: Failed to open " << path;
+            throw std::runtime_error(err.str());
+        }
+        struct stat st;
+        if (::fstat(fd_, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(archive_header)) {
+            ::close(fd_);
+            std::ostringstream err;
+            err << "Archive Error: " << path << " is not a tile archive";
+            throw std::runtime_error(err.str());
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        void * addr = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (addr == MAP_FAILED) {
+            ::close(fd_);
+            std::ostringstream err;
+            err << "Archive Error: Failed to map " << path;
+            throw std::runtime_error(err.str());
+        }
+        map_ = static_cast<const char*>(addr);
+        header_ = reinterpret_cast<const archive_header*>(map_);
+        if (std::memcmp(header_->magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 ||
+            header_->version != ARCHIVE_VERSION ||
+            !within(header_->directory_offset, header_->directory_length, size_) ||
+            !within(header_->metadata_offset, header_->metadata_length, size_) ||
+            !within(header_->data_offset, header_->data_length, size_) ||
+            header_->directory_offset % alignof(archive_entry) != 0 ||
+            header_->directory_length % sizeof(archive_entry) != 0) {
+            invalid(path);
+        }
+        entries_ = reinterpret_cast<const archive_entry*>(map_ + header_->directory_offset);
+        entry_count_ = header_->directory_length / sizeof(archive_entry);
+        // checked once here so get_tile never points outside the tile data
+        for (std::size_t i = 0; i < entry_count_; ++i) {
+            if (!within(entries_[i].offset, entries_[i].length, header_->data_length)) {
+                invalid(path);
+            }
+        }
+        ::madvise(const_cast<char*>(map_) + header_->directory_offset, header_->directory_length, MADV_WILLNEED);
+    }
+
+    ~archive_reader() {
+        release();
+    }
+
+    archive_reader(archive_reader const&) = delete;
+    archive_reader& operator=(archive_reader const&) = delete;
+
+    tile_view get_tile(std::uint32_t z, std::uint32_t x, std::uint32_t y) const {
+        archive_entry key { zxy_to_tile_id(z, x, y), 0, 0, 0 };
+        const archive_entry * end = entries_ + entry_count_;
+        const archive_entry * itr = std::lower_bound(entries_, end, key);
+        if (itr == end || itr->tile_id != key.tile_id) {
+            return tile_view { nullptr, 0 };
+        }
+        return tile_view { map_ + header_->data_offset + itr->offset, itr->length };
+    }
+
+    compression_type compression() const {
+        return static_cast<compression_type>(header_->compression);
+    }
+
+    std::string metadata() const {
+        return std::string(map_ + header_->metadata_offset, header_->metadata_length);
+    }
+
+    std::size_t size() const {
+        return entry_count_;
+    }
+
+    archive_entry const& entry(std::size_t i) const {
+        return entries_[i];
+    }
+
+private:
+    // Whether [offset, offset + length) fits in size, without overflowing.
+    static bool within(std::uint64_t offset, std::uint64_t length, std::uint64_t size) {
+        return length <= size && offset <= size - length;
+    }
+
+    void invalid(std::string const& path) {
+        release();
+        std::ostringstream err;
+        err << "Archive Error: " << path << " is not a valid tile archive";
+        throw std::runtime_error(err.str());
+    }
+
+    void release() {
+        if (map_) {
+            ::munmap(const_cast<char*>(map_), size_);
+            map_ = nullptr;
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    int fd_;
+    const char * map_;
+    std::size_t size_;
+    const archive_header * header_;
+    const archive_entry * entries_;
+    std::size_t entry_count_;
+};
+
+}}
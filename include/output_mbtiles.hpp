@@ -1,5 +1,8 @@
 #pragma once
 
+#include "layer_metadata.hpp"
+#include "tile_hash.hpp"
+
 #include <sqlite3.h>
 
 #include <cstdlib>
@@ -26,9 +29,32 @@ using sqlite_stmt_ptr = std::unique_ptr<sqlite3_stmt, close_stmt>;
 
 struct sqlite_db {
     sqlite_ptr db;
-    sqlite_stmt_ptr tile_stmt;
+    sqlite_stmt_ptr map_stmt;
+    sqlite_stmt_ptr image_stmt;
+    std::size_t pending_writes = 0; // tile writes in the open transaction
 };
 
+// Tile writes are grouped into transactions of this many tiles, so sqlite
+// syncs the journal once per batch instead of once per tile.
+static const std::size_t MBTILES_BATCH_SIZE = 10000;
+
+inline void mbtiles_exec(sqlite_db const& db, const char * sql) {
+    char *err;
+    if (sqlite3_exec(db.db.get(), sql, NULL, NULL, &err) != SQLITE_OK) {
+        std::ostringstream err_msg;
+        err_msg << "SQLite Error: " << sql << " failed: " << err << std::endl;
+        sqlite3_free(err);
+        throw std::runtime_error(err_msg.str());
+    }
+}
+
+inline void mbtiles_commit(sqlite_db & db) {
+    if (db.pending_writes > 0) {
+        mbtiles_exec(db, "COMMIT;");
+        db.pending_writes = 0;
+    }
+}
+
 inline sqlite_db mbtiles_open(std::string const& dbname) {
     
     sqlite3 *db;
@@ -60,9 +86,17 @@ inline sqlite_db mbtiles_open(std::string const& dbname) {
         err << "SQLite Error: Metadata Table Creation error: " << err_msg << std::endl;
         throw std::runtime_error(err.str());
     }
-    if (sqlite3_exec(outdb.get(), "CREATE TABLE tiles (zoom_level integer, tile_column integer, tile_row integer, tile_data blob);", NULL, NULL, &err_msg) != SQLITE_OK) {
+    // Tiles are stored deduplicated by content: `images` holds each distinct
+    // blob once keyed by its hash, `map` points every z/x/y at a blob, and the
+    // `tiles` view keeps the file readable as a plain MBTiles.
+    if (sqlite3_exec(outdb.get(), "CREATE TABLE map (zoom_level integer, tile_column integer, tile_row integer, tile_id text);", NULL, NULL, &err_msg) != SQLITE_OK) {
         std::ostringstream err;
-        err << "SQLite Error: Tiles Table Creation error: " << err_msg << std::endl;
+        err << "SQLite Error: Map Table Creation error: " << err_msg << std::endl;
+        throw std::runtime_error(err.str());
+    }
+    if (sqlite3_exec(outdb.get(), "CREATE TABLE images (tile_data blob, tile_id text);", NULL, NULL, &err_msg) != SQLITE_OK) {
+        std::ostringstream err;
+        err << "SQLite Error: Images Table Creation error: " << err_msg << std::endl;
         throw std::runtime_error(err.str());
     }
     if (sqlite3_exec(outdb.get(), "create unique index name on metadata (name);", NULL, NULL, &err_msg) != SQLITE_OK) {
@@ -70,71 +104,81 @@ inline sqlite_db mbtiles_open(std::string const& dbname) {
         err << "SQLite Error: Metadata Index Creation error: " << err_msg << std::endl;
         throw std::runtime_error(err.str());
     }
-    if (sqlite3_exec(outdb.get(), "create unique index tile_index on tiles (zoom_level, tile_column, tile_row);", NULL, NULL, &err_msg) != SQLITE_OK) {
+    if (sqlite3_exec(outdb.get(), "create unique index map_index on map (zoom_level, tile_column, tile_row);", NULL, NULL, &err_msg) != SQLITE_OK) {
+        std::ostringstream err;
+        err << "SQLite Error: Map Index Creation error: " << err_msg << std::endl;
+        throw std::runtime_error(err.str());
+    }
+    if (sqlite3_exec(outdb.get(), "create unique index images_id on images (tile_id);", NULL, NULL, &err_msg) != SQLITE_OK) {
         std::ostringstream err;
-        err << "SQLite Error: Tiles Index Creation error: " << err_msg << std::endl;
+        err << "SQLite Error: Images Index Creation error: " << err_msg << std::endl;
+        throw std::runtime_error(err.str());
+    }
+    if (sqlite3_exec(outdb.get(), "CREATE VIEW tiles AS SELECT map.zoom_level AS zoom_level, map.tile_column AS tile_column, map.tile_row AS tile_row, images.tile_data AS tile_data FROM map JOIN images ON images.tile_id = map.tile_id;", NULL, NULL, &err_msg) != SQLITE_OK) {
+        std::ostringstream err;
+        err << "SQLite Error: Tiles View Creation error: " << err_msg << std::endl;
         throw std::runtime_error(err.str());
     }
 
-    // Construct tile insertion prepared statement
+    // Construct tile insertion prepared statements
     sqlite3_stmt *stmt;
-    const char *query = "insert into tiles (zoom_level, tile_column, tile_row, tile_data) values (?, ?, ?, ?)";
-    if (sqlite3_prepare_v2(outdb.get(), query, -1, &stmt, NULL) != SQLITE_OK) {
+    const char *map_query = "insert into map (zoom_level, tile_column, tile_row, tile_id) values (?, ?, ?, ?)";
+    if (sqlite3_prepare_v2(outdb.get(), map_query, -1, &stmt, NULL) != SQLITE_OK) {
+        std::ostringstream err;
+        err << "SQLite Error: Map prepared statement failed to create." << std::endl;
+        throw std::runtime_error(err.str());
+    }
+    sqlite_stmt_ptr map_stmt(stmt);
+    const char *image_query = "insert or ignore into images (tile_data, tile_id) values (?, ?)";
+    if (sqlite3_prepare_v2(outdb.get(), image_query, -1, &stmt, NULL) != SQLITE_OK) {
         std::ostringstream err;
-        err << "SQLite Error: Tile prepared statement failed to create." << std::endl;
+        err << "SQLite Error: Image prepared statement failed to create." << std::endl;
         throw std::runtime_error(err.str());
     }
-    sqlite_stmt_ptr tile_stmt(stmt);
-    return { std::move(outdb), std::move(tile_stmt) };
+    sqlite_stmt_ptr image_stmt(stmt);
+    return { std::move(outdb), std::move(map_stmt), std::move(image_stmt) };
 }
 
-void mbtiles_write_tile(sqlite_db const& db, int z, int x, int y, const char *data, int size) {
-    sqlite3_stmt *stmt = db.tile_stmt.get();
+void mbtiles_write_tile(sqlite_db & db, int z, int x, int y, const char *data, int size) {
+    std::string tile_id = tile_hash(data, static_cast<std::size_t>(size));
+    if (db.pending_writes >= MBTILES_BATCH_SIZE) {
+        mbtiles_commit(db);
+    }
+    if (db.pending_writes == 0) {
+        mbtiles_exec(db, "BEGIN;");
+    }
+    ++db.pending_writes;
+
+    // Identical blobs hash to the same tile_id, so the image row is only
+    // written the first time that content is seen.
+    sqlite3_stmt *stmt = db.image_stmt.get();
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    sqlite3_bind_blob(stmt, 1, data, size, NULL);
+    sqlite3_bind_text(stmt, 2, tile_id.c_str(), static_cast<int>(tile_id.size()), NULL);
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        std::cerr << "SQLite Error: image insert failed: " << sqlite3_errmsg(db.db.get()) << std::endl;
+        return;
+    }
+
+    stmt = db.map_stmt.get();
     sqlite3_reset(stmt);
     sqlite3_clear_bindings(stmt);
     sqlite3_bind_int(stmt, 1, z);
     sqlite3_bind_int(stmt, 2, x);
     sqlite3_bind_int(stmt, 3, (1 << z) - 1 - y);
-    sqlite3_bind_blob(stmt, 4, data, size, NULL);
+    sqlite3_bind_text(stmt, 4, tile_id.c_str(), static_cast<int>(tile_id.size()), NULL);
     if (sqlite3_step(stmt) != SQLITE_DONE) {
         std::cerr << "SQLite Error: tile insert failed: " << sqlite3_errmsg(db.db.get()) << std::endl;
     }
 }
 
-inline void quote(std::ostringstream & buf, std::string const& input) {
-    for (auto & ch : input) {
-        if (ch == '\\' || ch == '\"') {
-            buf << '\\';
-            buf << ch;
-        } else if (ch < ' ') {
-            char tmp[7];
-            sprintf(tmp, "\\u%04x", ch);
-			buf << tmp;
-        } else {
-			buf << ch;
-        }
-    }
-}
-
-enum json_field_type : std::uint8_t {
-    json_field_type_number = 0,
-    json_field_type_boolean,
-    json_field_type_string
-};
-
-struct layer_meta_data {
-    int min_zoom;
-    int max_zoom;
-    std::map<std::string, json_field_type> fields;
-};
-
-using layer_map_type = std::map<std::string, layer_meta_data>;
-
 void mbtiles_write_metadata(sqlite_db const& db,
 							std::string const& fname, 
 							int minzoom,
 							int maxzoom,
-							layer_map_type const &layermap) {
+							layer_map_type const &layermap,
+							std::string const& compression) {
     char *sql, *err;
 
     sql = sqlite3_mprintf("INSERT INTO metadata (name, value) VALUES ('name', %Q);", fname.c_str());
@@ -222,45 +266,18 @@ void mbtiles_write_metadata(sqlite_db const& db,
     }
     sqlite3_free(sql);
 
-	std::ostringstream buf;
-	buf << "{\"vector_layers\": [ ";  
-    
-	bool first = true;
-	for (auto const& ai : layermap) {
-		if (first) {
-			first = false;
-			buf << "{ \"id\": \"";
-		} else {
-			buf << ", { \"id\": \"";
-		}
-		quote(buf, ai.first);
-		buf << "\", \"description\": \"\", \"minzoom\": ";
-		buf << ai.second.min_zoom;
-		buf << ", \"maxzoom\": ";
-		buf << ai.second.max_zoom;
-        buf << ", \"fields\": {";
-		bool first_field = true;
-		for (auto const& j : ai.second.fields) {
-			if (first_field) {
-				first_field = false;
-				buf << "\"";
-			} else {
-				buf << ", \"";
-			}
-			quote(buf, j.first);
-            if (j.second == json_field_type_number) {
-                buf << "\": \"Number\"";
-            } else if (j.second == json_field_type_boolean) {
-                buf << "\": \"Boolean\"";
-            } else {
-                buf << "\": \"String\"";
-            }
-		}
-		buf << "} }";
+    sql = sqlite3_mprintf("INSERT INTO metadata (name, value) VALUES ('compression', %Q);", compression.c_str());
+    if (sqlite3_exec(db.db.get(), sql, NULL, NULL, &err) != SQLITE_OK) {
+        sqlite3_free(sql);
+        std::ostringstream err_msg;
+        err_msg << "SQLite Error: failed to set compression in metadata: " << err << std::endl;
+        throw std::runtime_error(err_msg.str());
     }
-	buf << " ] }";
+    sqlite3_free(sql);
+
+    std::string json = vector_layers_json(layermap);
 
-    sql = sqlite3_mprintf("INSERT INTO metadata (name, value) VALUES ('json', %Q);", buf.str().c_str());
+    sql = sqlite3_mprintf("INSERT INTO metadata (name, value) VALUES ('json', %Q);", json.c_str());
     if (sqlite3_exec(db.db.get(), sql, NULL, NULL, &err) != SQLITE_OK) {
         sqlite3_free(sql);
         std::ostringstream err_msg;
@@ -270,9 +287,11 @@ void mbtiles_write_metadata(sqlite_db const& db,
     sqlite3_free(sql);
 }
 
-void mbtiles_close(sqlite_db const& db) {
+void mbtiles_close(sqlite_db & db) {
     char *err;
 
+    mbtiles_commit(db);
+
     if (sqlite3_exec(db.db.get(), "ANALYZE;", NULL, NULL, &err) != SQLITE_OK) {
         std::ostringstream err_msg;
         err_msg << "SQLite Error: analyze failed: " << err << std::endl;
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace mapbox { namespace mrmvt {
+
+/*
+ * Checked parsing of command line values. The whole value must be a number
+ * within [min, max], anything else throws, so a typo never silently becomes
+ * 0 and a negative count never wraps around to a huge unsigned one.
+ */
+inline long long parse_integer_arg(const char * flag, const char * value, long long min, long long max) {
+    char * end = nullptr;
+    errno = 0;
+    long long n = std::strtoll(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || n < min || n > max) {
+        std::ostringstream err;
+        err << "Invalid value for " << flag << ": " << value << " (expected an integer from " << min << " to " << max << ")";
+        throw std::runtime_error(err.str());
+    }
+    return n;
+}
+
+inline double parse_double_arg(const char * flag, const char * value, double min, double max) {
+    char * end = nullptr;
+    errno = 0;
+    double n = std::strtod(value, &end);
+    if (errno != 0 || end == value || *end != '\0' || !std::isfinite(n) || n < min || n > max) {
+        std::ostringstream err;
+        err << "Invalid value for " << flag << ": " << value << " (expected a number from " << min << " to " << max << ")";
+        throw std::runtime_error(err.str());
+    }
+    return n;
+}
+
+inline std::size_t parse_thread_count(const char * value) {
+    char * end = nullptr;
+    errno = 0;
+    long n = std::strtol(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || n < 1) {
+        std::ostringstream err;
+        err << "Invalid thread count: " << value;
+        throw std::runtime_error(err.str());
+    }
+    return static_cast<std::size_t>(n);
+}
+
+}}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "hilbert.hpp"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace mapbox { namespace mrmvt {
+
+enum partition_scheme : std::uint8_t {
+    partition_hash = 0,
+    partition_range
+};
+
+inline partition_scheme parse_partition_scheme(std::string const& name) {
+    if (name == "hash") {
+        return partition_hash;
+    } else if (name == "range") {
+        return partition_range;
+    }
+    std::ostringstream err;
+    err << "Unknown partition scheme: " << name;
+    throw std::runtime_error(err.str());
+}
+
+// Every partition keeps its file open, so stay well under common fd limits.
+static const std::size_t MAX_PARTITIONS = 1000;
+
+struct partition_options {
+    std::size_t partitions = 0; // 0 writes everything to stdout
+    std::string output_dir;
+    partition_scheme scheme = partition_hash;
+};
+
+// splitmix64 finalizer, spreads neighbouring tiles over all partitions
+inline std::uint64_t mix_tile_key(std::uint64_t k) {
+    k += 0x9e3779b97f4a7c15ULL;
+    k = (k ^ (k >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    k = (k ^ (k >> 27)) * 0x94d049bb133111ebULL;
+    return k ^ (k >> 31);
+}
+
+/*
+ * Partition of a tile. Every record of a tile maps to the same partition, so
+ * each partition can be sorted and reduced on its own. "hash" balances load
+ * regardless of where the data is. "range" cuts the hilbert curve of every
+ * zoom into equal spans, so each partition is one spatially compact region
+ * per zoom and partitions can be merged by simply concatenating tilesets.
+ */
+inline std::size_t tile_partition(std::uint32_t z,
+                                  std::uint32_t x,
+                                  std::uint32_t y,
+                                  std::size_t partitions,
+                                  partition_scheme scheme) {
+    if (partitions <= 1) {
+        return 0;
+    }
+    if (scheme == partition_range) {
+        std::uint64_t d = hilbert_xy_to_d(z, x, y);
+        double fraction = static_cast<double>(d) / static_cast<double>(static_cast<std::uint64_t>(1) << (2 * z));
+        std::size_t p = static_cast<std::size_t>(fraction * static_cast<double>(partitions));
+        return p < partitions ? p : partitions - 1;
+    }
+    std::uint64_t key = (static_cast<std::uint64_t>(z) << 58) |
+                        (static_cast<std::uint64_t>(x) << 29) |
+                        static_cast<std::uint64_t>(y);
+    return static_cast<std::size_t>(mix_tile_key(key) % partitions);
+}
+
+inline std::string partition_path(std::string const& dir, std::size_t partition) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "part-%05zu", partition);
+    if (dir.empty() || dir.back() == '/') {
+        return dir + name;
+    }
+    return dir + "/" + name;
+}
+
+/*
+ * Routes m2t records to one file per partition under output_dir, or to
+ * stdout when no partitions are requested.
+ */
+class partition_writer {
+public:
+    explicit partition_writer(partition_options const& options) :
+        options_(options),
+        files_() {
+        if (options_.partitions == 0) {
+            return;
+        }
+        if (options_.output_dir.empty()) {
+            throw std::runtime_error("Partition Error: --partitions requires --output-dir");
+        }
+        if (::mkdir(options_.output_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+            std::ostringstream err;
+            err << "Partition Error: Failed to create " << options_.output_dir;
+            throw std::runtime_error(err.str());
+        }
+        for (std::size_t i = 0; i < options_.partitions; ++i) {
+            std::string path = partition_path(options_.output_dir, i);
+            std::unique_ptr<std::ofstream> out(new std::ofstream(path, std::ios::binary | std::ios::trunc));
+            if (!*out) {
+                std::ostringstream err;
+                err << "Partition Error: Failed to open " << path;
+                throw std::runtime_error(err.str());
+            }
+            files_.push_back(std::move(out));
+        }
+    }
+
+    std::ostream & stream(std::uint32_t z, std::uint32_t x, std::uint32_t y) {
+        if (files_.empty()) {
+            return std::cout;
+        }
+        return *files_[tile_partition(z, x, y, files_.size(), options_.scheme)];
+    }
+
+    void close() {
+        for (std::size_t i = 0; i < files_.size(); ++i) {
+            files_[i]->close();
+            if (!*files_[i]) {
+                std::ostringstream err;
+                err << "Partition Error: failed writing " << partition_path(options_.output_dir, i);
+                throw std::runtime_error(err.str());
+            }
+        }
+        files_.clear();
+        std::cout.flush();
+    }
+
+private:
+    partition_options options_;
+    std::vector<std::unique_ptr<std::ofstream>> files_;
+};
+
+}}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cmath>
+
+namespace mapbox { namespace mrmvt {
+
+static const double R2D = 180.0 / M_PI;
+static const double MAX_LATITUDE = R2D * (2 * std::atan(std::exp(M_PI)) - (M_PI / 2.0));
+
+// World coordinates are web mercator scaled to [0, 1] with y pointing down,
+// matching the tile coordinates produced by to_tile_coord_visitor.
+inline double lon_to_world_x(double lon) {
+    if (lon > 180.0) {
+        return 1.0;
+    } else if (lon < -180.0) {
+        return 0.0;
+    }
+    return (lon + 180.0) / 360.0;
+}
+
+inline double lat_to_world_y(double lat) {
+    if (lat > MAX_LATITUDE) {
+        return 0.0;
+    } else if (lat < -MAX_LATITUDE) {
+        return 1.0;
+    }
+    return 1.0 - (std::log(std::tan((90.0 + lat) * (M_PI / 360.0))) + M_PI) / (2.0 * M_PI);
+}
+
+}}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <mapbox/geometry.hpp>
+#include <mapbox/geojson.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace mapbox { namespace mrmvt {
+
+/*
+ * Property side table
+ *
+ * With `m2f --properties PATH` the properties of every feature are written
+ * once to PATH and the feature only carries a handle to them, so m2z, m2t and
+ * the sort move a few bytes per record instead of all the attributes once per
+ * zoom and tile. `r2mvt --properties PATH` puts the properties back before
+ * encoding.
+ *
+ * The table is one line per feature, a GeoJSON feature with a placeholder
+ * point geometry, so properties go through the same geojson parser as inline
+ * ones. The handle is the byte offset of the line, kept in the "@h" property
+ * as a string. Clusters cannot carry the properties of all their members
+ * through one handle, so m2z --cluster refuses handle-carrying points, and
+ * so does every tool that would otherwise encode the handle as a property:
+ * mvt-index, mvt-server and r2mvt without --properties.
+ *
+ * Handles are only unique within one table. Several m2f runs whose output is
+ * concatenated, one per layer for instance, share a table with
+ * `m2f --properties-append PATH`, which continues the handles after what the
+ * table already holds.
+ */
+static constexpr const char * PROPERTY_HANDLE_KEY = "@h";
+
+// Throws `message` when f carries a handle, for tools that have no table to
+// resolve it with.
+template <typename T>
+inline void reject_property_handle(geometry::feature<T> const& f, const char * message) {
+    if (f.properties.find(PROPERTY_HANDLE_KEY) != f.properties.end()) {
+        std::ostringstream err;
+        err << "Property Table Error: " << message;
+        throw std::runtime_error(err.str());
+    }
+}
+
+class property_table_writer {
+public:
+    // With `append`, lines are added after those of an existing table and
+    // handles continue from its size.
+    explicit property_table_writer(std::string const& path, bool append = false) :
+        path_(path),
+        out_(path, std::ios::binary | (append ? std::ios::app : std::ios::trunc)),
+        offset_(0) {
+        if (!out_) {
+            std::ostringstream err;
+            err << "Property Table Error: Failed to open " << path_;
+            throw std::runtime_error(err.str());
+        }
+        if (append) {
+            struct stat st;
+            if (::stat(path_.c_str(), &st) != 0) {
+                std::ostringstream err;
+                err << "Property Table Error: Failed to stat " << path_;
+                throw std::runtime_error(err.str());
+            }
+            offset_ = static_cast<std::uint64_t>(st.st_size);
+        }
+    }
+
+    // Moves the properties of f into the table, leaving only their handle.
+    template <typename T>
+    void detach(geometry::feature<T> & f) {
+        if (f.properties.empty()) {
+            return;
+        }
+        geometry::feature<T> record { geometry::point<T>(0, 0), std::move(f.properties) };
+        std::string line = geojson::stringify<T>(record);
+        line += '\n';
+        if (!out_.write(line.data(), static_cast<std::streamsize>(line.size()))) {
+            std::ostringstream err;
+            err << "Property Table Error: failed writing " << path_;
+            throw std::runtime_error(err.str());
+        }
+        f.properties = geometry::property_map();
+        f.properties.emplace(PROPERTY_HANDLE_KEY, std::to_string(offset_));
+        offset_ += line.size();
+    }
+
+    void close() {
+        out_.close();
+        if (!out_) {
+            std::ostringstream err;
+            err << "Property Table Error: failed writing " << path_;
+            throw std::runtime_error(err.str());
+        }
+    }
+
+private:
+    std::string path_;
+    std::ofstream out_;
+    std::uint64_t offset_;
+};
+
+// Memory mapped, read only view of a table written by property_table_writer.
+class property_table {
+public:
+    explicit property_table(std::string const& path) :
+        fd_(-1),
+        map_(nullptr),
+        size_(0) {
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) {
+            std::ostringstream err;
+            err << "Property Table Error: Failed to open " << path;
+            throw std::runtime_error(err.str());
+        }
+        struct stat st;
+        if (::fstat(fd_, &st) != 0) {
+            release();
+            std::ostringstream err;
+            err << "Property Table Error: Failed to stat " << path;
+            throw std::runtime_error(err.str());
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        if (size_ == 0) {
+            // no feature had properties, nothing to map
+            return;
+        }
+        void * addr = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+        if (addr == MAP_FAILED) {
+            release();
+            std::ostringstream err;
+            err << "Property Table Error: Failed to map " << path;
+            throw std::runtime_error(err.str());
+        }
+        map_ = static_cast<const char*>(addr);
+    }
+
+    ~property_table() {
+        release();
+    }
+
+    property_table(property_table const&) = delete;
+    property_table& operator=(property_table const&) = delete;
+
+    // Replaces a handle in f.properties with the properties it stands for.
+    // Features without a handle are left alone.
+    template <typename T>
+    void attach(geometry::feature<T> & f) const {
+        auto h = f.properties.find(PROPERTY_HANDLE_KEY);
+        if (h == f.properties.end()) {
+            return;
+        }
+        if (!h->second.template is<std::string>()) {
+            throw std::runtime_error("Property Table Error: handle is not a string");
+        }
+        std::string const& handle = h->second.template get<std::string>();
+        char * end = nullptr;
+        errno = 0;
+        unsigned long long offset = std::strtoull(handle.c_str(), &end, 10);
+        if (errno != 0 || end == handle.c_str() || *end != '\0' || offset >= size_) {
+            std::ostringstream err;
+            err << "Property Table Error: handle " << handle << " is out of range";
+            throw std::runtime_error(err.str());
+        }
+        const char * line = map_ + offset;
+        const char * eol = static_cast<const char*>(std::memchr(line, '\n', size_ - offset));
+        std::size_t length = eol ? static_cast<std::size_t>(eol - line) : size_ - offset;
+        geometry::feature<T> record = geojson::parse_feature<T>(std::string(line, length));
+        f.properties = std::move(record.properties);
+    }
+
+private:
+    void release() {
+        if (map_) {
+            ::munmap(const_cast<char*>(map_), size_);
+            map_ = nullptr;
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    int fd_;
+    const char * map_;
+    std::size_t size_;
+};
+
+}}
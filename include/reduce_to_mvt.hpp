@@ -1,6 +1,15 @@
 #pragma once
 
+#include "compress.hpp"
+#include "layer_encoder.hpp"
+#include "merge_tiles.hpp"
+#include "output_archive.hpp"
 #include "output_mbtiles.hpp"
+#include "parse_args.hpp"
+#include "property_table.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "tile_budget.hpp"
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunknown-pragmas" // clang+gcc
@@ -13,11 +22,12 @@
 
 #include <mapbox/geometry.hpp>
 #include <mapbox/geojson.hpp>
-#include <mapbox/vector_tile/encode_layer.hpp>
 
 #include <cmath>
+#include <cstdlib>
 #include <iostream>
 #include <istream>
+#include <memory>
 #include <sstream>
 #include <stdexcept>
 
@@ -69,32 +79,85 @@ inline void add_to_layer_map(layer_map_type & layer_map,
     }
 }
 
+inline geometry::feature<std::int64_t> parse_tile_feature(layer_map_type & layer_map,
+                                                         std::string const& layer_name,
+                                                         int z,
+                                                         std::string const& feature_str,
+                                                         stats_counters * stats = nullptr,
+                                                         property_table const* properties = nullptr) {
+    geometry::feature<std::int64_t> feature;
+    {
+        stats_scope timer(stats, stats_timer_parse);
+        trace_span span(trace_recorder::active(), "parse", "feature");
+        feature = geojson::parse_feature<std::int64_t>(feature_str);
+        if (properties) {
+            properties->attach(feature);
+        } else {
+            reject_property_handle(feature, "records written with m2f --properties need r2mvt --properties");
+        }
+    }
+    add_to_layer_map(layer_map, layer_name, z, feature);
+    if (stats) {
+        layer_zoom_stats & s = stats->at(z, layer_name);
+        ++s.features_in;
+        s.vertices_in += count_vertices(feature.geometry);
+    }
+    return feature;
+}
+
 inline void encode_tile_feature(layer_map_type & layer_map,
                                 std::string const& layer_name,
                                 int z,
                                 std::string const& feature_str,
-                                geometry::feature_collection<std::int64_t> & features) {
-    auto feature = geojson::parse_feature<std::int64_t>(feature_str);
-    add_to_layer_map(layer_map, layer_name, z, feature);
-    features.push_back(feature);
+                                geometry::feature_collection<std::int64_t> & features,
+                                stats_counters * stats = nullptr,
+                                property_table const* properties = nullptr) {
+    features.push_back(parse_tile_feature(layer_map, layer_name, z, feature_str, stats, properties));
+}
+
+// Encodes a feature straight into the layer being streamed.
+inline void stream_tile_feature(layer_map_type & layer_map,
+                                std::string const& layer_name,
+                                int z,
+                                std::string const& feature_str,
+                                streaming_layer_encoder & encoder,
+                                std::uint64_t & encode_ns,
+                                stats_counters * stats = nullptr,
+                                property_table const* properties = nullptr) {
+    geometry::feature<std::int64_t> feature = parse_tile_feature(layer_map, layer_name, z, feature_str, stats, properties);
+    bool encoded = false;
+    {
+        stats_scope timer(stats, stats_timer_encode, &encode_ns);
+        encoded = encoder.add(feature);
+    }
+    if (stats && encoded) {
+        layer_zoom_stats & s = stats->at(z, layer_name);
+        ++s.features_out;
+        s.vertices_out += count_vertices(feature.geometry);
+    }
 }
 
-inline void encode_tile_layer(std::string & buffer,
-                              std::string const& layer_name,
-                              geometry::feature_collection<std::int64_t> & features) {
-    if (!features.empty()) {
-        mapbox::vector_tile::encode_layer(buffer, layer_name, features);
+// Counts the features that made it into a tile's layer.
+inline void count_encoded_features(stats_counters * stats,
+                                   int z,
+                                   std::string const& layer_name,
+                                   geometry::feature_collection<std::int64_t> const& features) {
+    if (stats) {
+        layer_zoom_stats & s = stats->at(z, layer_name);
+        s.features_out += features.size();
+        for (auto const& f : features) {
+            s.vertices_out += count_vertices(f.geometry);
+        }
     }
-    features.clear();
 }
 
-inline void encode_vector_tile(sqlite_db const& db,
+inline void encode_vector_tile(compression_stage & stage,
                                std::string & buffer,
                                int z,
                                int x, 
                                int y) {
     if (!buffer.empty()) {
-        mbtiles_write_tile(db, z, x, y, buffer.c_str(), buffer.size());
+        stage.push(z, x, y, std::move(buffer));
     }
     buffer.clear();
 }
@@ -132,11 +195,46 @@ inline void find_min_max_zoom(layer_map_type const& layer_map,
     }
 }
 
-inline void reduce_to_mvt(std::string const& db_name) {
+enum output_format : std::uint8_t {
+    output_format_mbtiles = 0,
+    output_format_archive
+};
+
+inline output_format parse_output_format(std::string const& name) {
+    if (name == "mbtiles") {
+        return output_format_mbtiles;
+    } else if (name == "archive") {
+        return output_format_archive;
+    }
+    std::ostringstream err;
+    err << "Unknown output format: " << name;
+    throw std::runtime_error(err.str());
+}
+
+struct reduce_options {
+    compression_type compression = compression_gzip;
+    std::size_t threads = std::thread::hardware_concurrency();
+    output_format format = output_format_mbtiles;
+    tile_budget budget;
+    std::string properties; // property table written by m2f --properties, if any
+};
+
+// Writers run on whichever thread compressed the tile, so this counts into
+// that thread's counters.
+inline void count_tile_written(std::string const& data) {
+    stats_counters * stats = local_stats();
+    if (stats) {
+        ++stats->tiles_written;
+        stats->bytes_written += data.size();
+    }
+}
+
+inline void reduce_stream(compression_stage & stage,
+                          layer_map_type & layer_map,
+                          tile_budget const& budget,
+                          property_table const* properties = nullptr) {
     // don't skip the whitespace while reading
     std::cin >> std::noskipws;
-    layer_map_type layer_map;
-    auto db = mbtiles_open(db_name);
     int z = 0;
     int x = 0;
     int y = 0;
@@ -147,28 +245,167 @@ inline void reduce_to_mvt(std::string const& db_name) {
     std::string current_zxy;
     std::string buffer;
     geometry::feature_collection<std::int64_t> features;
+    // With a budget, whole tiles are held back until all of their layers are
+    // known; otherwise each feature is encoded into its layer as it arrives,
+    // so memory does not grow with the number of features in a layer.
+    bool budgeted = budget.enabled();
+    tile_layers layers;
+    budget_summary summary;
+    streaming_layer_encoder encoder;
+    bool layer_started = false;
+    // encode time of the layer being streamed, one sample per layer
+    std::uint64_t encode_ns = 0;
+    stats_counters * stats = local_stats();
+    auto finish_layer = [&]() {
+        if (!budgeted) {
+            if (layer_started) {
+                trace_span span(trace_recorder::active(), "encode", "tile");
+                span.args([&](std::ostringstream & buf) {
+                    buf << "\"layer\":\"";
+                    quote(buf, current_layer_name);
+                    buf << "\",\"z\":" << z << ",\"features\":" << encoder.features();
+                });
+                {
+                    stats_scope timer(stats, stats_timer_encode, &encode_ns);
+                    encoder.finish(buffer);
+                }
+                if (stats) {
+                    stats->timers[stats_timer_encode].add(encode_ns);
+                }
+                encode_ns = 0;
+                layer_started = false;
+            }
+        } else if (!features.empty()) {
+            layers.emplace_back(current_layer_name, std::move(features));
+            features.clear();
+        }
+    };
+    auto finish_tile = [&]() {
+        if (budgeted && !layers.empty()) {
+            {
+                stats_scope timer(stats, stats_timer_encode);
+                trace_span span(trace_recorder::active(), "encode", "tile");
+                span.args([&](std::ostringstream & buf) {
+                    buf << "\"z\":" << z << ",\"x\":" << x << ",\"y\":" << y << ",\"layers\":" << layers.size();
+                });
+                encode_budgeted_tile(buffer, layers, budget, summary, z, x, y);
+            }
+            for (auto const& layer : layers) {
+                count_encoded_features(stats, z, layer.first, layer.second);
+            }
+            layers.clear();
+        }
+        if (stats && !buffer.empty()) {
+            ++stats->records_out;
+        }
+        encode_vector_tile(stage, buffer, z, x, y);
+    };
     while (std::getline(std::cin, zxy_str, ' ') && 
            std::getline(std::cin, layer_name, ' ') && 
            std::getline(std::cin, feature_str)) {
         if (zxy_str != current_zxy) {
-            encode_tile_layer(buffer, current_layer_name, features);
+            finish_layer();
             current_layer_name = layer_name;
-            encode_vector_tile(db, buffer, z, x, y);
+            finish_tile();
             current_zxy = zxy_str;
             set_z_x_y(zxy_str, z, x, y);
         } else if (current_layer_name != layer_name) {
-            encode_tile_layer(buffer, current_layer_name, features);
+            finish_layer();
             current_layer_name = layer_name;
         }
-        encode_tile_feature(layer_map, current_layer_name, z, feature_str, features);
+        if (budgeted) {
+            encode_tile_feature(layer_map, current_layer_name, z, feature_str, features, stats, properties);
+        } else {
+            if (!layer_started) {
+                encoder.begin(current_layer_name);
+                layer_started = true;
+            }
+            stream_tile_feature(layer_map, current_layer_name, z, feature_str, encoder, encode_ns, stats, properties);
+        }
+        if (stats) {
+            ++stats->records_in;
+            stats_collector::instance().tick(*stats);
+        }
+    }
+    finish_layer();
+    finish_tile();
+    stage.finish();
+    if (budgeted) {
+        print_budget_summary(std::cerr, summary);
     }
-    encode_tile_layer(buffer, current_layer_name, features);
-    encode_vector_tile(db, buffer, z, x, y);
+}
+
+inline void reduce_to_mvt(std::string const& db_name, reduce_options const& options = reduce_options()) {
+    compression_type compression = options.compression;
+    std::size_t threads = options.threads;
+    layer_map_type layer_map;
     int min_zoom = std::numeric_limits<int>::max();
     int max_zoom = std::numeric_limits<int>::min();
+    tile_budget budget = options.budget;
+    budget.compression = compression;
+    std::unique_ptr<property_table> properties;
+    if (!options.properties.empty()) {
+        properties.reset(new property_table(options.properties));
+    }
+    if (options.format == output_format_archive) {
+        archive_writer archive(db_name, compression);
+        compression_stage stage(compression, threads, [&archive](int tz, int tx, int ty, std::string const& data) {
+            archive.write_tile(tz, tx, ty, data.data(), data.size());
+            count_tile_written(data);
+        });
+        reduce_stream(stage, layer_map, budget, properties.get());
+        find_min_max_zoom(layer_map, min_zoom, max_zoom);
+        archive.write_metadata(archive_metadata_json(db_name, min_zoom, max_zoom, layer_map, compression_name(compression)));
+        archive.close();
+        return;
+    }
+    auto db = mbtiles_open(db_name);
+    compression_stage stage(compression, threads, [&db](int tz, int tx, int ty, std::string const& data) {
+        mbtiles_write_tile(db, tz, tx, ty, data.data(), static_cast<int>(data.size()));
+        count_tile_written(data);
+    });
+    reduce_stream(stage, layer_map, budget, properties.get());
     find_min_max_zoom(layer_map, min_zoom, max_zoom);
-    mbtiles_write_metadata(db, db_name, min_zoom, max_zoom, layer_map);
+    mbtiles_write_metadata(db, db_name, min_zoom, max_zoom, layer_map, compression_name(compression));
     mbtiles_close(db);
 }
 
+// Merges partial MBTiles from several reducers into db_name. The inputs are
+// already encoded, so a property table cannot be applied to them any more.
+inline void merge_to_mvt(std::string const& db_name,
+                         std::vector<std::string> const& inputs,
+                         reduce_options const& options = reduce_options()) {
+    if (!options.properties.empty()) {
+        throw std::runtime_error("Property Table Error: --properties cannot be combined with --merge, pass it to the reducers that wrote the inputs");
+    }
+    compression_type compression = options.compression;
+    std::size_t threads = options.threads;
+    layer_map_type layer_map;
+    int min_zoom = std::numeric_limits<int>::max();
+    int max_zoom = std::numeric_limits<int>::min();
+    merge_summary summary;
+    if (options.format == output_format_archive) {
+        archive_writer archive(db_name, compression);
+        compression_stage stage(compression, threads, [&archive](int tz, int tx, int ty, std::string const& data) {
+            archive.write_tile(tz, tx, ty, data.data(), data.size());
+            count_tile_written(data);
+        });
+        summary = merge_tiles(inputs, stage, layer_map);
+        find_min_max_zoom(layer_map, min_zoom, max_zoom);
+        archive.write_metadata(archive_metadata_json(db_name, min_zoom, max_zoom, layer_map, compression_name(compression)));
+        archive.close();
+    } else {
+        auto db = mbtiles_open(db_name);
+        compression_stage stage(compression, threads, [&db](int tz, int tx, int ty, std::string const& data) {
+            mbtiles_write_tile(db, tz, tx, ty, data.data(), static_cast<int>(data.size()));
+            count_tile_written(data);
+        });
+        summary = merge_tiles(inputs, stage, layer_map);
+        find_min_max_zoom(layer_map, min_zoom, max_zoom);
+        mbtiles_write_metadata(db, db_name, min_zoom, max_zoom, layer_map, compression_name(compression));
+        mbtiles_close(db);
+    }
+    print_merge_summary(std::cerr, summary);
+}
+
 }}
@@ -0,0 +1,567 @@
+#pragma once
+
+#include "alloc_stats.hpp"
+#include "layer_metadata.hpp"
+
+#include <mapbox/geometry.hpp>
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace mapbox { namespace mrmvt {
+
+// Number of points in any geometry.
+struct vertex_count {
+    template <typename T>
+    std::size_t operator()(geometry::point<T> const&) const {
+        return 1;
+    }
+
+    template <typename T>
+    std::size_t operator()(geometry::geometry_collection<T> const& gc) const {
+        std::size_t n = 0;
+        for (auto const& g : gc) {
+            n += geometry::geometry<T>::visit(g, *this);
+        }
+        return n;
+    }
+
+    // everything else is a vector of points or of parts
+    template <typename Parts>
+    std::size_t operator()(Parts const& parts) const {
+        std::size_t n = 0;
+        for (auto const& p : parts) {
+            n += (*this)(p);
+        }
+        return n;
+    }
+};
+
+template <typename T>
+std::size_t count_vertices(geometry::geometry<T> const& g) {
+    return geometry::geometry<T>::visit(g, vertex_count());
+}
+
+enum stats_timer : std::uint8_t {
+    stats_timer_parse = 0,
+    stats_timer_project,
+    stats_timer_clip,
+    stats_timer_encode,
+    stats_timer_compress,
+    stats_timer_count
+};
+
+static_assert(stats_timer_count < alloc_max_stages, "every timed stage needs its own allocation counters");
+
+inline const char * stats_timer_name(std::size_t timer) {
+    static const char * names[stats_timer_count] = { "parse", "project", "clip", "encode", "compress" };
+    return timer < stats_timer_count ? names[timer] : "other";
+}
+
+inline std::uint64_t peak_rss_bytes() {
+    struct rusage usage;
+    if (::getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<std::uint64_t>(usage.ru_maxrss);
+#else
+    return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+/*
+ * Durations in power of two nanosecond buckets, bucket i holds everything
+ * below 2^(i+1) ns. Percentiles are reported as the bucket's upper bound.
+ */
+struct time_histogram {
+    static constexpr std::size_t bucket_count = 48;
+
+    std::array<std::uint64_t, bucket_count> buckets {};
+    std::uint64_t count = 0;
+    std::uint64_t total_ns = 0;
+    std::uint64_t max_ns = 0;
+
+    void add(std::uint64_t ns) {
+        std::size_t b = 0;
+        for (std::uint64_t v = ns >> 1; v != 0 && b + 1 < bucket_count; v >>= 1) {
+            ++b;
+        }
+        ++buckets[b];
+        ++count;
+        total_ns += ns;
+        max_ns = ns > max_ns ? ns : max_ns;
+    }
+
+    void merge(time_histogram const& other) {
+        for (std::size_t i = 0; i < bucket_count; ++i) {
+            buckets[i] += other.buckets[i];
+        }
+        count += other.count;
+        total_ns += other.total_ns;
+        max_ns = other.max_ns > max_ns ? other.max_ns : max_ns;
+    }
+
+    std::uint64_t percentile_ns(double p) const {
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < bucket_count; ++i) {
+            seen += buckets[i];
+            if (count > 0 && static_cast<double>(seen) >= p * static_cast<double>(count)) {
+                return std::min(static_cast<std::uint64_t>(1) << (i + 1), max_ns);
+            }
+        }
+        return max_ns;
+    }
+};
+
+struct layer_zoom_stats {
+    std::uint64_t features_in = 0;
+    std::uint64_t features_out = 0;
+    std::uint64_t vertices_in = 0;
+    std::uint64_t vertices_out = 0;
+    std::uint64_t fill_tiles = 0;
+    std::uint64_t clipped_tiles = 0;
+    std::uint64_t empty_clips = 0; // covered tiles where nothing was left after clipping
+
+    void merge(layer_zoom_stats const& other) {
+        features_in += other.features_in;
+        features_out += other.features_out;
+        vertices_in += other.vertices_in;
+        vertices_out += other.vertices_out;
+        fill_tiles += other.fill_tiles;
+        clipped_tiles += other.clipped_tiles;
+        empty_clips += other.empty_clips;
+    }
+};
+
+// Zoom -1 is used by m2f, which has no zoom yet.
+using layer_zoom_key = std::pair<int, std::string>;
+
+/*
+ * The counters of one thread. Nothing here is shared, so updating them costs
+ * no more than a plain increment; the collector merges them periodically.
+ */
+struct stats_counters {
+    std::uint64_t records_in = 0;
+    std::uint64_t records_out = 0;
+    std::uint64_t tiles_written = 0;
+    std::uint64_t bytes_written = 0;
+    std::map<layer_zoom_key, layer_zoom_stats> layers;
+    std::array<time_histogram, stats_timer_count> timers {};
+
+    // not merged, bookkeeping of the owning thread
+    std::uint32_t ticks = 0;
+    std::chrono::steady_clock::time_point last_flush = std::chrono::steady_clock::now();
+
+    // Features usually arrive grouped by layer and zoom, so the last entry is
+    // remembered and the map is only searched when the key changes.
+    layer_zoom_stats & at(int z, std::string const& layer) {
+        if (last_ == nullptr || last_z_ != z || last_layer_ != layer) {
+            last_ = &layers[layer_zoom_key(z, layer)];
+            last_z_ = z;
+            last_layer_ = layer;
+        }
+        return *last_;
+    }
+
+    void merge(stats_counters const& other) {
+        records_in += other.records_in;
+        records_out += other.records_out;
+        tiles_written += other.tiles_written;
+        bytes_written += other.bytes_written;
+        for (auto const& l : other.layers) {
+            layers[l.first].merge(l.second);
+        }
+        for (std::size_t i = 0; i < stats_timer_count; ++i) {
+            timers[i].merge(other.timers[i]);
+        }
+    }
+
+    void clear() {
+        records_in = 0;
+        records_out = 0;
+        tiles_written = 0;
+        bytes_written = 0;
+        layers.clear();
+        timers = std::array<time_histogram, stats_timer_count>();
+        last_ = nullptr;
+    }
+
+private:
+    layer_zoom_stats * last_ = nullptr;
+    int last_z_ = 0;
+    std::string last_layer_;
+};
+
+struct stats_options {
+    bool enabled = false;
+    std::string json_path; // the report is written here as JSON, else printed to stderr
+    double interval = 10.0; // seconds between progress lines, 0 disables them
+};
+
+// Consumes --stats, --stats-json PATH and --stats-interval SECONDS at argv[i].
+inline bool parse_stats_flag(int argc, char* argv[], int & i, stats_options & options) {
+    bool json = std::strcmp(argv[i], "--stats-json") == 0;
+    bool interval = std::strcmp(argv[i], "--stats-interval") == 0;
+    if (std::strcmp(argv[i], "--stats") == 0) {
+        options.enabled = true;
+        return true;
+    }
+    if (!json && !interval) {
+        return false;
+    }
+    ++i;
+    if (i >= argc) {
+        throw std::runtime_error("Not enough arguments provided");
+    }
+    options.enabled = true;
+    if (json) {
+        options.json_path = argv[i];
+    } else {
+        options.interval = std::atof(argv[i]);
+    }
+    return true;
+}
+
+/*
+ * Process wide statistics for --stats. Each thread counts into its own
+ * stats_counters and merges them into the total under a lock every interval
+ * and when the thread exits. The thread that called start() also prints a
+ * progress line every interval. When stats are off, local() returns null and
+ * instrumented code skips all counting and timing.
+ */
+class stats_collector {
+public:
+    static stats_collector & instance() {
+        static stats_collector collector;
+        return collector;
+    }
+
+    void start(std::string const& binary, stats_options const& options) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        binary_ = binary;
+        options_ = options;
+        start_ = std::chrono::steady_clock::now();
+        last_progress_ = start_;
+        reporter_ = std::this_thread::get_id();
+        enabled_.store(options.enabled, std::memory_order_relaxed);
+    }
+
+    bool enabled() const {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    stats_counters * local();
+
+    // Called once per record or tile by instrumented loops.
+    void tick(stats_counters & counters) {
+        if (++counters.ticks % 1024 != 0 || options_.interval <= 0.0) {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (std::chrono::duration<double>(now - counters.last_flush).count() < options_.interval) {
+            return;
+        }
+        flush(counters);
+        if (std::this_thread::get_id() == reporter_) {
+            print_progress(now);
+        }
+    }
+
+    void flush(stats_counters & counters) {
+        counters.last_flush = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(mutex_);
+        total_.merge(counters);
+        counters.clear();
+    }
+
+    // Merges the calling thread's counters and writes the report. Other
+    // threads must have exited, or flushed, before.
+    void finish() {
+        if (!enabled()) {
+            return;
+        }
+        flush(*local());
+        std::lock_guard<std::mutex> lock(mutex_);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+        if (options_.json_path.empty()) {
+            print_report(std::cerr, seconds);
+            return;
+        }
+        std::ofstream out(options_.json_path);
+        print_json(out, seconds);
+        if (!out) {
+            std::ostringstream err;
+            err << "Stats Error: failed writing " << options_.json_path;
+            throw std::runtime_error(err.str());
+        }
+    }
+
+private:
+    stats_collector() :
+        enabled_(false),
+        mutex_(),
+        binary_(),
+        options_(),
+        start_(std::chrono::steady_clock::now()),
+        last_progress_(start_),
+        reporter_(),
+        total_() {}
+
+    void print_progress(std::chrono::steady_clock::time_point now) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (std::chrono::duration<double>(now - last_progress_).count() < options_.interval) {
+            return;
+        }
+        last_progress_ = now;
+        std::fprintf(stderr, "%s: %.1fs, %llu records in, %llu records out, %.1f MB written\n",
+                     binary_.c_str(),
+                     std::chrono::duration<double>(now - start_).count(),
+                     static_cast<unsigned long long>(total_.records_in),
+                     static_cast<unsigned long long>(total_.records_out),
+                     static_cast<double>(total_.bytes_written) / 1e6);
+    }
+
+    void print_report(std::ostream & out, double seconds) const {
+        char line[256];
+        std::snprintf(line, sizeof(line), "%s stats: %.2fs, %llu records in, %llu records out, %llu tiles, %.1f MB written\n",
+                      binary_.c_str(), seconds,
+                      static_cast<unsigned long long>(total_.records_in),
+                      static_cast<unsigned long long>(total_.records_out),
+                      static_cast<unsigned long long>(total_.tiles_written),
+                      static_cast<double>(total_.bytes_written) / 1e6);
+        out << line;
+        std::snprintf(line, sizeof(line), "peak RSS %.1f MB\n", static_cast<double>(peak_rss_bytes()) / 1e6);
+        out << line;
+        std::snprintf(line, sizeof(line), "%5s %-20s %12s %12s %14s %14s %10s %10s %10s\n",
+                      "zoom", "layer", "features in", "features out", "vertices in", "vertices out", "fill", "clipped", "empty");
+        out << line;
+        for (auto const& l : total_.layers) {
+            auto const& s = l.second;
+            std::snprintf(line, sizeof(line), "%5s %-20s %12llu %12llu %14llu %14llu %10llu %10llu %10llu\n",
+                          l.first.first < 0 ? "-" : std::to_string(l.first.first).c_str(),
+                          l.first.second.c_str(),
+                          static_cast<unsigned long long>(s.features_in),
+                          static_cast<unsigned long long>(s.features_out),
+                          static_cast<unsigned long long>(s.vertices_in),
+                          static_cast<unsigned long long>(s.vertices_out),
+                          static_cast<unsigned long long>(s.fill_tiles),
+                          static_cast<unsigned long long>(s.clipped_tiles),
+                          static_cast<unsigned long long>(s.empty_clips));
+            out << line;
+        }
+        std::snprintf(line, sizeof(line), "%-10s %12s %12s %10s %10s %10s %10s %10s\n",
+                      "timer", "count", "total ms", "mean us", "p50 us", "p90 us", "p99 us", "max us");
+        out << line;
+        for (std::size_t i = 0; i < stats_timer_count; ++i) {
+            auto const& h = total_.timers[i];
+            if (h.count == 0) {
+                continue;
+            }
+            std::snprintf(line, sizeof(line), "%-10s %12llu %12.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                          stats_timer_name(i),
+                          static_cast<unsigned long long>(h.count),
+                          static_cast<double>(h.total_ns) / 1e6,
+                          static_cast<double>(h.total_ns) / 1e3 / static_cast<double>(h.count),
+                          static_cast<double>(h.percentile_ns(0.5)) / 1e3,
+                          static_cast<double>(h.percentile_ns(0.9)) / 1e3,
+                          static_cast<double>(h.percentile_ns(0.99)) / 1e3,
+                          static_cast<double>(h.max_ns) / 1e3);
+            out << line;
+        }
+#ifdef MRMVT_ALLOC_STATS
+        std::snprintf(line, sizeof(line), "%-10s %12s %14s %14s    peak live heap %.1f MB\n",
+                      "heap", "allocations", "allocated MB", "live MB",
+                      static_cast<double>(alloc_peak_live_bytes().load()) / 1e6);
+        out << line;
+        for (std::size_t i = 0; i < alloc_max_stages; ++i) {
+            alloc_stage_counters const& c = alloc_stages()[i];
+            if (c.allocations.load() == 0) {
+                continue;
+            }
+            std::snprintf(line, sizeof(line), "%-10s %12llu %14.1f %14.1f\n",
+                          stats_timer_name(i),
+                          static_cast<unsigned long long>(c.allocations.load()),
+                          static_cast<double>(c.bytes.load()) / 1e6,
+                          static_cast<double>(c.live_bytes.load()) / 1e6);
+            out << line;
+        }
+        out << "heap counts operator new only, malloc calls such as rapidjson's while parsing are not included\n";
+#endif
+    }
+
+    void print_json(std::ostream & out, double seconds) const {
+        std::ostringstream buf;
+        buf << "{\"binary\":\"";
+        quote(buf, binary_);
+        buf << "\",\"seconds\":" << seconds
+            << ",\"records_in\":" << total_.records_in
+            << ",\"records_out\":" << total_.records_out
+            << ",\"tiles_written\":" << total_.tiles_written
+            << ",\"bytes_written\":" << total_.bytes_written
+            << ",\"peak_rss_bytes\":" << peak_rss_bytes()
+            << ",\"layers\":[";
+        bool first = true;
+        for (auto const& l : total_.layers) {
+            auto const& s = l.second;
+            buf << (first ? "" : ",") << "{\"zoom\":";
+            if (l.first.first < 0) {
+                buf << "null";
+            } else {
+                buf << l.first.first;
+            }
+            buf << ",\"layer\":\"";
+            quote(buf, l.first.second);
+            buf << "\",\"features_in\":" << s.features_in
+                << ",\"features_out\":" << s.features_out
+                << ",\"vertices_in\":" << s.vertices_in
+                << ",\"vertices_out\":" << s.vertices_out
+                << ",\"fill_tiles\":" << s.fill_tiles
+                << ",\"clipped_tiles\":" << s.clipped_tiles
+                << ",\"empty_clips\":" << s.empty_clips << "}";
+            first = false;
+        }
+        buf << "],\"timers\":{";
+        first = true;
+        for (std::size_t i = 0; i < stats_timer_count; ++i) {
+            auto const& h = total_.timers[i];
+            if (h.count == 0) {
+                continue;
+            }
+            buf << (first ? "" : ",") << "\"" << stats_timer_name(i) << "\":{"
+                << "\"count\":" << h.count
+                << ",\"total_ns\":" << h.total_ns
+                << ",\"max_ns\":" << h.max_ns
+                << ",\"p50_ns\":" << h.percentile_ns(0.5)
+                << ",\"p90_ns\":" << h.percentile_ns(0.9)
+                << ",\"p99_ns\":" << h.percentile_ns(0.99)
+                << ",\"buckets\":[";
+            // trailing empty buckets are left out, bucket i ends at 2^(i+1) ns
+            std::size_t last = time_histogram::bucket_count;
+            while (last > 0 && h.buckets[last - 1] == 0) {
+                --last;
+            }
+            for (std::size_t b = 0; b < last; ++b) {
+                buf << (b == 0 ? "" : ",") << h.buckets[b];
+            }
+            buf << "]}";
+            first = false;
+        }
+        buf << "}";
+#ifdef MRMVT_ALLOC_STATS
+        buf << ",\"heap\":{\"counts\":\"operator new\",\"peak_live_bytes\":" << alloc_peak_live_bytes().load() << ",\"stages\":{";
+        first = true;
+        for (std::size_t i = 0; i < alloc_max_stages; ++i) {
+            alloc_stage_counters const& c = alloc_stages()[i];
+            if (c.allocations.load() == 0) {
+                continue;
+            }
+            buf << (first ? "" : ",") << "\"" << stats_timer_name(i) << "\":{"
+                << "\"allocations\":" << c.allocations.load()
+                << ",\"bytes\":" << c.bytes.load()
+                << ",\"live_bytes\":" << c.live_bytes.load() << "}";
+            first = false;
+        }
+        buf << "}}";
+#endif
+        buf << "}\n";
+        out << buf.str();
+    }
+
+    std::atomic<bool> enabled_;
+    std::mutex mutex_;
+    std::string binary_;
+    stats_options options_;
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::steady_clock::time_point last_progress_;
+    std::thread::id reporter_;
+    stats_counters total_;
+};
+
+// Owns one thread's counters and hands whatever is left to the total when
+// the thread exits.
+struct stats_shard {
+    stats_counters counters;
+
+    ~stats_shard() {
+        stats_collector::instance().flush(counters);
+    }
+};
+
+inline stats_counters * stats_collector::local() {
+    if (!enabled()) {
+        return nullptr;
+    }
+    static thread_local stats_shard shard;
+    return &shard.counters;
+}
+
+// The counters of the calling thread, or null when --stats is off.
+inline stats_counters * local_stats() {
+    return stats_collector::instance().local();
+}
+
+// Times a scope into one of the histograms, a no-op without counters. With
+// `total`, the time is added there instead, for work recorded as one sample
+// over several scopes.
+class stats_scope {
+public:
+    stats_scope(stats_counters * counters, stats_timer timer, std::uint64_t * total = nullptr) :
+        counters_(counters),
+        timer_(timer),
+        total_(total),
+        start_() {
+        if (counters_) {
+#ifdef MRMVT_ALLOC_STATS
+            previous_stage_ = alloc_current_stage();
+            alloc_current_stage() = timer_;
+#endif
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~stats_scope() {
+        if (counters_) {
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+            if (total_) {
+                *total_ += static_cast<std::uint64_t>(ns);
+            } else {
+                counters_->timers[timer_].add(static_cast<std::uint64_t>(ns));
+            }
+#ifdef MRMVT_ALLOC_STATS
+            alloc_current_stage() = previous_stage_;
+#endif
+        }
+    }
+
+    stats_scope(stats_scope const&) = delete;
+    stats_scope& operator=(stats_scope const&) = delete;
+
+private:
+    stats_counters * counters_;
+    stats_timer timer_;
+    std::uint64_t * total_;
+    std::chrono::steady_clock::time_point start_;
+#ifdef MRMVT_ALLOC_STATS
+    std::uint8_t previous_stage_ = alloc_max_stages - 1;
+#endif
+};
+
+}}
@@ -0,0 +1,392 @@
+#pragma once
+
+#include "compress.hpp"
+#include "douglas_peucker.hpp"
+#include "layer_encoder.hpp"
+
+#include <mapbox/geometry.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mapbox { namespace mrmvt {
+
+enum feature_priority : std::uint8_t {
+    feature_priority_area = 0,
+    feature_priority_length,
+    feature_priority_property
+};
+
+struct tile_budget {
+    std::size_t max_tile_bytes = 0;     // 0 disables the byte budget, checked after compression
+    compression_type compression = compression_none; // how tiles are stored
+    std::size_t max_layer_features = 0; // 0 disables the feature budget
+    double simplify_distance = 4.0;     // what the input was simplified with, coarsening starts above it
+    feature_priority priority = feature_priority_area;
+    std::string priority_property;
+    std::ostream * report = nullptr;    // per tile decisions, if set
+
+    bool enabled() const {
+        return max_tile_bytes > 0 || max_layer_features > 0;
+    }
+};
+
+// Parses "area", "length" or "property:<name>".
+inline void parse_priority(std::string const& spec, tile_budget & budget) {
+    if (spec == "area") {
+        budget.priority = feature_priority_area;
+    } else if (spec == "length") {
+        budget.priority = feature_priority_length;
+    } else if (spec.compare(0, 9, "property:") == 0 && spec.size() > 9) {
+        budget.priority = feature_priority_property;
+        budget.priority_property = spec.substr(9);
+    } else {
+        std::ostringstream err;
+        err << "Unknown priority: " << spec;
+        throw std::runtime_error(err.str());
+    }
+}
+
+// The spec parse_priority reads back into `budget`.
+inline std::string priority_spec(tile_budget const& budget) {
+    switch (budget.priority) {
+        case feature_priority_length:
+            return "length";
+        case feature_priority_property:
+            return "property:" + budget.priority_property;
+        default:
+            return "area";
+    }
+}
+
+struct budget_summary {
+    std::size_t tiles = 0;
+    std::size_t tiles_over_budget = 0;
+    std::size_t tiles_still_over = 0;
+    std::size_t features_dropped = 0;
+    std::size_t tiles_coarsened = 0;
+    std::size_t largest_tile = 0;
+};
+
+using tile_layer = std::pair<std::string, geometry::feature_collection<std::int64_t>>;
+using tile_layers = std::vector<tile_layer>;
+
+struct feature_measure_visitor {
+    double area = 0.0;
+    double length = 0.0;
+
+    static double ring_area(geometry::linear_ring<std::int64_t> const& ring) {
+        double sum = 0.0;
+        for (std::size_t i = 0, j = ring.size() - 1; i < ring.size(); j = i++) {
+            sum += static_cast<double>(ring[j].x) * static_cast<double>(ring[i].y) -
+                   static_cast<double>(ring[i].x) * static_cast<double>(ring[j].y);
+        }
+        return sum / 2.0;
+    }
+
+    template <typename Line>
+    static double line_length(Line const& line) {
+        double sum = 0.0;
+        for (std::size_t i = 1; i < line.size(); ++i) {
+            double dx = static_cast<double>(line[i].x - line[i - 1].x);
+            double dy = static_cast<double>(line[i].y - line[i - 1].y);
+            sum += std::sqrt(dx * dx + dy * dy);
+        }
+        return sum;
+    }
+
+    void operator() (geometry::point<std::int64_t> const&) {}
+
+    void operator() (geometry::multi_point<std::int64_t> const&) {}
+
+    void operator() (geometry::line_string<std::int64_t> const& ls) {
+        length += line_length(ls);
+    }
+
+    void operator() (geometry::multi_line_string<std::int64_t> const& mls) {
+        for (auto const& ls : mls) {
+            length += line_length(ls);
+        }
+    }
+
+    void operator() (geometry::polygon<std::int64_t> const& poly) {
+        bool exterior = true;
+        for (auto const& ring : poly) {
+            if (ring.empty()) {
+                continue;
+            }
+            double a = std::fabs(ring_area(ring));
+            area += exterior ? a : -a;
+            length += line_length(ring);
+            exterior = false;
+        }
+    }
+
+    void operator() (geometry::multi_polygon<std::int64_t> const& mp) {
+        for (auto const& poly : mp) {
+            (*this)(poly);
+        }
+    }
+
+    void operator() (geometry::geometry_collection<std::int64_t> const& gc) {
+        for (auto const& g : gc) {
+            geometry::geometry<std::int64_t>::visit(g, *this);
+        }
+    }
+};
+
+struct value_to_double_visitor {
+    double operator() (bool v) const { return v ? 1.0 : 0.0; }
+    double operator() (std::uint64_t v) const { return static_cast<double>(v); }
+    double operator() (std::int64_t v) const { return static_cast<double>(v); }
+    double operator() (double v) const { return v; }
+
+    template <typename T>
+    double operator() (T const&) const { return 0.0; }
+};
+
+// Higher values are kept longer. Polygons rank by area and everything else
+// by length under "area", so points always go first.
+inline double feature_priority_value(geometry::feature<std::int64_t> const& f, tile_budget const& budget) {
+    if (budget.priority == feature_priority_property) {
+        auto itr = f.properties.find(budget.priority_property);
+        if (itr == f.properties.end()) {
+            return 0.0;
+        }
+        return geometry::value::visit(itr->second, value_to_double_visitor());
+    }
+    feature_measure_visitor m;
+    geometry::geometry<std::int64_t>::visit(f.geometry, m);
+    if (budget.priority == feature_priority_area && m.area > 0.0) {
+        return m.area;
+    }
+    return m.length;
+}
+
+// Re-simplifies lines and rings in place with a larger tolerance. Rings that
+// collapse below four points are dropped, and so is a polygon whose exterior
+// collapses; operator() returns false when nothing of the geometry is left.
+struct coarsen_visitor {
+    double tolerance;
+
+    template <typename Line>
+    void simplify(Line & line) const {
+        if (line.size() <= 4) {
+            return;
+        }
+        Line simplified;
+        douglas_peucker<std::int64_t>(line, std::back_inserter(simplified), tolerance);
+        line = std::move(simplified);
+    }
+
+    bool operator() (geometry::point<std::int64_t> &) const {
+        return true;
+    }
+
+    bool operator() (geometry::multi_point<std::int64_t> &) const {
+        return true;
+    }
+
+    bool operator() (geometry::line_string<std::int64_t> & ls) const {
+        simplify(ls);
+        return true;
+    }
+
+    bool operator() (geometry::multi_line_string<std::int64_t> & mls) const {
+        for (auto & ls : mls) {
+            simplify(ls);
+        }
+        return true;
+    }
+
+    bool operator() (geometry::polygon<std::int64_t> & poly) const {
+        for (auto & ring : poly) {
+            simplify(ring);
+        }
+        if (poly.empty() || poly.front().size() < 4) {
+            poly.clear();
+            return false;
+        }
+        poly.erase(std::remove_if(poly.begin() + 1, poly.end(), [](geometry::linear_ring<std::int64_t> const& ring) {
+            return ring.size() < 4;
+        }), poly.end());
+        return true;
+    }
+
+    bool operator() (geometry::multi_polygon<std::int64_t> & mp) const {
+        mp.erase(std::remove_if(mp.begin(), mp.end(), [this](geometry::polygon<std::int64_t> & poly) {
+            return !(*this)(poly);
+        }), mp.end());
+        return !mp.empty();
+    }
+
+    bool operator() (geometry::geometry_collection<std::int64_t> & gc) const {
+        gc.erase(std::remove_if(gc.begin(), gc.end(), [this](geometry::geometry<std::int64_t> & g) {
+            return !geometry::geometry<std::int64_t>::visit(g, *this);
+        }), gc.end());
+        return !gc.empty();
+    }
+};
+
+inline void encode_tile_layers(std::string & buffer, tile_layers const& layers) {
+    buffer.clear();
+    streaming_layer_encoder encoder;
+    for (auto const& layer : layers) {
+        encoder.encode(buffer, layer.first, layer.second);
+    }
+}
+
+// Orders every layer by descending priority so drops can truncate from the back.
+inline void sort_by_priority(tile_layers & layers, tile_budget const& budget) {
+    for (auto & layer : layers) {
+        auto & features = layer.second;
+        std::vector<std::pair<double, std::size_t>> order;
+        order.reserve(features.size());
+        for (std::size_t i = 0; i < features.size(); ++i) {
+            order.emplace_back(feature_priority_value(features[i], budget), i);
+        }
+        std::stable_sort(order.begin(), order.end(), [](std::pair<double, std::size_t> const& a,
+                                                        std::pair<double, std::size_t> const& b) {
+            return a.first > b.first;
+        });
+        geometry::feature_collection<std::int64_t> sorted;
+        sorted.reserve(features.size());
+        for (auto const& o : order) {
+            sorted.push_back(std::move(features[o.second]));
+        }
+        features = std::move(sorted);
+    }
+}
+
+/*
+ * Encodes the layers of one tile into `buffer` while keeping it within
+ * `budget`. Layers over the feature budget lose their lowest priority
+ * features first. The byte budget is compared with the tile as it will be
+ * stored, so each check compresses the tile with budget.compression; the
+ * compressed copy is thrown away, the compression stage redoes it. If the
+ * encoded tile is still over the byte budget, all geometries are coarsened
+ * with a doubling simplification tolerance that starts at twice the
+ * distance the input was simplified with, since anything below that barely
+ * changes the tile. After that the lowest priority features of every layer
+ * are dropped in proportion to the overshoot until the tile fits.
+ */
+inline void encode_budgeted_tile(std::string & buffer,
+                                 tile_layers & layers,
+                                 tile_budget const& budget,
+                                 budget_summary & summary,
+                                 int z,
+                                 int x,
+                                 int y) {
+    static const int max_coarsen_rounds = 3;
+    static const int max_drop_rounds = 16;
+
+    ++summary.tiles;
+    std::size_t dropped = 0;
+    int coarsened = 0;
+    bool sorted = false;
+
+    if (budget.max_layer_features > 0) {
+        for (auto & layer : layers) {
+            if (layer.second.size() > budget.max_layer_features) {
+                if (!sorted) {
+                    sort_by_priority(layers, budget);
+                    sorted = true;
+                }
+                dropped += layer.second.size() - budget.max_layer_features;
+                layer.second.resize(budget.max_layer_features);
+            }
+        }
+    }
+
+    std::string compressed;
+    auto stored_size = [&]() -> std::size_t {
+        if (budget.max_tile_bytes == 0 || budget.compression == compression_none) {
+            return buffer.size();
+        }
+        compress_tile(buffer, compressed, budget.compression);
+        return compressed.size();
+    };
+
+    encode_tile_layers(buffer, layers);
+    std::size_t size = stored_size();
+    std::size_t initial_size = size;
+
+    if (budget.max_tile_bytes > 0) {
+        double tolerance = 2.0 * std::max(budget.simplify_distance, 1.0);
+        for (int round = 0; round < max_coarsen_rounds && size > budget.max_tile_bytes; ++round) {
+            coarsen_visitor visitor { tolerance };
+            for (auto & layer : layers) {
+                auto & features = layer.second;
+                std::size_t before = features.size();
+                features.erase(std::remove_if(features.begin(), features.end(), [&visitor](geometry::feature<std::int64_t> & f) {
+                    return !geometry::geometry<std::int64_t>::visit(f.geometry, visitor);
+                }), features.end());
+                dropped += before - features.size();
+            }
+            tolerance *= 2.0;
+            ++coarsened;
+            encode_tile_layers(buffer, layers);
+            size = stored_size();
+        }
+        for (int round = 0; round < max_drop_rounds && size > budget.max_tile_bytes; ++round) {
+            if (!sorted) {
+                sort_by_priority(layers, budget);
+                sorted = true;
+            }
+            double keep = std::min(0.9, static_cast<double>(budget.max_tile_bytes) / static_cast<double>(size));
+            bool any = false;
+            for (auto & layer : layers) {
+                std::size_t n = layer.second.size();
+                std::size_t target = static_cast<std::size_t>(std::floor(static_cast<double>(n) * keep));
+                if (target < n) {
+                    dropped += n - target;
+                    layer.second.resize(target);
+                    any = true;
+                }
+            }
+            if (!any) {
+                break;
+            }
+            encode_tile_layers(buffer, layers);
+            size = stored_size();
+        }
+    }
+
+    summary.features_dropped += dropped;
+    summary.largest_tile = std::max(summary.largest_tile, size);
+    if (coarsened > 0) {
+        ++summary.tiles_coarsened;
+    }
+    bool over = dropped > 0 || coarsened > 0;
+    if (over) {
+        ++summary.tiles_over_budget;
+    }
+    if (budget.max_tile_bytes > 0 && size > budget.max_tile_bytes) {
+        ++summary.tiles_still_over;
+    }
+    if (over && budget.report) {
+        *budget.report << z << "/" << x << "/" << y
+                       << " bytes_before=" << initial_size
+                       << " bytes_after=" << size
+                       << " dropped=" << dropped
+                       << " coarsen_rounds=" << coarsened << std::endl;
+    }
+}
+
+inline void print_budget_summary(std::ostream & out, budget_summary const& summary) {
+    out << "Budget: " << summary.tiles << " tiles, "
+        << summary.tiles_over_budget << " over budget, "
+        << summary.tiles_coarsened << " coarsened, "
+        << summary.features_dropped << " features dropped, "
+        << summary.tiles_still_over << " still over budget, "
+        << "largest tile " << summary.largest_tile << " bytes" << std::endl;
+}
+
+}}
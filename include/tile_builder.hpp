@@ -0,0 +1,114 @@
+#pragma once
+
+#include "clip.hpp"
+#include "layer_encoder.hpp"
+#include "map_to_zoom.hpp"
+#include "tile_cover.hpp"
+
+#include <mapbox/geometry.hpp>
+#include <mapbox/geojson.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mapbox { namespace mrmvt {
+
+struct tile_builder_options {
+    double simplify_distance = 4.0;
+    std::int64_t buffer = 8;
+};
+
+struct layer_feature {
+    std::string layer;
+    geometry::feature<double> feature;
+};
+
+/*
+ * Parses one input feature. A record in the m2f output format, "<layer>
+ * <feature json>", keeps its layer; a bare GeoJSON feature goes into
+ * `default_layer`.
+ */
+inline layer_feature parse_layer_feature(const char * data, std::size_t size, std::string const& default_layer) {
+    std::size_t start = 0;
+    while (start < size && (data[start] == ' ' || data[start] == '\n')) {
+        ++start;
+    }
+    if (start < size && data[start] == '{') {
+        return layer_feature { default_layer, geojson::parse_feature<double>(std::string(data + start, data + size)) };
+    }
+    const char * sep = static_cast<const char*>(std::memchr(data + start, ' ', size - start));
+    if (!sep) {
+        throw std::runtime_error("Tile Builder Error: feature must be GeoJSON or a '<layer> <feature>' record");
+    }
+    return layer_feature {
+        std::string(data + start, sep),
+        geojson::parse_feature<double>(std::string(sep + 1, data + size))
+    };
+}
+
+/*
+ * Runs m2z | m2t | r2mvt in memory for a set of features: every feature is
+ * projected and simplified for each zoom from min_z to max_z, clipped to the
+ * tiles it covers and encoded. `visit(z, x, y, buffer)` receives each
+ * uncompressed tile, with layers in name order, one zoom at a time so only a
+ * single zoom of clipped features is held at once. max_z must not exceed
+ * MAX_ZOOM.
+ */
+template <typename Visit>
+inline void build_tiles(std::vector<layer_feature> const& features,
+                        std::uint32_t min_z,
+                        std::uint32_t max_z,
+                        tile_builder_options const& options,
+                        Visit && visit) {
+    using tile_layers = std::map<std::string, geometry::feature_collection<std::int64_t>>;
+    if (max_z > MAX_ZOOM) {
+        std::ostringstream err;
+        err << "Tile Builder Error: max zoom " << max_z << " is above " << MAX_ZOOM;
+        throw std::runtime_error(err.str());
+    }
+    geometry::polygon<std::int64_t> fill_geometry = tile_fill_polygon(options.buffer);
+    streaming_layer_encoder encoder;
+    for (std::uint32_t z = min_z; z <= max_z; ++z) {
+        std::map<std::pair<std::uint32_t, std::uint32_t>, tile_layers> tiles;
+        for (auto const& lf : features) {
+            auto g = geom_to_zoom(lf.feature.geometry, z, 4096, options.simplify_distance);
+            for (auto const& t : tile_cover::get_tiles(g, 4096)) {
+                std::uint32_t x = static_cast<std::uint32_t>(t.x);
+                std::uint32_t y = static_cast<std::uint32_t>(t.y);
+                if (t.fill) {
+                    tiles[std::make_pair(x, y)][lf.layer].push_back(geometry::feature<std::int64_t> {
+                        fill_geometry,
+                        lf.feature.properties,
+                        lf.feature.id
+                    });
+                    continue;
+                }
+                auto og = clip(g, x, y, options.buffer);
+                if (!og) {
+                    continue;
+                }
+                tiles[std::make_pair(x, y)][lf.layer].push_back(geometry::feature<std::int64_t> {
+                    std::move(*og),
+                    lf.feature.properties,
+                    lf.feature.id
+                });
+            }
+        }
+        for (auto & tile : tiles) {
+            std::string buffer;
+            for (auto const& layer : tile.second) {
+                encoder.encode(buffer, layer.first, layer.second);
+            }
+            tile.second.clear();
+            visit(z, tile.first.first, tile.first.second, std::move(buffer));
+        }
+    }
+}
+
+}}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "arena.hpp"
+
 #include <mapbox/geometry/geometry.hpp>
 
 #include <cmath>
@@ -73,6 +75,7 @@ inline bool operator< (tile_coordinate const& a, tile_coordinate const& b) {
 }
 
 using tile_coordinates = std::vector<tile_coordinate>;
+using arena_tile_coordinates = mrmvt::arena_vector<tile_coordinate>;
 
 inline tile_coordinate point_to_tile(geometry::point<std::int64_t> const& pt, 
                                      std::uint32_t extent) {
@@ -83,7 +86,8 @@ inline bool almost_zero(double val) {
     return std::fabs(val) < 1e-12;
 }
 
-inline void line_cover(tile_coordinates & tiles,
+template <typename Tiles>
+inline void line_cover(Tiles & tiles,
                        std::uint32_t extent, 
                        mapbox::geometry::line_string<std::int64_t> const& line) {
     auto itr = line.begin();
@@ -109,8 +113,7 @@ inline void line_cover(tile_coordinates & tiles,
         std::int64_t i_dx = i_x1 - i_x0;
         std::int64_t i_dy = i_y1 - i_y0;
         if (i_dx == 0 && i_dy == 0) {
-            auto const& back = tiles.back();
-            if (!tiles.empty() || back.x != i_x0 || back.y != i_y0) {
+            if (tiles.empty() || tiles.back().x != i_x0 || tiles.back().y != i_y0) {
                 tiles.push_back(tile_coordinate { 
                         static_cast<std::uint32_t>(i_x0), 
                         static_cast<std::uint32_t>(i_y0),
@@ -125,8 +128,7 @@ inline void line_cover(tile_coordinates & tiles,
         double tdx = std::fabs(sx / dx);
         double tdy = std::fabs(sy / dy);
         
-        auto const& back = tiles.back();
-        if (back.x != i_x0 || back.y != i_y0) {
+        if (tiles.empty() || tiles.back().x != i_x0 || tiles.back().y != i_y0) {
             tiles.push_back(tile_coordinate { 
                     static_cast<std::uint32_t>(i_x0), 
                     static_cast<std::uint32_t>(i_y0),
@@ -150,8 +152,9 @@ inline void line_cover(tile_coordinates & tiles,
     }
 }
 
-inline void ring_cover(tile_coordinates & partial_ring,
-                       tile_coordinates & all_tiles,
+template <typename Tiles>
+inline void ring_cover(Tiles & partial_ring,
+                       Tiles & all_tiles,
                        std::uint32_t extent, 
                        mapbox::geometry::linear_ring<std::int64_t> const& ring) {
     auto itr = ring.begin();
@@ -240,13 +243,20 @@ inline void ring_cover(tile_coordinates & partial_ring,
     }
 }
 
-inline void polygon_cover(tile_coordinates & tiles,
+// The per ring work lists come from `arena` and are left for the caller to
+// rewind.
+template <typename Tiles>
+inline void polygon_cover(Tiles & tiles,
                           std::uint32_t extent, 
-                          mapbox::geometry::polygon<std::int64_t> const& polygon) {
-    tile_coordinates intersections;
+                          mapbox::geometry::polygon<std::int64_t> const& polygon,
+                          mrmvt::monotonic_arena & arena) {
+    mrmvt::arena_allocator<tile_coordinate> alloc(arena);
+    arena_tile_coordinates intersections(alloc);
+    arena_tile_coordinates partial_ring(alloc);
+    arena_tile_coordinates all_tiles(alloc);
     for (auto const& ring : polygon) {
-        tile_coordinates partial_ring;
-        tile_coordinates all_tiles;
+        partial_ring.clear();
+        all_tiles.clear();
         ring_cover(partial_ring, all_tiles, extent, ring);
         if (partial_ring.size() >= 3) {
             auto itr_1 = partial_ring.end();
@@ -286,9 +296,11 @@ inline void polygon_cover(tile_coordinates & tiles,
     }
 }
 
+template <typename Tiles>
 struct tile_cover_visitor {
     std::int64_t extent;
-    tile_coordinates & tiles;
+    Tiles & tiles;
+    mrmvt::monotonic_arena & arena;
 
     void operator() (geometry::point<std::int64_t> const& pt) {
         tiles.push_back(point_to_tile(pt, extent));
@@ -311,12 +323,12 @@ struct tile_cover_visitor {
     }
 
     void operator() (geometry::polygon<std::int64_t> const& poly) {
-        polygon_cover(tiles, extent, poly);
+        polygon_cover(tiles, extent, poly, arena);
     }
 
     void operator() (geometry::multi_polygon<std::int64_t> const& mp) {
         for (auto const& p : mp) {
-            polygon_cover(tiles, extent, p);
+            polygon_cover(tiles, extent, p, arena);
         }
     }
 
@@ -327,12 +339,31 @@ struct tile_cover_visitor {
     }
 };
 
+template <typename Tiles>
+inline void cover_tiles(Tiles & tiles,
+                        geometry::geometry<std::int64_t> const& g,
+                        std::int64_t extent,
+                        mrmvt::monotonic_arena & arena) {
+    geometry::geometry<std::int64_t>::visit(g, tile_cover_visitor<Tiles> { extent, tiles, arena } );
+    std::sort(tiles.begin(), tiles.end());
+    tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+}
+
 inline tile_coordinates get_tiles(geometry::geometry<std::int64_t> const& g,
                                   std::int64_t extent) {
     tile_coordinates tiles;
-    geometry::geometry<std::int64_t>::visit(g, tile_cover_visitor { extent, tiles } );
-    std::sort(tiles.begin(), tiles.end());
-    tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+    mrmvt::arena_scope scope(mrmvt::thread_arena());
+    cover_tiles(tiles, g, extent, mrmvt::thread_arena());
+    return tiles;
+}
+
+// Tiles and work lists all come from `arena`, for callers that rewind it
+// once per feature.
+inline arena_tile_coordinates get_tiles(geometry::geometry<std::int64_t> const& g,
+                                        std::int64_t extent,
+                                        mrmvt::monotonic_arena & arena) {
+    arena_tile_coordinates tiles { mrmvt::arena_allocator<tile_coordinate>(arena) };
+    cover_tiles(tiles, g, extent, arena);
     return tiles;
 }
 
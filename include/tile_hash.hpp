@@ -0,0 +1,108 @@
+#pragma once
+
+// MurmurHash3 was written by Austin Appleby, and is placed in the public
+// domain. The author hereby disclaims copyright to this source code.
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace mapbox { namespace mrmvt { namespace detail {
+
+inline std::uint64_t rotl64(std::uint64_t x, std::int8_t r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline std::uint64_t fmix64(std::uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// Blocks are read little endian whatever the host, so hashes match across
+// platforms like the byte-wise tail handling below.
+inline std::uint64_t get_block64(const char * p, std::size_t i) {
+    std::uint64_t k;
+    std::memcpy(&k, p + i * 8, sizeof(k));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    k = __builtin_bswap64(k);
+#endif
+    return k;
+}
+
+inline void murmur_hash3_x64_128(const char * data, std::size_t len, std::uint64_t & h1, std::uint64_t & h2) {
+    const std::size_t nblocks = len / 16;
+    const std::uint64_t c1 = 0x87c37b91114253d5ULL;
+    const std::uint64_t c2 = 0x4cf5ad432745937fULL;
+    h1 = 0;
+    h2 = 0;
+
+    for (std::size_t i = 0; i < nblocks; ++i) {
+        std::uint64_t k1 = get_block64(data, i * 2 + 0);
+        std::uint64_t k2 = get_block64(data, i * 2 + 1);
+
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    const unsigned char * tail = reinterpret_cast<const unsigned char*>(data + nblocks * 16);
+    std::uint64_t k1 = 0;
+    std::uint64_t k2 = 0;
+
+    switch (len & 15) {
+        case 15: k2 ^= static_cast<std::uint64_t>(tail[14]) << 48; // fallthrough
+        case 14: k2 ^= static_cast<std::uint64_t>(tail[13]) << 40; // fallthrough
+        case 13: k2 ^= static_cast<std::uint64_t>(tail[12]) << 32; // fallthrough
+        case 12: k2 ^= static_cast<std::uint64_t>(tail[11]) << 24; // fallthrough
+        case 11: k2 ^= static_cast<std::uint64_t>(tail[10]) << 16; // fallthrough
+        case 10: k2 ^= static_cast<std::uint64_t>(tail[9]) << 8;   // fallthrough
+        case  9: k2 ^= static_cast<std::uint64_t>(tail[8]) << 0;
+                 k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+                 // fallthrough
+        case  8: k1 ^= static_cast<std::uint64_t>(tail[7]) << 56; // fallthrough
+        case  7: k1 ^= static_cast<std::uint64_t>(tail[6]) << 48; // fallthrough
+        case  6: k1 ^= static_cast<std::uint64_t>(tail[5]) << 40; // fallthrough
+        case  5: k1 ^= static_cast<std::uint64_t>(tail[4]) << 32; // fallthrough
+        case  4: k1 ^= static_cast<std::uint64_t>(tail[3]) << 24; // fallthrough
+        case  3: k1 ^= static_cast<std::uint64_t>(tail[2]) << 16; // fallthrough
+        case  2: k1 ^= static_cast<std::uint64_t>(tail[1]) << 8;  // fallthrough
+        case  1: k1 ^= static_cast<std::uint64_t>(tail[0]) << 0;
+                 k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+                 break;
+        default: break;
+    }
+
+    h1 ^= len; h2 ^= len;
+    h1 += h2; h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2; h2 += h1;
+}
+
+} // end ns detail
+
+/*
+ * Content hash of an encoded tile, returned as a 32 character hex string.
+ * Used as the tile_id when deduplicating tile blobs, so it must stay stable
+ * across platforms and builds.
+ */
+inline std::string tile_hash(const char * data, std::size_t size) {
+    static const char hex[] = "0123456789abcdef";
+    std::uint64_t h1;
+    std::uint64_t h2;
+    detail::murmur_hash3_x64_128(data, size, h1, h2);
+    std::string out(32, '0');
+    for (std::size_t i = 0; i < 16; ++i) {
+        out[15 - i] = hex[(h1 >> (i * 4)) & 0xf];
+        out[31 - i] = hex[(h2 >> (i * 4)) & 0xf];
+    }
+    return out;
+}
+
+}}
@@ -0,0 +1,256 @@
+#pragma once
+
+#include "clip.hpp"
+#include "cluster.hpp"
+#include "feature_index.hpp"
+#include "map_to_zoom.hpp"
+#include "tile_budget.hpp"
+#include "tile_cover.hpp"
+
+#include <mapbox/geometry.hpp>
+#include <mapbox/geojson.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mapbox { namespace mrmvt {
+
+// World coordinate box of tile z/x/y, grown by `buffer` tile units.
+inline index_box tile_world_bbox(std::uint32_t z, std::uint32_t x, std::uint32_t y, std::int64_t buffer) {
+    double tiles = std::pow(2.0, static_cast<double>(z));
+    double pad = static_cast<double>(buffer) / 4096.0;
+    return index_box {{ (x - pad) / tiles, (y - pad) / tiles, (x + 1 + pad) / tiles, (y + 1 + pad) / tiles }};
+}
+
+using tile_layer_map = std::map<std::string, geometry::feature_collection<std::int64_t>>;
+
+/*
+ * Hands a zoom level geometry to the tiles it lands in the way m2t does:
+ * tiles it covers completely get `fill_geometry`, the others a clipped copy.
+ * `layers_of(x, y)` returns the layers of a tile being built, or null for
+ * tiles that are not.
+ */
+template <typename LayersOf>
+inline void tile_zoom_feature(std::string const& layer,
+                              geometry::geometry<std::int64_t> const& g,
+                              geometry::property_map const& properties,
+                              decltype(geometry::feature<std::int64_t>::id) const& id,
+                              geometry::polygon<std::int64_t> const& fill_geometry,
+                              std::int64_t buffer,
+                              LayersOf && layers_of) {
+    for (auto const& t : tile_cover::get_tiles(g, 4096)) {
+        std::uint32_t x = static_cast<std::uint32_t>(t.x);
+        std::uint32_t y = static_cast<std::uint32_t>(t.y);
+        tile_layer_map * layers = layers_of(x, y);
+        if (!layers) {
+            continue;
+        }
+        if (t.fill) {
+            (*layers)[layer].push_back(geometry::feature<std::int64_t> { fill_geometry, properties, id });
+            continue;
+        }
+        auto og = clip(g, x, y, buffer);
+        if (og) {
+            (*layers)[layer].push_back(geometry::feature<std::int64_t> { std::move(*og), properties, id });
+        }
+    }
+}
+
+/*
+ * The Point features of an index at the zooms m2z --cluster turns them into
+ * clusters. Clusters depend on every point of a layer, so only the lines of
+ * the layers asked for are read, but all of them.
+ */
+class index_clusters {
+public:
+    index_clusters(feature_index const& index, std::set<std::string> const& layers) :
+        options_(index.options().cluster),
+        max_zoom_(index.options().cluster_max_zoom()),
+        layers_() {
+        if (max_zoom_ < 0 || layers.empty()) {
+            return;
+        }
+        index.for_each([&](std::uint64_t, const char * data, std::size_t size) {
+            const char * sep = static_cast<const char*>(std::memchr(data, ' ', size));
+            if (!sep) {
+                return;
+            }
+            std::string layer_name(data, static_cast<std::size_t>(sep - data));
+            if (layers.find(layer_name) == layers.end()) {
+                return;
+            }
+            auto feature = geojson::parse_feature<double>(std::string(sep + 1, data + size));
+            reject_property_handle(feature, "mvt-index cannot read records written with m2f --properties, run m2f without --properties");
+            if (!feature.geometry.is<geometry::point<double>>()) {
+                return;
+            }
+            point_layer & layer = layers_[layer_name].points;
+            layer.points.push_back(feature.geometry.get<geometry::point<double>>());
+            layer.properties.push_back(std::move(feature.properties));
+            layer.ids.push_back(std::move(feature.id));
+        });
+        for (auto & layer : layers_) {
+            point_layer const& points = layer.second.points;
+            layer.second.clusters.reset(new point_clusters(points.points, &points.properties, options_, 0, static_cast<std::size_t>(max_zoom_)));
+        }
+    }
+
+    index_clusters(index_clusters const&) = delete;
+    index_clusters& operator=(index_clusters const&) = delete;
+
+    // True if Point features are replaced by clusters at zoom z.
+    bool clustered(std::uint32_t z) const {
+        return max_zoom_ >= 0 && z <= static_cast<std::uint32_t>(max_zoom_);
+    }
+
+    // Calls visit(layer, feature) with every cluster and unclustered point of
+    // a clustered zoom, in zoom level coordinates, exactly as m2z writes them.
+    template <typename Visitor>
+    void for_each(std::uint32_t z, Visitor && visit) const {
+        double size = static_cast<double>(options_.extent) * std::pow(2.0, static_cast<double>(z));
+        for (auto const& layer : layers_) {
+            point_layer const& points = layer.second.points;
+            point_clusters const& clusters = *layer.second.clusters;
+            for (auto const& p : clusters.zoom(z)) {
+                if (p.is_cluster()) {
+                    geometry::feature<std::int64_t> f {
+                        cluster_to_tile_coord(p, size),
+                        clusters.cluster_properties(p)
+                    };
+                    f.id = geometry::identifier(p.id);
+                    visit(layer.first, f);
+                } else {
+                    geometry::feature<std::int64_t> f {
+                        geom_to_zoom(points.points[p.index], z, options_.extent, 0.0),
+                        points.properties[p.index],
+                        points.ids[p.index]
+                    };
+                    visit(layer.first, f);
+                }
+            }
+        }
+    }
+
+private:
+    struct clustered_layer {
+        point_layer points;
+        std::unique_ptr<point_clusters> clusters;
+    };
+
+    cluster_options options_;
+    int max_zoom_;
+    std::map<std::string, clustered_layer> layers_;
+};
+
+/*
+ * Builds tiles of zoom z straight from a feature index, running the same
+ * project, simplify, cluster, tile cover, clip and encode steps as
+ * m2z | m2t | r2mvt with the options recorded in the index, but only for the
+ * features whose boxes touch the tiles. Each feature is parsed once however
+ * many of the tiles it lands in, and features keep their input order.
+ * `clusters` must be given for clustered zooms. `visit(x, y, buffer)`
+ * receives every tile, with layers in name order and `buffer` left empty if
+ * nothing falls in the tile.
+ */
+template <typename Visit>
+inline void tiles_from_index(feature_index const& index,
+                             std::uint32_t z,
+                             std::vector<std::pair<std::uint32_t, std::uint32_t>> const& tile_list,
+                             index_clusters const* clusters,
+                             tile_budget const& budget,
+                             budget_summary & summary,
+                             Visit && visit) {
+    index_options const& options = index.options();
+    bool clustered = options.cluster_max_zoom() >= 0 && z <= static_cast<std::uint32_t>(options.cluster_max_zoom());
+    if (clustered && !clusters) {
+        throw std::runtime_error("Index Error: clustered zooms need the index clusters");
+    }
+    geometry::polygon<std::int64_t> fill_geometry = tile_fill_polygon(options.buffer);
+    std::map<std::pair<std::uint32_t, std::uint32_t>, tile_layer_map> tiles;
+    for (auto const& t : tile_list) {
+        tiles[t];
+    }
+    auto layers_of = [&](std::uint32_t x, std::uint32_t y) -> tile_layer_map * {
+        auto itr = tiles.find(std::make_pair(x, y));
+        return itr == tiles.end() ? nullptr : &itr->second;
+    };
+    // lines are stored in input order, so sorting by address keeps the
+    // features of a layer in the same order whatever the shape of the tree
+    std::vector<std::pair<const char*, std::size_t>> lines;
+    for (auto const& t : tile_list) {
+        index.search(tile_world_bbox(z, t.first, t.second, options.buffer), [&](const char * data, std::size_t size) {
+            lines.emplace_back(data, size);
+        });
+    }
+    std::sort(lines.begin(), lines.end());
+    lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+    for (auto const& line : lines) {
+        const char * data = line.first;
+        const char * sep = static_cast<const char*>(std::memchr(data, ' ', line.second));
+        if (!sep) {
+            continue;
+        }
+        std::string layer_name(data, static_cast<std::size_t>(sep - data));
+        auto feature = geojson::parse_feature<double>(std::string(sep + 1, data + line.second));
+        reject_property_handle(feature, "mvt-index cannot read records written with m2f --properties, run m2f without --properties");
+        if (clustered && feature.geometry.is<geometry::point<double>>()) {
+            continue;
+        }
+        auto g = geom_to_zoom(feature.geometry, z, 4096, options.simplify_distance);
+        tile_zoom_feature(layer_name, g, feature.properties, feature.id, fill_geometry, options.buffer, layers_of);
+    }
+    if (clustered) {
+        clusters->for_each(z, [&](std::string const& layer_name, geometry::feature<std::int64_t> const& f) {
+            tile_zoom_feature(layer_name, f.geometry, f.properties, f.id, fill_geometry, options.buffer, layers_of);
+        });
+    }
+    std::string buffer;
+    for (auto & tile : tiles) {
+        tile_layers layers;
+        layers.reserve(tile.second.size());
+        for (auto & layer : tile.second) {
+            layers.emplace_back(layer.first, std::move(layer.second));
+        }
+        tile.second.clear();
+        if (budget.enabled()) {
+            encode_budgeted_tile(buffer, layers, budget, summary, static_cast<int>(z),
+                                 static_cast<int>(tile.first.first), static_cast<int>(tile.first.second));
+        } else {
+            encode_tile_layers(buffer, layers);
+        }
+        visit(tile.first.first, tile.first.second, buffer);
+    }
+}
+
+// Builds the single tile z/x/y, see tiles_from_index. Without `clusters`, a
+// clustered zoom clusters the points of the index on the spot.
+inline void tile_from_index(feature_index const& index,
+                            std::uint32_t z,
+                            std::uint32_t x,
+                            std::uint32_t y,
+                            std::string & buffer,
+                            index_clusters const* clusters = nullptr) {
+    std::unique_ptr<index_clusters> local_clusters;
+    int cluster_max_z = index.options().cluster_max_zoom();
+    if (!clusters && cluster_max_z >= 0 && z <= static_cast<std::uint32_t>(cluster_max_z)) {
+        local_clusters.reset(new index_clusters(index, index.options().point_layers));
+        clusters = local_clusters.get();
+    }
+    budget_summary summary;
+    buffer.clear();
+    tiles_from_index(index, z, { std::make_pair(x, y) }, clusters, index.options().budget, summary,
+                     [&](std::uint32_t, std::uint32_t, std::string const& tile) {
+        buffer = tile;
+    });
+}
+
+}}
@@ -0,0 +1,560 @@
+#pragma once
+
+#include "lru_cache.hpp"
+#include "tile_source.hpp"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace mapbox { namespace mrmvt {
+
+struct server_options {
+    std::string path;
+    std::string host = "0.0.0.0";
+    int port = 8080;
+    std::size_t threads = std::thread::hardware_concurrency();
+    std::size_t cache_bytes = 256 * 1024 * 1024;
+};
+
+struct cached_tile {
+    bool found;
+    std::string data;
+    const char * encoding;
+};
+
+using tile_cache = sharded_lru_cache<std::uint64_t, cached_tile>;
+
+inline void set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        throw std::runtime_error("Server Error: failed to set socket non-blocking");
+    }
+}
+
+inline int open_listener(std::string const& host, int port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw std::runtime_error("Server Error: failed to create socket");
+    }
+    int one = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    // every worker binds its own listener and the kernel balances accepts
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<std::uint16_t>(port));
+    if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+        ::close(fd);
+        std::ostringstream err;
+        err << "Server Error: invalid address " << host;
+        throw std::runtime_error(err.str());
+    }
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, 1024) != 0) {
+        ::close(fd);
+        std::ostringstream err;
+        err << "Server Error: failed to listen on " << host << ":" << port << " - " << std::strerror(errno);
+        throw std::runtime_error(err.str());
+    }
+    set_nonblocking(fd);
+    return fd;
+}
+
+// Parses "/{z}/{x}/{y}.pbf" (or .mvt) into a tile coordinate.
+inline bool parse_tile_path(std::string const& path, std::uint32_t & z, std::uint32_t & x, std::uint32_t & y) {
+    unsigned long vz;
+    unsigned long vx;
+    unsigned long vy;
+    char ext[8];
+    if (std::sscanf(path.c_str(), "/%lu/%lu/%lu.%7s", &vz, &vx, &vy, ext) != 4) {
+        return false;
+    }
+    if (std::strcmp(ext, "pbf") != 0 && std::strcmp(ext, "mvt") != 0) {
+        return false;
+    }
+    if (vz > 30 || vx >= (1ul << vz) || vy >= (1ul << vz)) {
+        return false;
+    }
+    z = static_cast<std::uint32_t>(vz);
+    x = static_cast<std::uint32_t>(vx);
+    y = static_cast<std::uint32_t>(vy);
+    return true;
+}
+
+inline bool header_contains(std::string const& headers, const char * needle) {
+    auto itr = std::search(headers.begin(), headers.end(), needle, needle + std::strlen(needle),
+                           [](char a, char b) { return std::tolower(a) == std::tolower(b); });
+    return itr != headers.end();
+}
+
+inline void append_response(std::string & out,
+                            const char * status,
+                            const char * encoding,
+                            const char * body,
+                            std::size_t body_size,
+                            bool keep_alive) {
+    out += "HTTP/1.1 ";
+    out += status;
+    out += "\r\nContent-Type: application/vnd.mapbox-vector-tile\r\nContent-Length: ";
+    out += std::to_string(body_size);
+    if (encoding) {
+        out += "\r\nContent-Encoding: ";
+        out += encoding;
+    }
+    out += keep_alive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n";
+    out.append(body, body_size);
+}
+
+class server_worker {
+public:
+    server_worker(server_options const& options,
+                  tile_cache & cache,
+                  std::atomic<bool> & running,
+                  tile_source const* shared = nullptr) :
+        source_(options.path, shared),
+        cache_(cache),
+        running_(running),
+        listen_fd_(open_listener(options.host, options.port)),
+        epoll_fd_(::epoll_create1(0)),
+        connections_() {
+        if (epoll_fd_ < 0) {
+            ::close(listen_fd_);
+            throw std::runtime_error("Server Error: epoll_create1 failed");
+        }
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = listen_fd_;
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev);
+    }
+
+    ~server_worker() {
+        for (auto const& c : connections_) {
+            ::close(c.first);
+        }
+        ::close(epoll_fd_);
+        ::close(listen_fd_);
+    }
+
+    server_worker(server_worker const&) = delete;
+    server_worker& operator=(server_worker const&) = delete;
+
+    void run() {
+        std::vector<epoll_event> events(256);
+        while (running_.load(std::memory_order_relaxed)) {
+            int n = ::epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), 200);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("Server Error: epoll_wait failed");
+            }
+            for (int i = 0; i < n; ++i) {
+                int fd = events[static_cast<std::size_t>(i)].data.fd;
+                if (fd == listen_fd_) {
+                    accept_all();
+                    continue;
+                }
+                std::uint32_t flags = events[static_cast<std::size_t>(i)].events;
+                if (flags & (EPOLLHUP | EPOLLERR)) {
+                    close_connection(fd);
+                    continue;
+                }
+                if ((flags & EPOLLIN) && !on_readable(fd)) {
+                    continue;
+                }
+                if (flags & EPOLLOUT) {
+                    flush(fd);
+                }
+            }
+        }
+    }
+
+    tile_source const& source() const {
+        return source_;
+    }
+
+private:
+    struct connection {
+        std::string in;
+        std::string out;
+        std::size_t out_offset = 0;
+        bool close_after_write = false;
+        bool want_write = false;
+    };
+
+    void accept_all() {
+        while (true) {
+            int fd = ::accept(listen_fd_, nullptr, nullptr);
+            if (fd < 0) {
+                return;
+            }
+            set_nonblocking(fd);
+            int one = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+            connections_.emplace(fd, connection());
+        }
+    }
+
+    void close_connection(int fd) {
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+        ::close(fd);
+        connections_.erase(fd);
+    }
+
+    // Returns false if the connection was closed.
+    bool on_readable(int fd) {
+        auto itr = connections_.find(fd);
+        if (itr == connections_.end()) {
+            return false;
+        }
+        connection & c = itr->second;
+        char buf[16384];
+        while (true) {
+            ssize_t n = ::read(fd, buf, sizeof(buf));
+            if (n > 0) {
+                c.in.append(buf, static_cast<std::size_t>(n));
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                close_connection(fd);
+                return false;
+            }
+            break;
+        }
+        // answer every complete request in the buffer, which covers pipelining
+        std::size_t start = 0;
+        while (!c.close_after_write) {
+            std::size_t end = c.in.find("\r\n\r\n", start);
+            if (end == std::string::npos) {
+                break;
+            }
+            handle_request(c, c.in.substr(start, end - start));
+            start = end + 4;
+        }
+        c.in.erase(0, start);
+        if (c.in.size() > 65536) {
+            close_connection(fd);
+            return false;
+        }
+        return flush(fd);
+    }
+
+    void handle_request(connection & c, std::string const& request) {
+        std::size_t line_end = request.find("\r\n");
+        std::string line = request.substr(0, line_end);
+        std::string headers = line_end == std::string::npos ? std::string() : request.substr(line_end);
+        bool http10 = line.find("HTTP/1.0") != std::string::npos;
+        bool keep_alive = http10 ? header_contains(headers, "connection: keep-alive")
+                                 : !header_contains(headers, "connection: close");
+        c.close_after_write = !keep_alive;
+
+        std::size_t sp1 = line.find(' ');
+        std::size_t sp2 = line.find(' ', sp1 == std::string::npos ? sp1 : sp1 + 1);
+        std::uint32_t z;
+        std::uint32_t x;
+        std::uint32_t y;
+        if (sp1 == std::string::npos || sp2 == std::string::npos || line.compare(0, sp1, "GET") != 0 ||
+            !parse_tile_path(line.substr(sp1 + 1, sp2 - sp1 - 1), z, x, y)) {
+            append_response(c.out, "400 Bad Request", nullptr, nullptr, 0, keep_alive);
+            return;
+        }
+        tile_cache::value_ptr tile = lookup(z, x, y);
+        if (!tile->found) {
+            append_response(c.out, "404 Not Found", nullptr, nullptr, 0, keep_alive);
+            return;
+        }
+        append_response(c.out, "200 OK", tile->encoding, tile->data.data(), tile->data.size(), keep_alive);
+    }
+
+    tile_cache::value_ptr lookup(std::uint32_t z, std::uint32_t x, std::uint32_t y) {
+        std::uint64_t key = zxy_to_tile_id(z, x, y);
+        tile_cache::value_ptr tile = cache_.get(key);
+        if (tile) {
+            return tile;
+        }
+        std::shared_ptr<cached_tile> fresh = std::make_shared<cached_tile>();
+        fresh->found = source_.get_tile(z, x, y, fresh->data);
+        fresh->encoding = fresh->found ? tile_content_encoding(fresh->data.data(), fresh->data.size()) : nullptr;
+        // misses are cached too so repeated requests for empty tiles stay cheap
+        cache_.put(key, fresh, fresh->data.size() + sizeof(cached_tile));
+        return fresh;
+    }
+
+    // Returns false if the connection was closed.
+    bool flush(int fd) {
+        auto itr = connections_.find(fd);
+        if (itr == connections_.end()) {
+            return false;
+        }
+        connection & c = itr->second;
+        while (c.out_offset < c.out.size()) {
+            ssize_t n = ::write(fd, c.out.data() + c.out_offset, c.out.size() - c.out_offset);
+            if (n > 0) {
+                c.out_offset += static_cast<std::size_t>(n);
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                if (!c.want_write) {
+                    epoll_event ev;
+                    ev.events = EPOLLIN | EPOLLOUT;
+                    ev.data.fd = fd;
+                    ::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev);
+                    c.want_write = true;
+                }
+                return true;
+            }
+            close_connection(fd);
+            return false;
+        }
+        c.out.clear();
+        c.out_offset = 0;
+        if (c.want_write) {
+            epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            ::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev);
+            c.want_write = false;
+        }
+        if (c.close_after_write) {
+            close_connection(fd);
+            return false;
+        }
+        return true;
+    }
+
+    tile_source source_;
+    tile_cache & cache_;
+    std::atomic<bool> & running_;
+    int listen_fd_;
+    int epoll_fd_;
+    std::unordered_map<int, connection> connections_;
+};
+
+/*
+ * Serves /{z}/{x}/{y}.pbf from an MBTiles or tile archive produced by r2mvt.
+ * Each thread runs its own epoll loop over its own SO_REUSEPORT listener and
+ * tile_source; the tile cache is shared between all of them. Returns once
+ * `running` is cleared.
+ */
+inline void serve_tiles(server_options const& options, std::atomic<bool> & running) {
+    tile_cache cache(options.cache_bytes);
+    std::size_t threads = options.threads == 0 ? 1 : options.threads;
+    std::vector<std::unique_ptr<server_worker>> workers;
+    for (std::size_t i = 0; i < threads; ++i) {
+        workers.emplace_back(new server_worker(options, cache, running, i == 0 ? nullptr : &workers[0]->source()));
+    }
+    std::cerr << "Serving " << options.path << " on http://" << options.host << ":" << options.port
+              << " with " << threads << " threads" << std::endl;
+    std::vector<std::thread> pool;
+    for (std::size_t i = 1; i < threads; ++i) {
+        server_worker * w = workers[i].get();
+        pool.emplace_back([w]() { w->run(); });
+    }
+    workers[0]->run();
+    for (auto & t : pool) {
+        t.join();
+    }
+    std::cerr << "Cache hits: " << cache.hits() << " misses: " << cache.misses() << std::endl;
+}
+
+struct load_test_options {
+    std::string path;
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    std::size_t connections = 64;
+    std::size_t requests = 100000;
+};
+
+struct load_test_result {
+    std::size_t requests;
+    std::size_t errors;
+    double seconds;
+    std::vector<double> latencies_us;
+};
+
+inline double percentile(std::vector<double> const& sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    std::size_t idx = static_cast<std::size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+/*
+ * Keep-alive load generator for the tile server. Requests are drawn uniformly
+ * from the tiles present in the tileset at `options.path`, so every request
+ * exercises a real lookup. One request is in flight per connection.
+ */
+inline load_test_result run_load_test(load_test_options const& options) {
+    std::vector<tile_key> tiles;
+    {
+        tile_source source(options.path);
+        tiles = source.list_tiles();
+    }
+    if (tiles.empty()) {
+        throw std::runtime_error("Load Test Error: tileset contains no tiles");
+    }
+
+    struct client {
+        int fd;
+        std::string out;
+        std::size_t out_offset;
+        std::string in;
+        std::chrono::steady_clock::time_point started;
+    };
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<std::uint16_t>(options.port));
+    if (::inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr) != 1) {
+        throw std::runtime_error("Load Test Error: invalid address");
+    }
+
+    int epoll_fd = ::epoll_create1(0);
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<std::size_t> pick(0, tiles.size() - 1);
+    std::size_t issued = 0;
+    std::size_t completed = 0;
+    load_test_result result { 0, 0, 0.0, {} };
+    result.latencies_us.reserve(options.requests);
+
+    // Requests are tiny, so they are written directly; EPOLLOUT is only
+    // watched while a partial write is pending.
+    auto send_request = [&](client & c, std::size_t index) {
+        tile_key const& t = tiles[pick(rng)];
+        c.out = "GET /" + std::to_string(t[0]) + "/" + std::to_string(t[1]) + "/" + std::to_string(t[2]) +
+                ".pbf HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        c.in.clear();
+        c.started = std::chrono::steady_clock::now();
+        ++issued;
+        ssize_t w = ::write(c.fd, c.out.data(), c.out.size());
+        c.out_offset = w > 0 ? static_cast<std::size_t>(w) : 0;
+        epoll_event ev;
+        ev.events = c.out_offset < c.out.size() ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+        ev.data.u64 = index;
+        ::epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c.fd, &ev);
+    };
+
+    std::vector<client> clients(std::min(options.connections, options.requests));
+    for (std::size_t i = 0; i < clients.size(); ++i) {
+        client & c = clients[i];
+        c.fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (c.fd < 0 || ::connect(c.fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            throw std::runtime_error("Load Test Error: failed to connect to server");
+        }
+        int one = 1;
+        ::setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        set_nonblocking(c.fd);
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = i;
+        ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c.fd, &ev);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < clients.size(); ++i) {
+        send_request(clients[i], i);
+    }
+    std::vector<epoll_event> events(clients.size());
+    char buf[65536];
+    while (completed < options.requests) {
+        int n = ::epoll_wait(epoll_fd, events.data(), static_cast<int>(events.size()), 1000);
+        if (n < 0 && errno != EINTR) {
+            throw std::runtime_error("Load Test Error: epoll_wait failed");
+        }
+        for (int i = 0; i < n; ++i) {
+            std::size_t index = static_cast<std::size_t>(events[static_cast<std::size_t>(i)].data.u64);
+            client & c = clients[index];
+            if (c.out_offset < c.out.size()) {
+                ssize_t w = ::write(c.fd, c.out.data() + c.out_offset, c.out.size() - c.out_offset);
+                if (w > 0) {
+                    c.out_offset += static_cast<std::size_t>(w);
+                }
+                if (c.out_offset == c.out.size()) {
+                    epoll_event ev;
+                    ev.events = EPOLLIN;
+                    ev.data.u64 = index;
+                    ::epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c.fd, &ev);
+                }
+            }
+            while (true) {
+                ssize_t r = ::read(c.fd, buf, sizeof(buf));
+                if (r <= 0) {
+                    if (r == 0) {
+                        throw std::runtime_error("Load Test Error: server closed the connection");
+                    }
+                    break;
+                }
+                c.in.append(buf, static_cast<std::size_t>(r));
+            }
+            std::size_t header_end = c.in.find("\r\n\r\n");
+            if (header_end == std::string::npos) {
+                continue;
+            }
+            std::size_t body_size = 0;
+            std::size_t cl = c.in.find("Content-Length: ");
+            if (cl != std::string::npos && cl < header_end) {
+                body_size = static_cast<std::size_t>(std::strtoull(c.in.c_str() + cl + 16, nullptr, 10));
+            }
+            if (c.in.size() < header_end + 4 + body_size) {
+                continue;
+            }
+            double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - c.started).count();
+            result.latencies_us.push_back(us);
+            if (c.in.compare(0, 12, "HTTP/1.1 200") != 0) {
+                ++result.errors;
+            }
+            ++completed;
+            if (issued < options.requests) {
+                send_request(c, index);
+            }
+        }
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.requests = completed;
+    for (auto & c : clients) {
+        ::close(c.fd);
+    }
+    ::close(epoll_fd);
+    std::sort(result.latencies_us.begin(), result.latencies_us.end());
+    return result;
+}
+
+inline void print_load_test(load_test_result const& r) {
+    std::cout << "requests: " << r.requests << " errors: " << r.errors
+              << " seconds: " << r.seconds
+              << " req/s: " << (r.seconds > 0.0 ? static_cast<double>(r.requests) / r.seconds : 0.0) << std::endl;
+    std::cout << "latency us p50: " << percentile(r.latencies_us, 0.50)
+              << " p90: " << percentile(r.latencies_us, 0.90)
+              << " p99: " << percentile(r.latencies_us, 0.99)
+              << " max: " << (r.latencies_us.empty() ? 0.0 : r.latencies_us.back()) << std::endl;
+}
+
+}}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "output_archive.hpp"
+#include "output_mbtiles.hpp"
+#include "tile_on_demand.hpp"
+
+#include <sqlite3.h>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace mapbox { namespace mrmvt {
+
+using tile_key = std::array<std::uint32_t, 3>;
+
+// Content-Encoding of a stored tile, detected from its magic bytes.
+inline const char * tile_content_encoding(const char * data, std::size_t size) {
+    if (size >= 2 && static_cast<unsigned char>(data[0]) == 0x1f && static_cast<unsigned char>(data[1]) == 0x8b) {
+        return "gzip";
+    }
+    if (size >= 4 && static_cast<unsigned char>(data[0]) == 0x28 && static_cast<unsigned char>(data[1]) == 0xb5 &&
+        static_cast<unsigned char>(data[2]) == 0x2f && static_cast<unsigned char>(data[3]) == 0xfd) {
+        return "zstd";
+    }
+    return nullptr;
+}
+
+inline bool has_magic(std::string const& path, const char (&expected)[8]) {
+    std::ifstream in(path, std::ios::binary);
+    char magic[8];
+    if (!in.read(magic, sizeof(magic))) {
+        return false;
+    }
+    return std::memcmp(magic, expected, sizeof(magic)) == 0;
+}
+
+inline bool is_tile_archive(std::string const& path) {
+    return has_magic(path, ARCHIVE_MAGIC);
+}
+
+/*
+ * Read only access to the output of r2mvt, either an MBTiles file or a packed
+ * tile archive, or to a feature index from mvt-index, in which case tiles are
+ * built on request. A tile_source is not thread safe; open one per thread.
+ * The point clusters of an index are read only once built, so sources opened
+ * with `shared` reuse those of that source instead of clustering again.
+ */
+class tile_source {
+public:
+    explicit tile_source(std::string const& path, tile_source const* shared = nullptr) :
+        archive_(),
+        index_(),
+        clusters_(),
+        db_(),
+        stmt_() {
+        if (is_tile_archive(path)) {
+            archive_.reset(new archive_reader(path));
+            return;
+        }
+        if (has_magic(path, INDEX_MAGIC)) {
+            index_.reset(new feature_index(path));
+            if (shared && shared->clusters_) {
+                clusters_ = shared->clusters_;
+            } else if (index_->options().cluster_max_zoom() >= 0) {
+                clusters_ = std::make_shared<index_clusters const>(*index_, index_->options().point_layers);
+            }
+            return;
+        }
+        sqlite3 * db;
+        if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK) {
+            std::ostringstream err;
+            err << "SQLite Error: Failed to open " << path << " - " << sqlite3_errmsg(db) << std::endl;
+            sqlite3_close(db);
+            throw std::runtime_error(err.str());
+        }
+        db_.reset(db);
+        sqlite3_stmt * stmt;
+        const char * query = "select tile_data from tiles where zoom_level = ? and tile_column = ? and tile_row = ?";
+        if (sqlite3_prepare_v2(db_.get(), query, -1, &stmt, NULL) != SQLITE_OK) {
+            std::ostringstream err;
+            err << "SQLite Error: Tile select statement failed to create: " << sqlite3_errmsg(db_.get()) << std::endl;
+            throw std::runtime_error(err.str());
+        }
+        stmt_.reset(stmt);
+    }
+
+    bool is_archive() const {
+        return static_cast<bool>(archive_);
+    }
+
+    // Looks up a tile and copies it into `out`. Returns false if it does not exist.
+    bool get_tile(std::uint32_t z, std::uint32_t x, std::uint32_t y, std::string & out) {
+        if (archive_) {
+            tile_view t = archive_->get_tile(z, x, y);
+            if (!t) {
+                return false;
+            }
+            out.assign(t.data, t.size);
+            return true;
+        }
+        if (index_) {
+            tile_from_index(*index_, z, x, y, out, clusters_.get());
+            return !out.empty();
+        }
+        if (z > 31 || x >= (1u << z) || y >= (1u << z)) {
+            return false;
+        }
+        sqlite3_stmt * stmt = stmt_.get();
+        sqlite3_reset(stmt);
+        sqlite3_bind_int(stmt, 1, static_cast<int>(z));
+        sqlite3_bind_int(stmt, 2, static_cast<int>(x));
+        sqlite3_bind_int(stmt, 3, static_cast<int>((1u << z) - 1 - y));
+        if (sqlite3_step(stmt) != SQLITE_ROW) {
+            return false;
+        }
+        const char * data = static_cast<const char*>(sqlite3_column_blob(stmt, 0));
+        int size = sqlite3_column_bytes(stmt, 0);
+        out.assign(data, static_cast<std::size_t>(size));
+        return true;
+    }
+
+    // Every tile in the source as z/x/y with xyz (not tms) rows. A feature
+    // index has no fixed set of tiles and lists none.
+    std::vector<tile_key> list_tiles() {
+        std::vector<tile_key> tiles;
+        if (index_) {
+            return tiles;
+        }
+        if (archive_) {
+            tiles.reserve(archive_->size());
+            for (std::size_t i = 0; i < archive_->size(); ++i) {
+                tile_key k;
+                tile_id_to_zxy(archive_->entry(i).tile_id, k[0], k[1], k[2]);
+                tiles.push_back(k);
+            }
+            return tiles;
+        }
+        sqlite3_stmt * stmt;
+        const char * query = "select zoom_level, tile_column, tile_row from tiles";
+        if (sqlite3_prepare_v2(db_.get(), query, -1, &stmt, NULL) != SQLITE_OK) {
+            std::ostringstream err;
+            err << "SQLite Error: Tile list statement failed to create: " << sqlite3_errmsg(db_.get()) << std::endl;
+            throw std::runtime_error(err.str());
+        }
+        sqlite_stmt_ptr list_stmt(stmt);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            std::uint32_t z = static_cast<std::uint32_t>(sqlite3_column_int(stmt, 0));
+            std::uint32_t x = static_cast<std::uint32_t>(sqlite3_column_int(stmt, 1));
+            std::uint32_t y = static_cast<std::uint32_t>(sqlite3_column_int(stmt, 2));
+            tiles.push_back(tile_key {{ z, x, (1u << z) - 1 - y }});
+        }
+        return tiles;
+    }
+
+private:
+    std::unique_ptr<archive_reader> archive_;
+    std::unique_ptr<feature_index> index_;
+    std::shared_ptr<index_clusters const> clusters_;
+    sqlite_ptr db_;
+    sqlite_stmt_ptr stmt_;
+};
+
+}}
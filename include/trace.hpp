@@ -0,0 +1,323 @@
+#pragma once
+
+#include "layer_metadata.hpp"
+
+#include <mapbox/geometry.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace mapbox { namespace mrmvt {
+
+struct identifier_to_string_visitor {
+    std::string operator() (std::string const& v) const {
+        return v;
+    }
+
+    template <typename T>
+    std::string operator() (T const& v) const {
+        std::ostringstream buf;
+        buf << v;
+        return buf.str();
+    }
+};
+
+template <typename T>
+std::string feature_id_string(geometry::feature<T> const& f) {
+    if (!f.id) {
+        return std::string();
+    }
+    return geometry::identifier::visit(*f.id, identifier_to_string_visitor());
+}
+
+struct trace_options {
+    std::string path;        // Chrome trace events are written here when set
+    std::size_t slowest = 0; // length of the slowest features report, 0 disables it
+};
+
+// Consumes --trace PATH and --slowest N at argv[i].
+inline bool parse_trace_flag(int argc, char* argv[], int & i, trace_options & options) {
+    bool trace = std::strcmp(argv[i], "--trace") == 0;
+    bool slowest = std::strcmp(argv[i], "--slowest") == 0;
+    if (!trace && !slowest) {
+        return false;
+    }
+    ++i;
+    if (i >= argc) {
+        throw std::runtime_error("Not enough arguments provided");
+    }
+    if (trace) {
+        options.path = argv[i];
+    } else {
+        options.slowest = static_cast<std::size_t>(std::atoll(argv[i]));
+    }
+    return true;
+}
+
+struct slow_feature {
+    double seconds;
+    std::string id;
+    std::string layer;
+    int zoom;
+    std::size_t vertices;
+    std::size_t tiles;
+};
+
+/*
+ * Opt-in tracing for finding pathological inputs. With --trace every span is
+ * written as a Chrome trace event ("ph":"X"), the file opens in
+ * chrome://tracing or ui.perfetto.dev. With --slowest N the N slowest
+ * features are kept and printed to stderr at the end. When neither is set,
+ * active() is null and instrumented code does not even read the clock.
+ */
+class trace_recorder {
+public:
+    static trace_recorder & instance() {
+        static trace_recorder recorder;
+        return recorder;
+    }
+
+    static trace_recorder * active() {
+        trace_recorder & r = instance();
+        return r.enabled_.load(std::memory_order_relaxed) ? &r : nullptr;
+    }
+
+    void start(std::string const& binary, trace_options const& options) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        binary_ = binary;
+        slowest_ = options.slowest;
+        start_ = std::chrono::steady_clock::now();
+        if (!options.path.empty()) {
+            path_ = options.path;
+            out_.open(path_, std::ios::binary | std::ios::trunc);
+            if (!out_) {
+                std::ostringstream err;
+                err << "Trace Error: Failed to open " << path_;
+                throw std::runtime_error(err.str());
+            }
+            out_ << "{\"traceEvents\":[\n";
+            out_ << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"";
+            std::ostringstream name;
+            quote(name, binary_);
+            out_ << name.str() << "\"}}";
+            tracing_ = true;
+        }
+        enabled_.store(tracing_ || slowest_ > 0, std::memory_order_relaxed);
+    }
+
+    bool tracing() const {
+        return tracing_;
+    }
+
+    bool tracking_features() const {
+        return slowest_ > 0;
+    }
+
+    std::chrono::steady_clock::time_point now() const {
+        return std::chrono::steady_clock::now();
+    }
+
+    // `args` is the body of a JSON object, possibly empty.
+    void event(char const* name,
+               char const* category,
+               std::chrono::steady_clock::time_point begin,
+               std::chrono::steady_clock::time_point end,
+               std::string const& args) {
+        if (!tracing_) {
+            return;
+        }
+        double ts = std::chrono::duration<double, std::micro>(begin - start_).count();
+        double dur = std::chrono::duration<double, std::micro>(end - begin).count();
+        char times[96];
+        std::snprintf(times, sizeof(times), "\"ts\":%.3f,\"dur\":%.3f", ts, dur);
+        std::size_t tid = thread_index();
+        std::lock_guard<std::mutex> lock(mutex_);
+        out_ << ",\n{\"name\":\"" << name << "\",\"cat\":\"" << category << "\",\"ph\":\"X\","
+             << times << ",\"pid\":1,\"tid\":" << tid << ",\"args\":{" << args << "}}";
+    }
+
+    // Keeps f if it is among the slowest features seen so far.
+    void feature(slow_feature && f) {
+        if (slowest_ == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (slow_.size() == slowest_) {
+            if (f.seconds <= slow_.front().seconds) {
+                return;
+            }
+            std::pop_heap(slow_.begin(), slow_.end(), faster);
+            slow_.pop_back();
+        }
+        slow_.push_back(std::move(f));
+        std::push_heap(slow_.begin(), slow_.end(), faster);
+    }
+
+    void finish() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (tracing_) {
+            out_ << "\n]}\n";
+            out_.close();
+            tracing_ = false;
+            if (!out_) {
+                std::ostringstream err;
+                err << "Trace Error: failed writing " << path_;
+                throw std::runtime_error(err.str());
+            }
+        }
+        if (slowest_ > 0) {
+            print_slowest(std::cerr);
+        }
+        enabled_.store(false, std::memory_order_relaxed);
+    }
+
+private:
+    trace_recorder() :
+        enabled_(false),
+        tracing_(false),
+        mutex_(),
+        binary_(),
+        path_(),
+        out_(),
+        start_(std::chrono::steady_clock::now()),
+        slowest_(0),
+        slow_() {}
+
+    // min heap, the fastest of the kept features is at the front
+    static bool faster(slow_feature const& a, slow_feature const& b) {
+        return a.seconds > b.seconds;
+    }
+
+    // Small, stable thread ids make the trace viewer's rows readable.
+    static std::size_t thread_index() {
+        static std::atomic<std::size_t> next(1);
+        static thread_local std::size_t index = next++;
+        return index;
+    }
+
+    void print_slowest(std::ostream & out) {
+        std::vector<slow_feature> sorted(slow_);
+        std::sort(sorted.begin(), sorted.end(), faster);
+        char line[256];
+        out << binary_ << " slowest features:\n";
+        std::snprintf(line, sizeof(line), "%12s %5s %-20s %-20s %12s %10s\n", "ms", "zoom", "layer", "id", "vertices", "tiles");
+        out << line;
+        for (auto const& f : sorted) {
+            std::snprintf(line, sizeof(line), "%12.3f %5d %-20s %-20s %12zu %10zu\n",
+                          f.seconds * 1e3, f.zoom, f.layer.c_str(), f.id.empty() ? "-" : f.id.c_str(), f.vertices, f.tiles);
+            out << line;
+        }
+    }
+
+    std::atomic<bool> enabled_;
+    bool tracing_;
+    std::mutex mutex_;
+    std::string binary_;
+    std::string path_;
+    std::ofstream out_;
+    std::chrono::steady_clock::time_point start_;
+    std::size_t slowest_;
+    std::vector<slow_feature> slow_;
+};
+
+/*
+ * One traced span, written when it ends. Arguments are only built when the
+ * span is actually written, so args() takes a callback filling the JSON body.
+ */
+class trace_span {
+public:
+    trace_span(trace_recorder * recorder, char const* name, char const* category) :
+        recorder_(recorder && recorder->tracing() ? recorder : nullptr),
+        name_(name),
+        category_(category),
+        begin_(),
+        args_() {
+        if (recorder_) {
+            begin_ = recorder_->now();
+        }
+    }
+
+    ~trace_span() {
+        if (recorder_) {
+            recorder_->event(name_, category_, begin_, recorder_->now(), args_);
+        }
+    }
+
+    trace_span(trace_span const&) = delete;
+    trace_span& operator=(trace_span const&) = delete;
+
+    void args(std::function<void(std::ostringstream &)> const& fill) {
+        if (recorder_) {
+            std::ostringstream buf;
+            fill(buf);
+            args_ = buf.str();
+        }
+    }
+
+private:
+    trace_recorder * recorder_;
+    char const* name_;
+    char const* category_;
+    std::chrono::steady_clock::time_point begin_;
+    std::string args_;
+};
+
+/*
+ * Times all the work on one feature, for its "feature" trace event and the
+ * slowest features report.
+ */
+class feature_trace {
+public:
+    explicit feature_trace(trace_recorder * recorder) :
+        recorder_(recorder),
+        begin_() {
+        if (recorder_) {
+            begin_ = recorder_->now();
+        }
+    }
+
+    template <typename T>
+    void finish(geometry::feature<T> const& f,
+                std::string const& layer,
+                int zoom,
+                std::size_t vertices,
+                std::size_t tiles) {
+        if (!recorder_) {
+            return;
+        }
+        auto end = recorder_->now();
+        std::string id = feature_id_string(f);
+        if (recorder_->tracing()) {
+            std::ostringstream buf;
+            buf << "\"id\":\"";
+            quote(buf, id);
+            buf << "\",\"layer\":\"";
+            quote(buf, layer);
+            buf << "\",\"zoom\":" << zoom << ",\"vertices\":" << vertices << ",\"tiles\":" << tiles;
+            recorder_->event("feature", "feature", begin_, end, buf.str());
+        }
+        if (recorder_->tracking_features()) {
+            double seconds = std::chrono::duration<double>(end - begin_).count();
+            recorder_->feature(slow_feature { seconds, std::move(id), layer, zoom, vertices, tiles });
+        }
+    }
+
+private:
+    trace_recorder * recorder_;
+    std::chrono::steady_clock::time_point begin_;
+};
+
+}}
@@ -0,0 +1,450 @@
+#pragma once
+
+#include "compress.hpp"
+#include "feature_index.hpp"
+#include "merge_tiles.hpp"
+#include "output_mbtiles.hpp"
+#include "reduce_to_mvt.hpp"
+#include "tile_budget.hpp"
+#include "tile_cover.hpp"
+#include "tile_on_demand.hpp"
+#include "trace.hpp"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace mapbox { namespace mrmvt {
+
+/*
+ * Incremental re-tiling
+ *
+ * A diff is a stream of lines
+ *
+ *   add <layer> <geojson feature>
+ *   modify <layer> <geojson feature>
+ *   delete <layer> <feature id>
+ *
+ * keyed by layer and feature id. Applying it to the feature index of the
+ * previous build yields the index of the new build, and every tile covered by
+ * an old or new geometry of a changed feature is rebuilt from that index and
+ * replaced in the existing MBTiles within one transaction.
+ */
+
+enum diff_op : std::uint8_t {
+    diff_add = 0,
+    diff_modify,
+    diff_delete
+};
+
+struct diff_entry {
+    diff_op op;
+    std::string layer;
+    std::string payload;
+    bool found;
+};
+
+struct update_options {
+    int min_zoom = -1;        // -1 takes minzoom from the MBTiles metadata
+    int max_zoom = -1;        // -1 takes maxzoom from the MBTiles metadata
+    int compression = -1;     // -1 keeps the compression named in the metadata
+};
+
+struct update_summary {
+    std::size_t features_kept = 0;
+    std::size_t added = 0;
+    std::size_t modified = 0;
+    std::size_t deleted = 0;
+    std::size_t missing = 0;
+    std::size_t dirty_tiles = 0;
+    std::size_t tiles_written = 0;
+    std::size_t tiles_removed = 0;
+    budget_summary budget;
+};
+
+inline std::map<std::string, diff_entry> read_diff(std::istream & in) {
+    std::map<std::string, diff_entry> diff;
+    in >> std::noskipws;
+    std::string op;
+    std::string layer;
+    std::string payload;
+    while (std::getline(in, op, ' ') && std::getline(in, layer, ' ') && std::getline(in, payload)) {
+        diff_entry e { diff_add, layer, payload, false };
+        std::string key;
+        if (op == "delete") {
+            e.op = diff_delete;
+            key = feature_key(layer, payload);
+        } else if (op == "add" || op == "modify") {
+            e.op = op == "add" ? diff_add : diff_modify;
+            auto feature = geojson::parse_feature<double>(payload);
+            reject_property_handle(feature, "mvt-index cannot read records written with m2f --properties, run m2f without --properties");
+            key = feature_key(layer, feature);
+            if (key.empty()) {
+                std::ostringstream err;
+                err << "Diff Error: " << op << " of a feature without an id in layer " << layer;
+                throw std::runtime_error(err.str());
+            }
+        } else {
+            std::ostringstream err;
+            err << "Diff Error: unknown operation " << op;
+            throw std::runtime_error(err.str());
+        }
+        diff[key] = std::move(e);
+    }
+    return diff;
+}
+
+using dirty_tile_set = std::set<std::tuple<std::uint32_t, std::uint32_t, std::uint32_t>>;
+
+// Adds every tile the geometry lands in on zooms [min_z, max_z], exactly as m2z | m2t would assign it.
+inline void add_dirty_tiles(dirty_tile_set & dirty,
+                            geometry::geometry<double> const& geom,
+                            int min_z,
+                            int max_z,
+                            double simplify_distance) {
+    for (int z = min_z; z <= max_z; ++z) {
+        auto g = geom_to_zoom(geom, static_cast<std::size_t>(z), 4096, simplify_distance);
+        for (auto const& t : tile_cover::get_tiles(g, 4096)) {
+            dirty.emplace(static_cast<std::uint32_t>(z), t.x, t.y);
+        }
+    }
+}
+
+// Adds the tiles of zooms [min_z, max_z] whose clusters or unclustered
+// points differ between `before` and `after`.
+inline void add_dirty_cluster_tiles(dirty_tile_set & dirty,
+                                    index_clusters const& before,
+                                    index_clusters const& after,
+                                    int min_z,
+                                    int max_z) {
+    using tile_points = std::map<std::pair<std::uint32_t, std::uint32_t>, std::string>;
+    auto collect = [](tile_points & tiles) {
+        return [&tiles](std::string const& layer, geometry::feature<std::int64_t> const& f) {
+            for (auto const& t : tile_cover::get_tiles(f.geometry, 4096)) {
+                std::string & points = tiles[std::make_pair(static_cast<std::uint32_t>(t.x), static_cast<std::uint32_t>(t.y))];
+                points += layer;
+                points += ' ';
+                points += geojson::stringify<std::int64_t>(f);
+                points += '\n';
+            }
+        };
+    };
+    for (int z = min_z; z <= max_z; ++z) {
+        tile_points tiles_before;
+        tile_points tiles_after;
+        before.for_each(static_cast<std::uint32_t>(z), collect(tiles_before));
+        after.for_each(static_cast<std::uint32_t>(z), collect(tiles_after));
+        for (auto const& t : tiles_before) {
+            auto itr = tiles_after.find(t.first);
+            if (itr == tiles_after.end() || itr->second != t.second) {
+                dirty.emplace(static_cast<std::uint32_t>(z), t.first.first, t.first.second);
+            }
+        }
+        for (auto const& t : tiles_after) {
+            if (tiles_before.find(t.first) == tiles_before.end()) {
+                dirty.emplace(static_cast<std::uint32_t>(z), t.first.first, t.first.second);
+            }
+        }
+    }
+}
+
+/*
+ * Updates an MBTiles written by r2mvt in place. Everything happens in one
+ * transaction, so readers see either the old or the new tileset.
+ */
+class mbtiles_updater {
+public:
+    explicit mbtiles_updater(std::string const& path) :
+        db_(),
+        put_map_(),
+        put_image_(),
+        delete_map_() {
+        sqlite3 * db;
+        if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE, NULL) != SQLITE_OK) {
+            std::ostringstream err;
+            err << "SQLite Error: Failed to open " << path << " - " << sqlite3_errmsg(db) << std::endl;
+            sqlite3_close(db);
+            throw std::runtime_error(err.str());
+        }
+        db_.db.reset(db);
+        prepare(put_map_, "insert or replace into map (zoom_level, tile_column, tile_row, tile_id) values (?, ?, ?, ?)");
+        prepare(put_image_, "insert or ignore into images (tile_data, tile_id) values (?, ?)");
+        prepare(delete_map_, "delete from map where zoom_level = ? and tile_column = ? and tile_row = ?");
+        mbtiles_exec(db_, "BEGIN;");
+    }
+
+    std::string metadata(std::string const& name) {
+        sqlite_stmt_ptr stmt;
+        prepare(stmt, "select value from metadata where name = ?");
+        sqlite3_bind_text(stmt.get(), 1, name.c_str(), static_cast<int>(name.size()), SQLITE_TRANSIENT);
+        if (sqlite3_step(stmt.get()) != SQLITE_ROW) {
+            return std::string();
+        }
+        const char * text = reinterpret_cast<const char*>(sqlite3_column_text(stmt.get(), 0));
+        return text ? std::string(text) : std::string();
+    }
+
+    void set_metadata(std::string const& name, std::string const& value) {
+        sqlite_stmt_ptr stmt;
+        prepare(stmt, "insert or replace into metadata (name, value) values (?, ?)");
+        sqlite3_bind_text(stmt.get(), 1, name.c_str(), static_cast<int>(name.size()), SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt.get(), 2, value.c_str(), static_cast<int>(value.size()), SQLITE_TRANSIENT);
+        step(stmt.get(), "metadata update");
+    }
+
+    void put_tile(std::uint32_t z, std::uint32_t x, std::uint32_t y, std::string const& data) {
+        std::string tile_id = tile_hash(data.data(), data.size());
+        sqlite3_stmt * stmt = put_image_.get();
+        sqlite3_reset(stmt);
+        sqlite3_bind_blob(stmt, 1, data.data(), static_cast<int>(data.size()), SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, tile_id.c_str(), static_cast<int>(tile_id.size()), SQLITE_TRANSIENT);
+        step(stmt, "image insert");
+        stmt = put_map_.get();
+        sqlite3_reset(stmt);
+        bind_tile(stmt, z, x, y);
+        sqlite3_bind_text(stmt, 4, tile_id.c_str(), static_cast<int>(tile_id.size()), SQLITE_TRANSIENT);
+        step(stmt, "tile insert");
+    }
+
+    // Returns true if the tile existed.
+    bool delete_tile(std::uint32_t z, std::uint32_t x, std::uint32_t y) {
+        sqlite3_stmt * stmt = delete_map_.get();
+        sqlite3_reset(stmt);
+        bind_tile(stmt, z, x, y);
+        step(stmt, "tile delete");
+        return sqlite3_changes(db_.db.get()) > 0;
+    }
+
+    // Drops blobs no tile points at any more and commits.
+    void commit() {
+        mbtiles_exec(db_, "delete from images where tile_id not in (select tile_id from map);");
+        mbtiles_exec(db_, "COMMIT;");
+    }
+
+private:
+    void prepare(sqlite_stmt_ptr & out, const char * query) {
+        sqlite3_stmt * stmt;
+        if (sqlite3_prepare_v2(db_.db.get(), query, -1, &stmt, NULL) != SQLITE_OK) {
+            std::ostringstream err;
+            err << "SQLite Error: " << sqlite3_errmsg(db_.db.get())
+                << " (only MBTiles written by r2mvt can be updated)" << std::endl;
+            throw std::runtime_error(err.str());
+        }
+        out.reset(stmt);
+    }
+
+    void step(sqlite3_stmt * stmt, const char * what) {
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            std::ostringstream err;
+            err << "SQLite Error: " << what << " failed: " << sqlite3_errmsg(db_.db.get()) << std::endl;
+            throw std::runtime_error(err.str());
+        }
+    }
+
+    static void bind_tile(sqlite3_stmt * stmt, std::uint32_t z, std::uint32_t x, std::uint32_t y) {
+        sqlite3_bind_int(stmt, 1, static_cast<int>(z));
+        sqlite3_bind_int(stmt, 2, static_cast<int>(x));
+        sqlite3_bind_int(stmt, 3, static_cast<int>((1u << z) - 1 - y));
+    }
+
+    sqlite_db db_;
+    sqlite_stmt_ptr put_map_;
+    sqlite_stmt_ptr put_image_;
+    sqlite_stmt_ptr delete_map_;
+};
+
+/*
+ * Applies `diff` to the features of `old_index_path`, writes the result to
+ * `new_index_path` and rebuilds only the dirty tiles of `mbtiles_path`, with
+ * the simplification, clustering and budget recorded in the index. The old
+ * versions of changed features are found through the key table and the
+ * unchanged lines are copied over with their boxes, so only changed features
+ * are parsed. With clustering, the point layers a change touches are read in
+ * full, since one point can move every cluster of its layer.
+ */
+inline update_summary update_tiles(std::istream & diff_stream,
+                                   std::string const& old_index_path,
+                                   std::string const& new_index_path,
+                                   std::string const& mbtiles_path,
+                                   update_options const& options = update_options()) {
+    static const std::size_t batch_tiles = 1024;
+    static const std::uint64_t no_item = std::numeric_limits<std::uint64_t>::max();
+
+    if (old_index_path == new_index_path) {
+        throw std::runtime_error("Update Error: the new index must not overwrite the old one");
+    }
+    update_summary summary;
+    mbtiles_updater db(mbtiles_path);
+    int min_z = options.min_zoom >= 0 ? options.min_zoom : std::atoi(db.metadata("minzoom").c_str());
+    int max_z = options.max_zoom >= 0 ? options.max_zoom : std::atoi(db.metadata("maxzoom").c_str());
+    compression_type compression = compression_gzip;
+    if (options.compression >= 0) {
+        compression = static_cast<compression_type>(options.compression);
+    } else if (!db.metadata("compression").empty()) {
+        compression = parse_compression(db.metadata("compression"));
+    }
+    layer_map_type layer_map;
+    std::string json = db.metadata("json");
+    if (!json.empty()) {
+        merge_vector_layers(layer_map, json);
+    }
+
+    feature_index old_index(old_index_path);
+    index_options build = old_index.options();
+    tile_budget budget = build.budget;
+    budget.compression = compression;
+    int cluster_max_z = build.cluster_max_zoom();
+
+    auto diff = read_diff(diff_stream);
+    dirty_tile_set dirty;
+    std::set<std::string> changed_point_layers;
+    // Points at clustered zooms are placed by clustering and diffed below.
+    auto add_feature_tiles = [&](std::string const& layer, geometry::geometry<double> const& geom) {
+        int from_z = min_z;
+        if (cluster_max_z >= 0 && geom.is<geometry::point<double>>()) {
+            changed_point_layers.insert(layer);
+            from_z = std::max(min_z, cluster_max_z + 1);
+        }
+        add_dirty_tiles(dirty, geom, from_z, max_z, build.simplify_distance);
+    };
+
+    std::vector<bool> replaced(old_index.size(), false);
+    for (auto & d : diff) {
+        old_index.find(feature_key_hash(d.first), [&](std::uint64_t item, const char * data, std::size_t size) {
+            const char * sep = static_cast<const char*>(std::memchr(data, ' ', size));
+            if (!sep) {
+                return;
+            }
+            std::string layer(data, static_cast<std::size_t>(sep - data));
+            auto feature = geojson::parse_feature<double>(std::string(sep + 1, data + size));
+            if (feature_key(layer, feature) != d.first) {
+                return;
+            }
+            d.second.found = true;
+            replaced[item] = true;
+            add_feature_tiles(layer, feature.geometry);
+        });
+    }
+
+    {
+        feature_index_writer writer(new_index_path);
+        std::vector<index_box> boxes(old_index.size());
+        old_index.for_each_box([&](std::uint64_t item, index_box const& box) {
+            boxes[item] = box;
+        });
+        std::vector<std::uint64_t> items(old_index.size(), no_item);
+        old_index.for_each([&](std::uint64_t item, const char * data, std::size_t size) {
+            if (replaced[item]) {
+                return;
+            }
+            items[item] = writer.add(data, size, boxes[item]);
+            ++summary.features_kept;
+        });
+        old_index.for_each_key([&](index_key const& k) {
+            if (items[k.item] != no_item) {
+                writer.add_key(k.hash, items[k.item]);
+            }
+        });
+        for (auto const& d : diff) {
+            diff_entry const& e = d.second;
+            if (e.op == diff_delete) {
+                if (e.found) {
+                    ++summary.deleted;
+                } else {
+                    ++summary.missing;
+                }
+                continue;
+            }
+            auto feature = geojson::parse_feature<double>(e.payload);
+            add_feature_tiles(e.layer, feature.geometry);
+            auto lm = layer_map.find(e.layer);
+            if (lm == layer_map.end()) {
+                lm = layer_map.emplace(e.layer, layer_meta_data { min_z, max_z, std::map<std::string, json_field_type>() }).first;
+            }
+            add_to_fields(lm->second.fields, feature.properties);
+            if (e.found) {
+                ++summary.modified;
+            } else {
+                ++summary.added;
+            }
+            if (build.cluster.enabled && feature.geometry.is<geometry::point<double>>()) {
+                build.point_layers.insert(e.layer);
+            }
+            std::string line = e.layer + " " + e.payload;
+            std::uint64_t item = writer.add(line.data(), line.size(), world_bbox(feature.geometry));
+            writer.add_key(feature_key_hash(d.first), item);
+        }
+        writer.finish(build);
+    }
+
+    feature_index index(new_index_path);
+    std::unique_ptr<index_clusters> clusters;
+    int last_clustered_z = std::min(cluster_max_z, max_z);
+    if (last_clustered_z >= min_z) {
+        if (!changed_point_layers.empty()) {
+            index_clusters before(old_index, changed_point_layers);
+            index_clusters after(index, changed_point_layers);
+            add_dirty_cluster_tiles(dirty, before, after, min_z, last_clustered_z);
+        }
+        if (!dirty.empty() && static_cast<int>(std::get<0>(*dirty.begin())) <= last_clustered_z) {
+            clusters.reset(new index_clusters(index, build.point_layers));
+        }
+    }
+
+    summary.dirty_tiles = dirty.size();
+    std::string compressed;
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> tile_list;
+    auto itr = dirty.begin();
+    while (itr != dirty.end()) {
+        std::uint32_t z = std::get<0>(*itr);
+        tile_list.clear();
+        for (; itr != dirty.end() && std::get<0>(*itr) == z && tile_list.size() < batch_tiles; ++itr) {
+            tile_list.emplace_back(std::get<1>(*itr), std::get<2>(*itr));
+        }
+        tiles_from_index(index, z, tile_list, clusters.get(), budget, summary.budget,
+                         [&](std::uint32_t x, std::uint32_t y, std::string const& buffer) {
+            if (buffer.empty()) {
+                if (db.delete_tile(z, x, y)) {
+                    ++summary.tiles_removed;
+                }
+                return;
+            }
+            compress_tile(buffer, compressed, compression);
+            db.put_tile(z, x, y, compressed);
+            ++summary.tiles_written;
+        });
+    }
+    db.set_metadata("json", vector_layers_json(layer_map));
+    db.commit();
+    return summary;
+}
+
+inline void print_update_summary(std::ostream & out, update_summary const& summary) {
+    out << "Update: " << summary.added << " added, "
+        << summary.modified << " modified, "
+        << summary.deleted << " deleted, "
+        << summary.missing << " deletes not found, "
+        << summary.features_kept << " unchanged; "
+        << summary.dirty_tiles << " dirty tiles, "
+        << summary.tiles_written << " written, "
+        << summary.tiles_removed << " removed" << std::endl;
+    if (summary.budget.tiles > 0) {
+        print_budget_summary(out, summary.budget);
+    }
+}
+
+}}
@@ -0,0 +1,88 @@
+"use strict";
+
+/**
+ * Decoder for the binary geometry encoding returned by
+ * MapToZoom#executeRange, see include/geometry_encoding.hpp.
+ *
+ * @param {Buffer} buffer
+ * @returns {Object} GeoJSON geometry in tile coordinates
+ */
+function decodeGeometry(buffer) {
+    var pos = 0;
+    var x = 0;
+    var y = 0;
+
+    function varint() {
+        var value = 0;
+        var scale = 1;
+        var b;
+        do {
+            if (pos >= buffer.length) throw new Error('truncated geometry');
+            b = buffer[pos++];
+            value += (b & 0x7f) * scale;
+            scale *= 128;
+        } while (b & 0x80);
+        return value;
+    }
+
+    function zigzag() {
+        var v = varint();
+        return v % 2 === 0 ? v / 2 : -(v + 1) / 2;
+    }
+
+    function point() {
+        x += zigzag();
+        y += zigzag();
+        return [x, y];
+    }
+
+    function points() {
+        var n = varint();
+        var out = new Array(n);
+        for (var i = 0; i < n; ++i) out[i] = point();
+        return out;
+    }
+
+    function polygon() {
+        var n = varint();
+        var out = new Array(n);
+        for (var i = 0; i < n; ++i) out[i] = points();
+        return out;
+    }
+
+    function geometry() {
+        var type = buffer[pos++];
+        var i, n, parts;
+        switch (type) {
+        case 1:
+            return { type: 'Point', coordinates: point() };
+        case 2:
+            return { type: 'LineString', coordinates: points() };
+        case 3:
+            return { type: 'Polygon', coordinates: polygon() };
+        case 4:
+            return { type: 'MultiPoint', coordinates: points() };
+        case 5:
+            n = varint();
+            parts = new Array(n);
+            for (i = 0; i < n; ++i) parts[i] = points();
+            return { type: 'MultiLineString', coordinates: parts };
+        case 6:
+            n = varint();
+            parts = new Array(n);
+            for (i = 0; i < n; ++i) parts[i] = polygon();
+            return { type: 'MultiPolygon', coordinates: parts };
+        case 7:
+            n = varint();
+            parts = new Array(n);
+            for (i = 0; i < n; ++i) parts[i] = geometry();
+            return { type: 'GeometryCollection', geometries: parts };
+        default:
+            throw new Error('unknown geometry type ' + type);
+        }
+    }
+
+    return geometry();
+}
+
+module.exports.decodeGeometry = decodeGeometry;
@@ -0,0 +1,249 @@
+"use strict";
+
+/**
+ * Merger of uncompressed vector tiles, the same layer merge r2mvt --merge
+ * does in include/merge_tiles.hpp. Only layer names, key and value
+ * dictionaries and feature tags are decoded, everything else is copied as
+ * encoded.
+ */
+
+function Reader(buffer, start, end) {
+    this.buffer = buffer;
+    this.pos = start;
+    this.end = end;
+}
+
+Reader.prototype.varint = function() {
+    var value = 0;
+    var scale = 1;
+    var b;
+    do {
+        if (this.pos >= this.end) throw new Error('Merge Error: malformed tile');
+        b = this.buffer[this.pos++];
+        value += (b & 0x7f) * scale;
+        scale *= 128;
+    } while (b & 0x80);
+    return value;
+};
+
+Reader.prototype.bytes = function() {
+    var length = this.varint();
+    var start = this.pos;
+    if (length > this.end - start) throw new Error('Merge Error: malformed tile');
+    this.pos += length;
+    return { start: start, end: this.pos };
+};
+
+Reader.prototype.skip = function(wire_type) {
+    if (wire_type === 0) {
+        this.varint();
+    } else if (wire_type === 1) {
+        this.pos += 8;
+    } else if (wire_type === 2) {
+        this.bytes();
+    } else if (wire_type === 5) {
+        this.pos += 4;
+    } else {
+        throw new Error('Merge Error: malformed tile');
+    }
+    if (this.pos > this.end) throw new Error('Merge Error: malformed tile');
+};
+
+function Writer() {
+    this.chunks = [];
+    this.length = 0;
+}
+
+Writer.prototype.buffer = function(buffer) {
+    this.chunks.push(buffer);
+    this.length += buffer.length;
+};
+
+Writer.prototype.varint = function(value) {
+    var bytes = [];
+    while (value >= 128) {
+        bytes.push((value % 128) | 0x80);
+        value = Math.floor(value / 128);
+    }
+    bytes.push(value);
+    this.buffer(Buffer.from(bytes));
+};
+
+Writer.prototype.bytesField = function(field, buffer) {
+    this.varint((field << 3) | 2);
+    this.varint(buffer.length);
+    this.buffer(buffer);
+};
+
+Writer.prototype.finish = function() {
+    return Buffer.concat(this.chunks, this.length);
+};
+
+function layerName(buffer, layer) {
+    var r = new Reader(buffer, layer.start, layer.end);
+    while (r.pos < r.end) {
+        var key = r.varint();
+        if (key === ((1 << 3) | 2)) {
+            var name = r.bytes();
+            return buffer.toString('utf8', name.start, name.end);
+        }
+        r.skip(key & 0x7);
+    }
+    return '';
+}
+
+// Index of `item` in a dictionary of encoded keys or values, added if new.
+function indexOf(dictionary, order, item) {
+    var id = item.toString('binary');
+    var index = dictionary[id];
+    if (index === undefined) {
+        index = dictionary[id] = order.length;
+        order.push(item);
+    }
+    return index;
+}
+
+function mergeLayers(name, slices) {
+    var features = new Writer();
+    var keys = Object.create(null);
+    var key_order = [];
+    var values = Object.create(null);
+    var value_order = [];
+    var extent = 0;
+    var version = 0;
+
+    slices.forEach(function(slice) {
+        var buffer = slice.buffer;
+        var r = new Reader(buffer, slice.start, slice.end);
+        var layer_extent = 4096;
+        var layer_version = 1;
+        var layer_features = [];
+        var key_map = [];
+        var value_map = [];
+        while (r.pos < r.end) {
+            var key = r.varint();
+            var field = Math.floor(key / 8);
+            var wire_type = key & 0x7;
+            if (wire_type === 2 && field === 2) {
+                layer_features.push(r.bytes());
+            } else if (wire_type === 2 && field === 3) {
+                var k = r.bytes();
+                key_map.push(indexOf(keys, key_order, buffer.slice(k.start, k.end)));
+            } else if (wire_type === 2 && field === 4) {
+                var v = r.bytes();
+                value_map.push(indexOf(values, value_order, buffer.slice(v.start, v.end)));
+            } else if (wire_type === 0 && field === 5) {
+                layer_extent = r.varint();
+            } else if (wire_type === 0 && field === 15) {
+                layer_version = r.varint();
+            } else {
+                r.skip(wire_type);
+            }
+        }
+        if (extent === 0) {
+            extent = layer_extent;
+            version = layer_version;
+        } else if (layer_extent !== extent) {
+            throw new Error('Merge Error: layer ' + name + ' has extents ' + extent + ' and ' + layer_extent);
+        }
+        layer_features.forEach(function(feature) {
+            features.bytesField(2, remapFeature(name, buffer, feature, key_map, value_map));
+        });
+    });
+
+    var layer = new Writer();
+    layer.bytesField(1, Buffer.from(name, 'utf8'));
+    features.chunks.forEach(function(chunk) { layer.buffer(chunk); });
+    key_order.forEach(function(k) { layer.bytesField(3, k); });
+    value_order.forEach(function(v) { layer.bytesField(4, v); });
+    layer.varint((5 << 3) | 0);
+    layer.varint(extent);
+    layer.varint((15 << 3) | 0);
+    layer.varint(version);
+    return layer.finish();
+}
+
+// Copies a feature with its tags pointing into the merged dictionaries.
+function remapFeature(name, buffer, feature, key_map, value_map) {
+    var out = new Writer();
+    var tags = [];
+    var r = new Reader(buffer, feature.start, feature.end);
+    while (r.pos < r.end) {
+        var field_start = r.pos;
+        var key = r.varint();
+        var field = Math.floor(key / 8);
+        var wire_type = key & 0x7;
+        if (field === 2 && wire_type === 2) {
+            var packed = r.bytes();
+            var p = new Reader(buffer, packed.start, packed.end);
+            while (p.pos < p.end) tags.push(p.varint());
+        } else if (field === 2 && wire_type === 0) {
+            tags.push(r.varint());
+        } else {
+            r.skip(wire_type);
+            out.buffer(buffer.slice(field_start, r.pos));
+        }
+    }
+    if (tags.length % 2 !== 0) {
+        throw new Error('Merge Error: odd number of tags in layer ' + name);
+    }
+    if (tags.length) {
+        var remapped = new Writer();
+        for (var i = 0; i < tags.length; i += 2) {
+            if (tags[i] >= key_map.length || tags[i + 1] >= value_map.length) {
+                throw new Error('Merge Error: tag index out of range in layer ' + name);
+            }
+            remapped.varint(key_map[tags[i]]);
+            remapped.varint(value_map[tags[i + 1]]);
+        }
+        out.bytesField(2, remapped.finish());
+    }
+    return out.finish();
+}
+
+/**
+ * Merges uncompressed vector tiles of the same z/x/y into one tile, for
+ * instance the pieces a {@link TileStream} emits for a tile. Layers keep the
+ * order in which their names first appear, and same named layers become a
+ * single layer with shared keys and values.
+ *
+ * @param {Buffer[]} tiles
+ * @returns {Buffer}
+ * @example
+ * var tile = mrmvt.mergeTiles([piece_a, piece_b]);
+ */
+function mergeTiles(tiles) {
+    var layers = [];
+    var index = Object.create(null);
+    tiles.forEach(function(buffer) {
+        var r = new Reader(buffer, 0, buffer.length);
+        while (r.pos < r.end) {
+            var key = r.varint();
+            if (key !== ((3 << 3) | 2)) {
+                r.skip(key & 0x7);
+                continue;
+            }
+            var layer = r.bytes();
+            layer.buffer = buffer;
+            var name = layerName(buffer, layer);
+            if (index[name] === undefined) {
+                index[name] = layers.length;
+                layers.push({ name: name, slices: [layer] });
+            } else {
+                layers[index[name]].slices.push(layer);
+            }
+        }
+    });
+    var out = new Writer();
+    layers.forEach(function(layer) {
+        if (layer.slices.length === 1) {
+            var only = layer.slices[0];
+            out.bytesField(3, only.buffer.slice(only.start, only.end));
+        } else {
+            out.bytesField(3, mergeLayers(layer.name, layer.slices));
+        }
+    });
+    return out.finish();
+}
+
+module.exports.mergeTiles = mergeTiles;
@@ -7,3 +7,21 @@ var binding_path = binary.find(path.resolve(path.join(__dirname,'../package.json
 
 var MR_MVT = module.exports = require(binding_path);
 MR_MVT.version = require('../package.json').version;
+MR_MVT.decodeGeometry = require('./geometry.js').decodeGeometry;
+MR_MVT.mergeTiles = require('./merge_tiles.js').mergeTiles;
+
+var TileStream = require('./tile_stream.js');
+
+/**
+ * Creates a {@link TileStream} backed by the native TileBuilder.
+ *
+ * @param {Object} options - see {@link TileStream}
+ * @returns {TileStream}
+ * @example
+ * fs.createReadStream('features.ldjson')
+ *   .pipe(mrmvt.createTileStream({ minzoom: 0, maxzoom: 12 }))
+ *   .on('data', function(tile) { console.log(tile.z, tile.x, tile.y, tile.data.length); });
+ */
+MR_MVT.createTileStream = function(options) {
+    return new TileStream(MR_MVT.TileBuilder, options);
+};
@@ -0,0 +1,177 @@
+"use strict";
+
+var os = require('os');
+var stream = require('stream');
+var util = require('util');
+var mergeTiles = require('./merge_tiles.js').mergeTiles;
+
+/**
+ * A Transform stream that reads line delimited GeoJSON features, or m2f
+ * records `<layer> <feature json>`, and emits encoded vector tiles as
+ * `{ z, x, y, data }` objects. Lines are grouped into batches, each built by
+ * one TileBuilder task in the threadpool, and no more input is accepted while
+ * `max_in_flight` batches are running, so memory stays flat however large
+ * the input is.
+ *
+ * Tiles are built per batch, so a tile touched by features of several
+ * batches is emitted once per batch. Each piece is a complete vector tile
+ * holding only the features of its batch and is flagged `partial: true`.
+ * Pieces of the same z/x/y are combined with {@link mergeTiles}. With the
+ * `merge` option, pieces are held until the input ends and every tile is
+ * emitted once, already merged, with `partial: false`. That gives up the flat
+ * memory use: all tiles are held at once.
+ *
+ * @class TileStream
+ * @param {Function} TileBuilder - the native TileBuilder class
+ * @param {Object} options
+ * @param {number} options.minzoom
+ * @param {number} options.maxzoom
+ * @param {number} [options.batch_size=1000] - features per native task
+ * @param {number} [options.max_in_flight=number of cpus] - native tasks running at once
+ * @param {number} [options.simplify_distance=4] - passed to TileBuilder
+ * @param {number} [options.buffer=8] - passed to TileBuilder
+ * @param {string} [options.layer='features'] - passed to TileBuilder
+ * @param {boolean} [options.merge=false] - emit each tile once, merged, at the end of the input
+ */
+function TileStream(TileBuilder, options) {
+    if (!options || typeof options.minzoom !== 'number' || typeof options.maxzoom !== 'number') {
+        throw new Error('TileStream requires minzoom and maxzoom options');
+    }
+    stream.Transform.call(this, { readableObjectMode: true });
+
+    var builder_options = {};
+    ['simplify_distance', 'buffer', 'layer'].forEach(function(key) {
+        if (options[key] !== undefined) builder_options[key] = options[key];
+    });
+    this._builder = new TileBuilder(builder_options);
+    this._minzoom = options.minzoom;
+    this._maxzoom = options.maxzoom;
+    this._batch_size = options.batch_size || 1000;
+    this._max_in_flight = options.max_in_flight || os.cpus().length;
+    this._merge = !!options.merge;
+    this._pieces = {};
+
+    this._lines = [];
+    this._tail = null;
+    this._in_flight = 0;
+    this._waiting = null;
+    this._flushed = null;
+    this._failed = false;
+}
+
+util.inherits(TileStream, stream.Transform);
+
+TileStream.prototype._transform = function(chunk, encoding, callback) {
+    var start = 0;
+    var end;
+    if (this._tail) {
+        chunk = Buffer.concat([this._tail, chunk]);
+        this._tail = null;
+    }
+    while ((end = chunk.indexOf(10, start)) !== -1) {
+        this._line(chunk.slice(start, end));
+        start = end + 1;
+    }
+    if (start < chunk.length) {
+        // copy the partial line so the chunk it came from can be released
+        this._tail = Buffer.from(chunk.slice(start));
+    }
+    this._pump(false);
+    // full batches left in _lines are dispatched as running tasks complete
+    if (this._in_flight >= this._max_in_flight) {
+        this._waiting = callback;
+    } else {
+        callback();
+    }
+};
+
+TileStream.prototype._flush = function(callback) {
+    if (this._tail) {
+        this._line(this._tail);
+        this._tail = null;
+    }
+    this._pump(true);
+    if (this._in_flight === 0) {
+        this._finish(callback);
+    } else {
+        this._flushed = callback;
+    }
+};
+
+// Emits the merged tiles held back by the `merge` option.
+TileStream.prototype._finish = function(callback) {
+    if (this._failed) return callback();
+    var self = this;
+    var pieces = this._pieces;
+    this._pieces = {};
+    try {
+        Object.keys(pieces).forEach(function(key) {
+            var zxy = key.split('/');
+            var data = pieces[key].length === 1 ? pieces[key][0] : mergeTiles(pieces[key]);
+            self.push({ z: +zxy[0], x: +zxy[1], y: +zxy[2], data: data, partial: false });
+        });
+    } catch (err) {
+        return callback(err);
+    }
+    callback();
+};
+
+TileStream.prototype._line = function(line) {
+    if (line.length === 0 || (line.length === 1 && line[0] === 13)) return;
+    this._lines.push(line);
+};
+
+// Dispatches held lines a batch at a time while fewer than `max_in_flight`
+// tasks are running. A short last batch only goes once the input has ended.
+TileStream.prototype._pump = function(ended) {
+    while (!this._failed && this._in_flight < this._max_in_flight &&
+           (this._lines.length >= this._batch_size || (ended && this._lines.length > 0))) {
+        this._dispatch(this._lines.splice(0, this._batch_size));
+    }
+};
+
+TileStream.prototype._dispatch = function(batch) {
+    var self = this;
+    this._in_flight++;
+    this._builder.build(batch, this._minzoom, this._maxzoom, function(err, tiles) {
+        self._in_flight--;
+        if (self._failed) return;
+        if (err) {
+            self._failed = true;
+            self.emit('error', err);
+            return;
+        }
+        Object.keys(tiles).forEach(function(key) {
+            if (self._merge) {
+                (self._pieces[key] = self._pieces[key] || []).push(tiles[key]);
+                return;
+            }
+            var zxy = key.split('/');
+            self.push({ z: +zxy[0], x: +zxy[1], y: +zxy[2], data: tiles[key], partial: true });
+        });
+        self._pump(!!self._flushed);
+        if (self._waiting && self._in_flight < self._max_in_flight) {
+            var waiting = self._waiting;
+            self._waiting = null;
+            waiting();
+        }
+        if (self._flushed && self._in_flight === 0) {
+            var flushed = self._flushed;
+            self._flushed = null;
+            self._finish(flushed);
+        }
+    });
+};
+
+/**
+ * Number of native tasks currently running.
+ *
+ * @name inFlight
+ * @memberof TileStream
+ * @returns {number}
+ */
+TileStream.prototype.inFlight = function() {
+    return this._in_flight;
+};
+
+module.exports = TileStream;
@@ -1,12 +1,40 @@
 #include "map_to_features.hpp"
+#include "alloc_hooks.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
 
 int main(int argc, char* argv[]) {
     std::string layer_name("layer");
-    if (argc > 1) {
-        layer_name = std::string(argv[1]);
+    std::string properties_path;
+    bool append_properties = false;
+    mapbox::mrmvt::stats_options stats;
+    for (int i = 1; i < argc; ++i) {
+        if (mapbox::mrmvt::parse_stats_flag(argc, argv, i, stats)) {
+            continue;
+        }
+        if (std::strcmp(argv[i], "--properties") == 0 || std::strcmp(argv[i], "--properties-append") == 0) {
+            append_properties = std::strcmp(argv[i], "--properties-append") == 0;
+            ++i;
+            if (i >= argc) {
+                throw std::runtime_error("Not enough arguments provided");
+            }
+            properties_path = argv[i];
+        } else {
+            layer_name = std::string(argv[i]);
+        }
     }
+    mapbox::mrmvt::stats_collector::instance().start("m2f", stats);
     mapbox::geojson::geojson<double> json = mapbox::mrmvt::geojson_std_in<double>();
     mapbox::geometry::feature_collection<double> fc = mapbox::mrmvt::geojson_to_fc<double>(std::move(json));
-    mapbox::mrmvt::to_std_out(fc, layer_name);
+    if (properties_path.empty()) {
+        mapbox::mrmvt::to_std_out(fc, layer_name);
+    } else {
+        mapbox::mrmvt::property_table_writer properties(properties_path, append_properties);
+        mapbox::mrmvt::to_std_out(fc, layer_name, &properties);
+        properties.close();
+    }
+    mapbox::mrmvt::stats_collector::instance().finish();
     return 0;
 }
@@ -1,9 +1,43 @@
 #include "map_to_tile.hpp"
+#include "alloc_hooks.hpp"
+#include "parse_args.hpp"
 
-#include <cstdlib>
+#include <cstring>
 #include <stdexcept>
 
 int main(int argc, char* argv[]) {
-    mapbox::mrmvt::map_to_tile();
+    mapbox::mrmvt::partition_options partitions;
+    mapbox::mrmvt::stats_options stats;
+    mapbox::mrmvt::trace_options trace;
+    for (int i = 1; i < argc; ++i) {
+        if (mapbox::mrmvt::parse_stats_flag(argc, argv, i, stats) ||
+            mapbox::mrmvt::parse_trace_flag(argc, argv, i, trace)) {
+            continue;
+        } else if (std::strcmp(argv[i],"--partitions") == 0) {
+            ++i;
+            if (i >= argc) {
+                throw std::runtime_error("Not enough arguments provided");
+            }
+            partitions.partitions = static_cast<std::size_t>(mapbox::mrmvt::parse_integer_arg(
+                "--partitions", argv[i], 1, static_cast<long long>(mapbox::mrmvt::MAX_PARTITIONS)));
+        } else if (std::strcmp(argv[i],"--output-dir") == 0) {
+            ++i;
+            if (i >= argc) {
+                throw std::runtime_error("Not enough arguments provided");
+            }
+            partitions.output_dir = argv[i];
+        } else if (std::strcmp(argv[i],"--partition-by") == 0) {
+            ++i;
+            if (i >= argc) {
+                throw std::runtime_error("Not enough arguments provided");
+            }
+            partitions.scheme = mapbox::mrmvt::parse_partition_scheme(argv[i]);
+        }
+    }
+    mapbox::mrmvt::stats_collector::instance().start("m2t", stats);
+    mapbox::mrmvt::trace_recorder::instance().start("m2t", trace);
+    mapbox::mrmvt::map_to_tile(partitions);
+    mapbox::mrmvt::trace_recorder::instance().finish();
+    mapbox::mrmvt::stats_collector::instance().finish();
     return 0;
 }
@@ -1,26 +1,59 @@
 #include "map_to_zoom.hpp"
+#include "alloc_hooks.hpp"
+#include "parse_args.hpp"
 
-#include <cstdlib>
+#include <cstring>
 #include <stdexcept>
 
 int main(int argc, char* argv[]) {
+    using mapbox::mrmvt::parse_integer_arg;
+    const long long max_zoom = static_cast<long long>(mapbox::mrmvt::MAX_ZOOM);
     std::size_t min_z = 0;
     std::size_t max_z = 16;
-    for (std::size_t i = 0; i < argc; ++i) {
-        if (std::strcmp(argv[i],"--min") == 0) {
+    mapbox::mrmvt::cluster_options cluster;
+    mapbox::mrmvt::stats_options stats;
+    mapbox::mrmvt::trace_options trace;
+    for (int i = 1; i < argc; ++i) {
+        if (mapbox::mrmvt::parse_stats_flag(argc, argv, i, stats) ||
+            mapbox::mrmvt::parse_trace_flag(argc, argv, i, trace)) {
+            continue;
+        } else if (std::strcmp(argv[i],"--min") == 0) {
             ++i;
             if (i >= argc) {
                 throw std::runtime_error("Not enough arguments provided");
             }
-            min_z = static_cast<std::size_t>(std::atoi(argv[i]));
+            min_z = static_cast<std::size_t>(parse_integer_arg("--min", argv[i], 0, max_zoom));
         } else if (std::strcmp(argv[i],"--max") == 0) {
             ++i;
             if (i >= argc) {
                 throw std::runtime_error("Not enough arguments provided");
             }
-            max_z = static_cast<std::size_t>(std::atoi(argv[i]));
+            max_z = static_cast<std::size_t>(parse_integer_arg("--max", argv[i], 0, max_zoom));
+        } else if (std::strcmp(argv[i],"--cluster") == 0) {
+            cluster.enabled = true;
+        } else if (std::strcmp(argv[i],"--cluster-radius") == 0) {
+            ++i;
+            if (i >= argc) {
+                throw std::runtime_error("Not enough arguments provided");
+            }
+            cluster.enabled = true;
+            cluster.radius = mapbox::mrmvt::parse_double_arg("--cluster-radius", argv[i], 1.0, 65536.0);
+        } else if (std::strcmp(argv[i],"--cluster-max-zoom") == 0) {
+            ++i;
+            if (i >= argc) {
+                throw std::runtime_error("Not enough arguments provided");
+            }
+            cluster.enabled = true;
+            cluster.max_zoom = static_cast<int>(parse_integer_arg("--cluster-max-zoom", argv[i], 0, max_zoom));
         }
     }
-    mapbox::mrmvt::map_to_zoom(min_z, max_z);
+    if (min_z > max_z) {
+        throw std::runtime_error("--min must not be greater than --max");
+    }
+    mapbox::mrmvt::stats_collector::instance().start("m2z", stats);
+    mapbox::mrmvt::trace_recorder::instance().start("m2z", trace);
+    mapbox::mrmvt::map_to_zoom(min_z, max_z, cluster);
+    mapbox::mrmvt::trace_recorder::instance().finish();
+    mapbox::mrmvt::stats_collector::instance().finish();
     return 0;
 }
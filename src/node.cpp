@@ -5,9 +5,13 @@
 #pragma GCC diagnostic pop
 
 #include "node_map_to_zoom.hpp"
+#include "node_tile_builder.hpp"
+#include "node_worker_pool.hpp"
 
 NAN_MODULE_INIT(Init) {
     MapToZoom::Initialize(target);
+    TileBuilder::Initialize(target);
+    WorkerPool::Initialize(target);
 }
 
 /*
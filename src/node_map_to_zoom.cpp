@@ -1,14 +1,121 @@
 #include "node.hpp"
 #include "node_map_to_zoom.hpp"
+#include "node_worker_pool.hpp"
 #include "tile_cover.hpp"
 #include "map_to_zoom.hpp"
+#include "geometry_encoding.hpp"
+#include "lru_cache.hpp"
 
 #include <exception>
 #include <stdexcept>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
 
-MapToZoom::MapToZoom(char const* json, std::size_t size) : 
-    geom(mapbox::geojson::parse_geometry<double>(json, size)) {
+// Per instance cache of projected zoom levels, 16MB by default
+constexpr std::size_t DEFAULT_CACHE_SIZE = 16 * 1024 * 1024;
+
+// One zoom level of a MapToZoom. Only the geometry and its cover are cached,
+// execute stringifies the geometry itself so executeRange never pays for it.
+struct ZoomResult {
+    mapbox::geometry::geometry<std::int64_t> geom;
+    mapbox::tile_cover::tile_coordinates tiles;
+};
+
+// Reduces any GeoJSON object to the geometry MapToZoom works on.
+struct to_source_geometry {
+    mapbox::geometry::geometry<double> operator()(mapbox::geometry::geometry<double> const& g) const {
+        return g;
+    }
+
+    mapbox::geometry::geometry<double> operator()(mapbox::geometry::feature<double> const& f) const {
+        return f.geometry;
+    }
+
+    mapbox::geometry::geometry<double> operator()(mapbox::geometry::feature_collection<double> const& fc) const {
+        mapbox::geometry::geometry_collection<double> gc;
+        gc.reserve(fc.size());
+        for (auto const& f : fc) {
+            gc.push_back(f.geometry);
+        }
+        return gc;
+    }
+};
+
+/*
+ * The geometry of a MapToZoom and the zoom levels already projected and
+ * simplified for it, keyed by zoom, extent and simplify distance. Tasks of
+ * the same instance may run at once, the cache does its own locking.
+ *
+ * The cache bytes are reported to V8 as external memory so the garbage
+ * collector sees what an instance holds. V8 must only be told on the JS
+ * thread, so reporting happens as tasks complete rather than where the cache
+ * grows, and external_memory is only touched on that thread.
+ */
+struct MapToZoomSource {
+    mapbox::geometry::geometry<double> geom;
+    std::size_t cache_size;
+    mapbox::mrmvt::sharded_lru_cache<std::string, ZoomResult> cache;
+    std::size_t external_memory;
+    bool released;
+
+    MapToZoomSource(char const* json, std::size_t size, std::size_t cache_size_) :
+        geom(mapbox::geojson::geojson<double>::visit(mapbox::geojson::parse<double>(std::string(json, size)),
+                                                     to_source_geometry())),
+        cache_size(cache_size_),
+        cache(cache_size_, 4),
+        external_memory(0),
+        released(false) {}
+
+    // Tells V8 how much the cache grew or shrank since the last call.
+    void report_external_memory() {
+        if (released || cache_size == 0) {
+            return;
+        }
+        std::size_t current = cache.size();
+        if (current != external_memory) {
+            Nan::AdjustExternalMemory(static_cast<int>(static_cast<std::int64_t>(current) - static_cast<std::int64_t>(external_memory)));
+            external_memory = current;
+        }
+    }
+
+    // Returns everything reported once the MapToZoom is collected. Tasks
+    // still running keep the cache alive but no longer report it.
+    void release_external_memory() {
+        if (external_memory > 0) {
+            Nan::AdjustExternalMemory(-static_cast<int>(external_memory));
+            external_memory = 0;
+        }
+        released = true;
+    }
+
+    std::shared_ptr<const ZoomResult> zoom(std::size_t z, std::size_t extent, double simplify_distance) {
+        std::ostringstream key;
+        key.precision(17);
+        key << z << "/" << extent << "/" << simplify_distance;
+        std::shared_ptr<const ZoomResult> cached;
+        if (cache_size > 0 && (cached = cache.get(key.str()))) {
+            return cached;
+        }
+        std::shared_ptr<ZoomResult> result = std::make_shared<ZoomResult>();
+        result->geom = mapbox::mrmvt::geom_to_zoom(geom, z, extent, simplify_distance);
+        result->tiles = mapbox::tile_cover::get_tiles(result->geom, static_cast<std::int64_t>(extent));
+        if (cache_size > 0) {
+            cache.put(key.str(), result, mapbox::mrmvt::count_vertices(result->geom) * sizeof(mapbox::geometry::point<std::int64_t>) +
+                                         result->tiles.size() * sizeof(mapbox::tile_cover::tile_coordinate));
+        }
+        return result;
+    }
+};
+
+MapToZoom::MapToZoom(std::shared_ptr<MapToZoomSource> source_) :
+    source(std::move(source_)) {
+}
+
+MapToZoom::~MapToZoom() {
+    source->release_external_memory();
 }
 
 void MapToZoom::Initialize(v8::Handle<v8::Object> target) {
@@ -21,6 +128,8 @@ void MapToZoom::Initialize(v8::Handle<v8::Object> target) {
     lcons->SetClassName(Nan::New("MapToZoom").ToLocalChecked());
     
     Nan::SetPrototypeMethod(lcons, "execute", execute);
+    Nan::SetPrototypeMethod(lcons, "executeRange", executeRange);
+    Nan::SetMethod(lcons, "create", create);
     
     target->Set(Nan::New("MapToZoom").ToLocalChecked(),lcons->GetFunction());
     constructor.Reset(lcons);
@@ -28,10 +137,40 @@ void MapToZoom::Initialize(v8::Handle<v8::Object> target) {
 
 Nan::Persistent<v8::FunctionTemplate> MapToZoom::constructor;
 
+/*
+ * Reads the 'cache_size' option of the constructor and create. Returns false
+ * after setting `error`.
+ */
+static bool GetCacheSize(v8::Local<v8::Value> options_val, std::size_t & cache_size, std::string & error) {
+    if (options_val->IsUndefined()) {
+        return true;
+    }
+    if (!options_val->IsObject()) {
+        error = "arg 'options' must be an object";
+        return false;
+    }
+    v8::Local<v8::Object> options = options_val.As<v8::Object>();
+    if (options->Has(Nan::New("cache_size").ToLocalChecked())) {
+        v8::Local<v8::Value> cache_size_val = options->Get(Nan::New("cache_size").ToLocalChecked());
+        if (!cache_size_val->IsUint32()) {
+            error = "option 'cache_size' must be an unsigned integer";
+            return false;
+        }
+        cache_size = static_cast<std::size_t>(cache_size_val->Uint32Value());
+    }
+    return true;
+}
+
 /**
- * Main class, called MapToZoom
+ * Main class, called MapToZoom. The buffer holds a GeoJSON geometry, Feature
+ * or FeatureCollection, the geometries of a FeatureCollection are handled as
+ * one GeometryCollection. Each instance caches the zoom levels it computed,
+ * so repeating an `execute` with the same zoom and options is free.
+ *
  * @class MapToZoom
  * @param {Buffer} buffer
+ * @param {Object} [options]
+ * @param {number} [options.cache_size=16777216] - bytes of projected zoom levels to keep, reported to V8 as external memory, 0 disables the cache
  * @example
  * var mrmvt = require('index.js');
  * var m2z = new mrmvt.MapToZoom(buffer);
@@ -41,6 +180,15 @@ NAN_METHOD(MapToZoom::New) {
         return Nan::ThrowTypeError("Cannot call constructor as function, you need to use 'new' keyword");
     }
 
+    // from AfterCreate, the source was already parsed in the threadpool
+    if (info.Length() == 1 && info[0]->IsExternal()) {
+        auto * parsed = static_cast<std::shared_ptr<MapToZoomSource>*>(info[0].As<v8::External>()->Value());
+        auto *const self = new MapToZoom(*parsed);
+        self->Wrap(info.This());
+        info.GetReturnValue().Set(info.This());
+        return;
+    }
+
     if (info.Length() < 1) {
         return Nan::ThrowTypeError("MapToZoom requires one parameter, a buffer");
     }
@@ -55,9 +203,14 @@ NAN_METHOD(MapToZoom::New) {
     if (json_size <= 0) {
         return Nan::ThrowTypeError("buffer is empty");
     }
+    std::size_t cache_size = DEFAULT_CACHE_SIZE;
+    std::string options_error;
+    if (!GetCacheSize(info[1], cache_size, options_error)) {
+        return Nan::ThrowTypeError(options_error.c_str());
+    }
     try {
         const char* json = node::Buffer::Data(obj);
-        auto *const self = new MapToZoom(json, json_size);
+        auto *const self = new MapToZoom(std::make_shared<MapToZoomSource>(json, json_size, cache_size));
         self->Wrap(info.This());
     } catch (const std::exception &ex) {
         std::string err_msg = "Error in processing buffer: ";
@@ -67,6 +220,109 @@ NAN_METHOD(MapToZoom::New) {
     info.GetReturnValue().Set(info.This());
 }
 
+/**
+ * Create a MapToZoom without blocking the event loop, the buffer is parsed
+ * in the threadpool.
+ *
+ * @name create
+ * @memberof MapToZoom
+ * @static
+ * @param {Buffer} buffer - a GeoJSON geometry, Feature or FeatureCollection
+ * @param {Object} [options] - as for the constructor
+ * @param {Function} callback - called with an error or the new MapToZoom
+ * @example
+ * mrmvt.MapToZoom.create(buffer, function(err, m2z) {
+ *   if (err) throw err;
+ *   m2z.execute(0, {}, function(err, response) {});
+ * });
+ */
+
+struct MapToZoomCreateBaton {
+    uv_work_t request; // required
+    Nan::Persistent<v8::Function> cb; // callback function type
+    std::string json;
+    std::size_t cache_size;
+    std::string error_name;
+    std::shared_ptr<MapToZoomSource> source;
+
+    MapToZoomCreateBaton(const char * data,
+                         std::size_t size,
+                         std::size_t cache_size_,
+                         v8::Local<v8::Function> const& callback) :
+            request(),
+            cb(callback),
+            json(data, size),
+            cache_size(cache_size_),
+            error_name(),
+            source() {
+        request.data = this;
+    }
+};
+
+NAN_METHOD(MapToZoom::create) {
+    v8::Local<v8::Value> callback_val = info[info.Length() > 0 ? info.Length() - 1 : 0];
+    if (info.Length() < 2 || !callback_val->IsFunction()) {
+        Nan::ThrowTypeError("last arg 'callback' must be a function");
+        return;
+    }
+    v8::Local<v8::Function> callback = callback_val.As<v8::Function>();
+
+    if (!info[0]->IsObject() || !node::Buffer::HasInstance(info[0])) {
+        CallbackError("arg must be a buffer", callback);
+        return;
+    }
+    std::size_t json_size = node::Buffer::Length(info[0]);
+    if (json_size == 0) {
+        CallbackError("buffer is empty", callback);
+        return;
+    }
+    std::size_t cache_size = DEFAULT_CACHE_SIZE;
+    std::string options_error;
+    if (info.Length() > 2 && !GetCacheSize(info[1], cache_size, options_error)) {
+        CallbackError(options_error, callback);
+        return;
+    }
+
+    // the bytes are copied, the Buffer may change before the task runs
+    MapToZoomCreateBaton *baton = new MapToZoomCreateBaton(node::Buffer::Data(info[0]), json_size, cache_size, callback);
+    WorkerPool::QueueWork(&baton->request, AsyncCreate, AfterCreate);
+}
+
+void MapToZoom::AsyncCreate(uv_work_t* req)
+{
+    MapToZoomCreateBaton *baton = static_cast<MapToZoomCreateBaton *>(req->data);
+
+    try {
+        baton->source = std::make_shared<MapToZoomSource>(baton->json.data(), baton->json.size(), baton->cache_size);
+        baton->json.clear();
+        baton->json.shrink_to_fit();
+    } catch (std::exception const& ex) {
+        baton->error_name = "Error in processing buffer: ";
+        baton->error_name += ex.what();
+    }
+}
+
+void MapToZoom::AfterCreate(uv_work_t* req)
+{
+    Nan::HandleScope scope;
+
+    MapToZoomCreateBaton *baton = static_cast<MapToZoomCreateBaton *>(req->data);
+
+    if (!baton->error_name.empty()) {
+        v8::Local<v8::Value> argv[1] = { Nan::Error(baton->error_name.c_str()) };
+        Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New(baton->cb), 1, argv);
+    } else {
+        v8::Local<v8::Value> ctor_argv[1] = { Nan::New<v8::External>(&baton->source) };
+        v8::Local<v8::Function> ctor = Nan::GetFunction(Nan::New(constructor)).ToLocalChecked();
+        v8::Local<v8::Object> instance = Nan::NewInstance(ctor, 1, ctor_argv).ToLocalChecked();
+        v8::Local<v8::Value> argv[2] = { Nan::Null(), instance };
+        Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New(baton->cb), 2, argv);
+    }
+
+    baton->cb.Reset();
+    delete baton;
+}
+
 /**
  * Tile coordinates information as an array in the form of
  * [x, y, is_solid]
@@ -75,6 +331,15 @@ NAN_METHOD(MapToZoom::New) {
  * 
  */
 
+/**
+ * Tile coordinates returned when the `typed_tiles` option is set. Tile i is
+ * at x = xy[2 * i], y = xy[2 * i + 1] and is solid when fill[i] is 1.
+ *
+ * @typedef {Object} typedTileCoordinates
+ * @property {Uint32Array} xy - x/y pairs of every tile
+ * @property {Uint8Array} fill - 1 for tiles entirely inside a polygon, else 0
+ */
+
 /**
  * The callback type 'mapToZoomCallback' and is the definition
  * of the callback required for using the MapToZoom objects's 
@@ -85,7 +350,8 @@ NAN_METHOD(MapToZoom::New) {
  * @param {Object} [response]
  * @param {number} [response.zoom] - the zoom level of the data provided
  * @param {string} [response.data] - a string containing the geometry data for the zoom level
- * @param {tileCoordinates[]} [response.tiles] - array of tile coordinates
+ * @param {tileCoordinates[]|typedTileCoordinates} [response.tiles] - tile coordinates, as typed arrays when `typed_tiles` is set
+ * @param {number[]} [response.counts] - when clustering, the number of points in each cluster of `data`
  */
 
 /**
@@ -99,6 +365,10 @@ NAN_METHOD(MapToZoom::New) {
  * @param {Object} [options]
  * @param {number} [options.simplify_distance=4] - the distance for simplification, 0 disables simplification
  * @param {number} [options.extent=4096] - the size of the extent for tiles
+ * @param {boolean} [options.typed_tiles=false] - return tiles as {@link typedTileCoordinates}, which are
+ * built in the threadpool and cost nothing on the main thread for large covers
+ * @param {number} [options.cluster_radius=0] - for MultiPoint geometries, cluster points within this many
+ * extent units of each other and return the cluster centers, 0 disables clustering
  * @param {mapToZoomCallback} callback
  * @example
  * var m2z = new mrmvt.MapToZoom();
@@ -109,40 +379,178 @@ NAN_METHOD(MapToZoom::New) {
  *
  */
 
+static v8::Local<v8::Array> TilesToArray(mapbox::tile_cover::tile_coordinates const& tiles) {
+    v8::Local<v8::Array> result = Nan::New<v8::Array>(tiles.size());
+    std::size_t i = 0;
+    for (auto const& t : tiles) {
+        v8::Local<v8::Array> row = Nan::New<v8::Array>(3);
+        Nan::Set(row, 0, Nan::New(t.x));
+        Nan::Set(row, 1, Nan::New(t.y));
+        Nan::Set(row, 2, Nan::New(t.fill));
+        Nan::Set(result, i++, row);
+    }
+    return result;
+}
+
+// Frees a vector backing a Buffer once V8 collects it.
+template <typename T>
+static void FreeVector(char *, void * hint) {
+    delete static_cast<std::vector<T>*>(hint);
+}
+
+// Hands a vector over to a Buffer without copying it.
+template <typename T>
+static v8::Local<v8::Object> VectorToBuffer(std::unique_ptr<std::vector<T>> & values) {
+    if (!values || values->empty()) {
+        return Nan::NewBuffer(0).ToLocalChecked();
+    }
+    std::vector<T> * raw = values.release();
+    return Nan::NewBuffer(reinterpret_cast<char*>(raw->data()),
+                          static_cast<std::uint32_t>(raw->size() * sizeof(T)),
+                          FreeVector<T>,
+                          raw).ToLocalChecked();
+}
+
+/*
+ * The tile cover of one zoom level. With typed_tiles the tiles are flattened
+ * into x/y pairs and fill flags while still in the threadpool, so returning
+ * them only wraps two Buffers instead of creating an array per tile.
+ */
+struct TileCover {
+    bool typed;
+    mapbox::tile_cover::tile_coordinates tiles;
+    std::unique_ptr<std::vector<std::uint32_t>> xy;
+    std::unique_ptr<std::vector<std::uint8_t>> fill;
+
+    TileCover() :
+        typed(false),
+        tiles(),
+        xy(),
+        fill() {}
+
+    void set(mapbox::tile_cover::tile_coordinates && t, bool typed_) {
+        typed = typed_;
+        if (!typed) {
+            tiles = std::move(t);
+            return;
+        }
+        xy.reset(new std::vector<std::uint32_t>());
+        fill.reset(new std::vector<std::uint8_t>());
+        xy->reserve(t.size() * 2);
+        fill->reserve(t.size());
+        for (auto const& tile : t) {
+            xy->push_back(static_cast<std::uint32_t>(tile.x));
+            xy->push_back(static_cast<std::uint32_t>(tile.y));
+            fill->push_back(tile.fill ? 1 : 0);
+        }
+    }
+
+    v8::Local<v8::Value> ToJS() {
+        if (!typed) {
+            return TilesToArray(tiles);
+        }
+        std::size_t count = xy ? xy->size() : 0;
+        v8::Local<v8::Object> xy_buffer = VectorToBuffer(xy);
+        v8::Local<v8::Object> fill_buffer = VectorToBuffer(fill);
+        v8::Local<v8::Uint8Array> bytes = xy_buffer.As<v8::Uint8Array>();
+        v8::Local<v8::Object> result = Nan::New<v8::Object>();
+        Nan::Set(result, Nan::New("xy").ToLocalChecked(),
+                 v8::Uint32Array::New(bytes->Buffer(), bytes->ByteOffset(), count));
+        Nan::Set(result, Nan::New("fill").ToLocalChecked(), fill_buffer);
+        return result;
+    }
+};
+
 struct MapToZoomBaton {
     uv_work_t request; // required
     Nan::Persistent<v8::Function> cb; // callback function type
-    mapbox::geometry::geometry<double> const& geom;
-    mapbox::tile_cover::tile_coordinates tiles;
+    std::shared_ptr<MapToZoomSource> source;
+    std::shared_ptr<const ZoomResult> zoomed;
+    TileCover tiles;
+    bool typed_tiles;
     double simplify_distance;
+    double cluster_radius;
     std::size_t zoom;
     std::size_t extent;
     std::string error_name;
     std::string result;
+    std::vector<std::uint32_t> counts;
 
-    MapToZoomBaton(mapbox::geometry::geometry<double> const& g,
+    MapToZoomBaton(std::shared_ptr<MapToZoomSource> const& source_,
                    double simplify_distance_,
+                   double cluster_radius_,
                    std::size_t zoom_,
                    std::size_t extent_,
                    v8::Local<v8::Function> const& callback) : 
             request(),
             cb(callback),
-            geom(g),
+            source(source_),
+            zoomed(),
             tiles(),
+            typed_tiles(false),
             simplify_distance(simplify_distance_),
+            cluster_radius(cluster_radius_),
             zoom(zoom_),
             extent(extent_),
             error_name(),
-            result() {
+            result(),
+            counts() {
         request.data = this;
     }
 };
 
+/*
+ * Reads the 'extent', 'simplify_distance' and 'typed_tiles' options shared by
+ * execute and executeRange. Returns false after passing an error to the callback.
+ */
+static bool GetTileOptions(v8::Local<v8::Object> options,
+                           std::size_t & extent,
+                           double & simplify_distance,
+                           bool & typed_tiles,
+                           v8::Local<v8::Function> callback) {
+    if (options->Has(Nan::New("extent").ToLocalChecked())) {
+        v8::Local<v8::Value> extent_val = options->Get(Nan::New("extent").ToLocalChecked());
+        if (!extent_val->IsUint32())
+        {
+            CallbackError("option 'extent' must be an unsigned integer", callback);
+            return false;
+        }
+        extent = static_cast<std::size_t>(extent_val->Uint32Value());
+    }
+    
+    if (options->Has(Nan::New("simplify_distance").ToLocalChecked())) {
+        v8::Local<v8::Value> simplify_distance_val = options->Get(Nan::New("simplify_distance").ToLocalChecked());
+        if (!simplify_distance_val->IsNumber())
+        {
+            CallbackError("option 'simplify_distance' must be an number", callback);
+            return false;
+        }
+        simplify_distance = simplify_distance_val->NumberValue();
+        if (simplify_distance < 0.0) {
+            CallbackError("option 'simplify_distance' must be a positive number value", callback);
+            return false;
+        }
+    }
+
+    if (options->Has(Nan::New("typed_tiles").ToLocalChecked())) {
+        v8::Local<v8::Value> typed_tiles_val = options->Get(Nan::New("typed_tiles").ToLocalChecked());
+        if (!typed_tiles_val->IsBoolean())
+        {
+            CallbackError("option 'typed_tiles' must be a boolean", callback);
+            return false;
+        }
+        typed_tiles = typed_tiles_val->BooleanValue();
+    }
+    return true;
+}
+
 NAN_METHOD(MapToZoom::execute) {
     // Default values
     std::size_t zoom = 0;
     std::size_t extent = 4096;
     double simplify_distance = 4.0;
+    double cluster_radius = 0.0;
+    bool typed_tiles = false;
 
     // check third argument, should be a 'callback' function.
     // This allows us to set the callback so we can use it to return errors
@@ -167,26 +575,20 @@ NAN_METHOD(MapToZoom::execute) {
     }
     v8::Local<v8::Object> options = info[1].As<v8::Object>();
 
-    if (options->Has(Nan::New("extent").ToLocalChecked())) {
-        v8::Local<v8::Value> extent_val = options->Get(Nan::New("extent").ToLocalChecked());
-        if (!extent_val->IsUint32())
-        {
-            CallbackError("option 'extent' must be an unsigned integer", callback);
-            return;
-        }
-        extent = static_cast<std::size_t>(extent_val->Uint32Value());
+    if (!GetTileOptions(options, extent, simplify_distance, typed_tiles, callback)) {
+        return;
     }
-    
-    if (options->Has(Nan::New("simplify_distance").ToLocalChecked())) {
-        v8::Local<v8::Value> simplify_distance_val = options->Get(Nan::New("simplify_distance").ToLocalChecked());
-        if (!simplify_distance_val->IsNumber())
+
+    if (options->Has(Nan::New("cluster_radius").ToLocalChecked())) {
+        v8::Local<v8::Value> cluster_radius_val = options->Get(Nan::New("cluster_radius").ToLocalChecked());
+        if (!cluster_radius_val->IsNumber())
         {
-            CallbackError("option 'simplify_distance' must be an number", callback);
+            CallbackError("option 'cluster_radius' must be a number", callback);
             return;
         }
-        simplify_distance = simplify_distance_val->NumberValue();
-        if (simplify_distance < 0.0) {
-            CallbackError("option 'simplify_distance' must be a positive number value", callback);
+        cluster_radius = cluster_radius_val->NumberValue();
+        if (cluster_radius < 0.0) {
+            CallbackError("option 'cluster_radius' must be a positive number value", callback);
             return;
         }
     }
@@ -194,19 +596,19 @@ NAN_METHOD(MapToZoom::execute) {
     // set up the baton to pass into our threadpool
     MapToZoom* me = Nan::ObjectWrap::Unwrap<MapToZoom>(info.Holder());
 
-    MapToZoomBaton *baton = new MapToZoomBaton(me->geom, simplify_distance, zoom, extent, callback);
+    MapToZoomBaton *baton = new MapToZoomBaton(me->source, simplify_distance, cluster_radius, zoom, extent, callback);
+    baton->typed_tiles = typed_tiles;
 
     /*
-    `uv_queue_work` is the all-important way to pass info into the threadpool.
+    `WorkerPool::QueueWork` is the all-important way to pass info into the threadpool.
     It cannot take v8 objects, so we need to do some manipulation above to convert into cpp objects
-    otherwise things get janky. It takes four arguments:
+    otherwise things get janky. It takes three arguments:
 
-    1) which loop to use, node only has one so we pass in a pointer to the default
-    2) the baton defined above, we use this to access information important for the method
-    3) operations to be executed within the threadpool
-    4) operations to be executed after #3 is complete to pass into the callback
+    1) the baton defined above, we use this to access information important for the method
+    2) operations to be executed within the threadpool
+    3) operations to be executed after #2 is complete to pass into the callback
     */
-    uv_queue_work(uv_default_loop(), &baton->request, AsyncExecute, (uv_after_work_cb)AfterExecute);
+    WorkerPool::QueueWork(&baton->request, AsyncExecute, AfterExecute);
     return;
 }
 
@@ -216,12 +618,27 @@ void MapToZoom::AsyncExecute(uv_work_t* req)
 
     // The try/catch is critical here: if code was added that could throw an unhandled error INSIDE the threadpool, it would be disasterous
     try {
-        mapbox::geometry::geometry<std::int64_t> g = mapbox::mrmvt::geom_to_zoom(baton->geom, 
-                                                          baton->zoom,
-                                                          baton->extent,
-                                                          baton->simplify_distance);
-        baton->result = mapbox::geojson::stringify<std::int64_t>(g);
-        baton->tiles = mapbox::tile_cover::get_tiles(g, baton->extent);
+        mapbox::geometry::geometry<double> const& geom = baton->source->geom;
+        if (baton->cluster_radius > 0.0 && geom.is<mapbox::geometry::multi_point<double>>()) {
+            mapbox::mrmvt::cluster_options options;
+            options.radius = baton->cluster_radius;
+            options.extent = baton->extent;
+            mapbox::mrmvt::point_clusters clusters(geom.get<mapbox::geometry::multi_point<double>>(),
+                                                   nullptr, options, baton->zoom, baton->zoom);
+            double size = baton->extent * std::pow(2, baton->zoom);
+            mapbox::geometry::multi_point<std::int64_t> centers;
+            for (auto const& p : clusters.zoom(baton->zoom)) {
+                centers.push_back(mapbox::mrmvt::cluster_to_tile_coord(p, size));
+                baton->counts.push_back(p.count);
+            }
+            mapbox::geometry::geometry<std::int64_t> g = std::move(centers);
+            baton->result = mapbox::geojson::stringify<std::int64_t>(g);
+            baton->tiles.set(mapbox::tile_cover::get_tiles(g, baton->extent), baton->typed_tiles);
+        } else {
+            baton->zoomed = baton->source->zoom(baton->zoom, baton->extent, baton->simplify_distance);
+            baton->result = mapbox::geojson::stringify<std::int64_t>(baton->zoomed->geom);
+            baton->tiles.set(mapbox::tile_cover::tile_coordinates(baton->zoomed->tiles), baton->typed_tiles);
+        }
     } catch (std::exception const& ex) {
         baton->error_name = ex.what();
     }
@@ -233,24 +650,23 @@ void MapToZoom::AfterExecute(uv_work_t* req)
     Nan::HandleScope scope;
 
     MapToZoomBaton *baton = static_cast<MapToZoomBaton *>(req->data);
+    baton->source->report_external_memory();
 
     if (!baton->error_name.empty()) {
         v8::Local<v8::Value> argv[1] = { Nan::Error(baton->error_name.c_str()) };
         Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New(baton->cb), 1, argv);
     } else {
         v8::Local<v8::Object> result = Nan::New<v8::Object>();
-        v8::Local<v8::Array> tiles = Nan::New<v8::Array>(baton->tiles.size());
-        std::size_t i = 0;
-        for (auto const& t : baton->tiles) {
-            v8::Local<v8::Array> row = Nan::New<v8::Array>(3);
-            Nan::Set(row, 0, Nan::New(t.x));
-            Nan::Set(row, 1, Nan::New(t.y));
-            Nan::Set(row, 2, Nan::New(t.fill));
-            Nan::Set(tiles, i++, row);
-        }
-        Nan::Set(result, Nan::New("tiles").ToLocalChecked(), tiles);
+        Nan::Set(result, Nan::New("tiles").ToLocalChecked(), baton->tiles.ToJS());
         Nan::Set(result, Nan::New("zoom").ToLocalChecked(), Nan::New(static_cast<std::uint32_t>(baton->zoom)));
-        Nan::Set(result, Nan::New("data").ToLocalChecked(), Nan::New<v8::String>(baton->result.data()).ToLocalChecked());
+        Nan::Set(result, Nan::New("data").ToLocalChecked(), Nan::New<v8::String>(baton->result.data(), static_cast<int>(baton->result.size())).ToLocalChecked());
+        if (!baton->zoomed) {
+            v8::Local<v8::Array> counts = Nan::New<v8::Array>(baton->counts.size());
+            for (std::size_t j = 0; j < baton->counts.size(); ++j) {
+                Nan::Set(counts, j, Nan::New(baton->counts[j]));
+            }
+            Nan::Set(result, Nan::New("counts").ToLocalChecked(), counts);
+        }
         v8::Local<v8::Value> argv[2] = { Nan::Null(), result };
         Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New(baton->cb), 2, argv);
     }
@@ -259,3 +675,170 @@ void MapToZoom::AfterExecute(uv_work_t* req)
     delete baton;
 }
 
+/**
+ * Response for a single zoom level of executeRange
+ *
+ * @typedef {Object} zoomResult
+ * @property {number} zoom - the zoom level of the data provided
+ * @property {Buffer} data - the geometry in tile coordinates, in the binary encoding read by `mrmvt.decodeGeometry`
+ * @property {tileCoordinates[]|typedTileCoordinates} tiles - tile coordinates, as typed arrays when `typed_tiles` is set
+ */
+
+/**
+ * Request data in tile coordinates for every zoom level from minZoom to
+ * maxZoom in a single threadpool task. Geometries are returned as Buffers
+ * pointing straight at the encoded data, so nothing is copied or parsed.
+ *
+ * @name executeRange
+ * @memberof MapToZoom
+ * @param {number} minZoom
+ * @param {number} maxZoom - at most 24
+ * @param {Object} [options]
+ * @param {number} [options.simplify_distance=4] - the distance for simplification, 0 disables simplification
+ * @param {number} [options.extent=4096] - the size of the extent for tiles
+ * @param {boolean} [options.typed_tiles=false] - return tiles as {@link typedTileCoordinates}
+ * @param {Function} callback - called with an error or an array of {@link zoomResult}, one per zoom
+ * @example
+ * var m2z = new mrmvt.MapToZoom(buffer);
+ * m2z.executeRange(0, 14, {}, function(err, zooms) {
+ *   if (err) throw err;
+ *   var geometry = mrmvt.decodeGeometry(zooms[0].data);
+ * });
+ *
+ */
+
+struct MapToZoomRangeBaton {
+    uv_work_t request; // required
+    Nan::Persistent<v8::Function> cb; // callback function type
+    std::shared_ptr<MapToZoomSource> source;
+    double simplify_distance;
+    std::size_t min_zoom;
+    std::size_t max_zoom;
+    std::size_t extent;
+    std::string error_name;
+    std::vector<std::unique_ptr<std::string>> data;
+    std::vector<TileCover> tiles;
+    bool typed_tiles;
+
+    MapToZoomRangeBaton(std::shared_ptr<MapToZoomSource> const& source_,
+                        double simplify_distance_,
+                        std::size_t min_zoom_,
+                        std::size_t max_zoom_,
+                        std::size_t extent_,
+                        v8::Local<v8::Function> const& callback) :
+            request(),
+            cb(callback),
+            source(source_),
+            simplify_distance(simplify_distance_),
+            min_zoom(min_zoom_),
+            max_zoom(max_zoom_),
+            extent(extent_),
+            error_name(),
+            data(),
+            tiles(),
+            typed_tiles(false) {
+        request.data = this;
+    }
+};
+
+NAN_METHOD(MapToZoom::executeRange) {
+    std::size_t extent = 4096;
+    double simplify_distance = 4.0;
+    bool typed_tiles = false;
+
+    if (!info[3]->IsFunction()) {
+        Nan::ThrowTypeError("fourth arg 'callback' must be a function");
+        return;
+    }
+    v8::Local<v8::Function> callback = info[3].As<v8::Function>();
+
+    if (!info[0]->IsUint32()) {
+        CallbackError("first arg 'minZoom' must be an unsigned integer", callback);
+        return;
+    }
+    if (!info[1]->IsUint32()) {
+        CallbackError("second arg 'maxZoom' must be an unsigned integer", callback);
+        return;
+    }
+    std::size_t min_zoom = static_cast<std::size_t>(info[0]->Uint32Value());
+    std::size_t max_zoom = static_cast<std::size_t>(info[1]->Uint32Value());
+    if (min_zoom > max_zoom) {
+        CallbackError("'minZoom' must not be greater than 'maxZoom'", callback);
+        return;
+    }
+    if (max_zoom > mapbox::mrmvt::MAX_ZOOM) {
+        std::ostringstream err;
+        err << "'maxZoom' must not be greater than " << mapbox::mrmvt::MAX_ZOOM;
+        CallbackError(err.str(), callback);
+        return;
+    }
+
+    if (!info[2]->IsObject()) {
+        CallbackError("third arg 'options' must be an object", callback);
+        return;
+    }
+    if (!GetTileOptions(info[2].As<v8::Object>(), extent, simplify_distance, typed_tiles, callback)) {
+        return;
+    }
+
+    MapToZoom* me = Nan::ObjectWrap::Unwrap<MapToZoom>(info.Holder());
+    MapToZoomRangeBaton *baton = new MapToZoomRangeBaton(me->source, simplify_distance, min_zoom, max_zoom, extent, callback);
+    baton->typed_tiles = typed_tiles;
+    WorkerPool::QueueWork(&baton->request, AsyncExecuteRange, AfterExecuteRange);
+}
+
+void MapToZoom::AsyncExecuteRange(uv_work_t* req)
+{
+    MapToZoomRangeBaton *baton = static_cast<MapToZoomRangeBaton *>(req->data);
+
+    try {
+        for (std::size_t z = baton->min_zoom; z <= baton->max_zoom; ++z) {
+            auto zoomed = baton->source->zoom(z, baton->extent, baton->simplify_distance);
+            std::unique_ptr<std::string> encoded(new std::string());
+            mapbox::mrmvt::encode_geometry(zoomed->geom, *encoded);
+            baton->data.push_back(std::move(encoded));
+            baton->tiles.emplace_back();
+            baton->tiles.back().set(mapbox::tile_cover::tile_coordinates(zoomed->tiles), baton->typed_tiles);
+        }
+    } catch (std::exception const& ex) {
+        baton->error_name = ex.what();
+    }
+}
+
+// Frees the string backing a Buffer once V8 collects it.
+static void FreeEncodedGeometry(char *, void * hint) {
+    delete static_cast<std::string*>(hint);
+}
+
+void MapToZoom::AfterExecuteRange(uv_work_t* req)
+{
+    Nan::HandleScope scope;
+
+    MapToZoomRangeBaton *baton = static_cast<MapToZoomRangeBaton *>(req->data);
+    baton->source->report_external_memory();
+
+    if (!baton->error_name.empty()) {
+        v8::Local<v8::Value> argv[1] = { Nan::Error(baton->error_name.c_str()) };
+        Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New(baton->cb), 1, argv);
+    } else {
+        v8::Local<v8::Array> zooms = Nan::New<v8::Array>(baton->data.size());
+        for (std::size_t i = 0; i < baton->data.size(); ++i) {
+            // the Buffer takes ownership of the string, no bytes are copied
+            std::string * encoded = baton->data[i].release();
+            v8::Local<v8::Object> buffer = Nan::NewBuffer(&(*encoded)[0],
+                                                          static_cast<std::uint32_t>(encoded->size()),
+                                                          FreeEncodedGeometry,
+                                                          encoded).ToLocalChecked();
+            v8::Local<v8::Object> result = Nan::New<v8::Object>();
+            Nan::Set(result, Nan::New("zoom").ToLocalChecked(), Nan::New(static_cast<std::uint32_t>(baton->min_zoom + i)));
+            Nan::Set(result, Nan::New("data").ToLocalChecked(), buffer);
+            Nan::Set(result, Nan::New("tiles").ToLocalChecked(), baton->tiles[i].ToJS());
+            Nan::Set(zooms, i, result);
+        }
+        v8::Local<v8::Value> argv[2] = { Nan::Null(), zooms };
+        Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New(baton->cb), 2, argv);
+    }
+
+    baton->cb.Reset();
+    delete baton;
+}
@@ -0,0 +1,249 @@
+#include "node.hpp"
+#include "node_tile_builder.hpp"
+#include "node_worker_pool.hpp"
+
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+TileBuilder::TileBuilder(mapbox::mrmvt::tile_builder_options const& options_, std::string const& layer_) :
+    options(options_),
+    layer(layer_) {
+}
+
+void TileBuilder::Initialize(v8::Handle<v8::Object> target) {
+
+    Nan::HandleScope scope;
+
+    v8::Local<v8::FunctionTemplate> lcons = Nan::New<v8::FunctionTemplate>(TileBuilder::New);
+    lcons->InstanceTemplate()->SetInternalFieldCount(1);
+
+    lcons->SetClassName(Nan::New("TileBuilder").ToLocalChecked());
+
+    Nan::SetPrototypeMethod(lcons, "build", build);
+
+    target->Set(Nan::New("TileBuilder").ToLocalChecked(),lcons->GetFunction());
+    constructor.Reset(lcons);
+}
+
+Nan::Persistent<v8::FunctionTemplate> TileBuilder::constructor;
+
+/**
+ * Builds vector tiles from features without spawning m2z, m2t and r2mvt
+ * @class TileBuilder
+ * @param {Object} [options]
+ * @param {number} [options.simplify_distance=4] - the distance for simplification, 0 disables simplification
+ * @param {number} [options.buffer=8] - the tile buffer in extent units
+ * @param {string} [options.layer='features'] - the layer of features given as bare GeoJSON
+ * @example
+ * var mrmvt = require('index.js');
+ * var builder = new mrmvt.TileBuilder({ layer: 'roads' });
+ */
+NAN_METHOD(TileBuilder::New) {
+    if (!info.IsConstructCall()) {
+        return Nan::ThrowTypeError("Cannot call constructor as function, you need to use 'new' keyword");
+    }
+
+    mapbox::mrmvt::tile_builder_options options;
+    std::string layer = "features";
+    if (info.Length() > 0 && !info[0]->IsUndefined()) {
+        if (!info[0]->IsObject()) {
+            return Nan::ThrowTypeError("arg 'options' must be an object");
+        }
+        v8::Local<v8::Object> opts = info[0].As<v8::Object>();
+        if (opts->Has(Nan::New("simplify_distance").ToLocalChecked())) {
+            v8::Local<v8::Value> simplify_distance_val = opts->Get(Nan::New("simplify_distance").ToLocalChecked());
+            if (!simplify_distance_val->IsNumber() || simplify_distance_val->NumberValue() < 0.0) {
+                return Nan::ThrowTypeError("option 'simplify_distance' must be a positive number value");
+            }
+            options.simplify_distance = simplify_distance_val->NumberValue();
+        }
+        if (opts->Has(Nan::New("buffer").ToLocalChecked())) {
+            v8::Local<v8::Value> buffer_val = opts->Get(Nan::New("buffer").ToLocalChecked());
+            if (!buffer_val->IsUint32()) {
+                return Nan::ThrowTypeError("option 'buffer' must be an unsigned integer");
+            }
+            options.buffer = static_cast<std::int64_t>(buffer_val->Uint32Value());
+        }
+        if (opts->Has(Nan::New("layer").ToLocalChecked())) {
+            v8::Local<v8::Value> layer_val = opts->Get(Nan::New("layer").ToLocalChecked());
+            if (!layer_val->IsString()) {
+                return Nan::ThrowTypeError("option 'layer' must be a string");
+            }
+            layer = *Nan::Utf8String(layer_val);
+        }
+    }
+
+    auto *const self = new TileBuilder(options, layer);
+    self->Wrap(info.This());
+    info.GetReturnValue().Set(info.This());
+}
+
+/**
+ * Encode every tile the features touch from minZoom to maxZoom. Features are
+ * Buffers holding either a GeoJSON Feature, placed in the `layer` layer, or a
+ * m2f record `<layer> <feature json>`. Parsing, projection, clipping and
+ * encoding all happen in the threadpool.
+ *
+ * @name build
+ * @memberof TileBuilder
+ * @param {Buffer[]} features
+ * @param {number} minZoom
+ * @param {number} maxZoom - at most 24
+ * @param {Function} callback - called with an error or an object mapping 'z/x/y' to an uncompressed vector tile Buffer
+ * @example
+ * var builder = new mrmvt.TileBuilder();
+ * builder.build([feature_buffer], 0, 10, function(err, tiles) {
+ *   if (err) throw err;
+ *   var tile = tiles['10/163/395'];
+ * });
+ *
+ */
+
+struct EncodedTile {
+    std::uint32_t z;
+    std::uint32_t x;
+    std::uint32_t y;
+    std::unique_ptr<std::string> data;
+};
+
+struct TileBuilderBaton {
+    uv_work_t request; // required
+    Nan::Persistent<v8::Function> cb; // callback function type
+    mapbox::mrmvt::tile_builder_options options;
+    std::string layer;
+    std::vector<std::string> features;
+    std::uint32_t min_zoom;
+    std::uint32_t max_zoom;
+    std::string error_name;
+    std::vector<EncodedTile> tiles;
+
+    TileBuilderBaton(mapbox::mrmvt::tile_builder_options const& options_,
+                     std::string const& layer_,
+                     std::uint32_t min_zoom_,
+                     std::uint32_t max_zoom_,
+                     v8::Local<v8::Function> const& callback) :
+            request(),
+            cb(callback),
+            options(options_),
+            layer(layer_),
+            features(),
+            min_zoom(min_zoom_),
+            max_zoom(max_zoom_),
+            error_name(),
+            tiles() {
+        request.data = this;
+    }
+};
+
+NAN_METHOD(TileBuilder::build) {
+    if (!info[3]->IsFunction()) {
+        Nan::ThrowTypeError("fourth arg 'callback' must be a function");
+        return;
+    }
+    v8::Local<v8::Function> callback = info[3].As<v8::Function>();
+
+    if (!info[0]->IsArray()) {
+        CallbackError("first arg 'features' must be an array of buffers", callback);
+        return;
+    }
+    if (!info[1]->IsUint32()) {
+        CallbackError("second arg 'minZoom' must be an unsigned integer", callback);
+        return;
+    }
+    if (!info[2]->IsUint32()) {
+        CallbackError("third arg 'maxZoom' must be an unsigned integer", callback);
+        return;
+    }
+    std::uint32_t min_zoom = info[1]->Uint32Value();
+    std::uint32_t max_zoom = info[2]->Uint32Value();
+    if (min_zoom > max_zoom) {
+        CallbackError("'minZoom' must not be greater than 'maxZoom'", callback);
+        return;
+    }
+    if (max_zoom > mapbox::mrmvt::MAX_ZOOM) {
+        std::ostringstream err;
+        err << "'maxZoom' must not be greater than " << mapbox::mrmvt::MAX_ZOOM;
+        CallbackError(err.str(), callback);
+        return;
+    }
+
+    TileBuilder* me = Nan::ObjectWrap::Unwrap<TileBuilder>(info.Holder());
+    std::unique_ptr<TileBuilderBaton> baton(new TileBuilderBaton(me->options, me->layer, min_zoom, max_zoom, callback));
+
+    // Buffers may be changed or collected once we return, so the bytes are
+    // copied here and parsed in the threadpool
+    v8::Local<v8::Array> features = info[0].As<v8::Array>();
+    baton->features.reserve(features->Length());
+    for (std::uint32_t i = 0; i < features->Length(); ++i) {
+        v8::Local<v8::Value> feature = Nan::Get(features, i).ToLocalChecked();
+        if (!feature->IsObject() || !node::Buffer::HasInstance(feature)) {
+            baton->cb.Reset();
+            std::ostringstream err;
+            err << "feature " << i << " must be a buffer";
+            CallbackError(err.str(), callback);
+            return;
+        }
+        baton->features.emplace_back(node::Buffer::Data(feature), node::Buffer::Length(feature));
+    }
+
+    WorkerPool::QueueWork(&baton.release()->request, AsyncBuild, AfterBuild);
+}
+
+void TileBuilder::AsyncBuild(uv_work_t* req)
+{
+    TileBuilderBaton *baton = static_cast<TileBuilderBaton *>(req->data);
+
+    try {
+        std::vector<mapbox::mrmvt::layer_feature> features;
+        features.reserve(baton->features.size());
+        for (auto const& f : baton->features) {
+            features.push_back(mapbox::mrmvt::parse_layer_feature(f.data(), f.size(), baton->layer));
+        }
+        baton->features.clear();
+        mapbox::mrmvt::build_tiles(features, baton->min_zoom, baton->max_zoom, baton->options,
+            [&](std::uint32_t z, std::uint32_t x, std::uint32_t y, std::string && buffer) {
+                baton->tiles.push_back(EncodedTile { z, x, y, std::unique_ptr<std::string>(new std::string(std::move(buffer))) });
+            });
+    } catch (std::exception const& ex) {
+        baton->error_name = ex.what();
+    }
+}
+
+// Frees the string backing a Buffer once V8 collects it.
+static void FreeEncodedTile(char *, void * hint) {
+    delete static_cast<std::string*>(hint);
+}
+
+void TileBuilder::AfterBuild(uv_work_t* req)
+{
+    Nan::HandleScope scope;
+
+    TileBuilderBaton *baton = static_cast<TileBuilderBaton *>(req->data);
+
+    if (!baton->error_name.empty()) {
+        v8::Local<v8::Value> argv[1] = { Nan::Error(baton->error_name.c_str()) };
+        Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New(baton->cb), 1, argv);
+    } else {
+        v8::Local<v8::Object> result = Nan::New<v8::Object>();
+        for (auto & tile : baton->tiles) {
+            // the Buffer takes ownership of the string, no bytes are copied
+            std::string * encoded = tile.data.release();
+            v8::Local<v8::Object> buffer = Nan::NewBuffer(&(*encoded)[0],
+                                                          static_cast<std::uint32_t>(encoded->size()),
+                                                          FreeEncodedTile,
+                                                          encoded).ToLocalChecked();
+            std::ostringstream key;
+            key << tile.z << "/" << tile.x << "/" << tile.y;
+            Nan::Set(result, Nan::New(key.str()).ToLocalChecked(), buffer);
+        }
+        v8::Local<v8::Value> argv[2] = { Nan::Null(), result };
+        Nan::MakeCallback(Nan::GetCurrentContext()->Global(), Nan::New(baton->cb), 2, argv);
+    }
+
+    baton->cb.Reset();
+    delete baton;
+}
@@ -0,0 +1,232 @@
+#include "node.hpp"
+#include "node_worker_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Most tasks a worker takes off the queue at once when it is backed up
+constexpr std::size_t MAX_BATCH_SIZE = 16;
+
+using clock_type = std::chrono::steady_clock;
+
+struct pool_task {
+    uv_work_t * req;
+    WorkerPool::work_cb work;
+    WorkerPool::after_work_cb after;
+    clock_type::time_point queued;
+    double wait_ms;
+    double run_ms;
+};
+
+struct pool_stats {
+    std::size_t completed = 0;
+    std::size_t batches = 0;
+    std::size_t max_queued = 0;
+    double wait_ms_total = 0.0;
+    double wait_ms_max = 0.0;
+    double run_ms_total = 0.0;
+    double run_ms_max = 0.0;
+};
+
+struct pool_state {
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<pool_task> queue;
+    std::vector<pool_task> done;
+    std::size_t running = 0;
+    pool_stats stats;
+
+    // main thread only, size is fixed once the workers are started
+    std::size_t size = 0;
+    std::size_t pending = 0;
+    bool started = false;
+    uv_async_t async;
+};
+
+// Never destroyed: detached workers may still wait on it while the process exits.
+pool_state & pool() {
+    static pool_state * state = new pool_state();
+    return *state;
+}
+
+double elapsed_ms(clock_type::time_point from, clock_type::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+std::size_t default_size() {
+    const char * env = std::getenv("MRMVT_THREADPOOL_SIZE");
+    if (env) {
+        long n = std::strtol(env, nullptr, 10);
+        if (n > 0) {
+            return static_cast<std::size_t>(n);
+        }
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/*
+ * Takes a batch off the queue, more than one task only when every thread
+ * would still have work left, so a few slow tasks are never serialized
+ * behind each other. Completions of a batch are handed back together.
+ */
+void worker_loop() {
+    pool_state & p = pool();
+    std::vector<pool_task> batch;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(p.mutex);
+            p.ready.wait(lock, [&] { return !p.queue.empty(); });
+            std::size_t take = std::min(MAX_BATCH_SIZE, std::max<std::size_t>(1, p.queue.size() / p.size));
+            for (std::size_t i = 0; i < take; ++i) {
+                batch.push_back(p.queue.front());
+                p.queue.pop_front();
+            }
+            p.running += batch.size();
+        }
+        for (auto & task : batch) {
+            auto start = clock_type::now();
+            task.wait_ms = elapsed_ms(task.queued, start);
+            task.work(task.req);
+            task.run_ms = elapsed_ms(start, clock_type::now());
+        }
+        {
+            std::lock_guard<std::mutex> lock(p.mutex);
+            p.running -= batch.size();
+            ++p.stats.batches;
+            p.done.insert(p.done.end(), batch.begin(), batch.end());
+        }
+        batch.clear();
+        uv_async_send(&p.async);
+    }
+}
+
+// Runs on the main thread, uv_async_send calls may be coalesced into one.
+void after_work(uv_async_t * handle) {
+    pool_state & p = pool();
+    std::vector<pool_task> done;
+    {
+        std::lock_guard<std::mutex> lock(p.mutex);
+        done.swap(p.done);
+        for (auto const& task : done) {
+            ++p.stats.completed;
+            p.stats.wait_ms_total += task.wait_ms;
+            p.stats.wait_ms_max = std::max(p.stats.wait_ms_max, task.wait_ms);
+            p.stats.run_ms_total += task.run_ms;
+            p.stats.run_ms_max = std::max(p.stats.run_ms_max, task.run_ms);
+        }
+    }
+    p.pending -= done.size();
+    for (auto const& task : done) {
+        task.after(task.req);
+    }
+    // an idle pool must not keep the process alive
+    if (p.pending == 0) {
+        uv_unref(reinterpret_cast<uv_handle_t*>(&p.async));
+    }
+}
+
+void start() {
+    pool_state & p = pool();
+    if (p.started) {
+        return;
+    }
+    if (p.size == 0) {
+        p.size = default_size();
+    }
+    uv_async_init(uv_default_loop(), &p.async, after_work);
+    uv_unref(reinterpret_cast<uv_handle_t*>(&p.async));
+    for (std::size_t i = 0; i < p.size; ++i) {
+        std::thread(worker_loop).detach();
+    }
+    p.started = true;
+}
+
+} // namespace
+
+void WorkerPool::Initialize(v8::Handle<v8::Object> target) {
+    Nan::HandleScope scope;
+    Nan::SetMethod(target, "setWorkerPoolSize", setSize);
+    Nan::SetMethod(target, "workerPoolStats", stats);
+}
+
+void WorkerPool::QueueWork(uv_work_t* req, work_cb work, after_work_cb after) {
+    start();
+    pool_state & p = pool();
+    if (p.pending++ == 0) {
+        uv_ref(reinterpret_cast<uv_handle_t*>(&p.async));
+    }
+    {
+        std::lock_guard<std::mutex> lock(p.mutex);
+        p.queue.push_back(pool_task { req, work, after, clock_type::now(), 0.0, 0.0 });
+        p.stats.max_queued = std::max(p.stats.max_queued, p.queue.size());
+    }
+    p.ready.notify_one();
+}
+
+/**
+ * Set the number of threads used by the binding. Defaults to the
+ * MRMVT_THREADPOOL_SIZE environment variable or else the number of cores,
+ * and can only be changed before the first task is queued.
+ *
+ * @name setWorkerPoolSize
+ * @param {number} size
+ * @example
+ * var mrmvt = require('mr-mvt');
+ * mrmvt.setWorkerPoolSize(16);
+ */
+NAN_METHOD(WorkerPool::setSize) {
+    if (!info[0]->IsUint32() || info[0]->Uint32Value() == 0) {
+        return Nan::ThrowTypeError("worker pool size must be a positive integer");
+    }
+    pool_state & p = pool();
+    if (p.started) {
+        return Nan::ThrowError("worker pool size must be set before the first task is queued");
+    }
+    p.size = info[0]->Uint32Value();
+}
+
+/**
+ * Statistics of the binding's thread pool. Times are in milliseconds, wait
+ * is from queueing a task until a thread starts it.
+ *
+ * @name workerPoolStats
+ * @returns {Object} threads, queued, running, pending, completed, batches,
+ * max_queued, wait_ms_mean, wait_ms_max, run_ms_mean, run_ms_max
+ */
+NAN_METHOD(WorkerPool::stats) {
+    pool_state & p = pool();
+    if (p.size == 0) {
+        p.size = default_size();
+    }
+    std::size_t queued;
+    std::size_t running;
+    pool_stats stats;
+    {
+        std::lock_guard<std::mutex> lock(p.mutex);
+        queued = p.queue.size();
+        running = p.running;
+        stats = p.stats;
+    }
+    double completed = static_cast<double>(stats.completed);
+    v8::Local<v8::Object> result = Nan::New<v8::Object>();
+    Nan::Set(result, Nan::New("threads").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(p.size)));
+    Nan::Set(result, Nan::New("queued").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(queued)));
+    Nan::Set(result, Nan::New("running").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(running)));
+    Nan::Set(result, Nan::New("pending").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(p.pending)));
+    Nan::Set(result, Nan::New("completed").ToLocalChecked(), Nan::New<v8::Number>(completed));
+    Nan::Set(result, Nan::New("batches").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(stats.batches)));
+    Nan::Set(result, Nan::New("max_queued").ToLocalChecked(), Nan::New<v8::Number>(static_cast<double>(stats.max_queued)));
+    Nan::Set(result, Nan::New("wait_ms_mean").ToLocalChecked(), Nan::New<v8::Number>(completed > 0 ? stats.wait_ms_total / completed : 0.0));
+    Nan::Set(result, Nan::New("wait_ms_max").ToLocalChecked(), Nan::New<v8::Number>(stats.wait_ms_max));
+    Nan::Set(result, Nan::New("run_ms_mean").ToLocalChecked(), Nan::New<v8::Number>(completed > 0 ? stats.run_ms_total / completed : 0.0));
+    Nan::Set(result, Nan::New("run_ms_max").ToLocalChecked(), Nan::New<v8::Number>(stats.run_ms_max));
+    info.GetReturnValue().Set(result);
+}
@@ -1,17 +1,94 @@
 #include "reduce_to_mvt.hpp"
+#include "alloc_hooks.hpp"
 
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
 #include <stdexcept>
+#include <string>
+#include <vector>
 #include <exception>
 
 int main(int argc, char* argv[]) {
-    std::string db_name("output.mbtiles");
-    if (argc > 1) {
-        db_name = std::string(argv[1]);
-    } else {
+    std::string db_name;
+    std::vector<std::string> merge_inputs;
+    bool merge = false;
+    std::string report_path;
+    mapbox::mrmvt::reduce_options options;
+    mapbox::mrmvt::stats_options stats;
+    mapbox::mrmvt::trace_options trace;
+    for (int i = 1; i < argc; ++i) {
+        if (mapbox::mrmvt::parse_stats_flag(argc, argv, i, stats) ||
+            mapbox::mrmvt::parse_trace_flag(argc, argv, i, trace)) {
+            continue;
+        }
+        bool has_value = std::strcmp(argv[i],"--compression") == 0 ||
+                         std::strcmp(argv[i],"--threads") == 0 ||
+                         std::strcmp(argv[i],"--format") == 0 ||
+                         std::strcmp(argv[i],"--max-tile-bytes") == 0 ||
+                         std::strcmp(argv[i],"--max-layer-features") == 0 ||
+                         std::strcmp(argv[i],"--priority") == 0 ||
+                         std::strcmp(argv[i],"--properties") == 0 ||
+                         std::strcmp(argv[i],"--budget-report") == 0;
+        if (std::strcmp(argv[i],"--merge") == 0) {
+            merge = true;
+            continue;
+        }
+        if (!has_value) {
+            // with --merge the first name is the output and the rest are inputs
+            if (merge && !db_name.empty()) {
+                merge_inputs.push_back(argv[i]);
+            } else {
+                db_name = std::string(argv[i]);
+            }
+            continue;
+        }
+        const char * flag = argv[i];
+        ++i;
+        if (i >= argc) {
+            throw std::runtime_error("Not enough arguments provided");
+        }
+        if (std::strcmp(flag,"--compression") == 0) {
+            options.compression = mapbox::mrmvt::parse_compression(argv[i]);
+        } else if (std::strcmp(flag,"--threads") == 0) {
+            options.threads = mapbox::mrmvt::parse_thread_count(argv[i]);
+        } else if (std::strcmp(flag,"--format") == 0) {
+            options.format = mapbox::mrmvt::parse_output_format(argv[i]);
+        } else if (std::strcmp(flag,"--max-tile-bytes") == 0) {
+            options.budget.max_tile_bytes = static_cast<std::size_t>(std::atoll(argv[i]));
+        } else if (std::strcmp(flag,"--max-layer-features") == 0) {
+            options.budget.max_layer_features = static_cast<std::size_t>(std::atoll(argv[i]));
+        } else if (std::strcmp(flag,"--priority") == 0) {
+            mapbox::mrmvt::parse_priority(argv[i], options.budget);
+        } else if (std::strcmp(flag,"--properties") == 0) {
+            options.properties = argv[i];
+        } else {
+            report_path = argv[i];
+        }
+    }
+    if (db_name.empty() || (merge && merge_inputs.empty())) {
         std::cerr << "Not enough parameters provided." << std::endl;
         return 1;
     }
-    mapbox::mrmvt::reduce_to_mvt(db_name);
+    std::ofstream report;
+    if (!report_path.empty()) {
+        report.open(report_path);
+        if (!report) {
+            std::ostringstream err;
+            err << "Budget Error: Failed to open " << report_path;
+            throw std::runtime_error(err.str());
+        }
+        options.budget.report = &report;
+    }
+    mapbox::mrmvt::stats_collector::instance().start("r2mvt", stats);
+    mapbox::mrmvt::trace_recorder::instance().start("r2mvt", trace);
+    if (merge) {
+        mapbox::mrmvt::merge_to_mvt(db_name, merge_inputs, options);
+    } else {
+        mapbox::mrmvt::reduce_to_mvt(db_name, options);
+    }
+    mapbox::mrmvt::trace_recorder::instance().finish();
+    mapbox::mrmvt::stats_collector::instance().finish();
     return 0;
 }
@@ -0,0 +1,115 @@
+#include "parse_args.hpp"
+#include "tile_on_demand.hpp"
+#include "update_tiles.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+static void unknown_option(const char * flag) {
+    std::ostringstream err;
+    err << "Unknown option: " << flag;
+    throw std::runtime_error(err.str());
+}
+
+int main(int argc, char* argv[]) {
+    using mapbox::mrmvt::parse_double_arg;
+    using mapbox::mrmvt::parse_integer_arg;
+    const long long max_zoom = static_cast<long long>(mapbox::mrmvt::MAX_ZOOM);
+    if (argc >= 3 && std::strcmp(argv[1],"build") == 0) {
+        // the options of the m2z, m2t and r2mvt runs that built the tileset
+        mapbox::mrmvt::index_options options;
+        for (int i = 3; i < argc; ++i) {
+            if (std::strcmp(argv[i],"--cluster") == 0) {
+                options.cluster.enabled = true;
+                continue;
+            }
+            const char * flag = argv[i];
+            bool has_value = std::strcmp(flag,"--max") == 0 ||
+                             std::strcmp(flag,"--cluster-radius") == 0 ||
+                             std::strcmp(flag,"--cluster-max-zoom") == 0 ||
+                             std::strcmp(flag,"--max-tile-bytes") == 0 ||
+                             std::strcmp(flag,"--max-layer-features") == 0 ||
+                             std::strcmp(flag,"--priority") == 0;
+            if (!has_value) {
+                unknown_option(flag);
+            }
+            ++i;
+            if (i >= argc) {
+                throw std::runtime_error("Not enough arguments provided");
+            }
+            if (std::strcmp(flag,"--max") == 0) {
+                options.max_zoom = static_cast<int>(parse_integer_arg(flag, argv[i], 0, max_zoom));
+            } else if (std::strcmp(flag,"--cluster-radius") == 0) {
+                options.cluster.enabled = true;
+                options.cluster.radius = parse_double_arg(flag, argv[i], 1.0, 65536.0);
+            } else if (std::strcmp(flag,"--cluster-max-zoom") == 0) {
+                options.cluster.enabled = true;
+                options.cluster.max_zoom = static_cast<int>(parse_integer_arg(flag, argv[i], 0, max_zoom));
+            } else if (std::strcmp(flag,"--max-tile-bytes") == 0) {
+                options.budget.max_tile_bytes = static_cast<std::size_t>(parse_integer_arg(flag, argv[i], 1, 1LL << 31));
+            } else if (std::strcmp(flag,"--max-layer-features") == 0) {
+                options.budget.max_layer_features = static_cast<std::size_t>(parse_integer_arg(flag, argv[i], 1, 1LL << 31));
+            } else {
+                mapbox::mrmvt::parse_priority(argv[i], options.budget);
+            }
+        }
+        auto start = std::chrono::steady_clock::now();
+        std::uint64_t count = mapbox::mrmvt::build_feature_index(std::cin, argv[2], options);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << "Indexed " << count << " features in " << ms << " ms" << std::endl;
+        return 0;
+    }
+    if (argc == 6 && std::strcmp(argv[1],"tile") == 0) {
+        mapbox::mrmvt::feature_index index(argv[2]);
+        std::uint32_t z = static_cast<std::uint32_t>(parse_integer_arg("z", argv[3], 0, max_zoom));
+        long long last = (1LL << z) - 1;
+        std::uint32_t x = static_cast<std::uint32_t>(parse_integer_arg("x", argv[4], 0, last));
+        std::uint32_t y = static_cast<std::uint32_t>(parse_integer_arg("y", argv[5], 0, last));
+        std::string buffer;
+        auto start = std::chrono::steady_clock::now();
+        mapbox::mrmvt::tile_from_index(index, z, x, y, buffer);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        std::cerr << z << "/" << x << "/" << y << ": " << buffer.size() << " bytes in " << ms << " ms" << std::endl;
+        return 0;
+    }
+    if (argc >= 5 && std::strcmp(argv[1],"update") == 0) {
+        mapbox::mrmvt::update_options options;
+        for (int i = 5; i < argc; ++i) {
+            const char * flag = argv[i];
+            if (std::strcmp(flag,"--min") != 0 &&
+                std::strcmp(flag,"--max") != 0 &&
+                std::strcmp(flag,"--compression") != 0) {
+                unknown_option(flag);
+            }
+            ++i;
+            if (i >= argc) {
+                throw std::runtime_error("Not enough arguments provided");
+            }
+            if (std::strcmp(flag,"--min") == 0) {
+                options.min_zoom = static_cast<int>(parse_integer_arg(flag, argv[i], 0, max_zoom));
+            } else if (std::strcmp(flag,"--max") == 0) {
+                options.max_zoom = static_cast<int>(parse_integer_arg(flag, argv[i], 0, max_zoom));
+            } else {
+                options.compression = mapbox::mrmvt::parse_compression(argv[i]);
+            }
+        }
+        if (options.min_zoom >= 0 && options.max_zoom >= 0 && options.min_zoom > options.max_zoom) {
+            throw std::runtime_error("--min must not be greater than --max");
+        }
+        auto start = std::chrono::steady_clock::now();
+        auto summary = mapbox::mrmvt::update_tiles(std::cin, argv[2], argv[3], argv[4], options);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        mapbox::mrmvt::print_update_summary(std::cerr, summary);
+        std::cerr << "Updated " << argv[4] << " in " << ms << " ms" << std::endl;
+        return 0;
+    }
+    std::cerr << "Usage: mvt-index build <index> [--max z] [--cluster] [--cluster-radius r] [--cluster-max-zoom z]" << std::endl;
+    std::cerr << "                       [--max-tile-bytes n] [--max-layer-features n] [--priority spec] < features" << std::endl;
+    std::cerr << "       mvt-index tile <index> <z> <x> <y> > tile.pbf" << std::endl;
+    std::cerr << "       mvt-index update <old index> <new index> <mbtiles> [--min z] [--max z] [--compression type] < diff" << std::endl;
+    return 1;
+}
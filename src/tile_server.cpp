@@ -0,0 +1,70 @@
+#include "parse_args.hpp"
+#include "tile_server.hpp"
+
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+
+static std::atomic<bool> running(true);
+
+static void stop_server(int) {
+    running.store(false);
+}
+
+int main(int argc, char* argv[]) {
+    mapbox::mrmvt::server_options options;
+    mapbox::mrmvt::load_test_options load_options;
+    bool load_test = false;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i],"--load-test") == 0) {
+            load_test = true;
+        } else if (std::strcmp(argv[i],"--host") == 0 ||
+                   std::strcmp(argv[i],"--port") == 0 ||
+                   std::strcmp(argv[i],"--threads") == 0 ||
+                   std::strcmp(argv[i],"--cache-mb") == 0 ||
+                   std::strcmp(argv[i],"--connections") == 0 ||
+                   std::strcmp(argv[i],"--requests") == 0) {
+            const char * flag = argv[i];
+            ++i;
+            if (i >= argc) {
+                throw std::runtime_error("Not enough arguments provided");
+            }
+            if (std::strcmp(flag,"--host") == 0) {
+                options.host = argv[i];
+                load_options.host = argv[i];
+            } else if (std::strcmp(flag,"--port") == 0) {
+                options.port = static_cast<int>(mapbox::mrmvt::parse_integer_arg(flag, argv[i], 1, 65535));
+                load_options.port = options.port;
+            } else if (std::strcmp(flag,"--threads") == 0) {
+                options.threads = mapbox::mrmvt::parse_thread_count(argv[i]);
+            } else if (std::strcmp(flag,"--cache-mb") == 0) {
+                // 0 turns the cache off
+                options.cache_bytes = static_cast<std::size_t>(mapbox::mrmvt::parse_integer_arg(flag, argv[i], 0, 1 << 20)) * 1024 * 1024;
+            } else if (std::strcmp(flag,"--connections") == 0) {
+                load_options.connections = static_cast<std::size_t>(mapbox::mrmvt::parse_integer_arg(flag, argv[i], 1, 65536));
+            } else {
+                load_options.requests = static_cast<std::size_t>(mapbox::mrmvt::parse_integer_arg(flag, argv[i], 1, 1000000000));
+            }
+        } else {
+            options.path = argv[i];
+            load_options.path = argv[i];
+        }
+    }
+    if (options.path.empty()) {
+        std::cerr << "Usage: mvt-server <tileset> [--port 8080] [--host 0.0.0.0] [--threads N] [--cache-mb 256]" << std::endl;
+        std::cerr << "       mvt-server <tileset> --load-test [--host 127.0.0.1] [--port 8080] [--connections 64] [--requests 100000]" << std::endl;
+        return 1;
+    }
+    if (load_test) {
+        if (std::strcmp(load_options.host.c_str(), "0.0.0.0") == 0) {
+            load_options.host = "127.0.0.1";
+        }
+        mapbox::mrmvt::print_load_test(mapbox::mrmvt::run_load_test(load_options));
+        return 0;
+    }
+    std::signal(SIGINT, stop_server);
+    std::signal(SIGTERM, stop_server);
+    std::signal(SIGPIPE, SIG_IGN);
+    mapbox::mrmvt::serve_tiles(options, running);
+    return 0;
+}
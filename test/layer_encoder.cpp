@@ -0,0 +1,293 @@
+#include "clip.hpp"
+#include "layer_encoder.hpp"
+#include "map_to_features.hpp"
+#include "map_to_zoom.hpp"
+#include "merge_tiles.hpp"
+#include "tile_cover.hpp"
+
+#include <mapbox/geometry.hpp>
+#include <mapbox/geojson.hpp>
+#include <mapbox/vector_tile/encode_layer.hpp>
+
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+ * Checks that streaming_layer_encoder writes the same layers as
+ * vector_tile::encode_layer: the countries fixture clipped to every tile of
+ * zooms 0 to 4, plus a tile holding every geometry and property type.
+ *
+ * usage: mvt-test-layer-encoder [fixture]
+ */
+
+using namespace mapbox;
+using namespace mapbox::mrmvt;
+
+namespace {
+
+using tile_features = std::map<std::pair<std::int64_t, std::int64_t>, geometry::feature_collection<std::int64_t>>;
+
+geometry::feature_collection<double> read_fixture(std::string const& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::ostringstream err;
+        err << "Test Error: Failed to open " << path;
+        throw std::runtime_error(err.str());
+    }
+    std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return geojson_to_fc(geojson::parse<double>(json));
+}
+
+// The clipped features of every tile at zoom z, as r2mvt would see them.
+tile_features clip_to_tiles(geometry::feature_collection<double> const& fc, std::size_t z) {
+    tile_features tiles;
+    geometry::polygon<std::int64_t> fill_geometry = tile_fill_polygon(8);
+    for (auto const& f : fc) {
+        auto g = geom_to_zoom(f.geometry, z, 4096, 4.0);
+        for (auto const& t : tile_cover::get_tiles(g, 4096)) {
+            auto og = t.fill ? optional_geometry(geometry::geometry<std::int64_t>(fill_geometry))
+                             : clip(g, static_cast<std::uint32_t>(t.x), static_cast<std::uint32_t>(t.y), 8);
+            if (og) {
+                tiles[std::make_pair(t.x, t.y)].push_back(geometry::feature<std::int64_t> { std::move(*og), f.properties, f.id });
+            }
+        }
+    }
+    return tiles;
+}
+
+geometry::linear_ring<std::int64_t> square(std::int64_t x, std::int64_t y, std::int64_t size, bool clockwise) {
+    geometry::linear_ring<std::int64_t> ring;
+    if (clockwise) {
+        ring = { { x, y }, { x + size, y }, { x + size, y + size }, { x, y + size }, { x, y } };
+    } else {
+        ring = { { x, y }, { x, y + size }, { x + size, y + size }, { x + size, y }, { x, y } };
+    }
+    return ring;
+}
+
+// One feature of every geometry type, with ids and every kind of property
+// value a layer can hold.
+geometry::feature_collection<std::int64_t> all_types() {
+    geometry::feature_collection<std::int64_t> fc;
+    geometry::property_map props;
+    props.emplace("name", std::string("a"));
+    props.emplace("double", 1.5);
+    props.emplace("negative", std::int64_t(-7));
+    props.emplace("unsigned", std::uint64_t(7));
+    props.emplace("bool", true);
+    fc.push_back(geometry::feature<std::int64_t> { geometry::point<std::int64_t>(10, 20), props, std::uint64_t(1) });
+    props["name"] = std::string("b");
+    fc.push_back(geometry::feature<std::int64_t> { geometry::multi_point<std::int64_t> { { 1, 2 }, { 3, 4 }, { 2000, 10 } }, props, std::int64_t(2) });
+    fc.push_back(geometry::feature<std::int64_t> { geometry::line_string<std::int64_t> { { 0, 0 }, { 100, 100 }, { 200, 50 } }, props });
+    fc.push_back(geometry::feature<std::int64_t> {
+        geometry::multi_line_string<std::int64_t> { { { 0, 0 }, { 10, 10 } }, { { 50, 50 }, { 60, 40 }, { 70, 70 } } }, geometry::property_map() });
+    fc.push_back(geometry::feature<std::int64_t> {
+        geometry::polygon<std::int64_t> { square(0, 0, 1000, true), square(100, 100, 200, false) }, props, std::uint64_t(5) });
+    fc.push_back(geometry::feature<std::int64_t> {
+        geometry::multi_polygon<std::int64_t> { { square(0, 0, 100, true) }, { square(500, 500, 100, true), square(520, 520, 20, false) } }, props });
+    return fc;
+}
+
+// A Tile.Value message as "<type>:<value>", integers of any encoding alike.
+std::string describe_value(const char * data, const char * end) {
+    std::ostringstream out;
+    out.precision(17);
+    while (data < end) {
+        std::uint64_t key;
+        std::uint64_t v;
+        if (!detail::read_varint(data, end, key)) {
+            break;
+        }
+        std::uint32_t field = static_cast<std::uint32_t>(key >> 3);
+        if (field == 1) {
+            detail::layer_slice str = detail::read_bytes(data, end);
+            out << "string:" << std::string(str.data, str.end);
+        } else if ((field == 2 && end - data >= 4) || (field == 3 && end - data >= 8)) {
+            if (field == 2) {
+                float f;
+                std::memcpy(&f, data, sizeof(f));
+                out << "double:" << static_cast<double>(f);
+                data += 4;
+            } else {
+                double d;
+                std::memcpy(&d, data, sizeof(d));
+                out << "double:" << d;
+                data += 8;
+            }
+        } else if (field >= 4 && field <= 7 && detail::read_varint(data, end, v)) {
+            if (field == 4) {
+                out << "int:" << static_cast<std::int64_t>(v);
+            } else if (field == 5) {
+                out << "int:" << v;
+            } else if (field == 6) {
+                out << "int:" << static_cast<std::int64_t>((v >> 1) ^ (0 - (v & 1)));
+            } else {
+                out << "bool:" << v;
+            }
+        } else {
+            out << "unknown:" << field;
+            break;
+        }
+    }
+    return out.str();
+}
+
+/*
+ * Decodes the layers of a tile into one line per layer and per feature, with
+ * tags resolved through the layer's dictionaries and sorted by key, so two
+ * encoders can be compared whatever order they write fields and dictionary
+ * entries in.
+ */
+std::vector<std::string> describe_tile(std::string const& tile) {
+    std::vector<std::string> lines;
+    const char * data = tile.data();
+    const char * end = data + tile.size();
+    while (data < end) {
+        std::uint64_t key;
+        if (!detail::read_varint(data, end, key)) {
+            throw std::runtime_error("Test Error: malformed tile");
+        }
+        if (key != ((3 << 3) | 2)) {
+            if (!detail::skip_field(data, end, static_cast<std::uint32_t>(key & 0x7))) {
+                throw std::runtime_error("Test Error: malformed tile");
+            }
+            continue;
+        }
+        detail::layer_slice layer = detail::read_bytes(data, end);
+        std::string name;
+        std::uint64_t extent = 4096;
+        std::vector<std::string> keys;
+        std::vector<std::string> values;
+        std::vector<detail::layer_slice> features;
+        const char * l = layer.data;
+        while (l < layer.end) {
+            if (!detail::read_varint(l, layer.end, key)) {
+                throw std::runtime_error("Test Error: malformed layer");
+            }
+            std::uint32_t field = static_cast<std::uint32_t>(key >> 3);
+            if (field == 1 || field == 2 || field == 3 || field == 4) {
+                detail::layer_slice bytes = detail::read_bytes(l, layer.end);
+                if (field == 1) {
+                    name.assign(bytes.data, bytes.end);
+                } else if (field == 2) {
+                    features.push_back(bytes);
+                } else if (field == 3) {
+                    keys.emplace_back(bytes.data, bytes.end);
+                } else {
+                    values.push_back(describe_value(bytes.data, bytes.end));
+                }
+            } else if (field == 5) {
+                detail::read_varint(l, layer.end, extent);
+            } else if (!detail::skip_field(l, layer.end, static_cast<std::uint32_t>(key & 0x7))) {
+                throw std::runtime_error("Test Error: malformed layer");
+            }
+        }
+        std::ostringstream header;
+        header << "layer " << name << " extent " << extent;
+        lines.push_back(header.str());
+        for (auto const& feature : features) {
+            std::ostringstream id;
+            std::uint64_t type = 0;
+            std::vector<std::uint64_t> tags;
+            std::vector<std::uint64_t> geometry;
+            const char * f = feature.data;
+            while (f < feature.end) {
+                if (!detail::read_varint(f, feature.end, key)) {
+                    throw std::runtime_error("Test Error: malformed feature");
+                }
+                std::uint32_t field = static_cast<std::uint32_t>(key >> 3);
+                std::uint64_t v;
+                if ((field == 2 || field == 4) && (key & 0x7) == 2) {
+                    detail::layer_slice packed = detail::read_bytes(f, feature.end);
+                    while (packed.data < packed.end && detail::read_varint(packed.data, packed.end, v)) {
+                        (field == 2 ? tags : geometry).push_back(v);
+                    }
+                } else if ((field == 1 || field == 3) && detail::read_varint(f, feature.end, v)) {
+                    if (field == 1) {
+                        id << v;
+                    } else {
+                        type = v;
+                    }
+                } else if (!detail::skip_field(f, feature.end, static_cast<std::uint32_t>(key & 0x7))) {
+                    throw std::runtime_error("Test Error: malformed feature");
+                }
+            }
+            std::map<std::string, std::string> properties;
+            for (std::size_t i = 0; i + 1 < tags.size(); i += 2) {
+                if (tags[i] >= keys.size() || tags[i + 1] >= values.size()) {
+                    throw std::runtime_error("Test Error: tag out of range");
+                }
+                properties[keys[tags[i]]] = values[tags[i + 1]];
+            }
+            std::ostringstream line;
+            line << "  feature id=" << id.str() << " type=" << type << " tags={";
+            for (auto const& p : properties) {
+                line << p.first << "=" << p.second << ";";
+            }
+            line << "} geometry=";
+            for (auto g : geometry) {
+                line << g << ",";
+            }
+            lines.push_back(line.str());
+        }
+    }
+    return lines;
+}
+
+// Throws on the first tile where the two encoders disagree.
+void check_tiles(std::string const& name, tile_features const& tiles) {
+    // one encoder for every tile, as r2mvt reuses it
+    streaming_layer_encoder encoder;
+    for (auto const& t : tiles) {
+        std::string expected;
+        std::string actual;
+        vector_tile::encode_layer(expected, "test", t.second);
+        encoder.encode(actual, "test", t.second);
+        auto want = describe_tile(expected);
+        auto got = describe_tile(actual);
+        if (want == got) {
+            continue;
+        }
+        std::size_t i = 0;
+        while (i < want.size() && i < got.size() && want[i] == got[i]) {
+            ++i;
+        }
+        std::ostringstream err;
+        err << "Test Error: streaming_layer_encoder differs from encode_layer for " << name
+            << " tile " << t.first.first << "/" << t.first.second << " at line " << i
+            << "\n  encode_layer: " << (i < want.size() ? want[i].substr(0, 200) : "<end>")
+            << "\n  streaming:    " << (i < got.size() ? got[i].substr(0, 200) : "<end>");
+        throw std::runtime_error(err.str());
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string fixture = argc > 1 ? argv[1] : "test/fixtures/countries.geojson";
+    try {
+        auto countries = read_fixture(fixture);
+        std::size_t checked = 0;
+        for (std::size_t z = 0; z <= 4; ++z) {
+            auto tiles = clip_to_tiles(countries, z);
+            check_tiles("countries/z" + std::to_string(z), tiles);
+            checked += tiles.size();
+        }
+        tile_features types;
+        types[std::make_pair(0, 0)] = all_types();
+        check_tiles("all-types", types);
+        checked += types.size();
+        std::cout << "layer_encoder: " << checked << " tiles match encode_layer" << std::endl;
+    } catch (std::exception const& ex) {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
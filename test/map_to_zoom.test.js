@@ -4,6 +4,7 @@ var fs = require('fs');
 
 var point_buffer = fs.readFileSync('./test/fixtures/point.geojson');
 var polygon_buffer = fs.readFileSync('./test/fixtures/polygon.geojson');
+var multipoint_buffer = fs.readFileSync('./test/fixtures/multipoint.geojson');
 
 test('MapToZoom - Initialization', function(t) {
     t.doesNotThrow(function() {
@@ -66,3 +67,194 @@ test('MapToZoom - execute - polygon zoom 10', function(t) {
         t.end();
     });
 });
+
+test('MapToZoom - execute - multipoint clustering zoom 0', function(t) {
+    var m2z = new mrmvt.MapToZoom(multipoint_buffer);
+    m2z.execute(0, { cluster_radius: 320 }, function(err, output) {
+        t.error(err);
+        t.equal(output.zoom, 0);
+        t.deepEqual(output.counts, [3, 1]);
+        t.equal(JSON.parse(output.data).coordinates.length, 2);
+        t.end();
+    });
+});
+
+test('MapToZoom - execute - multipoint without clustering', function(t) {
+    var m2z = new mrmvt.MapToZoom(multipoint_buffer);
+    m2z.execute(0, {}, function(err, output) {
+        t.error(err);
+        t.equal(output.counts, undefined);
+        t.equal(JSON.parse(output.data).coordinates.length, 4);
+        t.end();
+    });
+});
+
+test('MapToZoom - execute - invalid cluster_radius', function(t) {
+    var m2z = new mrmvt.MapToZoom(multipoint_buffer);
+    m2z.execute(0, { cluster_radius: -1 }, function(err) {
+        t.ok(err);
+        t.ok(/cluster_radius/.test(err.message));
+        t.end();
+    });
+});
+
+test('MapToZoom - executeRange - matches execute per zoom', function(t) {
+    var m2z = new mrmvt.MapToZoom(polygon_buffer);
+    m2z.executeRange(0, 4, {}, function(err, zooms) {
+        t.error(err);
+        t.equal(zooms.length, 5);
+        var pending = zooms.length;
+        zooms.forEach(function(z, i) {
+            t.equal(z.zoom, i);
+            t.ok(Buffer.isBuffer(z.data));
+            m2z.execute(i, {}, function(err, output) {
+                t.error(err);
+                t.deepEqual(mrmvt.decodeGeometry(z.data), JSON.parse(output.data));
+                t.deepEqual(z.tiles, output.tiles);
+                if (--pending === 0) t.end();
+            });
+        });
+    });
+});
+
+test('MapToZoom - executeRange - point', function(t) {
+    var m2z = new mrmvt.MapToZoom(point_buffer);
+    m2z.executeRange(0, 0, {}, function(err, zooms) {
+        t.error(err);
+        t.deepEqual(mrmvt.decodeGeometry(zooms[0].data), { type: 'Point', coordinates: [2744, 1613] });
+        t.end();
+    });
+});
+
+test('MapToZoom - executeRange - invalid range', function(t) {
+    var m2z = new mrmvt.MapToZoom(point_buffer);
+    m2z.executeRange(3, 1, {}, function(err) {
+        t.ok(err);
+        t.ok(/minZoom/.test(err.message));
+        t.end();
+    });
+});
+
+test('MapToZoom - executeRange - zoom above the maximum', function(t) {
+    var m2z = new mrmvt.MapToZoom(point_buffer);
+    m2z.executeRange(0, 4294967295, {}, function(err) {
+        t.ok(err);
+        t.ok(/maxZoom/.test(err.message));
+        m2z.executeRange(25, 25, {}, function(err) {
+            t.ok(err);
+            t.ok(/maxZoom/.test(err.message));
+            t.end();
+        });
+    });
+});
+
+test('MapToZoom - execute - typed_tiles matches array tiles', function(t) {
+    var m2z = new mrmvt.MapToZoom(polygon_buffer);
+    m2z.execute(10, {}, function(err, plain) {
+        t.error(err);
+        m2z.execute(10, { typed_tiles: true }, function(err, typed) {
+            t.error(err);
+            t.ok(typed.tiles.xy instanceof Uint32Array);
+            t.ok(typed.tiles.fill instanceof Uint8Array);
+            t.equal(typed.tiles.xy.length, plain.tiles.length * 2);
+            t.equal(typed.tiles.fill.length, plain.tiles.length);
+            var tiles = [];
+            for (var i = 0; i < typed.tiles.fill.length; ++i) {
+                tiles.push([typed.tiles.xy[2 * i], typed.tiles.xy[2 * i + 1], typed.tiles.fill[i] === 1]);
+            }
+            t.deepEqual(tiles, plain.tiles);
+            t.end();
+        });
+    });
+});
+
+test('MapToZoom - executeRange - typed_tiles', function(t) {
+    var m2z = new mrmvt.MapToZoom(point_buffer);
+    m2z.executeRange(0, 1, { typed_tiles: true }, function(err, zooms) {
+        t.error(err);
+        t.deepEqual(Array.from(zooms[0].tiles.xy), [0, 0]);
+        t.deepEqual(Array.from(zooms[0].tiles.fill), [0]);
+        t.equal(zooms[1].tiles.xy.length, 2);
+        t.end();
+    });
+});
+
+test('MapToZoom - execute - invalid typed_tiles', function(t) {
+    var m2z = new mrmvt.MapToZoom(point_buffer);
+    m2z.execute(0, { typed_tiles: 1 }, function(err) {
+        t.ok(err);
+        t.ok(/typed_tiles/.test(err.message));
+        t.end();
+    });
+});
+
+test('MapToZoom - create - parses in the threadpool', function(t) {
+    mrmvt.MapToZoom.create(point_buffer, function(err, m2z) {
+        t.error(err);
+        t.ok(m2z instanceof mrmvt.MapToZoom);
+        m2z.execute(0, {}, function(err, output) {
+            t.error(err);
+            t.equal(output.data, '{"type":"Point","coordinates":[2744,1613]}');
+            t.end();
+        });
+    });
+});
+
+test('MapToZoom - create - errors', function(t) {
+    mrmvt.MapToZoom.create(new Buffer(1), function(err) {
+        t.ok(/Error in processing buffer/.test(err.message));
+        mrmvt.MapToZoom.create({}, function(err) {
+            t.ok(/arg must be a buffer/.test(err.message));
+            mrmvt.MapToZoom.create(point_buffer, { cache_size: -1 }, function(err) {
+                t.ok(/cache_size/.test(err.message));
+                t.end();
+            });
+        });
+    });
+});
+
+test('MapToZoom - Feature and FeatureCollection', function(t) {
+    var point = JSON.parse(point_buffer);
+    var feature = new Buffer(JSON.stringify({ type: 'Feature', properties: {}, geometry: point }));
+    var collection = new Buffer(JSON.stringify({
+        type: 'FeatureCollection',
+        features: [
+            { type: 'Feature', properties: {}, geometry: point },
+            { type: 'Feature', properties: {}, geometry: point }
+        ]
+    }));
+    new mrmvt.MapToZoom(feature).execute(0, {}, function(err, output) {
+        t.error(err);
+        t.equal(output.data, '{"type":"Point","coordinates":[2744,1613]}');
+        mrmvt.MapToZoom.create(collection, function(err, m2z) {
+            t.error(err);
+            m2z.execute(0, {}, function(err, output) {
+                t.error(err);
+                var data = JSON.parse(output.data);
+                t.equal(data.type, 'GeometryCollection');
+                t.equal(data.geometries.length, 2);
+                t.deepEqual(data.geometries[1], { type: 'Point', coordinates: [2744, 1613] });
+                t.end();
+            });
+        });
+    });
+});
+
+test('MapToZoom - execute - cached zoom levels match', function(t) {
+    var pending = 2;
+    [new mrmvt.MapToZoom(polygon_buffer), new mrmvt.MapToZoom(polygon_buffer, { cache_size: 0 })].forEach(function(m2z) {
+        m2z.execute(6, {}, function(err, first) {
+            t.error(err);
+            m2z.execute(6, { typed_tiles: true }, function(err, second) {
+                t.error(err);
+                t.equal(second.data, first.data);
+                t.equal(second.tiles.fill.length, first.tiles.length);
+                m2z.execute(6, { simplify_distance: 0 }, function(err, unsimplified) {
+                    t.error(err);
+                    t.notEqual(unsimplified.data, first.data, 'options are part of the cache key');
+                    if (--pending === 0) t.end();
+                });
+            });
+        });
+    });
+});
@@ -0,0 +1,87 @@
+var test = require('tape');
+var mrmvt = require('../lib/index.js');
+var fs = require('fs');
+
+var polygon = JSON.parse(fs.readFileSync('./test/fixtures/polygon.geojson'));
+var point = JSON.parse(fs.readFileSync('./test/fixtures/point.geojson'));
+
+function feature(geometry, properties) {
+    return new Buffer(JSON.stringify({ type: 'Feature', properties: properties || {}, geometry: geometry }));
+}
+
+test('TileBuilder - Initialization with Errors', function(t) {
+    t.throws(function() {
+        mrmvt.TileBuilder();
+    }, new RegExp('use \'new\' keyword'));
+    t.throws(function() {
+        new mrmvt.TileBuilder({ layer: 1 });
+    }, new RegExp('option \'layer\' must be a string'));
+    t.throws(function() {
+        new mrmvt.TileBuilder({ buffer: -1 });
+    }, new RegExp('option \'buffer\' must be an unsigned integer'));
+    t.end();
+});
+
+test('TileBuilder - build - point zoom 0', function(t) {
+    var builder = new mrmvt.TileBuilder({ layer: 'points' });
+    builder.build([feature(point, { name: 'a' })], 0, 0, function(err, tiles) {
+        t.error(err);
+        t.deepEqual(Object.keys(tiles), ['0/0/0']);
+        t.ok(Buffer.isBuffer(tiles['0/0/0']));
+        t.ok(tiles['0/0/0'].length > 0);
+        t.ok(tiles['0/0/0'].toString('binary').indexOf('points') !== -1);
+        t.end();
+    });
+});
+
+test('TileBuilder - build - polygon tiles match the tile cover', function(t) {
+    var builder = new mrmvt.TileBuilder();
+    var m2z = new mrmvt.MapToZoom(new Buffer(JSON.stringify(polygon)));
+    builder.build([feature(polygon)], 0, 5, function(err, tiles) {
+        t.error(err);
+        m2z.executeRange(0, 5, {}, function(err, zooms) {
+            t.error(err);
+            var covered = {};
+            zooms.forEach(function(z) {
+                z.tiles.forEach(function(tile) {
+                    covered[z.zoom + '/' + tile[0] + '/' + tile[1]] = true;
+                });
+            });
+            var keys = Object.keys(tiles);
+            t.ok(keys.length > 0);
+            keys.forEach(function(key) {
+                t.ok(covered[key], key + ' is in the tile cover');
+            });
+            t.end();
+        });
+    });
+});
+
+test('TileBuilder - build - m2f records keep their layer', function(t) {
+    var builder = new mrmvt.TileBuilder();
+    var record = new Buffer('roads ' + feature(point).toString());
+    builder.build([record, feature(point)], 0, 0, function(err, tiles) {
+        t.error(err);
+        var tile = tiles['0/0/0'].toString('binary');
+        t.ok(tile.indexOf('roads') !== -1);
+        t.ok(tile.indexOf('features') !== -1);
+        t.end();
+    });
+});
+
+test('TileBuilder - build - invalid arguments', function(t) {
+    var builder = new mrmvt.TileBuilder();
+    builder.build('nope', 0, 0, function(err) {
+        t.ok(/must be an array of buffers/.test(err.message));
+        builder.build([{}], 0, 0, function(err) {
+            t.ok(/feature 0 must be a buffer/.test(err.message));
+            builder.build([new Buffer('{')], 0, 0, function(err) {
+                t.ok(err);
+                builder.build([feature(point)], 0, 4294967295, function(err) {
+                    t.ok(/maxZoom/.test(err.message));
+                    t.end();
+                });
+            });
+        });
+    });
+});
@@ -0,0 +1,296 @@
+var test = require('tape');
+var mrmvt = require('../lib/index.js');
+var TileStream = require('../lib/tile_stream.js');
+var fs = require('fs');
+var stream = require('stream');
+
+var point = JSON.parse(fs.readFileSync('./test/fixtures/point.geojson'));
+
+function line(properties) {
+    return JSON.stringify({ type: 'Feature', properties: properties, geometry: point }) + '\n';
+}
+
+// Stands in for the native TileBuilder, finishing tasks only when told to.
+function MockBuilder() {
+    MockBuilder.instance = this;
+    this.pending = [];
+    this.batches = [];
+    this.max_running = 0;
+}
+
+MockBuilder.prototype.build = function(features, minzoom, maxzoom, callback) {
+    this.batches.push(features.map(String));
+    this.pending.push(callback);
+    this.max_running = Math.max(this.max_running, this.pending.length);
+};
+
+MockBuilder.prototype.finish = function(tiles) {
+    var callback = this.pending.shift();
+    callback(null, tiles || { '0/0/0': new Buffer('tile') });
+};
+
+function varint(value) {
+    var bytes = [];
+    while (value >= 128) {
+        bytes.push((value % 128) | 0x80);
+        value = Math.floor(value / 128);
+    }
+    bytes.push(value);
+    return new Buffer(bytes);
+}
+
+function field(tag, data) {
+    return Buffer.concat([varint((tag << 3) | 2), varint(data.length), data]);
+}
+
+// A tile holding one layer with a point feature per property map.
+function encode_tile(name, features) {
+    var parts = [field(1, new Buffer(name))];
+    var keys = [];
+    var values = [];
+    features.forEach(function(properties) {
+        var tags = [];
+        Object.keys(properties).forEach(function(k) {
+            if (keys.indexOf(k) === -1) keys.push(k);
+            if (values.indexOf(properties[k]) === -1) values.push(properties[k]);
+            tags.push(keys.indexOf(k), values.indexOf(properties[k]));
+        });
+        var feature = [varint((3 << 3) | 0), varint(1), field(4, Buffer.concat([varint(9), varint(0), varint(0)]))];
+        if (tags.length) feature.push(field(2, Buffer.concat(tags.map(varint))));
+        parts.push(field(2, Buffer.concat(feature)));
+    });
+    keys.forEach(function(k) { parts.push(field(3, new Buffer(k))); });
+    values.forEach(function(v) { parts.push(field(4, field(1, new Buffer(v)))); });
+    parts.push(varint((5 << 3) | 0), varint(4096), varint((15 << 3) | 0), varint(2));
+    return field(3, Buffer.concat(parts));
+}
+
+// Layer names with the properties of each feature, string values only.
+function decode_tile(buffer) {
+    function reader(buf) {
+        var pos = 0;
+        return {
+            done: function() { return pos >= buf.length; },
+            varint: function() {
+                var value = 0, scale = 1, b;
+                do { b = buf[pos++]; value += (b & 0x7f) * scale; scale *= 128; } while (b & 0x80);
+                return value;
+            },
+            bytes: function() { var n = this.varint(); pos += n; return buf.slice(pos - n, pos); }
+        };
+    }
+    var layers = [];
+    var t = reader(buffer);
+    while (!t.done()) {
+        t.varint();
+        var l = reader(t.bytes());
+        var layer = { name: '', features: [] };
+        var keys = [], values = [], tags = [];
+        while (!l.done()) {
+            var key = l.varint();
+            if ((key & 7) === 0) { l.varint(); continue; }
+            var data = l.bytes();
+            if (key >> 3 === 1) layer.name = data.toString();
+            if (key >> 3 === 3) keys.push(data.toString());
+            if (key >> 3 === 4) {
+                var v = reader(data);
+                v.varint();
+                values.push(v.bytes().toString());
+            }
+            if (key >> 3 === 2) {
+                var f = reader(data), feature_tags = [];
+                while (!f.done()) {
+                    var fkey = f.varint();
+                    if ((fkey & 7) === 0) { f.varint(); continue; }
+                    var fdata = f.bytes();
+                    if (fkey >> 3 === 2) {
+                        var p = reader(fdata);
+                        while (!p.done()) feature_tags.push(p.varint());
+                    }
+                }
+                tags.push(feature_tags);
+            }
+        }
+        layer.features = tags.map(function(feature_tags) {
+            var properties = {};
+            for (var i = 0; i < feature_tags.length; i += 2) properties[keys[feature_tags[i]]] = values[feature_tags[i + 1]];
+            return properties;
+        });
+        layers.push(layer);
+    }
+    return layers;
+}
+
+test('TileStream - requires a zoom range', function(t) {
+    t.throws(function() {
+        mrmvt.createTileStream({ minzoom: 0 });
+    }, /minzoom and maxzoom/);
+    t.end();
+});
+
+test('TileStream - batches lines split across chunks', function(t) {
+    var tiles = stream_of(MockBuilder, { minzoom: 0, maxzoom: 0, batch_size: 2, max_in_flight: 4 });
+    tiles.write('{"a":');
+    tiles.write('1}\n{"b":2}\n\n{"c":3}');
+    tiles.end();
+    var builder = MockBuilder.instance;
+    setImmediate(function() {
+        t.deepEqual(builder.batches, [['{"a":1}', '{"b":2}'], ['{"c":3}']]);
+        builder.finish();
+        builder.finish();
+    });
+    var out = [];
+    tiles.on('data', function(tile) { out.push(tile); });
+    tiles.on('end', function() {
+        t.equal(out.length, 2);
+        t.deepEqual([out[0].z, out[0].x, out[0].y], [0, 0, 0]);
+        t.equal(out[0].data.toString(), 'tile');
+        t.equal(out[0].partial, true, 'pieces of a tile are flagged');
+        t.end();
+    });
+});
+
+test('TileStream - stops reading while max_in_flight tasks run', function(t) {
+    var tiles = stream_of(MockBuilder, { minzoom: 0, maxzoom: 0, batch_size: 1, max_in_flight: 2 });
+    var builder = MockBuilder.instance;
+    var accepted = 0;
+    function write(i) {
+        if (i === 10) return tiles.end();
+        tiles.write(line({ i: i }), function() {
+            accepted++;
+            write(i + 1);
+        });
+    }
+    write(0);
+    setImmediate(function() {
+        t.equal(accepted, 1, 'second write waits for a running task');
+        t.equal(tiles.inFlight(), 2);
+        (function drain() {
+            if (builder.pending.length) builder.finish();
+            if (builder.batches.length < 10 || builder.pending.length) return setImmediate(drain);
+        })();
+    });
+    tiles.on('data', function() {});
+    tiles.on('end', function() {
+        t.equal(builder.batches.length, 10);
+        t.equal(builder.max_running, 2);
+        t.end();
+    });
+});
+
+test('TileStream - holds the batches of a large chunk until tasks complete', function(t) {
+    var tiles = stream_of(MockBuilder, { minzoom: 0, maxzoom: 0, batch_size: 1, max_in_flight: 2 });
+    var builder = MockBuilder.instance;
+    var chunk = '';
+    for (var i = 0; i < 10; i++) chunk += '{"i":' + i + '}\n';
+    var accepted = false;
+    tiles.write(chunk, function() { accepted = true; });
+    tiles.end();
+    setImmediate(function() {
+        t.equal(builder.batches.length, 2, 'only max_in_flight batches dispatched');
+        t.equal(accepted, false, 'chunk waits for the held batches');
+        (function drain() {
+            if (builder.pending.length) builder.finish();
+            if (builder.pending.length) return setImmediate(drain);
+        })();
+    });
+    tiles.on('data', function() {});
+    tiles.on('end', function() {
+        t.equal(accepted, true);
+        t.equal(builder.max_running, 2);
+        t.deepEqual(builder.batches.map(function(b) { return b[0]; }), chunk.trim().split('\n'));
+        t.end();
+    });
+});
+
+test('TileStream - merge emits each tile once', function(t) {
+    var tiles = stream_of(MockBuilder, { minzoom: 0, maxzoom: 1, batch_size: 1, max_in_flight: 4, merge: true });
+    tiles.write(line({ i: 0 }));
+    tiles.write(line({ i: 1 }));
+    tiles.end();
+    var builder = MockBuilder.instance;
+    setImmediate(function() {
+        builder.finish({
+            '0/0/0': encode_tile('points', [{ name: 'a' }]),
+            '1/0/0': encode_tile('points', [{ name: 'a' }])
+        });
+        builder.finish({
+            '0/0/0': Buffer.concat([encode_tile('points', [{ name: 'b', kind: 'x' }]), encode_tile('lines', [{ name: 'a' }])])
+        });
+    });
+    var out = {};
+    tiles.on('data', function(tile) {
+        t.equal(tile.partial, false);
+        t.notOk(out[tile.z + '/' + tile.x + '/' + tile.y], 'tile emitted once');
+        out[tile.z + '/' + tile.x + '/' + tile.y] = decode_tile(tile.data);
+    });
+    tiles.on('end', function() {
+        t.deepEqual(out['0/0/0'], [
+            { name: 'points', features: [{ name: 'a' }, { name: 'b', kind: 'x' }] },
+            { name: 'lines', features: [{ name: 'a' }] }
+        ]);
+        t.deepEqual(out['1/0/0'], [{ name: 'points', features: [{ name: 'a' }] }]);
+        t.end();
+    });
+});
+
+test('mergeTiles - merges same named layers', function(t) {
+    var merged = mrmvt.mergeTiles([
+        encode_tile('points', [{ name: 'a' }, { kind: 'x' }]),
+        Buffer.concat([encode_tile('lines', [{ kind: 'y' }]), encode_tile('points', [{ kind: 'x', name: 'c' }])])
+    ]);
+    t.deepEqual(decode_tile(merged), [
+        { name: 'points', features: [{ name: 'a' }, { kind: 'x' }, { kind: 'x', name: 'c' }] },
+        { name: 'lines', features: [{ kind: 'y' }] }
+    ]);
+    t.throws(function() {
+        mrmvt.mergeTiles([encode_tile('points', [{}]), new Buffer([0x1a, 0x05, 0x0a])]);
+    }, /Merge Error/);
+    t.end();
+});
+
+test('TileStream - native tiles', function(t) {
+    var tiles = mrmvt.createTileStream({ minzoom: 0, maxzoom: 2, batch_size: 3, layer: 'points' });
+    var out = {};
+    tiles.on('data', function(tile) {
+        t.ok(Buffer.isBuffer(tile.data));
+        out[tile.z + '/' + tile.x + '/' + tile.y] = (out[tile.z + '/' + tile.x + '/' + tile.y] || 0) + 1;
+    });
+    tiles.on('end', function() {
+        t.deepEqual(Object.keys(out).sort(), ['0/0/0', '1/1/0', '2/2/1']);
+        // 5 features in batches of 3 give two pieces per tile
+        t.equal(out['0/0/0'], 2);
+        t.end();
+    });
+    for (var i = 0; i < 5; ++i) tiles.write(line({ i: i }));
+    tiles.end();
+});
+
+test('TileStream - native tiles merged', function(t) {
+    var tiles = mrmvt.createTileStream({ minzoom: 0, maxzoom: 0, batch_size: 3, layer: 'points', merge: true });
+    var out = [];
+    tiles.on('data', function(tile) { out.push(tile); });
+    tiles.on('end', function() {
+        t.equal(out.length, 1);
+        var layers = decode_tile(out[0].data);
+        t.equal(layers.length, 1);
+        t.equal(layers[0].features.length, 5);
+        t.end();
+    });
+    for (var i = 0; i < 5; ++i) tiles.write(line({ i: String(i) }));
+    tiles.end();
+});
+
+test('TileStream - errors from native tasks', function(t) {
+    var tiles = mrmvt.createTileStream({ minzoom: 0, maxzoom: 0 });
+    tiles.on('error', function(err) {
+        t.ok(err);
+        t.end();
+    });
+    tiles.on('data', function() {});
+    tiles.end('not json\n');
+});
+
+function stream_of(Builder, options) {
+    return new TileStream(Builder, options);
+}
@@ -0,0 +1,39 @@
+var test = require('tape');
+var mrmvt = require('../lib/index.js');
+var fs = require('fs');
+
+var polygon_buffer = fs.readFileSync('./test/fixtures/polygon.geojson');
+
+test('WorkerPool - stats count completed tasks', function(t) {
+    var before = mrmvt.workerPoolStats();
+    t.ok(before.threads > 0);
+    var m2z = new mrmvt.MapToZoom(polygon_buffer);
+    var pending = 20;
+    for (var z = 0; z < 20; ++z) {
+        m2z.execute(z % 8, {}, function(err) {
+            t.error(err);
+            if (--pending === 0) {
+                var after = mrmvt.workerPoolStats();
+                t.equal(after.completed - before.completed, 20);
+                t.equal(after.queued, 0);
+                t.equal(after.pending, 0);
+                t.ok(after.max_queued >= 1);
+                t.ok(after.batches > before.batches);
+                t.ok(after.batches - before.batches <= 20, 'tasks may share a batch');
+                t.ok(after.run_ms_max >= after.run_ms_mean);
+                t.ok(after.wait_ms_max >= after.wait_ms_mean);
+                t.end();
+            }
+        });
+    }
+});
+
+test('WorkerPool - size is fixed once tasks ran', function(t) {
+    t.throws(function() {
+        mrmvt.setWorkerPoolSize(0);
+    }, /positive integer/);
+    t.throws(function() {
+        mrmvt.setWorkerPoolSize(2);
+    }, /before the first task/);
+    t.end();
+});